@@ -0,0 +1,89 @@
+#ifndef TOY_ADMISSION_CONTROL_H
+#define TOY_ADMISSION_CONTROL_H
+
+// Load shedding driven by queueing delay, after CoDel: https://queue.acm.org/detail.cfm?id=2209336
+//
+// A queue that drains now and then only absorbs bursts, and is harmless. A queue that has not drained for
+// a whole interval, with even its shortest wait above the target, is a standing queue: more work arrives than
+// is done, and waiting longer only makes every request slow. While the queue stands, the requests that have
+// waited past the target are rejected, for those admitted to stay fast, and the clients to retry elsewhere
+// or later; otherwise, only those that have waited past a whole interval are. Either way, the delay
+// of the admitted requests stays bounded, rather than growing with the backlog.
+//
+// Requests of `AdmissionPriority::High` are held to the interval even while the queue stands, and those
+// of `AdmissionPriority::Low` are rejected as long as it does, so that they are shed first.
+
+#include <chrono>
+#include <mutex>
+
+const std::chrono::milliseconds kDefaultAdmissionTarget = std::chrono::milliseconds(5);
+const std::chrono::milliseconds kDefaultAdmissionInterval = std::chrono::milliseconds(100);
+const std::chrono::seconds kDefaultAdmissionRetryAfter = std::chrono::seconds(1);
+
+enum class AdmissionPriority : int { Low, Normal, High };
+
+struct AdmissionControlOptions {
+  // The most time a request may wait while the queue stands.
+  std::chrono::milliseconds target = kDefaultAdmissionTarget;
+  // How long the waits must stay above `target` for the queue to be standing, and the most time any request
+  // may wait.
+  std::chrono::milliseconds interval = kDefaultAdmissionInterval;
+  // Sent to the rejected clients, as `Retry-After`.
+  std::chrono::seconds retry_after = kDefaultAdmissionRetryAfter;
+};
+
+// Thread-safe.
+class AdmissionController final {
+ public:
+  explicit AdmissionController(const AdmissionControlOptions& options = AdmissionControlOptions())
+      : options_(options), interval_end_(std::chrono::steady_clock::now() + options.interval) {
+  }
+
+  const AdmissionControlOptions& Options() const {
+    return options_;
+  }
+
+  // Takes in the time a request has waited in the queue, `sojourn`, as it leaves the queue at `now`,
+  // and returns whether to serve it.
+  bool Admit(std::chrono::steady_clock::duration sojourn,
+             AdmissionPriority priority = AdmissionPriority::Normal,
+             std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now()) {
+    bool standing;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (now >= interval_end_) {
+        // An interval with no requests at all has seen the queue empty.
+        standing_ = min_sojourn_ != std::chrono::steady_clock::duration::max() && min_sojourn_ > options_.target &&
+                    now < interval_end_ + options_.interval;
+        min_sojourn_ = std::chrono::steady_clock::duration::max();
+        interval_end_ = now + options_.interval;
+      }
+      if (sojourn < min_sojourn_) {
+        min_sojourn_ = sojourn;
+      }
+      standing = standing_;
+    }
+    if (!standing || priority == AdmissionPriority::High) {
+      return sojourn <= options_.interval;
+    }
+    return priority == AdmissionPriority::Normal && sojourn <= options_.target;
+  }
+
+  // Whether the queue has not drained below the target over the last interval.
+  bool Standing() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return standing_;
+  }
+
+ private:
+  const AdmissionControlOptions options_;
+  mutable std::mutex mutex_;
+  std::chrono::steady_clock::time_point interval_end_;
+  std::chrono::steady_clock::duration min_sojourn_ = std::chrono::steady_clock::duration::max();
+  bool standing_ = false;
+
+  AdmissionController(const AdmissionController&) = delete;
+  void operator=(const AdmissionController&) = delete;
+};
+
+#endif  // TOY_ADMISSION_CONTROL_H
@@ -0,0 +1,99 @@
+#ifndef TOY_ARENA_H
+#define TOY_ARENA_H
+
+// A bump-pointer arena: allocations are carved out of large blocks and never freed one by one.
+// `Reset()` makes all the memory available again while keeping the blocks, so a long-lived arena
+// that is reset between requests stops touching the heap once it has grown to fit the largest request.
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <vector>
+
+const size_t kDefaultArenaBlockSize = 4096;
+
+class Arena final {
+ public:
+  explicit Arena(size_t block_size = kDefaultArenaBlockSize) : block_size_(block_size) {
+  }
+
+  void* Allocate(size_t size, size_t alignment = alignof(std::max_align_t)) {
+    while (true) {
+      if (current_ < blocks_.size()) {
+        const size_t aligned = (offset_ + alignment - 1) & ~(alignment - 1);
+        if (aligned + size <= blocks_[current_].size) {
+          offset_ = aligned + size;
+          return blocks_[current_].data.get() + aligned;
+        }
+        ++current_;
+        offset_ = 0;
+      } else {
+        // Oversized allocations get a block of their own, which is kept for reuse too.
+        const size_t block_size = std::max(block_size_, size + alignment);
+        blocks_.push_back(Block(block_size));
+      }
+    }
+  }
+
+  // Frees everything allocated so far. The objects in the arena must not be used afterwards.
+  void Reset() {
+    current_ = 0;
+    offset_ = 0;
+  }
+
+ private:
+  struct Block {
+    std::unique_ptr<char[]> data;
+    size_t size;
+    explicit Block(size_t size) : data(new char[size]), size(size) {
+    }
+  };
+
+  const size_t block_size_;
+  std::vector<Block> blocks_;
+  size_t current_ = 0;
+  size_t offset_ = 0;
+
+  Arena(const Arena&) = delete;
+  void operator=(const Arena&) = delete;
+};
+
+// Standard allocator interface to an `Arena`, for containers whose contents die with the arena's `Reset()`.
+template <typename T>
+class ArenaAllocator {
+ public:
+  typedef T value_type;
+
+  explicit ArenaAllocator(Arena& arena) : arena_(&arena) {
+  }
+
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U>& rhs) : arena_(rhs.arena_) {
+  }
+
+  T* allocate(size_t n) {
+    return static_cast<T*>(arena_->Allocate(n * sizeof(T), alignof(T)));
+  }
+
+  void deallocate(T*, size_t) {
+  }
+
+  template <typename U>
+  bool operator==(const ArenaAllocator<U>& rhs) const {
+    return arena_ == rhs.arena_;
+  }
+
+  template <typename U>
+  bool operator!=(const ArenaAllocator<U>& rhs) const {
+    return arena_ != rhs.arena_;
+  }
+
+ private:
+  template <typename U>
+  friend class ArenaAllocator;
+
+  Arena* arena_;
+};
+
+#endif  // TOY_ARENA_H
@@ -0,0 +1,88 @@
+#!/bin/bash
+#
+# Runs the in-memory parser benchmark, then the load generator against each benchmarked server in turn,
+# on localhost:8080. Prints one JSON object per line: per parser, corpus file and fragmentation,
+# then per server and scenario, then per transport, loopback TCP or a Unix socket, and scenario.
+# Run via `make bench`, which builds with -O2.
+#
+# Override the defaults with environment variables, e.g.: DURATION=30 SERVERS=epoll_http_server make bench
+
+SERVERS=${SERVERS:-"epoll_http_server http_reuseport_server"}
+DURATION=${DURATION:-5}
+WARMUP=${WARMUP:-1}
+CONNECTIONS=${CONNECTIONS:-32}
+RATE=${RATE:-20000}
+UNIX_SOCKET=${UNIX_SOCKET:-/tmp/toy_http_bench.sock}
+
+# The blocking servers hold a worker thread, one per CPU, for as long as a connection is kept alive: more
+# connections than workers would only wait for one, and measure starvation rather than throughput. They get as
+# many connections as they have workers instead, so their results do not compare with the others' one to one.
+BLOCKING_SERVERS=${BLOCKING_SERVERS:-"http_reuseport_server"}
+# As `std::thread::hardware_concurrency()`, which sizes their pools.
+WORKERS=$(getconf _NPROCESSORS_ONLN)
+
+# One connection with one request in flight for the round-trip latency, then the throughput of many,
+# then the cost of connecting.
+TRANSPORT_SCENARIOS=(
+	"--connections=1"
+	"--connections=$CONNECTIONS"
+	"--connections=1 --keepalive=0"
+)
+
+./build/bench/http_parser_benchmark
+
+for SERVER in $SERVERS ; do
+	./build/bench/$SERVER >/dev/null 2>&1 &
+	PID=$!
+	# Wait for the server to start listening.
+	for i in $(seq 50) ; do
+		(echo >/dev/tcp/127.0.0.1/8080) 2>/dev/null && break
+		sleep 0.1
+	done
+	SERVER_CONNECTIONS=$CONNECTIONS
+	if [[ " $BLOCKING_SERVERS " == *" $SERVER "* ]] && [ $WORKERS -lt $CONNECTIONS ] ; then
+		SERVER_CONNECTIONS=$WORKERS
+	fi
+	SCENARIOS=(
+		"--connections=$SERVER_CONNECTIONS"
+		"--connections=$SERVER_CONNECTIONS --pipeline=8"
+		"--connections=$SERVER_CONNECTIONS --body=4096"
+		"--connections=$SERVER_CONNECTIONS --rate=$RATE"
+		"--connections=4 --keepalive=0"
+	)
+	for SCENARIO in "${SCENARIOS[@]}" ; do
+		echo -n "{\"server\":\"$SERVER\",\"result\":"
+		./build/bench/http_load_generator $SCENARIO --duration=$DURATION --warmup=$WARMUP | tr -d '\n'
+		echo "}"
+	done
+	kill $PID
+	wait $PID 2>/dev/null || true
+done
+
+rm -f $UNIX_SOCKET
+for TRANSPORT in tcp unix ; do
+	if [ $TRANSPORT == tcp ] ; then
+		./build/bench/epoll_http_server 127.0.0.1:8080 >/dev/null 2>&1 &
+		TARGET="--port=8080"
+	else
+		./build/bench/epoll_http_server $UNIX_SOCKET >/dev/null 2>&1 &
+		TARGET="--unix=$UNIX_SOCKET"
+	fi
+	PID=$!
+	for i in $(seq 50) ; do
+		if [ $TRANSPORT == tcp ] ; then
+			(echo >/dev/tcp/127.0.0.1/8080) 2>/dev/null && break
+		else
+			[ -S $UNIX_SOCKET ] && break
+		fi
+		sleep 0.1
+	done
+	for SCENARIO in "${TRANSPORT_SCENARIOS[@]}" ; do
+		echo -n "{\"server\":\"epoll_http_server\",\"transport\":\"$TRANSPORT\",\"result\":"
+		./build/bench/http_load_generator $TARGET $SCENARIO --duration=$DURATION --warmup=$WARMUP | tr -d '\n'
+		echo "}"
+	done
+	kill $PID
+	wait $PID 2>/dev/null || true
+done
+rm -f $UNIX_SOCKET
@@ -0,0 +1,112 @@
+#ifndef TOY_BOUNDED_MPMC_QUEUE_H
+#define TOY_BOUNDED_MPMC_QUEUE_H
+
+// Bounded lock-free multi-producer multi-consumer queue: http://www.1024cores.net/home/lock-free-algorithms/queues
+// Each slot carries a sequence number, so producers and consumers only contend on a single CAS each.
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+template <typename T>
+class BoundedMPMCQueue final {
+ public:
+  // `capacity` is rounded up to the next power of two, and to at least two: with a single slot, the sequence number
+  // a push leaves is the one the next push expects, so the second push would overwrite the first value.
+  explicit BoundedMPMCQueue(size_t capacity)
+      : mask_(RoundUpToPowerOfTwo(capacity < 2 ? 2 : capacity) - 1), slots_(mask_ + 1) {
+    static_assert(std::is_trivially_copyable<T>::value, "BoundedMPMCQueue only holds trivially copyable types.");
+    for (size_t i = 0; i <= mask_; ++i) {
+      slots_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  size_t Capacity() const {
+    return mask_ + 1;
+  }
+
+  // Returns false if the queue is full.
+  bool TryPush(const T& value) {
+    size_t position = enqueue_position_.load(std::memory_order_relaxed);
+    while (true) {
+      Slot& slot = slots_[position & mask_];
+      const size_t sequence = slot.sequence.load(std::memory_order_acquire);
+      const intptr_t delta = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+      if (delta == 0) {
+        if (enqueue_position_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+          slot.value = value;
+          slot.sequence.store(position + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (delta < 0) {
+        return false;
+      } else {
+        position = enqueue_position_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Returns false if the queue is empty.
+  bool TryPop(T& value) {
+    size_t position = dequeue_position_.load(std::memory_order_relaxed);
+    while (true) {
+      Slot& slot = slots_[position & mask_];
+      const size_t sequence = slot.sequence.load(std::memory_order_acquire);
+      const intptr_t delta = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position + 1);
+      if (delta == 0) {
+        if (dequeue_position_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+          value = slot.value;
+          slot.sequence.store(position + mask_ + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (delta < 0) {
+        return false;
+      } else {
+        position = dequeue_position_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Approximate under concurrent modification; exact when quiescent.
+  bool Empty() const {
+    return enqueue_position_.load(std::memory_order_acquire) == dequeue_position_.load(std::memory_order_acquire);
+  }
+
+  bool Full() const {
+    return enqueue_position_.load(std::memory_order_acquire) - dequeue_position_.load(std::memory_order_acquire) >
+           mask_;
+  }
+
+ private:
+  static size_t RoundUpToPowerOfTwo(size_t x) {
+    assert(x > 0);
+    size_t result = 1;
+    while (result < x) {
+      result <<= 1;
+    }
+    return result;
+  }
+
+  struct Slot {
+    std::atomic<size_t> sequence;
+    T value;
+  };
+
+  // Keep producer and consumer positions on separate cache lines to avoid false sharing.
+  static const size_t kCacheLineSize = 64;
+
+  const size_t mask_;
+  std::vector<Slot> slots_;
+  alignas(kCacheLineSize) std::atomic<size_t> enqueue_position_{0};
+  alignas(kCacheLineSize) std::atomic<size_t> dequeue_position_{0};
+
+  BoundedMPMCQueue(const BoundedMPMCQueue&) = delete;
+  BoundedMPMCQueue(BoundedMPMCQueue&&) = delete;
+  void operator=(const BoundedMPMCQueue&) = delete;
+  void operator=(BoundedMPMCQueue&&) = delete;
+};
+
+#endif  // TOY_BOUNDED_MPMC_QUEUE_H
@@ -0,0 +1 @@
+/root/repo/admission_control.h
\ No newline at end of file
@@ -0,0 +1 @@
+/root/repo/arena.h
\ No newline at end of file
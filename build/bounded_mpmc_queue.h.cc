@@ -0,0 +1 @@
+/root/repo/bounded_mpmc_queue.h
\ No newline at end of file
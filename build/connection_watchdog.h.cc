@@ -0,0 +1 @@
+/root/repo/connection_watchdog.h
\ No newline at end of file
@@ -0,0 +1 @@
+/root/repo/coroutine.h
\ No newline at end of file
@@ -0,0 +1 @@
+/root/repo/coroutine_http_server.h
\ No newline at end of file
@@ -0,0 +1 @@
+/root/repo/deflate.h
\ No newline at end of file
@@ -0,0 +1 @@
+/root/repo/exceptions.h
\ No newline at end of file
@@ -0,0 +1 @@
+/root/repo/http_client.h
\ No newline at end of file
@@ -0,0 +1 @@
+/root/repo/http_compression.h
\ No newline at end of file
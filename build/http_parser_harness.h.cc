@@ -0,0 +1 @@
+/root/repo/http_parser_harness.h
\ No newline at end of file
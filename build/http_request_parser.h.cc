@@ -0,0 +1 @@
+/root/repo/http_request_parser.h
\ No newline at end of file
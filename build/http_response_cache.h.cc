@@ -0,0 +1 @@
+/root/repo/http_response_cache.h
\ No newline at end of file
@@ -0,0 +1 @@
+/root/repo/http_response_codes.h
\ No newline at end of file
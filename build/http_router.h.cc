@@ -0,0 +1 @@
+/root/repo/http_router.h
\ No newline at end of file
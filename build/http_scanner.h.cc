@@ -0,0 +1 @@
+/root/repo/http_scanner.h
\ No newline at end of file
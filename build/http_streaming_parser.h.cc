@@ -0,0 +1 @@
+/root/repo/http_streaming_parser.h
\ No newline at end of file
@@ -0,0 +1 @@
+/root/repo/http_url.h
\ No newline at end of file
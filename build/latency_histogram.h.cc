@@ -0,0 +1 @@
+/root/repo/latency_histogram.h
\ No newline at end of file
@@ -0,0 +1 @@
+/root/repo/metrics.h
\ No newline at end of file
@@ -0,0 +1 @@
+/root/repo/object_pool.h
\ No newline at end of file
@@ -0,0 +1 @@
+/root/repo/posix_epoll_server.h
\ No newline at end of file
@@ -0,0 +1 @@
+/root/repo/signal_waiter.h
\ No newline at end of file
@@ -0,0 +1 @@
+/root/repo/small_vector.h
\ No newline at end of file
@@ -0,0 +1 @@
+/root/repo/socket_address.h
\ No newline at end of file
@@ -0,0 +1 @@
+/root/repo/socket_handoff.h
\ No newline at end of file
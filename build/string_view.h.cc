@@ -0,0 +1 @@
+/root/repo/string_view.h
\ No newline at end of file
@@ -0,0 +1 @@
+/root/repo/timer_wheel.h
\ No newline at end of file
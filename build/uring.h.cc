@@ -0,0 +1 @@
+/root/repo/uring.h
\ No newline at end of file
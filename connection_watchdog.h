@@ -0,0 +1,134 @@
+#ifndef TOY_CONNECTION_WATCHDOG_H
+#define TOY_CONNECTION_WATCHDOG_H
+
+// Deadlines for blocking socket I/O, enforced by one thread for the whole process rather than one per connection.
+//
+// A connection arms its `ConnectionDeadline` before a read or write that must finish in time, and disarms it after.
+// If the deadline passes first, the watchdog thread calls `shutdown()` on the socket, which makes the blocked
+// `read()` return the end of the stream, or the blocked `write()` fail, and marks the deadline as expired, for
+// the connection to tell a timeout from a client that has hung up. Shutting down the receiving side only leaves
+// the socket writable, so a request that took too long to arrive can still be answered with `408`.
+//
+// The deadlines live in `TimerWheel`-s, sharded by descriptor, each behind its own lock, so arming and disarming
+// is O(1) and rarely contended. The watchdog thread wakes up once per resolution on its own, so arming
+// a deadline never has to wake it.
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+#include <sys/socket.h>
+
+#include "timer_wheel.h"
+
+const std::chrono::milliseconds kDefaultConnectionWatchdogResolution = std::chrono::milliseconds(100);
+const size_t kConnectionWatchdogShards = 16;
+const size_t kConnectionWatchdogShardAlignment = 64;
+
+class ConnectionWatchdog;
+
+// Disarms itself when destroyed, so that a connection freed while its deadline is armed, as an exception unwinds
+// its constructor, is never left linked into the watchdog.
+struct ConnectionDeadline : TimerWheelEntry {
+  int fd = -1;
+  int how = SHUT_RD;  // What to `shutdown()` on expiry.
+  std::atomic<bool> expired{false};
+  ConnectionWatchdog* watchdog = nullptr;  // The one it has last been armed with.
+
+  ConnectionDeadline() = default;
+  ~ConnectionDeadline();
+};
+
+class ConnectionWatchdog final {
+ public:
+  explicit ConnectionWatchdog(std::chrono::milliseconds resolution = kDefaultConnectionWatchdogResolution)
+      : resolution_(resolution.count() > 0 ? resolution : std::chrono::milliseconds(1)),
+        epoch_(std::chrono::steady_clock::now()),
+        thread_(&ConnectionWatchdog::Thread, this) {
+  }
+
+  ~ConnectionWatchdog() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    wake_.notify_one();
+    thread_.join();
+  }
+
+  // The watchdog shared by all the connections of the process, started on first use.
+  static ConnectionWatchdog& Default() {
+    static ConnectionWatchdog watchdog;
+    return watchdog;
+  }
+
+  // Makes `deadline` shut down `how` of the socket `fd` in `timeout` from now, unless disarmed before.
+  // Rearms it if it is armed already, for the same `fd`. Fires up to one resolution late, never early.
+  void Arm(ConnectionDeadline& deadline, int fd, std::chrono::milliseconds timeout, int how) {
+    const uint64_t expiry = Ticks(std::chrono::steady_clock::now() + timeout + resolution_);
+    deadline.expired = false;
+    Shard& shard = shards_[static_cast<size_t>(fd) % kConnectionWatchdogShards];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    deadline.fd = fd;
+    deadline.how = how;
+    deadline.watchdog = this;
+    shard.wheel.Schedule(&deadline, expiry);
+  }
+
+  // Once this returns, the watchdog no longer touches `deadline` or its socket, which may then be closed.
+  void Disarm(ConnectionDeadline& deadline) {
+    Shard& shard = shards_[static_cast<size_t>(deadline.fd) % kConnectionWatchdogShards];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.wheel.Cancel(&deadline);
+  }
+
+ private:
+  struct alignas(kConnectionWatchdogShardAlignment) Shard {
+    std::mutex mutex;
+    TimerWheel wheel;
+  };
+
+  uint64_t Ticks(std::chrono::steady_clock::time_point t) const {
+    return static_cast<uint64_t>((t - epoch_) / resolution_);
+  }
+
+  void Thread() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stop_) {
+      wake_.wait_for(lock, resolution_);
+      const uint64_t now = Ticks(std::chrono::steady_clock::now());
+      for (Shard& shard : shards_) {
+        // Expired deadlines are shut down under the lock, so that a connection disarming its deadline
+        // right before closing the socket can not have the descriptor, maybe reused by then, shut down.
+        std::lock_guard<std::mutex> shard_lock(shard.mutex);
+        shard.wheel.Advance(now, [](TimerWheelEntry* entry) {
+          ConnectionDeadline* deadline = static_cast<ConnectionDeadline*>(entry);
+          deadline->expired = true;
+          shutdown(deadline->fd, deadline->how);
+        });
+      }
+    }
+  }
+
+  const std::chrono::milliseconds resolution_;
+  const std::chrono::steady_clock::time_point epoch_;
+  Shard shards_[kConnectionWatchdogShards];
+  std::mutex mutex_;  // Only for `stop_`.
+  std::condition_variable wake_;
+  bool stop_ = false;
+  std::thread thread_;  // Last, to start once the rest is initialized.
+
+  ConnectionWatchdog(const ConnectionWatchdog&) = delete;
+  void operator=(const ConnectionWatchdog&) = delete;
+};
+
+inline ConnectionDeadline::~ConnectionDeadline() {
+  if (watchdog) {
+    watchdog->Disarm(*this);
+  }
+}
+
+#endif  // TOY_CONNECTION_WATCHDOG_H
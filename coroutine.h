@@ -0,0 +1,532 @@
+#ifndef TOY_COROUTINE_H
+#define TOY_COROUTINE_H
+
+// C++20 coroutines on non-blocking sockets: code that reads as blocking, with `co_await` at each point
+// where it would block, and costs a coroutine frame per connection instead of a thread.
+//
+// `CoroutineTask<T>` is a lazily started coroutine returning `T`, run by awaiting it; awaiting resumes it
+// right away, and its completion resumes the awaiter right away, by symmetric transfer, with no trip through
+// the scheduler. `CoroutineExecutor` is the per-thread scheduler: tasks spawned on it run until they suspend
+// on a descriptor or a timer, and an edge-triggered epoll loop, with deadlines kept in a `TimerWheel`, resumes
+// them when either fires. All of it is single-threaded: a task only ever runs on the thread of its executor.
+//
+// Needs `-std=c++20`; compiles to nothing with earlier standards.
+
+#if defined(__cpp_impl_coroutine)
+
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include "exceptions.h"
+#include "posix_tcp_server.h"
+#include "timer_wheel.h"
+
+const size_t kDefaultMaxCoroutineEpollEvents = 256;
+const std::chrono::milliseconds kDefaultCoroutineTimerResolution = std::chrono::milliseconds(10);
+
+// No timeout for a wait.
+const std::chrono::milliseconds kNoCoroutineTimeout = std::chrono::milliseconds(0);
+
+template <typename T>
+class CoroutinePromise;
+
+// The result of a task is kept in its frame until the awaiter picks it up, exceptions included.
+class CoroutinePromiseBase {
+ public:
+  // Resumes the awaiter, if any, as the task completes.
+  struct FinalAwaiter {
+    bool await_ready() const noexcept {
+      return false;
+    }
+
+    template <typename PROMISE>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<PROMISE> coroutine) noexcept {
+      const std::coroutine_handle<> awaiter = coroutine.promise().awaiter_;
+      return awaiter ? awaiter : std::noop_coroutine();
+    }
+
+    void await_resume() const noexcept {
+    }
+  };
+
+  std::suspend_always initial_suspend() const noexcept {
+    return {};
+  }
+
+  FinalAwaiter final_suspend() const noexcept {
+    return {};
+  }
+
+  void unhandled_exception() noexcept {
+    exception_ = std::current_exception();
+  }
+
+  void SetAwaiter(std::coroutine_handle<> awaiter) {
+    awaiter_ = awaiter;
+  }
+
+ protected:
+  void RethrowIfFailed() const {
+    if (exception_) {
+      std::rethrow_exception(exception_);
+    }
+  }
+
+ private:
+  std::coroutine_handle<> awaiter_;
+  std::exception_ptr exception_;
+};
+
+// A coroutine returning `T`, started once awaited. Owns its frame.
+template <typename T = void>
+class CoroutineTask final {
+ public:
+  typedef CoroutinePromise<T> promise_type;
+
+  explicit CoroutineTask(std::coroutine_handle<promise_type> coroutine) : coroutine_(coroutine) {
+  }
+
+  CoroutineTask(CoroutineTask&& rhs) noexcept : coroutine_(std::exchange(rhs.coroutine_, nullptr)) {
+  }
+
+  ~CoroutineTask() {
+    if (coroutine_) {
+      coroutine_.destroy();
+    }
+  }
+
+  bool await_ready() const noexcept {
+    return false;
+  }
+
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept {
+    coroutine_.promise().SetAwaiter(awaiter);
+    return coroutine_;
+  }
+
+  // Returns what the task has returned, or rethrows what it has thrown.
+  T await_resume() {
+    return coroutine_.promise().Result();
+  }
+
+ private:
+  std::coroutine_handle<promise_type> coroutine_;
+
+  CoroutineTask(const CoroutineTask&) = delete;
+  void operator=(const CoroutineTask&) = delete;
+  void operator=(CoroutineTask&&) = delete;
+};
+
+template <typename T>
+class CoroutinePromise final : public CoroutinePromiseBase {
+ public:
+  CoroutineTask<T> get_return_object() {
+    return CoroutineTask<T>(std::coroutine_handle<CoroutinePromise>::from_promise(*this));
+  }
+
+  void return_value(T value) {
+    value_.emplace(std::move(value));
+  }
+
+  T Result() {
+    RethrowIfFailed();
+    return std::move(*value_);
+  }
+
+ private:
+  std::optional<T> value_;
+};
+
+template <>
+class CoroutinePromise<void> final : public CoroutinePromiseBase {
+ public:
+  CoroutineTask<void> get_return_object() {
+    return CoroutineTask<void>(std::coroutine_handle<CoroutinePromise>::from_promise(*this));
+  }
+
+  void return_void() const {
+  }
+
+  void Result() const {
+    RethrowIfFailed();
+  }
+};
+
+enum class CoroutineWaitResult : int { Ready, TimedOut, Interrupted };
+
+// A coroutine suspended until its descriptor is ready, its timeout passes, or it is interrupted.
+// Lives in the frame of the suspended coroutine.
+struct CoroutineWait : TimerWheelEntry {
+  std::coroutine_handle<> coroutine;
+  CoroutineWait** slot = nullptr;  // Where the descriptor waited on points back to this wait, if any.
+  CoroutineWaitResult result = CoroutineWaitResult::Ready;
+};
+
+class CoroutineExecutor;
+
+// A descriptor registered with the executor for as long as this object lives, with at most one coroutine
+// waiting for it to become readable and one for it to become writable. Does not own the descriptor,
+// which must stay open until this object is destroyed.
+class CoroutineDescriptor final {
+ public:
+  inline CoroutineDescriptor(CoroutineExecutor& executor, int fd);
+  inline ~CoroutineDescriptor();
+
+  int Descriptor() const {
+    return fd_;
+  }
+
+ private:
+  friend class CoroutineExecutor;
+
+  CoroutineExecutor& executor_;
+  const int fd_;
+  CoroutineWait* reader_ = nullptr;
+  CoroutineWait* writer_ = nullptr;
+
+  CoroutineDescriptor(const CoroutineDescriptor&) = delete;
+  void operator=(const CoroutineDescriptor&) = delete;
+};
+
+// `co_await executor.WaitReadable(...)` and the like: suspends, and returns why the coroutine was resumed.
+class CoroutineWaitAwaiter final {
+ public:
+  inline CoroutineWaitAwaiter(CoroutineExecutor& executor, CoroutineWait** slot, std::chrono::milliseconds timeout);
+
+  bool await_ready() const noexcept {
+    return false;
+  }
+
+  inline void await_suspend(std::coroutine_handle<> coroutine);
+
+  CoroutineWaitResult await_resume() const noexcept {
+    return wait_.result;
+  }
+
+ private:
+  CoroutineExecutor& executor_;
+  CoroutineWait** const slot_;
+  const std::chrono::milliseconds timeout_;
+  CoroutineWait wait_;
+
+  CoroutineWaitAwaiter(const CoroutineWaitAwaiter&) = delete;
+  void operator=(const CoroutineWaitAwaiter&) = delete;
+};
+
+class CoroutineExecutor final {
+ public:
+  explicit CoroutineExecutor(size_t max_events = kDefaultMaxCoroutineEpollEvents,
+                             std::chrono::milliseconds timer_resolution = kDefaultCoroutineTimerResolution)
+      : epoll_fd_(epoll_create1(EPOLL_CLOEXEC)),
+        events_(max_events),
+        timer_resolution_(timer_resolution.count() > 0 ? timer_resolution : std::chrono::milliseconds(1)),
+        epoch_(std::chrono::steady_clock::now()) {
+    if (epoll_fd_ < 0) {
+      throw EpollCreateException();
+    }
+  }
+
+  // The tasks still running are abandoned, along with their frames: `Run()` until none are left first.
+  ~CoroutineExecutor() {
+    close(epoll_fd_);
+  }
+
+  // Runs `task` on this executor, starting from the next iteration of the loop. What it throws
+  // of `NetworkException`-s ends it quietly; anything else terminates the process, as in a thread.
+  void Spawn(CoroutineTask<> task) {
+    ++tasks_;
+    Detach(this, std::move(task)).Start(*this);
+  }
+
+  // The spawned tasks that have not completed yet.
+  size_t Tasks() const {
+    return tasks_;
+  }
+
+  // Runs until all the spawned tasks have completed.
+  void Run() {
+    while (tasks_) {
+      RunOnce();
+    }
+  }
+
+  // Resumes the coroutines that are ready to run, and those whose descriptor or timeout has fired since.
+  // Blocks until there is at least one, unless some are ready already.
+  void RunOnce() {
+    int timeout_ms = -1;
+    if (!ready_.empty()) {
+      timeout_ms = 0;
+    } else if (!timers_.Empty()) {
+      timeout_ms = static_cast<int>(timer_resolution_.count());
+    }
+    const int n = epoll_wait(epoll_fd_, &events_[0], static_cast<int>(events_.size()), timeout_ms);
+    if (n < 0 && errno != EINTR) {
+      throw EpollWaitException();
+    }
+    // All the wake-ups are collected before any coroutine runs, as a coroutine may destroy any descriptor.
+    for (int i = 0; i < n; ++i) {
+      CoroutineDescriptor& descriptor = *static_cast<CoroutineDescriptor*>(events_[i].data.ptr);
+      const uint32_t events = events_[i].events;
+      if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+        Wake(descriptor.reader_, CoroutineWaitResult::Ready);
+      }
+      if (events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) {
+        Wake(descriptor.writer_, CoroutineWaitResult::Ready);
+      }
+    }
+    timers_.Advance(ElapsedTicks(std::chrono::steady_clock::now()), [this](TimerWheelEntry* timer) {
+      CoroutineWait* wait = static_cast<CoroutineWait*>(timer);
+      if (wait->slot) {
+        *wait->slot = nullptr;
+        wait->slot = nullptr;
+      }
+      wait->result = CoroutineWaitResult::TimedOut;
+      ready_.push_back(wait->coroutine);
+    });
+    // The coroutines made ready by these run on the next iteration, after the descriptors have been polled again.
+    std::deque<std::coroutine_handle<>> ready;
+    ready.swap(ready_);
+    for (const std::coroutine_handle<> coroutine : ready) {
+      coroutine.resume();
+    }
+  }
+
+  // Suspends until `descriptor` becomes readable, or has an error or a hang-up to report. The descriptor must
+  // have been read from until it would block first, as the readiness is edge-triggered. Zero means no timeout.
+  CoroutineWaitAwaiter WaitReadable(CoroutineDescriptor& descriptor,
+                                    std::chrono::milliseconds timeout = kNoCoroutineTimeout) {
+    return CoroutineWaitAwaiter(*this, &descriptor.reader_, timeout);
+  }
+
+  // Suspends until `descriptor` becomes writable, once written to until it would block.
+  CoroutineWaitAwaiter WaitWritable(CoroutineDescriptor& descriptor,
+                                    std::chrono::milliseconds timeout = kNoCoroutineTimeout) {
+    return CoroutineWaitAwaiter(*this, &descriptor.writer_, timeout);
+  }
+
+  // Suspends for `duration`, give or take one timer resolution.
+  CoroutineWaitAwaiter Sleep(std::chrono::milliseconds duration) {
+    return CoroutineWaitAwaiter(*this, nullptr, duration.count() > 0 ? duration : std::chrono::milliseconds(1));
+  }
+
+  // Resumes the coroutines waiting on `descriptor`, if any, with `CoroutineWaitResult::Interrupted`.
+  void Interrupt(CoroutineDescriptor& descriptor) {
+    Wake(descriptor.reader_, CoroutineWaitResult::Interrupted);
+    Wake(descriptor.writer_, CoroutineWaitResult::Interrupted);
+  }
+
+ private:
+  friend class CoroutineDescriptor;
+  friend class CoroutineWaitAwaiter;
+
+  // The coroutine a spawned task is awaited by: destroys itself, and the task with it, once the task completes.
+  struct DetachedTask {
+    struct promise_type {
+      DetachedTask get_return_object() {
+        return DetachedTask{std::coroutine_handle<promise_type>::from_promise(*this)};
+      }
+
+      std::suspend_always initial_suspend() const noexcept {
+        return {};
+      }
+
+      std::suspend_never final_suspend() const noexcept {
+        return {};
+      }
+
+      void return_void() const {
+      }
+
+      void unhandled_exception() const noexcept {
+        std::terminate();
+      }
+    };
+
+    void Start(CoroutineExecutor& executor) {
+      executor.ready_.push_back(coroutine);
+    }
+
+    std::coroutine_handle<promise_type> coroutine;
+  };
+
+  static DetachedTask Detach(CoroutineExecutor* executor, CoroutineTask<> task) {
+    try {
+      co_await task;
+    } catch (NetworkException&) {
+    }
+    --executor->tasks_;
+  }
+
+  // Rounded up, for deadlines to never fire early.
+  uint64_t Ticks(std::chrono::steady_clock::time_point t) const {
+    return static_cast<uint64_t>((t - epoch_ + timer_resolution_ - std::chrono::nanoseconds(1)) / timer_resolution_);
+  }
+
+  // Rounded down, for the timers to never be advanced ahead of the clock.
+  uint64_t ElapsedTicks(std::chrono::steady_clock::time_point t) const {
+    return static_cast<uint64_t>((t - epoch_) / timer_resolution_);
+  }
+
+  void Register(CoroutineDescriptor& descriptor) {
+    epoll_event e;
+    e.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    e.data.ptr = &descriptor;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, descriptor.fd_, &e)) {
+      throw EpollControlException();
+    }
+  }
+
+  void Unregister(CoroutineDescriptor& descriptor) {
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, descriptor.fd_, nullptr);
+    Interrupt(descriptor);
+  }
+
+  void Suspend(CoroutineWait& wait, CoroutineWait** slot, std::chrono::milliseconds timeout) {
+    if (slot) {
+      if (*slot) {
+        // Only one coroutine may wait for each direction of a descriptor.
+        throw EpollControlException();
+      }
+      *slot = &wait;
+      wait.slot = slot;
+    }
+    if (timeout.count() > 0) {
+      timers_.Schedule(&wait, Ticks(std::chrono::steady_clock::now() + timeout));
+    }
+  }
+
+  void Wake(CoroutineWait*& slot, CoroutineWaitResult result) {
+    CoroutineWait* wait = slot;
+    if (wait) {
+      slot = nullptr;
+      wait->slot = nullptr;
+      timers_.Cancel(wait);
+      wait->result = result;
+      ready_.push_back(wait->coroutine);
+    }
+  }
+
+  const int epoll_fd_;
+  std::vector<epoll_event> events_;
+  const std::chrono::milliseconds timer_resolution_;
+  const std::chrono::steady_clock::time_point epoch_;
+  TimerWheel timers_;
+  std::deque<std::coroutine_handle<>> ready_;
+  size_t tasks_ = 0;
+
+  CoroutineExecutor(const CoroutineExecutor&) = delete;
+  void operator=(const CoroutineExecutor&) = delete;
+};
+
+CoroutineDescriptor::CoroutineDescriptor(CoroutineExecutor& executor, int fd) : executor_(executor), fd_(fd) {
+  executor_.Register(*this);
+}
+
+CoroutineDescriptor::~CoroutineDescriptor() {
+  executor_.Unregister(*this);
+}
+
+CoroutineWaitAwaiter::CoroutineWaitAwaiter(CoroutineExecutor& executor,
+                                           CoroutineWait** slot,
+                                           std::chrono::milliseconds timeout)
+    : executor_(executor), slot_(slot), timeout_(timeout) {
+}
+
+void CoroutineWaitAwaiter::await_suspend(std::coroutine_handle<> coroutine) {
+  wait_.coroutine = coroutine;
+  executor_.Suspend(wait_, slot_, timeout_);
+}
+
+// A non-blocking socket, read from and written to by the coroutines of one executor. Does not own the descriptor.
+class AsyncConnection final {
+ public:
+  AsyncConnection(CoroutineExecutor& executor, int fd) : executor_(executor), descriptor_(executor, fd) {
+    MakeNonBlocking(fd);
+  }
+
+  int Descriptor() const {
+    return descriptor_.Descriptor();
+  }
+
+  CoroutineExecutor& Executor() const {
+    return executor_;
+  }
+
+  // For each wait of a read or a write; zero means none. Past it, the read or the write fails.
+  void SetReceiveTimeout(std::chrono::milliseconds timeout) {
+    receive_timeout_ = timeout;
+  }
+
+  void SetSendTimeout(std::chrono::milliseconds timeout) {
+    send_timeout_ = timeout;
+  }
+
+  // `co_await c.Read(buffer, max_length)`: reads what has arrived, waiting for at least one byte.
+  // Returns `0` if the peer has closed the connection. Throws `SocketReadException` on errors, timeouts,
+  // and interruptions.
+  CoroutineTask<size_t> Read(void* buffer, size_t max_length) {
+    while (true) {
+      const size_t result = NonBlockingRead(Descriptor(), buffer, max_length);
+      if (result != kWouldBlock) {
+        co_return result;
+      }
+      if (co_await WaitReadable(receive_timeout_) != CoroutineWaitResult::Ready) {
+        MetricsAdd(MetricsCounter::ReadErrors);
+        throw SocketReadException();
+      }
+    }
+  }
+
+  // `co_await c.Write(buffer, length)`: writes all of `buffer`, waiting for the socket to drain as needed.
+  // Throws `SocketWriteException` on errors, timeouts, and interruptions.
+  CoroutineTask<> Write(const void* buffer, size_t length) {
+    const char* data = static_cast<const char*>(buffer);
+    while (length) {
+      const size_t result = NonBlockingWrite(Descriptor(), data, length);
+      if (result == kWouldBlock) {
+        if (co_await WaitWritable(send_timeout_) != CoroutineWaitResult::Ready) {
+          MetricsAdd(MetricsCounter::WriteErrors);
+          throw SocketWriteException();
+        }
+        continue;
+      }
+      data += result;
+      length -= result;
+    }
+  }
+
+  CoroutineWaitAwaiter WaitReadable(std::chrono::milliseconds timeout = kNoCoroutineTimeout) {
+    return executor_.WaitReadable(descriptor_, timeout);
+  }
+
+  CoroutineWaitAwaiter WaitWritable(std::chrono::milliseconds timeout = kNoCoroutineTimeout) {
+    return executor_.WaitWritable(descriptor_, timeout);
+  }
+
+  // Makes the pending wait, read or write, if any, return early. See `CoroutineExecutor::Interrupt()`.
+  void Interrupt() {
+    executor_.Interrupt(descriptor_);
+  }
+
+ private:
+  CoroutineExecutor& executor_;
+  CoroutineDescriptor descriptor_;
+  std::chrono::milliseconds receive_timeout_ = kNoCoroutineTimeout;
+  std::chrono::milliseconds send_timeout_ = kNoCoroutineTimeout;
+
+  AsyncConnection(const AsyncConnection&) = delete;
+  void operator=(const AsyncConnection&) = delete;
+};
+
+#endif  // defined(__cpp_impl_coroutine)
+
+#endif  // TOY_COROUTINE_H
@@ -0,0 +1,400 @@
+#ifndef TOY_COROUTINE_HTTP_SERVER_H
+#define TOY_COROUTINE_HTTP_SERVER_H
+
+// An HTTP server whose handlers are coroutines, `CoroutineTask<> handler(CONNECTION& c)`, which may `co_await`
+// timers, other connections, or other tasks while serving a request, and `co_await SendHTTPResponse(c, ...)`
+// to respond. A thread serves as many connections at once as there are handlers suspended, at the cost
+// of a coroutine frame and the buffers of each, instead of a thread each.
+//
+// Each worker thread accepts on its own `SO_REUSEPORT` socket and runs its connections on its own
+// `CoroutineExecutor`. The request is received whole, asynchronously, before `GenericHTTPConnection<HEADER_PARSER>`
+// parses it from memory, and the response is written to memory, for the server to send asynchronously:
+// the existing parsers plug in unchanged, and never block.
+//
+// Needs `-std=c++20`; compiles to nothing with earlier standards.
+
+#include "coroutine.h"
+
+#if defined(__cpp_impl_coroutine)
+
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "exceptions.h"
+#include "http_request_parser.h"
+#include "posix_http_server.h"
+#include "posix_tcp_server.h"
+
+// How much room to make in the receive buffer of a connection for each read.
+const size_t kCoroutineHTTPReadSize = 16 * 1024;
+
+// Finds where each request received on a connection ends, body included, for it to be parsed once whole.
+class HTTPRequestFramer final {
+ public:
+  explicit HTTPRequestFramer(const HTTPServerLimits& limits) : max_body_bytes_(limits.max_body_bytes) {
+    parser_.SetLimits(limits.max_header_bytes, limits.max_headers);
+  }
+
+  void Reset() {
+    parser_.Reset();
+  }
+
+  bool HeadersComplete() const {
+    return parser_.HeadersComplete();
+  }
+
+  bool ExpectsContinue() const {
+    return EqualsIgnoreCase(parser_.Header("Expect"), "100-continue");
+  }
+
+  // `data` holds the first `length` bytes received for this request, as for `HTTPRequestParser::Parse()`.
+  // Returns the length of the request once all of it has arrived, and zero until then. Throws
+  // `HTTPHeadersTooLargeException` and `HTTPBodyTooLargeException` past the limits,
+  // `HTTPUnsupportedTransferEncodingException` for chunked requests, whose bodies the parsers that take the request
+  // from memory can not buffer, and `HTTPMalformedRequestException` if the request can not be framed.
+  size_t Frame(const char* data, size_t length) {
+    if (!parser_.HeadersComplete()) {
+      parser_.Parse(data, length);
+      if (!parser_.HeadersComplete()) {
+        return 0;
+      }
+      if (parser_.IsChunked()) {
+        throw HTTPUnsupportedTransferEncodingException();
+      }
+      if (parser_.HasBody() && parser_.ContentLength() > max_body_bytes_) {
+        throw HTTPBodyTooLargeException();
+      }
+    }
+    return length >= parser_.RequestLength() ? parser_.RequestLength() : 0;
+  }
+
+ private:
+  const size_t max_body_bytes_;
+  HTTPRequestParser parser_;
+};
+
+// The buffers of a connection of `GenericHTTPCoroutineServer`, and its socket.
+struct CoroutineHTTPIO : ConnectionBuffers {
+  CoroutineHTTPIO(CoroutineExecutor& executor, int fd) : socket(executor, fd) {
+  }
+
+  AsyncConnection socket;
+};
+
+// The socket of a connection served by `GenericHTTPCoroutineServer`, to `co_await` other than through the
+// responses, such as the peer going away. `FlushHTTPResponse()` before writing to it directly.
+template <typename CONNECTION>
+AsyncConnection& CoroutineSocket(CONNECTION& c) {
+  return static_cast<CoroutineHTTPIO*>(c.Buffers())->socket;
+}
+
+// `co_await FlushHTTPResponse(c)`: sends what has been responded on `c` so far, such as the chunks
+// of a chunked response sent up to now. The server flushes what is left once the handler returns.
+template <typename CONNECTION>
+CoroutineTask<> FlushHTTPResponse(CONNECTION& c) {
+  ConnectionBuffers& io = *c.Buffers();
+  if (!io.output.empty()) {
+    co_await CoroutineSocket(c).Write(&io.output[0], io.output.size());
+    io.output.clear();
+    if (io.output.capacity() > kMaxPooledHTTPBufferSize) {
+      std::vector<char>().swap(io.output);
+    }
+  }
+}
+
+// `co_await SendHTTPResponse(c, body, code, ...)`: `c.SendHTTPResponse(body, code, ...)`, and the flush.
+template <typename CONNECTION, typename... ARGS>
+CoroutineTask<> SendHTTPResponse(CONNECTION& c, ARGS&&... args) {
+  c.SendHTTPResponse(std::forward<ARGS>(args)...);
+  return FlushHTTPResponse(c);
+}
+
+template <typename CONNECTION = HTTPConnection>
+class GenericHTTPCoroutineServer final {
+ public:
+  typedef std::function<CoroutineTask<>(CONNECTION&)> T_HANDLER;
+
+  // The write timeout of `limits` applies to each wait for the socket to drain, rather than to the whole response.
+  GenericHTTPCoroutineServer(const SocketAddress& address,
+                             T_HANDLER handler,
+                             size_t threads = std::thread::hardware_concurrency(),
+                             const HTTPServerLimits& limits = HTTPServerLimits())
+      : handler_(handler), limits_(limits), drain_(threads ? threads : 1) {
+    if (!threads) {
+      threads = 1;
+    }
+    for (size_t i = 0; i < threads; ++i) {
+      sockets_.emplace_back(new Socket(address, kMaxQueuedConnections, true));
+      sockets_.back()->MakeNonBlocking();
+    }
+  }
+
+  // Runs the workers until `Shutdown()`.
+  void Run() {
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < sockets_.size(); ++i) {
+      workers.emplace_back(&GenericHTTPCoroutineServer::WorkerThread, this, i);
+    }
+    for (auto& thread : workers) {
+      thread.join();
+    }
+  }
+
+  // Makes `Run()` return once the connections being served are done, and waits up to `timeout` for them.
+  // Returns false if some are still being served by then. Thread-safe.
+  bool Shutdown(std::chrono::milliseconds timeout = kDefaultHTTPDrainTimeout) {
+    drain_.Begin();
+    return drain_.Wait(timeout);
+  }
+
+ private:
+  struct Worker {
+    CoroutineExecutor executor;
+    CoroutineDescriptor* listening = nullptr;
+    std::unordered_set<AsyncConnection*> idle;  // The connections waiting for their next request.
+  };
+
+  // Lists a connection among those a drain interrupts, while it waits for its next request.
+  class IdleScope final {
+   public:
+    IdleScope(Worker& worker, AsyncConnection& socket) : worker_(worker), socket_(socket) {
+      worker_.idle.insert(&socket_);
+    }
+
+    ~IdleScope() {
+      worker_.idle.erase(&socket_);
+    }
+
+   private:
+    Worker& worker_;
+    AsyncConnection& socket_;
+  };
+
+  void WorkerThread(size_t index) {
+    Worker worker;
+    worker.executor.Spawn(WatchDrain(worker));
+    worker.executor.Spawn(Accept(worker, *sockets_[index]));
+    worker.executor.Run();
+  }
+
+  CoroutineTask<> WatchDrain(Worker& worker) {
+    CoroutineDescriptor wake(worker.executor, drain_.WakeDescriptor());
+    while (!*drain_.Draining()) {
+      co_await worker.executor.WaitReadable(wake);
+    }
+    if (worker.listening) {
+      worker.executor.Interrupt(*worker.listening);
+    }
+    for (AsyncConnection* socket : worker.idle) {
+      socket->Interrupt();
+    }
+  }
+
+  CoroutineTask<> Accept(Worker& worker, const Socket& socket) {
+    CoroutineDescriptor listening(worker.executor, socket.Descriptor());
+    worker.listening = &listening;
+    while (!*drain_.Draining()) {
+      int fd;
+      bool no_resources = false;
+      try {
+        fd = socket.NonBlockingAccept();
+      } catch (SocketAcceptNoResourcesException&) {
+        // Retrying at once would keep the executor from running the connections that are to free some.
+        fd = -1;
+        no_resources = true;
+      } catch (NetworkException&) {
+        continue;
+      }
+      if (no_resources) {
+        co_await worker.executor.Sleep(kAcceptNoResourcesDelay);
+      } else if (fd == -1) {
+        co_await worker.executor.WaitReadable(listening);
+      } else {
+        worker.executor.Spawn(Serve(worker, fd));
+      }
+    }
+    worker.listening = nullptr;
+  }
+
+  CoroutineTask<> Serve(Worker& worker, int fd) {
+    drain_.ConnectionStarted();
+    try {
+      co_await ServeConnection(worker, fd);
+    } catch (NetworkException&) {
+    }
+    drain_.ConnectionFinished();
+  }
+
+  CoroutineTask<> ServeConnection(Worker& worker, int fd) {
+    // Declared first, to be destroyed last: the socket leaves the executor before it is closed.
+    std::optional<CONNECTION> c;
+    GenericConnection connection(fd);
+    CoroutineHTTPIO io(worker.executor, fd);
+    io.socket.SetSendTimeout(limits_.write_timeout);
+    HTTPRequestFramer framer(limits_);
+    bool served = co_await ReceiveRequest(worker, io, framer, false);
+    if (served) {
+      try {
+        c.emplace(std::move(connection), io, limits_);
+        c->CloseWhen(drain_.Draining());
+      } catch (NetworkException&) {
+        // The descriptor has been closed along with the connection, so the rejection, if any, can not be sent.
+        io.output.clear();
+        served = false;
+      }
+    }
+    while (served) {
+      try {
+        co_await handler_(*c);
+      } catch (NetworkException&) {
+        served = false;
+      }
+      co_await FlushHTTPResponse(*c);
+      if (!served || !c->Persistent()) {
+        break;
+      }
+      served = co_await ReceiveRequest(worker, io, framer, true);
+      if (served) {
+        served = c->NextRequest();
+      }
+    }
+    // The rejection of the last request, if any.
+    if (!io.output.empty()) {
+      co_await io.socket.Write(&io.output[0], io.output.size());
+    }
+  }
+
+  // Receives the next request whole, past the ones received already. Returns false if the connection should be
+  // closed instead, with the response rejecting the request, if any, in the output buffer.
+  CoroutineTask<bool> ReceiveRequest(Worker& worker, CoroutineHTTPIO& io, HTTPRequestFramer& framer, bool idle) {
+    if (io.input_end && io.input_begin == io.input_end) {
+      // The requests before have been read whole: make room for this one.
+      io.received -= io.input_end;
+      memmove(&io.input[0], &io.input[io.input_end], io.received);
+      io.input_begin = io.input_end = 0;
+      if (io.input.size() > kMaxPooledHTTPBufferSize && io.received < kCoroutineHTTPReadSize) {
+        io.input.resize(kCoroutineHTTPReadSize);
+        io.input.shrink_to_fit();
+      }
+    }
+    const size_t begin = io.input_end;
+    framer.Reset();
+    std::optional<IdleScope> idle_scope;
+    if (idle) {
+      idle_scope.emplace(worker, io.socket);
+    }
+    std::chrono::steady_clock::time_point deadline =
+        Deadline(idle ? kDefaultHTTPKeepAliveTimeout : limits_.header_timeout);
+    bool headers_complete = false;
+    HTTPResponseCode rejection = HTTPResponseCode::OK;
+    while (true) {
+      if (io.received > begin) {
+        if (idle_scope) {
+          idle_scope.reset();
+          deadline = Deadline(limits_.header_timeout);
+        }
+        size_t length = 0;
+        try {
+          length = framer.Frame(&io.input[begin], io.received - begin);
+        } catch (const HTTPHeadersTooLargeException&) {
+          rejection = HTTPResponseCode::RequestEntityTooLarge;
+        } catch (const HTTPBodyTooLargeException&) {
+          rejection = HTTPResponseCode::RequestEntityTooLarge;
+        } catch (const HTTPUnsupportedTransferEncodingException&) {
+          rejection = HTTPResponseCode::NotImplemented;
+        } catch (const HTTPException&) {
+          MetricsAdd(MetricsCounter::HTTPParseErrors);
+          co_return false;
+        }
+        if (rejection != HTTPResponseCode::OK) {
+          MetricsAdd(MetricsCounter::HTTPParseErrors);
+          break;
+        }
+        if (length) {
+          io.input_end = begin + length;
+          co_return true;
+        }
+        if (framer.HeadersComplete() && !headers_complete) {
+          headers_complete = true;
+          deadline = Deadline(limits_.body_timeout);
+          // The client waits for it to send the body, which is received whole before the handler runs.
+          if (framer.ExpectsContinue()) {
+            HTTPResponseHeaderBuilder header;
+            header.Append(HTTPStatusLine(HTTPResponseCode::Continue));
+            header.Append("\r\n");
+            co_await io.socket.Write(header.Data(), header.Size());
+          }
+        }
+      }
+      if (io.input.size() - io.received < kCoroutineHTTPReadSize) {
+        io.input.resize(io.received + kCoroutineHTTPReadSize);
+      }
+      const size_t read_count =
+          NonBlockingRead(io.socket.Descriptor(), &io.input[io.received], io.input.size() - io.received);
+      if (!read_count) {
+        co_return false;
+      }
+      if (read_count != kWouldBlock) {
+        io.received += read_count;
+        continue;
+      }
+      if (idle_scope && *drain_.Draining()) {
+        co_return false;
+      }
+      CoroutineWaitResult result = CoroutineWaitResult::TimedOut;
+      const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+      if (deadline == std::chrono::steady_clock::time_point::max()) {
+        result = co_await io.socket.WaitReadable();
+      } else if (now < deadline) {
+        result = co_await io.socket.WaitReadable(
+            std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now) + std::chrono::milliseconds(1));
+      }
+      if (result == CoroutineWaitResult::Interrupted || (result == CoroutineWaitResult::TimedOut && idle_scope)) {
+        co_return false;
+      }
+      if (result == CoroutineWaitResult::TimedOut) {
+        MetricsAdd(MetricsCounter::HTTPTimeouts);
+        rejection = HTTPResponseCode::RequestTimeout;
+        break;
+      }
+    }
+    // Answered with an empty response, and `Connection: close`, as `GenericHTTPConnection` does.
+    MetricsAdd(HTTPResponseClassCounter(rejection));
+    HTTPResponseHeaderBuilder header;
+    header.Append(HTTPStatusLine(rejection));
+    header.Append(kHTTPContentLengthHeaderPrefix);
+    header.Append("0\r\n");
+    header.Append(kHTTPConnectionCloseHeader);
+    header.Append("\r\n");
+    io.Write(header.Data(), header.Size());
+    co_return false;
+  }
+
+  static std::chrono::steady_clock::time_point Deadline(std::chrono::milliseconds timeout) {
+    return timeout.count() > 0 ? std::chrono::steady_clock::now() + timeout
+                               : std::chrono::steady_clock::time_point::max();
+  }
+
+  const T_HANDLER handler_;
+  const HTTPServerLimits limits_;
+  HTTPServerDrain drain_;
+  std::vector<std::unique_ptr<Socket>> sockets_;
+
+  GenericHTTPCoroutineServer(const GenericHTTPCoroutineServer&) = delete;
+  GenericHTTPCoroutineServer(GenericHTTPCoroutineServer&&) = delete;
+  void operator=(const GenericHTTPCoroutineServer&) = delete;
+  void operator=(GenericHTTPCoroutineServer&&) = delete;
+};
+
+typedef GenericHTTPCoroutineServer<HTTPConnection> HTTPCoroutineServer;
+
+#endif  // defined(__cpp_impl_coroutine)
+
+#endif  // TOY_COROUTINE_HTTP_SERVER_H
@@ -0,0 +1,651 @@
+#ifndef TOY_DEFLATE_H
+#define TOY_DEFLATE_H
+
+// A DEFLATE (RFC 1951) and gzip (RFC 1952) encoder, for compressing response bodies without external libraries.
+//
+// Compresses a whole buffer at once: LZ77 over a 32 KiB window with hash chains and one step of lazy matching,
+// then Huffman coding, in blocks of a bounded number of symbols. Each block is emitted with dynamic codes,
+// fixed codes or as stored bytes, whichever is the shortest. The ratio is close to zlib's default level.
+//
+// `DeflateEncoder` keeps its hash tables between calls, so that one encoder per thread compresses any number
+// of bodies without allocating or clearing its tables every time: positions are tagged with a running base,
+// and entries from earlier calls fall below it.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+const size_t kDeflateWindowSize = 32768;
+const size_t kDeflateMinMatch = 3;
+const size_t kDeflateMaxMatch = 258;
+const size_t kDeflateHashBits = 15;
+const size_t kDeflateBlockSymbols = 32768;
+// The largest piece of input matched in one go; larger inputs are split into pieces, with no matches across them,
+// so that the positions fit into 32 bits.
+const size_t kDeflateMaxPieceSize = 1u << 30;
+
+// How hard to look for matches: the number of hash chain links to follow, and the match lengths past which
+// to look less (`good`), not to look for a longer match at the next position (`lazy`), and to stop (`nice`).
+struct DeflateLevel {
+  size_t max_chain;
+  size_t good;
+  size_t lazy;
+  size_t nice;
+};
+
+// The order in which the lengths of the code length code are sent.
+const uint8_t kDeflateCodeLengthOrder[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+const DeflateLevel kDefaultDeflateLevel = {128, 8, 16, 128};
+const DeflateLevel kFastDeflateLevel = {8, 4, 4, 16};
+
+// The code tables of RFC 1951, section 3.2.5.
+struct DeflateTables {
+  uint8_t length_code[256];  // Indexed by `length - 3`, gives the code minus 257.
+  uint8_t distance_code[512];  // See `DistanceCode()`.
+  uint16_t length_base[29];
+  uint8_t length_extra[29];
+  uint16_t distance_base[30];
+  uint8_t distance_extra[30];
+  uint32_t crc[256];
+
+  DeflateTables() {
+    static const uint8_t kLengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+                                             2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+    size_t length = 3;
+    for (size_t code = 0; code < 28; ++code) {
+      length_base[code] = static_cast<uint16_t>(length);
+      length_extra[code] = kLengthExtra[code];
+      for (size_t i = 0; i < (1u << kLengthExtra[code]); ++i) {
+        length_code[length++ - 3] = static_cast<uint8_t>(code);
+      }
+    }
+    // 258 has a code of its own, rather than being the last length of code 284.
+    length_base[28] = 258;
+    length_extra[28] = 0;
+    length_code[255] = 28;
+
+    size_t distance = 1;
+    for (size_t code = 0; code < 30; ++code) {
+      distance_base[code] = static_cast<uint16_t>(distance);
+      distance_extra[code] = static_cast<uint8_t>(code < 4 ? 0 : code / 2 - 1);
+      for (size_t i = 0; i < (1u << distance_extra[code]); ++i, ++distance) {
+        if (distance <= 256) {
+          distance_code[distance - 1] = static_cast<uint8_t>(code);
+        } else {
+          distance_code[256 + ((distance - 1) >> 7)] = static_cast<uint8_t>(code);
+        }
+      }
+    }
+
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; ++k) {
+        c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+      }
+      crc[i] = c;
+    }
+  }
+
+  size_t DistanceCode(size_t distance) const {
+    return distance <= 256 ? distance_code[distance - 1] : distance_code[256 + ((distance - 1) >> 7)];
+  }
+
+  static const DeflateTables& Get() {
+    static const DeflateTables tables;
+    return tables;
+  }
+};
+
+// The CRC-32 of gzip, continued from `crc` over `[data, data + length)`.
+inline uint32_t GzipCRC32(uint32_t crc, const char* data, size_t length) {
+  const uint32_t* table = DeflateTables::Get().crc;
+  crc = ~crc;
+  for (size_t i = 0; i < length; ++i) {
+    crc = table[(crc ^ static_cast<uint8_t>(data[i])) & 0xff] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+class DeflateEncoder final {
+ public:
+  explicit DeflateEncoder(const DeflateLevel& level = kDefaultDeflateLevel)
+      : level_(level), head_(1u << kDeflateHashBits), prev_(kDeflateWindowSize) {
+    symbols_.reserve(kDeflateBlockSymbols);
+  }
+
+  // Appends the raw DEFLATE stream of `[data, data + length)` to `*output`.
+  void Deflate(const char* data, size_t length, std::string* output) {
+    output_ = output;
+    bit_buffer_ = 0;
+    bit_count_ = 0;
+    size_t offset = 0;
+    do {
+      const size_t piece = std::min(length - offset, kDeflateMaxPieceSize);
+      CompressPiece(reinterpret_cast<const uint8_t*>(data) + offset, piece, offset + piece == length);
+      offset += piece;
+    } while (offset < length);
+    FlushBits();
+    output_ = nullptr;
+  }
+
+  // Appends a gzip member with the compressed `[data, data + length)` to `*output`.
+  void Gzip(const char* data, size_t length, std::string* output) {
+    static const char kHeader[10] = {'\x1f', '\x8b', 8, 0, 0, 0, 0, 0, 0, 3};
+    output->append(kHeader, sizeof(kHeader));
+    Deflate(data, length, output);
+    AppendLittleEndian32(GzipCRC32(0, data, length), output);
+    AppendLittleEndian32(static_cast<uint32_t>(length), output);
+  }
+
+ private:
+  struct Symbol {
+    uint16_t literal_or_length;
+    uint16_t distance;  // Zero for literals.
+  };
+
+  // Huffman code lengths and bit-reversed codes, ready to be written least significant bit first.
+  struct HuffmanCode {
+    std::vector<uint8_t> lengths;
+    std::vector<uint16_t> codes;
+  };
+
+  void CompressPiece(const uint8_t* data, size_t length, bool last) {
+    // Positions are `base_ + index`: anything below `base_` is from an earlier piece, and never matched.
+    if (base_ > 0xffffffffu - length - kDeflateWindowSize) {
+      std::fill(head_.begin(), head_.end(), 0);
+      std::fill(prev_.begin(), prev_.end(), 0);
+      base_ = 1;
+    }
+    data_ = data;
+    length_ = length;
+    block_begin_ = 0;
+    emitted_ = 0;
+    symbols_.clear();
+
+    size_t i = 0;
+    size_t previous_length = 0;
+    size_t previous_distance = 0;
+    bool pending = false;  // Whether the position `i - 1` is yet to be emitted.
+    while (i < length) {
+      size_t match_length = 0;
+      size_t match_distance = 0;
+      if (i + kDeflateMinMatch <= length) {
+        const uint32_t candidate = Insert(i);
+        if (!pending || previous_length < level_.lazy) {
+          FindMatch(i, candidate, pending ? previous_length : 0, &match_length, &match_distance);
+        }
+      }
+      if (pending) {
+        if (previous_length >= kDeflateMinMatch && match_length <= previous_length) {
+          EmitMatch(previous_length, previous_distance);
+          const size_t end = i - 1 + previous_length;
+          for (size_t j = i + 1; j < end && j + kDeflateMinMatch <= length; ++j) {
+            Insert(j);
+          }
+          i = end;
+          pending = false;
+          continue;
+        }
+        EmitLiteral(data[i - 1]);
+      }
+      previous_length = match_length;
+      previous_distance = match_distance;
+      pending = true;
+      ++i;
+    }
+    if (pending) {
+      if (previous_length >= kDeflateMinMatch) {
+        EmitMatch(previous_length, previous_distance);
+      } else {
+        EmitLiteral(data[length - 1]);
+      }
+    }
+    FlushBlock(last);
+    base_ += static_cast<uint32_t>(length + kDeflateWindowSize);
+  }
+
+  static uint32_t Hash(const uint8_t* p) {
+    const uint32_t x = static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+                       (static_cast<uint32_t>(p[2]) << 16);
+    return (x * 2654435761u) >> (32 - kDeflateHashBits);
+  }
+
+  // Adds position `i` to its hash chain, and returns the previous head of the chain.
+  uint32_t Insert(size_t i) {
+    const uint32_t position = base_ + static_cast<uint32_t>(i);
+    uint32_t& head = head_[Hash(data_ + i)];
+    const uint32_t candidate = head;
+    head = position;
+    prev_[position & (kDeflateWindowSize - 1)] = candidate;
+    return candidate;
+  }
+
+  // Follows the chain from `candidate` for a match at `i` longer than `at_least`.
+  void FindMatch(size_t i, uint32_t candidate, size_t at_least, size_t* length, size_t* distance) const {
+    const uint32_t position = base_ + static_cast<uint32_t>(i);
+    const uint32_t lowest = position - base_ > kDeflateWindowSize ? position - kDeflateWindowSize : base_;
+    const size_t max_length = std::min(kDeflateMaxMatch, length_ - i);
+    size_t best = std::max(at_least, kDeflateMinMatch - 1);
+    if (best >= max_length) {
+      return;
+    }
+    size_t chain = at_least >= level_.good ? level_.max_chain / 4 : level_.max_chain;
+    const uint8_t* current = data_ + i;
+    while (candidate >= lowest && candidate < position && chain--) {
+      const uint8_t* match = data_ + (candidate - base_);
+      if (match[best] == current[best] && match[0] == current[0]) {
+        const size_t n = MatchLength(match, current, max_length);
+        if (n > best) {
+          best = n;
+          *length = n;
+          *distance = position - candidate;
+          if (n >= level_.nice || n == max_length) {
+            break;
+          }
+        }
+      }
+      const uint32_t next = prev_[candidate & (kDeflateWindowSize - 1)];
+      if (next >= candidate) {
+        break;
+      }
+      candidate = next;
+    }
+  }
+
+  static size_t MatchLength(const uint8_t* a, const uint8_t* b, size_t max_length) {
+    size_t n = 0;
+    while (n + 8 <= max_length) {
+      uint64_t x, y;
+      memcpy(&x, a + n, 8);
+      memcpy(&y, b + n, 8);
+      if (x != y) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        return n + (__builtin_ctzll(x ^ y) >> 3);
+#else
+        break;
+#endif
+      }
+      n += 8;
+    }
+    while (n < max_length && a[n] == b[n]) {
+      ++n;
+    }
+    return n;
+  }
+
+  void EmitLiteral(uint8_t c) {
+    symbols_.push_back(Symbol{c, 0});
+    ++emitted_;
+    if (symbols_.size() == kDeflateBlockSymbols) {
+      FlushBlock(false);
+    }
+  }
+
+  void EmitMatch(size_t length, size_t distance) {
+    symbols_.push_back(Symbol{static_cast<uint16_t>(length), static_cast<uint16_t>(distance)});
+    emitted_ += length;
+    if (symbols_.size() == kDeflateBlockSymbols) {
+      FlushBlock(false);
+    }
+  }
+
+  // Writes the symbols collected since the previous block, in the cheapest of the three block types.
+  void FlushBlock(bool last) {
+    const DeflateTables& tables = DeflateTables::Get();
+    uint32_t literal_frequencies[286] = {0};
+    uint32_t distance_frequencies[30] = {0};
+    size_t extra_bits = 0;
+    for (const Symbol& s : symbols_) {
+      if (!s.distance) {
+        ++literal_frequencies[s.literal_or_length];
+      } else {
+        const size_t length_code = tables.length_code[s.literal_or_length - 3];
+        const size_t distance_code = tables.DistanceCode(s.distance);
+        ++literal_frequencies[257 + length_code];
+        ++distance_frequencies[distance_code];
+        extra_bits += tables.length_extra[length_code] + tables.distance_extra[distance_code];
+      }
+    }
+    literal_frequencies[256] = 1;
+
+    HuffmanCode literals;
+    HuffmanCode distances;
+    BuildHuffmanCode(literal_frequencies, 286, 15, &literals);
+    BuildHuffmanCode(distance_frequencies, 30, 15, &distances);
+    std::vector<std::pair<uint8_t, uint8_t>> code_length_symbols;
+    HuffmanCode code_lengths;
+    size_t literal_count;
+    size_t distance_count;
+    size_t code_length_count;
+    const size_t dynamic_header_bits = EncodeCodeLengths(literals,
+                                                         distances,
+                                                         &code_length_symbols,
+                                                         &code_lengths,
+                                                         &literal_count,
+                                                         &distance_count,
+                                                         &code_length_count);
+
+    size_t dynamic_bits = 3 + dynamic_header_bits + extra_bits;
+    size_t fixed_bits = 3 + extra_bits;
+    for (size_t i = 0; i < 286; ++i) {
+      dynamic_bits += literal_frequencies[i] * literals.lengths[i];
+      fixed_bits += literal_frequencies[i] * FixedLiteralLength(i);
+    }
+    for (size_t i = 0; i < 30; ++i) {
+      dynamic_bits += distance_frequencies[i] * distances.lengths[i];
+      fixed_bits += distance_frequencies[i] * 5;
+    }
+    const size_t raw_length = emitted_ - block_begin_;
+    const size_t stored_bits = (raw_length + 5 * (raw_length / 65535 + 1)) * 8 + 7;
+
+    if (stored_bits <= std::min(dynamic_bits, fixed_bits)) {
+      WriteStoredBlocks(data_ + block_begin_, raw_length, last);
+    } else if (fixed_bits <= dynamic_bits) {
+      PutBits(last ? 1 : 0, 1);
+      PutBits(1, 2);
+      HuffmanCode fixed_literals;
+      HuffmanCode fixed_distances;
+      FixedCodes(&fixed_literals, &fixed_distances);
+      WriteSymbols(fixed_literals, fixed_distances);
+    } else {
+      PutBits(last ? 1 : 0, 1);
+      PutBits(2, 2);
+      PutBits(static_cast<uint32_t>(literal_count - 257), 5);
+      PutBits(static_cast<uint32_t>(distance_count - 1), 5);
+      PutBits(static_cast<uint32_t>(code_length_count - 4), 4);
+      for (size_t i = 0; i < code_length_count; ++i) {
+        PutBits(code_lengths.lengths[kDeflateCodeLengthOrder[i]], 3);
+      }
+      for (const auto& s : code_length_symbols) {
+        PutBits(code_lengths.codes[s.first], code_lengths.lengths[s.first]);
+        if (s.first == 16) {
+          PutBits(s.second, 2);
+        } else if (s.first == 17) {
+          PutBits(s.second, 3);
+        } else if (s.first == 18) {
+          PutBits(s.second, 7);
+        }
+      }
+      WriteSymbols(literals, distances);
+    }
+    symbols_.clear();
+    block_begin_ = emitted_;
+  }
+
+  void WriteSymbols(const HuffmanCode& literals, const HuffmanCode& distances) {
+    const DeflateTables& tables = DeflateTables::Get();
+    for (const Symbol& s : symbols_) {
+      if (!s.distance) {
+        PutBits(literals.codes[s.literal_or_length], literals.lengths[s.literal_or_length]);
+      } else {
+        const size_t length_code = tables.length_code[s.literal_or_length - 3];
+        PutBits(literals.codes[257 + length_code], literals.lengths[257 + length_code]);
+        PutBits(s.literal_or_length - tables.length_base[length_code], tables.length_extra[length_code]);
+        const size_t distance_code = tables.DistanceCode(s.distance);
+        PutBits(distances.codes[distance_code], distances.lengths[distance_code]);
+        PutBits(s.distance - tables.distance_base[distance_code], tables.distance_extra[distance_code]);
+      }
+    }
+    PutBits(literals.codes[256], literals.lengths[256]);
+  }
+
+  void WriteStoredBlocks(const uint8_t* data, size_t length, bool last) {
+    size_t offset = 0;
+    do {
+      const size_t n = std::min(length - offset, static_cast<size_t>(65535));
+      PutBits(last && offset + n == length ? 1 : 0, 1);
+      PutBits(0, 2);
+      FlushBits();
+      const char header[4] = {static_cast<char>(n & 0xff),
+                              static_cast<char>(n >> 8),
+                              static_cast<char>(~n & 0xff),
+                              static_cast<char>((~n >> 8) & 0xff)};
+      output_->append(header, 4);
+      output_->append(reinterpret_cast<const char*>(data) + offset, n);
+      offset += n;
+    } while (offset < length);
+  }
+
+  static size_t FixedLiteralLength(size_t symbol) {
+    return symbol < 144 ? 8 : symbol < 256 ? 9 : symbol < 280 ? 7 : 8;
+  }
+
+  static void FixedCodes(HuffmanCode* literals, HuffmanCode* distances) {
+    static const struct Fixed {
+      HuffmanCode literals;
+      HuffmanCode distances;
+      Fixed() {
+        literals.lengths.resize(288);
+        for (size_t i = 0; i < 288; ++i) {
+          literals.lengths[i] = static_cast<uint8_t>(FixedLiteralLength(i));
+        }
+        distances.lengths.assign(30, 5);
+        AssignCanonicalCodes(&literals);
+        AssignCanonicalCodes(&distances);
+      }
+    } fixed;
+    *literals = fixed.literals;
+    *distances = fixed.distances;
+  }
+
+  // Computes Huffman code lengths of at most `max_bits` for the symbols with non-zero frequencies.
+  // At least two symbols get a code, as some decoders reject a code with a single one.
+  static void BuildHuffmanCode(const uint32_t* frequencies, size_t n, size_t max_bits, HuffmanCode* code) {
+    code->lengths.assign(n, 0);
+    std::vector<std::pair<uint32_t, uint16_t>> leaves;
+    for (size_t i = 0; i < n; ++i) {
+      if (frequencies[i]) {
+        leaves.emplace_back(frequencies[i], static_cast<uint16_t>(i));
+      }
+    }
+    for (size_t i = 0; leaves.size() < 2; ++i) {
+      if (!frequencies[i]) {
+        leaves.emplace_back(1, static_cast<uint16_t>(i));
+      }
+    }
+    std::sort(leaves.begin(), leaves.end());
+
+    // Two-queue construction over the sorted leaves: internal nodes are created in increasing weight order.
+    const size_t m = leaves.size();
+    std::vector<uint64_t> weight(2 * m - 1);
+    std::vector<size_t> parent(2 * m - 1);
+    for (size_t i = 0; i < m; ++i) {
+      weight[i] = leaves[i].first;
+    }
+    size_t next_leaf = 0;
+    size_t next_internal = m;
+    for (size_t node = m; node < 2 * m - 1; ++node) {
+      size_t children[2];
+      for (size_t& child : children) {
+        if (next_leaf < m && (next_internal == node || weight[next_leaf] <= weight[next_internal])) {
+          child = next_leaf++;
+        } else {
+          child = next_internal++;
+        }
+      }
+      weight[node] = weight[children[0]] + weight[children[1]];
+      parent[children[0]] = parent[children[1]] = node;
+    }
+    std::vector<size_t> depth(2 * m - 1, 0);
+    for (size_t node = 2 * m - 1; node-- > 0;) {
+      if (node != 2 * m - 2) {
+        depth[node] = depth[parent[node]] + 1;
+      }
+    }
+
+    // Limits the lengths as zlib does: clamp, then move leaves down until the code is complete again.
+    std::vector<size_t> count(max_bits + 1, 0);
+    size_t overflow = 0;
+    for (size_t i = 0; i < m; ++i) {
+      if (depth[i] > max_bits) {
+        depth[i] = max_bits;
+        ++overflow;
+      }
+      ++count[depth[i]];
+    }
+    while (overflow > 0) {
+      size_t bits = max_bits - 1;
+      while (!count[bits]) {
+        --bits;
+      }
+      --count[bits];
+      count[bits + 1] += 2;
+      --count[max_bits];
+      overflow = overflow > 2 ? overflow - 2 : 0;
+    }
+    // The least frequent symbols get the longest codes.
+    size_t leaf = 0;
+    for (size_t bits = max_bits; bits >= 1; --bits) {
+      for (size_t k = 0; k < count[bits]; ++k) {
+        code->lengths[leaves[leaf++].second] = static_cast<uint8_t>(bits);
+      }
+    }
+    AssignCanonicalCodes(code);
+  }
+
+  static void AssignCanonicalCodes(HuffmanCode* code) {
+    uint16_t count[16] = {0};
+    for (const uint8_t length : code->lengths) {
+      ++count[length];
+    }
+    count[0] = 0;
+    uint16_t next[16] = {0};
+    uint16_t value = 0;
+    for (size_t bits = 1; bits < 16; ++bits) {
+      value = static_cast<uint16_t>((value + count[bits - 1]) << 1);
+      next[bits] = value;
+    }
+    code->codes.assign(code->lengths.size(), 0);
+    for (size_t i = 0; i < code->lengths.size(); ++i) {
+      const size_t length = code->lengths[i];
+      if (length) {
+        uint16_t c = next[length]++;
+        uint16_t reversed = 0;
+        for (size_t b = 0; b < length; ++b, c >>= 1) {
+          reversed = static_cast<uint16_t>((reversed << 1) | (c & 1));
+        }
+        code->codes[i] = reversed;
+      }
+    }
+  }
+
+  // Run-length encodes the code lengths of both codes with the symbols 0 to 18, and builds the code for those.
+  // Returns the number of bits of the dynamic block header.
+  static size_t EncodeCodeLengths(const HuffmanCode& literals,
+                                  const HuffmanCode& distances,
+                                  std::vector<std::pair<uint8_t, uint8_t>>* symbols,
+                                  HuffmanCode* code,
+                                  size_t* literal_count,
+                                  size_t* distance_count,
+                                  size_t* code_length_count) {
+    *literal_count = 286;
+    while (*literal_count > 257 && !literals.lengths[*literal_count - 1]) {
+      --*literal_count;
+    }
+    *distance_count = 30;
+    while (*distance_count > 1 && !distances.lengths[*distance_count - 1]) {
+      --*distance_count;
+    }
+    std::vector<uint8_t> lengths(literals.lengths.begin(), literals.lengths.begin() + *literal_count);
+    lengths.insert(lengths.end(), distances.lengths.begin(), distances.lengths.begin() + *distance_count);
+
+    symbols->clear();
+    for (size_t i = 0; i < lengths.size();) {
+      const uint8_t value = lengths[i];
+      size_t run = 1;
+      while (i + run < lengths.size() && lengths[i + run] == value) {
+        ++run;
+      }
+      i += run;
+      if (!value) {
+        while (run >= 11) {
+          const size_t n = std::min(run, static_cast<size_t>(138));
+          symbols->emplace_back(18, static_cast<uint8_t>(n - 11));
+          run -= n;
+        }
+        if (run >= 3) {
+          symbols->emplace_back(17, static_cast<uint8_t>(run - 3));
+          run = 0;
+        }
+      } else {
+        symbols->emplace_back(value, 0);
+        --run;
+        while (run >= 3) {
+          const size_t n = std::min(run, static_cast<size_t>(6));
+          symbols->emplace_back(16, static_cast<uint8_t>(n - 3));
+          run -= n;
+        }
+      }
+      while (run--) {
+        symbols->emplace_back(value, 0);
+      }
+    }
+
+    uint32_t frequencies[19] = {0};
+    for (const auto& s : *symbols) {
+      ++frequencies[s.first];
+    }
+    BuildHuffmanCode(frequencies, 19, 7, code);
+    *code_length_count = 19;
+    while (*code_length_count > 4 && !code->lengths[kDeflateCodeLengthOrder[*code_length_count - 1]]) {
+      --*code_length_count;
+    }
+    size_t bits = 5 + 5 + 4 + 3 * *code_length_count;
+    for (const auto& s : *symbols) {
+      bits += code->lengths[s.first] + (s.first == 16 ? 2 : s.first == 17 ? 3 : s.first == 18 ? 7 : 0);
+    }
+    return bits;
+  }
+
+  void PutBits(uint32_t bits, size_t count) {
+    bit_buffer_ |= static_cast<uint64_t>(bits) << bit_count_;
+    bit_count_ += count;
+    if (bit_count_ >= 32) {
+      const char bytes[4] = {static_cast<char>(bit_buffer_),
+                             static_cast<char>(bit_buffer_ >> 8),
+                             static_cast<char>(bit_buffer_ >> 16),
+                             static_cast<char>(bit_buffer_ >> 24)};
+      output_->append(bytes, 4);
+      bit_buffer_ >>= 32;
+      bit_count_ -= 32;
+    }
+  }
+
+  // Writes out the pending bits, padding the last byte with zeros.
+  void FlushBits() {
+    while (bit_count_ > 0) {
+      output_->push_back(static_cast<char>(bit_buffer_));
+      bit_buffer_ >>= 8;
+      bit_count_ = bit_count_ > 8 ? bit_count_ - 8 : 0;
+    }
+    bit_buffer_ = 0;
+  }
+
+  static void AppendLittleEndian32(uint32_t x, std::string* output) {
+    const char bytes[4] = {
+        static_cast<char>(x), static_cast<char>(x >> 8), static_cast<char>(x >> 16), static_cast<char>(x >> 24)};
+    output->append(bytes, 4);
+  }
+
+  const DeflateLevel level_;
+  std::vector<uint32_t> head_;
+  std::vector<uint32_t> prev_;
+  uint32_t base_ = 1;
+  std::vector<Symbol> symbols_;
+  const uint8_t* data_ = nullptr;
+  size_t length_ = 0;
+  size_t block_begin_ = 0;
+  size_t emitted_ = 0;
+  std::string* output_ = nullptr;
+  uint64_t bit_buffer_ = 0;
+  size_t bit_count_ = 0;
+
+  DeflateEncoder(const DeflateEncoder&) = delete;
+  void operator=(const DeflateEncoder&) = delete;
+};
+
+#endif  // TOY_DEFLATE_H
@@ -0,0 +1,220 @@
+// A single-threaded HTTP server on top of the io_uring reactor, or of the edge-triggered epoll reactor
+// on kernels without io_uring support or with `TOY_NO_IO_URING` set in the environment.
+// Keeps connections alive, so one thread serves any number of concurrent idle clients.
+// Idle connections, requests trickling in too slowly and clients not reading their responses are timed out
+// by the reactor, with `HTTPServerLimits` deadlines and no thread per connection.
+
+/*
+# To test:
+curl localhost:8080 localhost:8080/again
+curl -d DATA localhost:8080
+(echo -e "GET /one\n\nGET /two\n\n" ; sleep 1) | telnet localhost 8080  # Two requests, one connection.
+(echo -en "GET / HTTP/1.1\r\nHost: x\r\n" ; sleep 15) | nc localhost 8080  # 408 after ten seconds.
+TOY_NO_IO_URING=1 ./build/epoll_http_server  # With epoll.
+./build/epoll_http_server /tmp/http.sock ; curl --unix-socket /tmp/http.sock localhost  # Any `SocketAddress`.
+./build/epoll_http_server [::]:8080 ; curl -g 'http://[::1]:8080'
+*/
+
+#include <chrono>
+#include <string>
+
+#include "http_request_parser.h"
+#include "http_streaming_parser.h"
+#include "posix_epoll_server.h"
+#include "posix_uring_server.h"
+
+const int kPort = 8080;
+const size_t kReadChunkSize = 16 * 1024;
+const HTTPServerLimits kLimits;
+
+typedef std::chrono::steady_clock::time_point TimePoint;
+
+// `CONNECTION` is `GenericConnection` for the epoll reactor, and `UringConnection` for the io_uring one.
+template <typename CONNECTION>
+class BazingaHandler final {
+ public:
+  explicit BazingaHandler(CONNECTION&& c) : c_(std::move(c)), idle_since_(std::chrono::steady_clock::now()) {
+    parser_.SetLimits(kLimits.max_header_bytes, kLimits.max_headers);
+  }
+
+  EpollAction OnReadable() {
+    char chunk[kReadChunkSize];
+    size_t read_count;
+    while ((read_count = c_.NonBlockingRead(chunk, sizeof(chunk))) != kWouldBlock) {
+      if (!read_count) {
+        peer_closed_ = true;
+        break;
+      }
+      // Drops the requests served, once per read rather than once per request.
+      input_.erase(0, input_begin_);
+      input_begin_ = 0;
+      input_.append(chunk, read_count);
+      if (request_since_ == TimePoint()) {
+        request_since_ = std::chrono::steady_clock::now();
+      }
+      // Serves as the requests arrive, for only the one being received to be buffered, up to the limits.
+      ServeRequests();
+      if (last_request_served_) {
+        break;
+      }
+      if (input_.size() - input_begin_ > kLimits.max_header_bytes + kLimits.max_body_bytes) {
+        Reject(HTTPResponseCode::RequestEntityTooLarge);
+        break;
+      }
+    }
+    return Flush();
+  }
+
+  EpollAction OnWritable() {
+    return Flush();
+  }
+
+  // A response not fully sent, a request not fully received, or the connection idle.
+  TimePoint Deadline() const {
+    if (output_offset_ < output_.size()) {
+      return After(write_since_, kLimits.write_timeout);
+    } else if (request_since_ != TimePoint()) {
+      return headers_since_ != TimePoint() ? After(headers_since_, kLimits.body_timeout)
+                                           : After(request_since_, kLimits.header_timeout);
+    } else {
+      return After(idle_since_, kDefaultHTTPKeepAliveTimeout);
+    }
+  }
+
+  EpollAction OnTimeout() {
+    if (output_offset_ >= output_.size() && request_since_ != TimePoint()) {
+      Reject(HTTPResponseCode::RequestTimeout);
+      Flush();
+    }
+    return EpollAction::Close;
+  }
+
+ private:
+  void ServeRequests() {
+    try {
+      while (!last_request_served_ && ServeOneRequest()) {
+      }
+    } catch (const HTTPHeadersTooLargeException&) {
+      Reject(HTTPResponseCode::RequestEntityTooLarge);
+    } catch (const HTTPBodyTooLargeException&) {
+      Reject(HTTPResponseCode::RequestEntityTooLarge);
+    } catch (const HTTPMalformedRequestException&) {
+      Reject(HTTPResponseCode::BadRequest);
+    }
+  }
+
+  // Extracts one complete request from `input_`, if available, and appends the response to `output_`.
+  // A chunked body is decoded as it arrives, for the request to end where its last chunk does.
+  bool ServeOneRequest() {
+    const char* data = input_.data() + input_begin_;
+    const size_t length = input_.size() - input_begin_;
+    if (parser_.Parse(data, length) == HTTPRequestParserStatus::NeedMoreData) {
+      if (parser_.HeadersComplete()) {
+        if (parser_.ContentLength() > kLimits.max_body_bytes) {
+          throw HTTPBodyTooLargeException();
+        }
+        if (headers_since_ == TimePoint()) {
+          headers_since_ = std::chrono::steady_clock::now();
+        }
+      }
+      return false;
+    }
+    size_t request_length = parser_.RequestLength();
+    if (parser_.IsChunked()) {
+      if (!chunked_offset_) {
+        chunked_offset_ = request_length;
+        headers_since_ = std::chrono::steady_clock::now();
+      }
+      while (chunked_offset_ < length && !decoder_.Done()) {
+        StringView piece;
+        chunked_offset_ += decoder_.Decode(data + chunked_offset_, length - chunked_offset_, &piece);
+        chunked_body_.append(piece.data(), piece.size());
+        if (chunked_body_.size() > kLimits.max_body_bytes) {
+          throw HTTPBodyTooLargeException();
+        }
+      }
+      if (!decoder_.Done()) {
+        return false;
+      }
+      request_length = chunked_offset_;
+    }
+    std::string body = "BAZINGA\n" + parser_.Method().ToString() + "(" + parser_.URL().ToString() + ")\n";
+    if (parser_.IsChunked()) {
+      body += chunked_body_ + '\n';
+    } else if (parser_.HasBody()) {
+      body += parser_.Body().ToString() + '\n';
+    }
+    output_ += "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: " + std::to_string(body.length()) +
+               "\r\n\r\n" + body;
+    last_request_served_ = !parser_.KeepAlive();
+    input_begin_ += request_length;
+    parser_.Reset();
+    decoder_.Reset();
+    chunked_offset_ = 0;
+    chunked_body_.clear();
+    // A pipelined request, if any, starts now.
+    const TimePoint now = std::chrono::steady_clock::now();
+    request_since_ = input_begin_ == input_.size() ? TimePoint() : now;
+    headers_since_ = TimePoint();
+    idle_since_ = now;
+    return true;
+  }
+
+  // Answers with an empty response and closes the connection once it is sent.
+  void Reject(HTTPResponseCode code) {
+    const HTTPBytes status_line = HTTPStatusLine(code);
+    output_.append(status_line.data, status_line.size);
+    output_ += "Content-Length: 0\r\nConnection: close\r\n\r\n";
+    last_request_served_ = true;
+    input_.clear();
+    input_begin_ = 0;
+  }
+
+  static TimePoint After(TimePoint t, std::chrono::milliseconds timeout) {
+    return timeout.count() > 0 ? t + timeout : TimePoint::max();
+  }
+
+  EpollAction Flush() {
+    while (output_offset_ < output_.size()) {
+      const size_t written = c_.NonBlockingWrite(&output_[output_offset_], output_.size() - output_offset_);
+      if (written == kWouldBlock) {
+        if (write_since_ == TimePoint()) {
+          write_since_ = std::chrono::steady_clock::now();
+        }
+        return EpollAction::KeepOpen;
+      }
+      output_offset_ += written;
+    }
+    output_.clear();
+    output_offset_ = 0;
+    write_since_ = TimePoint();
+    return (peer_closed_ || last_request_served_) ? EpollAction::Close : EpollAction::KeepOpen;
+  }
+
+  CONNECTION c_;
+  HTTPRequestParser parser_;
+  HTTPChunkedBodyDecoder decoder_;
+  size_t chunked_offset_ = 0;  // How far the chunked body has been decoded, if the request is chunked.
+  std::string chunked_body_;
+  std::string input_;
+  size_t input_begin_ = 0;  // Where the request being received starts; those before are served.
+  std::string output_;
+  size_t output_offset_ = 0;
+  bool peer_closed_ = false;
+  bool last_request_served_ = false;
+  TimePoint idle_since_;     // The end of the last request.
+  TimePoint request_since_;  // The first byte of the request being received, if any.
+  TimePoint headers_since_;  // The end of its headers, if its body is being received.
+  TimePoint write_since_;    // When the socket send buffer filled up, with a response left to send.
+};
+
+int main(int argc, char** argv) {
+  Socket s(argc > 1 ? SocketAddress::Parse(argv[1]) : SocketAddress(kPort));
+  if (IOUringSupported()) {
+    UringServer<BazingaHandler<UringConnection>> server(s);
+    server.Run();
+  } else {
+    EpollServer<BazingaHandler<GenericConnection>> server(s);
+    server.Run();
+  }
+}
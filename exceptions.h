@@ -7,17 +7,43 @@ struct NetworkException : std::exception {};
 
 struct SocketException : NetworkException {};
 
+struct SocketAddressException : SocketException {};
 struct SocketCreateException : SocketException {};
 struct SocketBindException : SocketException {};
 struct SocketListenException : SocketException {};
 struct SocketAcceptException : SocketException {};
+// Out of descriptors or kernel memory: transient, as connections close.
+struct SocketAcceptNoResourcesException : SocketAcceptException {};
+struct SocketConnectException : SocketException {};
 struct SocketFcntlException : SocketException {};
+struct SocketSetOptionException : SocketException {};
 struct SocketReadException : SocketException {};
 struct SocketWriteException : SocketException {};
 struct SocketCouldNotWriteEverythingException : SocketWriteException {};
+struct SocketSendFileException : SocketWriteException {};
+
+struct EpollException : NetworkException {};
+struct EpollCreateException : EpollException {};
+struct EpollControlException : EpollException {};
+struct EpollWaitException : EpollException {};
+
+struct IOUringException : NetworkException {};
+struct IOUringSetupException : IOUringException {};
+struct IOUringEnterException : IOUringException {};
 
 struct HTTPException : NetworkException {};
 struct HTTPNoBodyProvidedException : HTTPException {};
 struct HTTPAttemptedToRespondTwiceException : HTTPException {};
+struct HTTPConnectionClosedException : HTTPException {};
+struct HTTPMalformedRequestException : HTTPException {};
+struct HTTPMalformedResponseException : HTTPException {};
+struct HTTPUnsupportedTransferEncodingException : HTTPException {};
+struct HTTPHeadersTooLargeException : HTTPException {};
+struct HTTPBodyTooLargeException : HTTPException {};
+struct HTTPRequestTimeoutException : HTTPException {};
+struct HTTPUpstreamTimeoutException : HTTPException {};
+struct HTTPInvalidRouteException : HTTPException {};
+struct HTTPDuplicateRouteException : HTTPException {};
+struct HTTPNoUpstreamsException : HTTPException {};
 
 #endif  // TOY_EXCEPTIONS_H
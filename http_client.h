@@ -0,0 +1,645 @@
+#ifndef TOY_HTTP_CLIENT_H
+#define TOY_HTTP_CLIENT_H
+
+// An outbound HTTP/1.1 client, and a reverse proxy built on it.
+//
+// `HTTPClientConnection` sends requests and reads responses over one persistent connection to an upstream server,
+// with `HTTPRequestParser` parsing the status line and the headers, and `HTTPChunkedBodyDecoder` chunked bodies.
+// `HTTPUpstreamPool` keeps the connections left idle between requests, so that the next request to the same
+// upstream skips the TCP handshake. Each worker thread has a pool of its own, which needs no locking: a request
+// is handled on one thread from start to end, so a connection never has to move between threads.
+//
+// `HTTPReverseProxy` is a handler forwarding requests to a set of upstreams, round-robin. With
+// `StreamingHTTPConnection`, bodies of known length go from socket to socket via `splice()`, in both directions,
+// and chunked ones are relayed piece by piece, so neither a request nor a response is ever held whole in memory.
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/socket.h>
+
+#include "exceptions.h"
+#include "http_request_parser.h"
+#include "http_response_codes.h"
+#include "http_streaming_parser.h"
+#include "posix_http_server.h"
+#include "posix_tcp_server.h"
+#include "small_vector.h"
+#include "string_view.h"
+
+const size_t kHTTPClientBufferSize = 32 * 1024;
+const size_t kHTTPInlineConnectionOptions = 8;
+
+// Shorter than the 5 seconds for which the servers here keep an idle connection open, so that a pooled connection
+// is rarely reused just as the upstream closes it.
+const std::chrono::milliseconds kDefaultHTTPUpstreamIdleTimeout = std::chrono::milliseconds(4000);
+const std::chrono::milliseconds kDefaultHTTPUpstreamTimeout = std::chrono::milliseconds(30000);
+const size_t kDefaultHTTPUpstreamMaxIdleConnections = 32;
+
+struct HTTPUpstream {
+  HTTPUpstream(const std::string& host, int port) : host(host), port(port), key(host + ':' + std::to_string(port)) {
+  }
+
+  std::string host;
+  int port;
+  std::string key;  // What its pooled connections are filed under.
+  size_t max_idle_connections = kDefaultHTTPUpstreamMaxIdleConnections;  // Per thread; zero to not pool.
+  std::chrono::milliseconds idle_timeout = kDefaultHTTPUpstreamIdleTimeout;
+  std::chrono::milliseconds timeout = kDefaultHTTPUpstreamTimeout;  // For each read, zero to wait forever.
+};
+
+// How the body of a response is delimited.
+enum class HTTPResponseFraming : int { None, ContentLength, Chunked, UntilClose };
+
+class HTTPClientConnection final {
+ public:
+  explicit HTTPClientConnection(GenericConnection&& c) : c_(std::move(c)), buffer_(kHTTPClientBufferSize) {
+    // The other half of the buffer cycles through the body, past the headers.
+    parser_.SetLimits(buffer_.size() / 2, kDefaultHTTPMaxHeaders);
+  }
+
+  GenericConnection& Connection() {
+    return c_;
+  }
+
+  int Descriptor() const {
+    return c_.Descriptor();
+  }
+
+  // Sends a request with a body known whole, possibly empty. `headers` should include `Host`.
+  void SendRequest(const StringView& method,
+                   const StringView& url,
+                   const HTTPHeadersType& headers = HTTPHeadersType(),
+                   const StringView& body = StringView()) {
+    HTTPResponseHeaderBuilder head;
+    head.Append(method.data(), method.size());
+    head.Append(" ");
+    head.Append(url.data(), url.size());
+    head.Append(" HTTP/1.1\r\n");
+    for (const auto& header : headers) {
+      head.Append(header.first);
+      head.Append(": ");
+      head.Append(header.second);
+      head.Append("\r\n");
+    }
+    if (!body.empty() || method == "POST" || method == "PUT") {
+      head.Append(kHTTPContentLengthHeaderPrefix);
+      head.AppendNumber(body.size());
+      head.Append("\r\n");
+    }
+    head.Append("\r\n");
+    iovec iov[2];
+    iov[0].iov_base = const_cast<char*>(head.Data());
+    iov[0].iov_len = head.Size();
+    iov[1].iov_base = const_cast<char*>(body.data());
+    iov[1].iov_len = body.size();
+    c_.BlockingWrite(iov, 2);
+  }
+
+  // Reads the status line and the headers of the response to a `method` request, skipping interim `1xx` ones.
+  // The body of the previous response, if any, must have been read. Throws `HTTPUpstreamTimeoutException`
+  // if the upstream has sent nothing for longer than the receive timeout of the connection.
+  void ReadResponseHead(const StringView& method) {
+    do {
+      if (begin_) {
+        // An interim response followed by the final one.
+        memmove(&buffer_[0], &buffer_[begin_], end_ - begin_);
+        end_ -= begin_;
+        begin_ = 0;
+      }
+      parser_.Reset();
+      while (parser_.Parse(&buffer_[0], end_), !parser_.HeadersComplete()) {
+        if (end_ == buffer_.size()) {
+          throw HTTPHeadersTooLargeException();
+        }
+        if (!Fill()) {
+          throw HTTPConnectionClosedException();
+        }
+      }
+      // The parser takes the status line for a request line: "HTTP/1.1" is the method, and the status the URL.
+      const StringView status = parser_.URL();
+      if (status.size() != 3 || parser_.Method().substr(0, 5) != "HTTP/") {
+        throw HTTPMalformedResponseException();
+      }
+      status_ = 0;
+      for (size_t i = 0; i < 3; ++i) {
+        if (status.data()[i] < '0' || status.data()[i] > '9') {
+          throw HTTPMalformedResponseException();
+        }
+        status_ = status_ * 10 + (status.data()[i] - '0');
+      }
+      begin_ = parser_.BodyOffset();
+    } while (status_ < 200);
+    // The headers stay in `[0, body_area_begin_)` for `Header()` to point to.
+    body_area_begin_ = begin_;
+    const StringView connection = parser_.Header("Connection");
+    keep_alive_ = !EqualsIgnoreCase(connection, "close") &&
+                  (parser_.Method() == "HTTP/1.1" || EqualsIgnoreCase(connection, "keep-alive"));
+    body_remaining_ = 0;
+    if (method == "HEAD" || status_ == 204 || status_ == 304) {
+      framing_ = HTTPResponseFraming::None;
+    } else if (parser_.IsChunked()) {
+      framing_ = HTTPResponseFraming::Chunked;
+      decoder_.Reset();
+    } else if (parser_.HasBody()) {
+      framing_ = HTTPResponseFraming::ContentLength;
+      body_remaining_ = parser_.ContentLength();
+    } else {
+      framing_ = HTTPResponseFraming::UntilClose;
+      keep_alive_ = false;
+    }
+    body_finished_ = framing_ == HTTPResponseFraming::None ||
+                     (framing_ == HTTPResponseFraming::ContentLength && !body_remaining_);
+  }
+
+  int Status() const {
+    return status_;
+  }
+
+  StringView Reason() const {
+    return parser_.Version();
+  }
+
+  StringView Header(const StringView& key) const {
+    return parser_.Header(key);
+  }
+
+  // Calls `f(StringView key, StringView value)` for each header, in the order received.
+  template <typename F>
+  void ForEachHeader(F&& f) const {
+    parser_.ForEachHeader(std::forward<F>(f));
+  }
+
+  HTTPResponseFraming Framing() const {
+    return framing_;
+  }
+
+  // Calls `f(const char* data, size_t length)` for each piece of the body as it arrives, straight from the receive
+  // buffer. Returns the total length of the body.
+  template <typename F>
+  size_t ReadBody(F&& f) {
+    size_t total = 0;
+    StringView piece;
+    while (NextBodyPiece(&piece)) {
+      f(piece.data(), piece.size());
+      total += piece.size();
+    }
+    return total;
+  }
+
+  // For a `Content-Length` body that the caller reads straight from the socket, as with `splice()`: calls
+  // `f(const char* data, size_t length)` once with the part of the body already received, possibly empty,
+  // and returns how many bytes of it are still to be read from the socket. The body then counts as read.
+  template <typename F>
+  size_t TakeOverBody(F&& f) {
+    if (framing_ != HTTPResponseFraming::ContentLength) {
+      throw HTTPUnsupportedTransferEncodingException();
+    }
+    const size_t n = std::min(end_ - begin_, body_remaining_);
+    f(static_cast<const char*>(&buffer_[begin_]), n);
+    begin_ += n;
+    const size_t remaining = body_remaining_ - n;
+    body_remaining_ = 0;
+    body_finished_ = true;
+    return remaining;
+  }
+
+  // Whether the connection can carry the next request: the response has been read whole, with nothing past it,
+  // and the upstream has not asked to close it.
+  bool Reusable() const {
+    return keep_alive_ && body_finished_ && begin_ == end_;
+  }
+
+  // Whether the upstream has neither closed the connection nor sent anything unasked while it was idle.
+  bool StillOpen() const {
+    char byte;
+    return recv(c_.Descriptor(), &byte, 1, MSG_PEEK | MSG_DONTWAIT) < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+  }
+
+ private:
+  bool NextBodyPiece(StringView* piece) {
+    while (!body_finished_) {
+      if (begin_ == end_) {
+        begin_ = end_ = body_area_begin_;
+        if (!Fill()) {
+          if (framing_ != HTTPResponseFraming::UntilClose) {
+            throw HTTPConnectionClosedException();
+          }
+          body_finished_ = true;
+          return false;
+        }
+      }
+      const size_t available = end_ - begin_;
+      if (framing_ == HTTPResponseFraming::Chunked) {
+        begin_ += decoder_.Decode(&buffer_[begin_], available, piece);
+        body_finished_ = decoder_.Done();
+        if (!piece->empty()) {
+          return true;
+        }
+      } else {
+        const size_t n =
+            framing_ == HTTPResponseFraming::UntilClose ? available : std::min(available, body_remaining_);
+        *piece = StringView(&buffer_[begin_], n);
+        begin_ += n;
+        if (framing_ == HTTPResponseFraming::ContentLength) {
+          body_remaining_ -= n;
+          body_finished_ = !body_remaining_;
+        }
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Returns false at the end of the stream.
+  bool Fill() {
+    size_t read_count;
+    try {
+      read_count = c_.BlockingRead(&buffer_[end_], buffer_.size() - end_);
+    } catch (SocketReadException&) {
+      // The receive timeout makes the read fail with `EAGAIN`.
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        throw HTTPUpstreamTimeoutException();
+      }
+      throw;
+    }
+    end_ += read_count;
+    return read_count > 0;
+  }
+
+  GenericConnection c_;
+  std::vector<char> buffer_;
+  size_t begin_ = 0;
+  size_t end_ = 0;
+  size_t body_area_begin_ = 0;
+  HTTPRequestParser parser_;
+  HTTPChunkedBodyDecoder decoder_;
+  int status_ = 0;
+  bool keep_alive_ = false;
+  HTTPResponseFraming framing_ = HTTPResponseFraming::None;
+  size_t body_remaining_ = 0;
+  bool body_finished_ = true;
+
+  HTTPClientConnection(const HTTPClientConnection&) = delete;
+  void operator=(const HTTPClientConnection&) = delete;
+};
+
+// Idle connections to upstreams, most recently used first. Not thread-safe: meant to be used per thread.
+class HTTPUpstreamPool final {
+ public:
+  // An idle connection to `upstream`, setting `*reused`, or a new one if there is none.
+  // Throws `SocketConnectException` if the upstream can not be connected to.
+  std::unique_ptr<HTTPClientConnection> Acquire(const HTTPUpstream& upstream, bool* reused) {
+    const auto it = idle_.find(upstream.key);
+    if (it != idle_.end()) {
+      std::vector<Idle>& idle = it->second;
+      const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+      while (!idle.empty()) {
+        Idle last = std::move(idle.back());
+        idle.pop_back();
+        if (now - last.since < upstream.idle_timeout && last.c->StillOpen()) {
+          *reused = true;
+          return std::move(last.c);
+        }
+      }
+    }
+    *reused = false;
+    return Connect(upstream);
+  }
+
+  // A new connection, bypassing the pool.
+  std::unique_ptr<HTTPClientConnection> Connect(const HTTPUpstream& upstream) {
+    std::unique_ptr<HTTPClientConnection> c(new HTTPClientConnection(::Connect(upstream.host, upstream.port)));
+    if (upstream.timeout.count() > 0) {
+      c->Connection().SetReceiveTimeout(upstream.timeout);
+    }
+    return c;
+  }
+
+  // Keeps `c` for the next request to `upstream` if it can carry one, and closes it otherwise.
+  // The least recently used connection goes if the pool is full.
+  void Release(const HTTPUpstream& upstream, std::unique_ptr<HTTPClientConnection> c) {
+    if (!c->Reusable() || !upstream.max_idle_connections) {
+      return;
+    }
+    std::vector<Idle>& idle = idle_[upstream.key];
+    if (idle.size() >= upstream.max_idle_connections) {
+      idle.erase(idle.begin());
+    }
+    idle.push_back(Idle{std::move(c), std::chrono::steady_clock::now()});
+  }
+
+ private:
+  struct Idle {
+    std::unique_ptr<HTTPClientConnection> c;
+    std::chrono::steady_clock::time_point since;
+  };
+
+  std::map<std::string, std::vector<Idle>> idle_;
+};
+
+// The pool of the calling thread, created on first use.
+inline HTTPUpstreamPool& ThreadHTTPUpstreamPool() {
+  static thread_local HTTPUpstreamPool pool;
+  return pool;
+}
+
+// Headers that describe the connection rather than the message, which a proxy must not forward, per
+// https://tools.ietf.org/html/rfc7230#section-6.1, and the framing ones, which it sets anew on the other side.
+inline bool IsHTTPHeaderNotForwarded(const StringView& key) {
+  static const char* const kHeaders[] = {"Connection",
+                                         "Keep-Alive",
+                                         "Proxy-Connection",
+                                         "TE",
+                                         "Trailer",
+                                         "Upgrade",
+                                         "Expect",
+                                         "Transfer-Encoding",
+                                         "Content-Length"};
+  for (const char* header : kHeaders) {
+    if (EqualsIgnoreCase(key, header)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// The header names listed in the `Connection` headers of a message, which only describe that connection as well,
+// and are not forwarded either.
+class HTTPConnectionOptions final {
+ public:
+  template <typename MESSAGE>
+  explicit HTTPConnectionOptions(const MESSAGE& m) {
+    m.ForEachHeader([this](const StringView& key, const StringView& value) {
+      if (EqualsIgnoreCase(key, "Connection")) {
+        Add(value);
+      }
+    });
+  }
+
+  bool Contains(const StringView& key) const {
+    for (size_t i = 0; i < options_.Size(); ++i) {
+      if (EqualsIgnoreCase(key, options_[i])) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+ private:
+  void Add(const StringView& value) {
+    size_t begin = 0;
+    while (begin < value.size()) {
+      size_t end = value.find(',', begin);
+      if (end == StringView::npos) {
+        end = value.size();
+      }
+      size_t first = begin;
+      size_t last = end;
+      while (first < last && (value[first] == ' ' || value[first] == '\t')) {
+        ++first;
+      }
+      while (last > first && (value[last - 1] == ' ' || value[last - 1] == '\t')) {
+        --last;
+      }
+      if (last > first) {
+        options_.PushBack(value.substr(first, last - first));
+      }
+      begin = end + 1;
+    }
+  }
+
+  SmallVector<StringView, kHTTPInlineConnectionOptions> options_;
+};
+
+// The methods whose requests can be sent again without changing the outcome, per
+// https://tools.ietf.org/html/rfc7231#section-4.2.2. Method names are case-sensitive.
+inline bool IsHTTPMethodIdempotent(const StringView& method) {
+  return method == "GET" || method == "HEAD" || method == "OPTIONS" || method == "PUT" || method == "DELETE";
+}
+
+// A handler forwarding each request to one of `upstreams`, taken in turn, skipping those that can not be connected
+// to. Answers `502` if none can, or if the upstream fails before responding, and `504` if it takes too long to.
+// An idempotent request sent on a pooled connection that turns out to have been closed by the upstream is sent
+// again, once, on a new connection, as long as its body has not been streamed already. Others may have been acted
+// upon before the upstream failed, so they get the `502`.
+// Once the response has started, a failure of either side closes the client connection.
+class HTTPReverseProxy final {
+ public:
+  explicit HTTPReverseProxy(const std::vector<HTTPUpstream>& upstreams) : upstreams_(upstreams) {
+    if (upstreams_.empty()) {
+      throw HTTPNoUpstreamsException();
+    }
+  }
+
+  template <typename CONNECTION>
+  void operator()(CONNECTION& c) const {
+    HTTPUpstreamPool& pool = ThreadHTTPUpstreamPool();
+    static thread_local size_t next_upstream = 0;
+    const size_t first = next_upstream++;
+    for (size_t i = 0; i < upstreams_.size(); ++i) {
+      const HTTPUpstream& upstream = upstreams_[(first + i) % upstreams_.size()];
+      for (bool from_pool = true;; from_pool = false) {
+        std::unique_ptr<HTTPClientConnection> u;
+        bool reused = false;
+        try {
+          u = from_pool ? pool.Acquire(upstream, &reused) : pool.Connect(upstream);
+        } catch (SocketConnectException&) {
+          break;
+        }
+        bool streamed = false;
+        bool sent = false;
+        try {
+          SendRequest(c, upstream, *u, &streamed);
+          sent = true;
+          u->ReadResponseHead(StringView(c.Method()));
+        } catch (HTTPUpstreamTimeoutException&) {
+          c.SendHTTPResponse(std::string(), HTTPResponseCode::GatewayTimeout);
+          return;
+        } catch (NetworkException&) {
+          if (streamed && !sent) {
+            // Part of the body has been read off the client connection, so it can not carry another request.
+            throw;
+          }
+          if (reused && !streamed && IsHTTPMethodIdempotent(StringView(c.Method()))) {
+            continue;
+          }
+          c.SendHTTPResponse(std::string(), HTTPResponseCode::BadGateway);
+          return;
+        }
+        SendResponse(c, *u);
+        pool.Release(upstream, std::move(u));
+        return;
+      }
+    }
+    c.SendHTTPResponse(std::string(), HTTPResponseCode::BadGateway);
+  }
+
+ private:
+  // The request line and the end-to-end headers for the upstream. The caller appends the framing headers and
+  // the empty line.
+  template <typename CONNECTION>
+  static std::string& StartRequest(const CONNECTION& c, const HTTPUpstream& upstream) {
+    static thread_local std::string head;
+    const StringView method(c.Method());
+    const StringView url(c.URL());
+    head.assign(method.data(), method.size());
+    head += ' ';
+    head.append(url.data(), url.size());
+    head += " HTTP/1.1\r\n";
+    const HTTPConnectionOptions options(c);
+    c.ForEachHeader([&options](const StringView& key, const StringView& value) {
+      if (!IsHTTPHeaderNotForwarded(key) && !options.Contains(key)) {
+        head.append(key.data(), key.size());
+        head += ": ";
+        head.append(value.data(), value.size());
+        head += "\r\n";
+      }
+    });
+    if (c.Header("Host").empty()) {
+      // HTTP/1.0 clients may not send one, while HTTP/1.1 requires it.
+      head += "Host: ";
+      head += upstream.key;
+      head += "\r\n";
+    }
+    return head;
+  }
+
+  // Bodies buffered whole by the parser go out along with the headers.
+  template <typename HEADER_PARSER>
+  static void SendRequest(GenericHTTPConnection<HEADER_PARSER>& c,
+                          const HTTPUpstream& upstream,
+                          HTTPClientConnection& u,
+                          bool*) {
+    std::string& head = StartRequest(c, upstream);
+    const size_t length = c.HasBody() ? c.BodyLength() : 0;
+    if (c.HasBody()) {
+      head += "Content-Length: ";
+      head += std::to_string(length);
+      head += "\r\n";
+    }
+    head += "\r\n";
+    iovec iov[2];
+    iov[0].iov_base = const_cast<char*>(head.data());
+    iov[0].iov_len = head.size();
+    iov[1].iov_base = length ? const_cast<char*>(c.BodyAsNonCopiedBuffer()) : nullptr;
+    iov[1].iov_len = length;
+    u.Connection().BlockingWrite(iov, 2);
+  }
+
+  // Streamed bodies are relayed as they arrive: from socket to socket if their length is known,
+  // and chunk by chunk otherwise.
+  static void SendRequest(StreamingHTTPConnection& c,
+                          const HTTPUpstream& upstream,
+                          HTTPClientConnection& u,
+                          bool* streamed) {
+    std::string& head = StartRequest(c, upstream);
+    if (!c.HasBody()) {
+      head += "\r\n";
+      u.Connection().BlockingWrite(head);
+      return;
+    }
+    *streamed = true;
+    if (c.IsChunked()) {
+      head += "Transfer-Encoding: chunked\r\n\r\n";
+      iovec iov;
+      iov.iov_base = const_cast<char*>(head.data());
+      iov.iov_len = head.size();
+      u.Connection().BlockingWrite(&iov, 1, true);
+      HTTPChunkedResponse body(u.Connection());
+      try {
+        c.ReadBody([&body](const char* data, size_t length) { body.Send(data, length); });
+      } catch (...) {
+        body.Abort();
+        throw;
+      }
+      body.Finish();
+      return;
+    }
+    StringView received;
+    const size_t remaining =
+        c.TakeOverBody([&received](const char* data, size_t length) { received = StringView(data, length); });
+    head += "Content-Length: ";
+    head += std::to_string(received.size() + remaining);
+    head += "\r\n\r\n";
+    iovec iov[2];
+    iov[0].iov_base = const_cast<char*>(head.data());
+    iov[0].iov_len = head.size();
+    iov[1].iov_base = const_cast<char*>(received.data());
+    iov[1].iov_len = received.size();
+    u.Connection().BlockingWrite(iov, 2, remaining > 0);
+    u.Connection().BlockingSpliceFrom(c.Descriptor(), remaining, ThreadSplicePipe());
+  }
+
+  template <typename CONNECTION>
+  static void SendResponse(CONNECTION& c, HTTPClientConnection& u) {
+    const HTTPResponseCode code = static_cast<HTTPResponseCode>(u.Status());
+    if (u.Framing() == HTTPResponseFraming::None) {
+      SendResponseWithoutBody(c, u, code);
+      return;
+    }
+    std::string content_type = CONNECTION::DefaultContentType();
+    HTTPHeadersType headers;
+    const HTTPConnectionOptions options(u);
+    u.ForEachHeader([&content_type, &headers, &options](const StringView& key, const StringView& value) {
+      if (options.Contains(key)) {
+        return;
+      }
+      if (EqualsIgnoreCase(key, "Content-Type")) {
+        content_type.assign(value.data(), value.size());
+      } else if (!IsHTTPHeaderNotForwarded(key)) {
+        headers.emplace_back(std::string(key.data(), key.size()), std::string(value.data(), value.size()));
+      }
+    });
+    if (u.Framing() == HTTPResponseFraming::ContentLength) {
+      StringView received;
+      const size_t remaining =
+          u.TakeOverBody([&received](const char* data, size_t length) { received = StringView(data, length); });
+      c.SendHTTPSplicedResponse(received, u.Descriptor(), remaining, code, content_type, headers);
+      return;
+    }
+    // Re-chunked as it is read, or for HTTP/1.0 clients, sent as it is, closing the connection after it.
+    HTTPChunkedResponse body = c.SendChunkedHTTPResponse(code, content_type, headers);
+    try {
+      u.ReadBody([&body](const char* data, size_t length) { body.Send(data, length); });
+    } catch (...) {
+      body.Abort();
+      throw;
+    }
+    body.Finish();
+  }
+
+  // Responses to `HEAD`, and `204` and `304` ones, keep the headers of the upstream as they are, `Content-Length`
+  // included, as it describes the body the request would otherwise have had.
+  template <typename CONNECTION>
+  static void SendResponseWithoutBody(CONNECTION& c, HTTPClientConnection& u, HTTPResponseCode code) {
+    HTTPResponseHeaderBuilder head;
+    const StringView reason = u.Reason();
+    head.Append("HTTP/1.1 ");
+    head.AppendNumber(static_cast<size_t>(u.Status()));
+    head.Append(" ");
+    head.Append(reason.data(), reason.size());
+    head.Append("\r\n");
+    const HTTPConnectionOptions options(u);
+    u.ForEachHeader([&head, &options](const StringView& key, const StringView& value) {
+      if ((!IsHTTPHeaderNotForwarded(key) || EqualsIgnoreCase(key, "Content-Length")) && !options.Contains(key)) {
+        head.Append(key.data(), key.size());
+        head.Append(": ");
+        head.Append(value.data(), value.size());
+        head.Append("\r\n");
+      }
+    });
+    c.SendPreformattedHTTPResponse(code, head.Data(), head.Size(), "\r\n", 2);
+  }
+
+  const std::vector<HTTPUpstream> upstreams_;
+};
+
+#endif  // TOY_HTTP_CLIENT_H
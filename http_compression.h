@@ -0,0 +1,168 @@
+#ifndef TOY_HTTP_COMPRESSION_H
+#define TOY_HTTP_COMPRESSION_H
+
+// Negotiated `Content-Encoding: gzip` for responses.
+//
+// `SendCompressedHTTPResponse()` gzips bodies above a size threshold if the client accepts it, with a
+// `DeflateEncoder` and an output buffer owned by the calling thread, so that a worker thread reuses its
+// compressor state from one response to the next. `PrecompressHTTPBody()` compresses a body once, ahead of time,
+// for `SendPrecompressedHTTPResponse()` to pick the encoding per request at no cost. Static files are served
+// precompressed by sending "name.gz" instead of "name", see `http_file_server.cc`.
+//
+// Responses that depend on `Accept-Encoding` carry `Vary: Accept-Encoding`. To put them behind
+// `HTTPResponseCache`, list "Accept-Encoding" among its vary headers.
+
+#include <string>
+
+#include "deflate.h"
+#include "posix_http_server.h"
+#include "string_view.h"
+
+// Smaller bodies fit into one TCP segment anyway, and compressing them saves little.
+const size_t kDefaultHTTPCompressionThreshold = 1024;
+// The per-thread output buffer is released after compressing a body larger than this, to not hoard memory.
+const size_t kMaxRetainedHTTPCompressionBufferSize = 1024 * 1024;
+
+// Whether the `Accept-Encoding` header value allows gzip: it lists "gzip", "x-gzip" or "*",
+// with a non-zero quality value, if any.
+inline bool HTTPAcceptsGzip(const StringView& accept_encoding) {
+  size_t i = 0;
+  while (i < accept_encoding.size()) {
+    size_t end = i;
+    while (end < accept_encoding.size() && accept_encoding[end] != ',') {
+      ++end;
+    }
+    const StringView item = accept_encoding.substr(i, end - i);
+    i = end + 1;
+    const size_t semicolon = item.find(';');
+    StringView coding = item.substr(0, semicolon);
+    while (!coding.empty() && (coding[0] == ' ' || coding[0] == '\t')) {
+      coding = coding.substr(1);
+    }
+    while (!coding.empty() && (coding[coding.size() - 1] == ' ' || coding[coding.size() - 1] == '\t')) {
+      coding = coding.substr(0, coding.size() - 1);
+    }
+    if (!EqualsIgnoreCase(coding, "gzip") && !EqualsIgnoreCase(coding, "x-gzip") && coding != "*") {
+      continue;
+    }
+    // "q=0", "q=0.0", "q=0.000" all mean "not acceptable".
+    bool rejected = false;
+    if (semicolon != StringView::npos) {
+      const StringView parameters = item.substr(semicolon + 1);
+      for (size_t q = 0; q + 1 < parameters.size(); ++q) {
+        if ((parameters[q] == 'q' || parameters[q] == 'Q') && parameters[q + 1] == '=') {
+          rejected = true;
+          for (size_t k = q + 2; k < parameters.size() && parameters[k] != ';' && parameters[k] != ' '; ++k) {
+            if (parameters[k] >= '1' && parameters[k] <= '9') {
+              rejected = false;
+            }
+          }
+          break;
+        }
+      }
+    }
+    if (!rejected) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Whether responses of `content_type` are worth compressing: text, and the textual `application/` types.
+// Images, video, archives and the like are compressed already.
+inline bool IsCompressibleHTTPContentType(const std::string& content_type) {
+  const StringView type(content_type);
+  const StringView kPrefixes[] = {"text/", "application/json", "application/javascript", "application/xml"};
+  for (const StringView& prefix : kPrefixes) {
+    if (type.substr(0, prefix.size()) == prefix) {
+      return true;
+    }
+  }
+  return content_type.find("+json") != std::string::npos || content_type.find("+xml") != std::string::npos;
+}
+
+// The compressor of the calling thread, and its output buffer.
+inline DeflateEncoder& ThreadDeflateEncoder() {
+  static thread_local DeflateEncoder encoder;
+  return encoder;
+}
+
+inline std::string& ThreadCompressionBuffer() {
+  static thread_local std::string buffer;
+  return buffer;
+}
+
+// A body along with its gzipped form, made once and sent many times.
+struct HTTPPrecompressedBody {
+  std::string identity;
+  std::string gzip;  // Empty if compressing does not make the body smaller.
+};
+
+inline HTTPPrecompressedBody PrecompressHTTPBody(const std::string& body) {
+  HTTPPrecompressedBody result;
+  result.identity = body;
+  DeflateEncoder encoder;
+  encoder.Gzip(body.data(), body.size(), &result.gzip);
+  if (result.gzip.size() >= body.size()) {
+    result.gzip.clear();
+  }
+  return result;
+}
+
+template <typename CONNECTION>
+bool ClientAcceptsGzip(const CONNECTION& c) {
+  return HTTPAcceptsGzip(c.Header("Accept-Encoding"));
+}
+
+// Sends `body` gzipped if it is at least `threshold` bytes long, of a compressible content type,
+// the client accepts gzip, and the compressed form is smaller. Sends it as is otherwise.
+template <typename CONNECTION>
+void SendCompressedHTTPResponse(CONNECTION& c,
+                                const std::string& body,
+                                HTTPResponseCode code = HTTPResponseCode::OK,
+                                const std::string& content_type = CONNECTION::DefaultContentType(),
+                                HTTPHeadersType extra_headers = HTTPHeadersType(),
+                                size_t threshold = kDefaultHTTPCompressionThreshold) {
+  if (body.size() < threshold || !IsCompressibleHTTPContentType(content_type)) {
+    c.SendHTTPResponse(body, code, content_type, extra_headers);
+    return;
+  }
+  extra_headers.emplace_back("Vary", "Accept-Encoding");
+  if (!ClientAcceptsGzip(c)) {
+    c.SendHTTPResponse(body, code, content_type, extra_headers);
+    return;
+  }
+  std::string& compressed = ThreadCompressionBuffer();
+  compressed.clear();
+  ThreadDeflateEncoder().Gzip(body.data(), body.size(), &compressed);
+  if (compressed.size() < body.size()) {
+    extra_headers.emplace_back("Content-Encoding", "gzip");
+    c.SendHTTPResponse(compressed, code, content_type, extra_headers);
+  } else {
+    c.SendHTTPResponse(body, code, content_type, extra_headers);
+  }
+  if (compressed.capacity() > kMaxRetainedHTTPCompressionBufferSize) {
+    std::string().swap(compressed);
+  }
+}
+
+template <typename CONNECTION>
+void SendPrecompressedHTTPResponse(CONNECTION& c,
+                                   const HTTPPrecompressedBody& body,
+                                   HTTPResponseCode code = HTTPResponseCode::OK,
+                                   const std::string& content_type = CONNECTION::DefaultContentType(),
+                                   HTTPHeadersType extra_headers = HTTPHeadersType()) {
+  if (body.gzip.empty()) {
+    c.SendHTTPResponse(body.identity, code, content_type, extra_headers);
+    return;
+  }
+  extra_headers.emplace_back("Vary", "Accept-Encoding");
+  if (ClientAcceptsGzip(c)) {
+    extra_headers.emplace_back("Content-Encoding", "gzip");
+    c.SendHTTPResponse(body.gzip, code, content_type, extra_headers);
+  } else {
+    c.SendHTTPResponse(body.identity, code, content_type, extra_headers);
+  }
+}
+
+#endif  // TOY_HTTP_COMPRESSION_H
@@ -0,0 +1,131 @@
+// Checks how `GenericHTTPConnection` answers requests that are easy to get wrong, over a socket pair, with
+// no server involved. Exits non-zero if any response is not the expected one.
+
+/*
+make conformance-check
+*/
+
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "http_client.h"
+#include "http_request_parser.h"
+#include "http_streaming_parser.h"
+#include "posix_http_server.h"
+
+// Serves all of `request` on a new connection, with `handler` for each request parsed, and returns what the client
+// receives until the connection is closed.
+template <typename CONNECTION>
+std::string Exchange(const std::string& request, const std::function<void(CONNECTION&)>& handler) {
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) {
+    perror("socketpair");
+    exit(1);
+  }
+  GenericConnection client(fds[0]);
+  client.BlockingWrite(request);
+  shutdown(fds[0], SHUT_WR);
+  try {
+    GenericConnection accepted(fds[1]);
+    CONNECTION c(std::move(accepted));
+    do {
+      handler(c);
+    } while (c.NextRequest());
+  } catch (NetworkException&) {
+  }
+  std::string response;
+  char buffer[4096];
+  while (const size_t length = client.BlockingRead(buffer, sizeof(buffer))) {
+    response.append(buffer, length);
+  }
+  return response;
+}
+
+template <typename CONNECTION>
+void RespondOK(CONNECTION& c) {
+  c.SendHTTPResponse(std::string("OK"));
+}
+
+// Whether `response` starts with `status_line`, and has no other response after it.
+bool IsOnlyResponse(const std::string& response, const std::string& status_line) {
+  return !response.compare(0, status_line.size(), status_line) &&
+         response.find("HTTP/1.", status_line.size()) == std::string::npos;
+}
+
+bool Check(const char* name, bool ok, const std::string& response) {
+  printf("%s: %s\n", name, ok ? "OK" : "FAILED");
+  if (!ok) {
+    printf("%s\n", response.c_str());
+  }
+  return ok;
+}
+
+// The chunk framing of a body the parser does not decode must not be taken for the next request.
+template <typename CONNECTION>
+bool CheckChunkedRequestRejected(const char* name) {
+  const std::string response = Exchange<CONNECTION>(
+      "POST /a HTTP/1.1\r\nHost: x\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nhello\r\n0\r\n\r\n"
+      "GET /b HTTP/1.1\r\nHost: x\r\n\r\n",
+      RespondOK<CONNECTION>);
+  return Check(name, IsOnlyResponse(response, "HTTP/1.1 501 "), response);
+}
+
+template <typename CONNECTION>
+void RespondChunked(CONNECTION& c) {
+  HTTPChunkedResponse response = c.SendChunkedHTTPResponse();
+  response.Send("hello, ");
+  response.Send("world");
+}
+
+// Whether `response` is the only one, with the body `RespondChunked()` sends as it is, ended by closing the
+// connection.
+bool IsUnchunkedResponse(const std::string& response) {
+  const std::string body = "\r\n\r\nhello, world";
+  const bool ends_with_body =
+      response.size() >= body.size() && !response.compare(response.size() - body.size(), body.size(), body);
+  return IsOnlyResponse(response, "HTTP/1.1 200 ") && ends_with_body &&
+         response.find("Connection: close\r\n") != std::string::npos &&
+         response.find("Transfer-Encoding") == std::string::npos;
+}
+
+// HTTP/1.0 clients know nothing of chunks, even when they ask for the connection to be kept alive.
+template <typename CONNECTION>
+bool CheckChunkedResponseToHTTP10(const char* name) {
+  const std::string response = Exchange<CONNECTION>(
+      "GET /a HTTP/1.0\r\nConnection: keep-alive\r\n\r\nGET /b HTTP/1.0\r\n\r\n", RespondChunked<CONNECTION>);
+  return Check(name, IsUnchunkedResponse(response), response);
+}
+
+// The same, for a chunked response from the upstream of `HTTPReverseProxy`.
+bool CheckProxiedChunkedResponseToHTTP10(const char* name) {
+  const Socket upstream(SocketAddress::IPv4(0, "127.0.0.1"));
+  std::thread serving([&upstream]() {
+    try {
+      HTTPConnection c(upstream.Accept());
+      RespondChunked(c);
+    } catch (NetworkException&) {
+    }
+  });
+  const HTTPReverseProxy proxy({HTTPUpstream("127.0.0.1", upstream.LocalAddress().Port())});
+  const std::string response = Exchange<StreamingHTTPConnection>(
+      "GET /a HTTP/1.0\r\n\r\n", [&proxy](StreamingHTTPConnection& c) { proxy(c); });
+  serving.join();
+  return Check(name, IsUnchunkedResponse(response), response);
+}
+
+int main() {
+  bool ok = true;
+  ok &= CheckChunkedRequestRejected<HTTPConnection>("HTTPConnection: chunked request gets 501");
+  ok &= CheckChunkedRequestRejected<ZeroCopyHTTPConnection>("ZeroCopyHTTPConnection: chunked request gets 501");
+  ok &= CheckChunkedResponseToHTTP10<HTTPConnection>("HTTPConnection: chunked response to HTTP/1.0 is not chunked");
+  ok &= CheckChunkedResponseToHTTP10<ZeroCopyHTTPConnection>(
+      "ZeroCopyHTTPConnection: chunked response to HTTP/1.0 is not chunked");
+  ok &= CheckProxiedChunkedResponseToHTTP10("HTTPReverseProxy: chunked response to HTTP/1.0 is not chunked");
+  return ok ? 0 : 1;
+}
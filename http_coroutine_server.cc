@@ -0,0 +1,53 @@
+// An HTTP server with coroutine handlers, one thread per core: `/sleep/N` responds after N milliseconds,
+// with the thread serving the other requests meanwhile, so thousands of them wait at once on a few threads.
+// Built with `-std=c++20`.
+
+/*
+# To test:
+curl localhost:8080
+curl -d DATA localhost:8080
+curl localhost:8080/sleep/1000
+for i in $(seq 1000) ; do curl -s localhost:8080/sleep/1000 >/dev/null & done ; time wait  # About a second.
+curl localhost:8080/stats
+*/
+
+#include <csignal>
+#include <cstdlib>
+#include <sstream>
+#include <thread>
+
+#include "coroutine_http_server.h"
+#include "signal_waiter.h"
+
+const int kPort = 8080;
+
+CoroutineTask<> Handler(HTTPConnection& c) {
+  if (ServeHTTPMetricsIfRequested(c)) {
+    co_return;
+  }
+  const std::string& url = c.URL();
+  if (url.compare(0, 7, "/sleep/") == 0) {
+    const std::chrono::milliseconds duration(strtoul(url.c_str() + 7, nullptr, 10));
+    co_await CoroutineSocket(c).Executor().Sleep(duration);
+    std::ostringstream os;
+    os << "Slept for " << duration.count() << " ms.\n";
+    co_await SendHTTPResponse(c, os.str());
+    co_return;
+  }
+  std::ostringstream os;
+  os << "BAZINGA\n" << c.Method() << "(" << url << ")\n";
+  if (c.HasBody()) {
+    os << c.Body() << '\n';
+  }
+  co_await SendHTTPResponse(c, os.str());
+}
+
+int main() {
+  // Before any thread is started, for all of them to leave the signals to `signals.Wait()`.
+  SignalWaiter signals({SIGTERM, SIGINT});
+  HTTPCoroutineServer server(kPort, Handler);
+  std::thread serving([&server]() { server.Run(); });
+  signals.Wait();
+  server.Shutdown();
+  serving.join();
+}
@@ -0,0 +1,86 @@
+// An HTTP server that serves files from the current directory with `sendfile()`, a generated report of unknown
+// length, streamed with `Transfer-Encoding: chunked`, and a generated JSON document, gzipped on the fly.
+// Files with a precompressed "name.gz" next to them are served from it to the clients that accept gzip.
+
+/*
+# To test:
+curl localhost:8080/README.md
+curl localhost:8080/report
+curl -o /dev/null -w "%{size_download}\n" localhost:8080/build/http_file_server
+curl -o /dev/null -w "%{size_download}\n" --compressed localhost:8080/numbers.json
+gzip -k README.md && curl -i --compressed localhost:8080/README.md  # Note `Content-Encoding: gzip`.
+*/
+
+#include <csignal>
+#include <string>
+
+#include <fcntl.h>
+
+#include "http_compression.h"
+#include "posix_http_server.h"
+
+const int kPort = 8080;
+
+void Serve(HTTPConnection& c) {
+  const std::string& url = c.URL();
+  if (url == "/report") {
+    HTTPChunkedResponse response = c.SendChunkedHTTPResponse();
+    for (int i = 1; i <= 10; ++i) {
+      response.Send("Line " + std::to_string(i) + " of the report.\n");
+    }
+    response.Finish();
+    return;
+  }
+  if (url == "/numbers.json") {
+    std::string json = "[";
+    for (int i = 1; i <= 10000; ++i) {
+      json += "{\"n\":" + std::to_string(i) + ",\"square\":" + std::to_string(i * i) + "},";
+    }
+    json.back() = ']';
+    SendCompressedHTTPResponse(c, json, HTTPResponseCode::OK, "application/json");
+    return;
+  }
+  // Serve files from the current directory only.
+  if (url.size() < 2 || url[0] != '/' || url.find("..") != std::string::npos) {
+    c.SendHTTPResponse(std::string("Bad path.\n"), HTTPResponseCode::BadRequest);
+    return;
+  }
+  HTTPHeadersType headers;
+  int fd = -1;
+  if (ClientAcceptsGzip(c)) {
+    fd = open((url + ".gz").c_str() + 1, O_RDONLY | O_CLOEXEC);
+    if (fd != -1) {
+      headers.emplace_back("Content-Encoding", "gzip");
+      headers.emplace_back("Vary", "Accept-Encoding");
+    }
+  }
+  if (fd == -1) {
+    fd = open(url.c_str() + 1, O_RDONLY | O_CLOEXEC);
+  }
+  if (fd == -1) {
+    c.SendHTTPResponse(std::string("Not found.\n"), HTTPResponseCode::NotFound);
+    return;
+  }
+  try {
+    c.SendHTTPFileResponse(fd, HTTPResponseCode::OK, "application/octet-stream", headers);
+  } catch (NetworkException&) {
+    close(fd);
+    throw;
+  }
+  close(fd);
+}
+
+int main() {
+  // `sendfile()` to a client that has gone away raises `SIGPIPE`, which should not terminate the server.
+  signal(SIGPIPE, SIG_IGN);
+  Socket s(kPort);
+  while (true) {
+    try {
+      HTTPConnection c(s.Accept());
+      do {
+        Serve(c);
+      } while (c.NextRequest());
+    } catch (NetworkException&) {
+    }
+  }
+}
@@ -0,0 +1,371 @@
+// An HTTP load generator for the in-tree servers: a fixed number of connections, each on its own thread,
+// either closed-loop (send as soon as fewer than `--pipeline` requests are in flight), or open-loop
+// (send at a constant `--rate`, measuring latency from when each request was due, not from when it was sent,
+// so a stalled server is not hidden by the generator slowing down too).
+// Prints one JSON object with the throughput and the latency percentiles to stdout.
+
+/*
+# To run against a server on localhost:8080, with optimizations on:
+make bench
+# Or manually:
+./build/bench/http_load_generator --connections=32 --pipeline=4 --duration=10
+./build/bench/http_load_generator --connections=8 --rate=20000 --body=1024 --path=/upload
+./build/bench/http_load_generator --keepalive=0
+./build/bench/http_load_generator --unix=/tmp/http.sock --connections=1  # Over a Unix socket, `@name` if abstract.
+*/
+
+#include <poll.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "http_request_parser.h"
+#include "http_streaming_parser.h"
+#include "latency_histogram.h"
+#include "posix_tcp_server.h"
+
+typedef std::chrono::steady_clock Clock;
+
+const size_t kResponseBufferSize = 64 * 1024;
+const int kReceiveTimeoutMS = 2000;
+
+struct Options {
+  std::string host = "127.0.0.1";
+  int port = 8080;
+  std::string unix_path;  // Connects over the Unix socket at this path, rather than to `host` and `port`.
+  SocketAddress address = SocketAddress(8080);  // Resolved once, not on every connect.
+  std::string path = "/";
+  size_t connections = 16;
+  size_t pipeline = 1;
+  bool keep_alive = true;
+  size_t body = 0;
+  double rate = 0;  // Requests per second over all the connections; zero for the closed loop.
+  double duration = 5;
+  double warmup = 1;
+};
+
+struct Results {
+  LatencyHistogram latency_ns;
+  uint64_t non_2xx = 0;
+  uint64_t errors = 0;
+};
+
+bool ParseFlag(const char* arg, const char* name, std::string* value) {
+  const size_t length = strlen(name);
+  if (strncmp(arg, "--", 2) || strncmp(arg + 2, name, length) || arg[length + 2] != '=') {
+    return false;
+  }
+  *value = arg + length + 3;
+  return true;
+}
+
+Options ParseOptions(int argc, char** argv) {
+  Options options;
+  for (int i = 1; i < argc; ++i) {
+    std::string value;
+    if (ParseFlag(argv[i], "host", &value)) {
+      options.host = value;
+    } else if (ParseFlag(argv[i], "port", &value)) {
+      options.port = atoi(value.c_str());
+    } else if (ParseFlag(argv[i], "unix", &value)) {
+      options.unix_path = value;
+    } else if (ParseFlag(argv[i], "path", &value)) {
+      options.path = value;
+    } else if (ParseFlag(argv[i], "connections", &value)) {
+      options.connections = std::max(atoi(value.c_str()), 1);
+    } else if (ParseFlag(argv[i], "pipeline", &value)) {
+      options.pipeline = std::max(atoi(value.c_str()), 1);
+    } else if (ParseFlag(argv[i], "keepalive", &value)) {
+      options.keep_alive = atoi(value.c_str()) != 0;
+    } else if (ParseFlag(argv[i], "body", &value)) {
+      options.body = static_cast<size_t>(atol(value.c_str()));
+    } else if (ParseFlag(argv[i], "rate", &value)) {
+      options.rate = atof(value.c_str());
+    } else if (ParseFlag(argv[i], "duration", &value)) {
+      options.duration = atof(value.c_str());
+    } else if (ParseFlag(argv[i], "warmup", &value)) {
+      options.warmup = atof(value.c_str());
+    } else {
+      std::cerr << "Usage: " << argv[0] << " [--host=127.0.0.1] [--port=8080] [--unix=] [--path=/]"
+                << " [--connections=16] [--pipeline=1] [--keepalive=1] [--body=0] [--rate=0] [--duration=5]"
+                << " [--warmup=1]"
+                << std::endl;
+      exit(1);
+    }
+  }
+  if (!options.keep_alive) {
+    // Every request gets a connection of its own, so there is nothing to pipeline.
+    options.pipeline = 1;
+  }
+  if (!options.unix_path.empty()) {
+    options.address = SocketAddress::Parse("unix:" + options.unix_path);
+  } else if (options.host.find(':') != std::string::npos) {
+    options.address = SocketAddress::IPv6(options.port, options.host);
+  } else {
+    options.address = SocketAddress::IPv4(options.port, options.host);
+  }
+  return options;
+}
+
+std::string BuildRequest(const Options& options) {
+  std::string request = (options.body ? "POST " : "GET ") + options.path + " HTTP/1.1\r\nHost: " +
+                        (options.address.IsUnix() ? std::string("localhost") : options.address.ToString()) + "\r\n";
+  if (!options.keep_alive) {
+    request += "Connection: close\r\n";
+  }
+  if (options.body) {
+    request += "Content-Length: " + std::to_string(options.body) + "\r\n\r\n" + std::string(options.body, 'x');
+  } else {
+    request += "\r\n";
+  }
+  return request;
+}
+
+GenericConnection Connect(const Options& options) {
+  GenericConnection connection(::Connect(options.address));
+  connection.SetReceiveTimeout(std::chrono::milliseconds(kReceiveTimeoutMS));
+  return connection;
+}
+
+// Splits the bytes received on one connection into responses. The status line is parsed by the request parser,
+// which only cares about it being three space-separated tokens; the body is framed by `Content-Length` or chunked.
+class ResponseReader final {
+ public:
+  ResponseReader() : buffer_(kResponseBufferSize) {
+  }
+
+  void Reset() {
+    begin_ = end_ = 0;
+    in_body_ = false;
+    parser_.Reset();
+  }
+
+  // Returns false if the server has closed the connection.
+  bool Read(const GenericConnection& connection) {
+    if (begin_ == end_) {
+      begin_ = end_ = 0;
+    } else if (end_ == buffer_.size()) {
+      if (begin_) {
+        memmove(&buffer_[0], &buffer_[begin_], end_ - begin_);
+        end_ -= begin_;
+        begin_ = 0;
+      } else {
+        buffer_.resize(buffer_.size() * 2);
+      }
+    }
+    const size_t read_count = connection.BlockingRead(&buffer_[end_], buffer_.size() - end_);
+    end_ += read_count;
+    return read_count != 0;
+  }
+
+  // Consumes the next complete response from the received bytes, if there is one.
+  bool NextResponse(int* status, bool* close) {
+    if (!in_body_) {
+      parser_.Parse(buffer_.data() + begin_, end_ - begin_);
+      if (!parser_.HeadersComplete()) {
+        return false;
+      }
+      status_ = atoi(parser_.URL().ToString().c_str());
+      close_ = EqualsIgnoreCase(parser_.Header("Connection"), "close");
+      chunked_ = parser_.IsChunked();
+      body_remaining_ = parser_.HasBody() ? parser_.ContentLength() : 0;
+      decoder_.Reset();
+      begin_ += parser_.BodyOffset();
+      in_body_ = true;
+    }
+    if (chunked_) {
+      while (!decoder_.Done()) {
+        if (begin_ == end_) {
+          return false;
+        }
+        StringView unused;
+        begin_ += decoder_.Decode(buffer_.data() + begin_, end_ - begin_, &unused);
+      }
+    } else {
+      const size_t n = std::min(end_ - begin_, body_remaining_);
+      begin_ += n;
+      body_remaining_ -= n;
+      if (body_remaining_) {
+        return false;
+      }
+    }
+    in_body_ = false;
+    parser_.Reset();
+    *status = status_;
+    *close = close_;
+    return true;
+  }
+
+ private:
+  std::vector<char> buffer_;
+  size_t begin_ = 0;
+  size_t end_ = 0;
+  bool in_body_ = false;
+  HTTPRequestParser parser_;
+  HTTPChunkedBodyDecoder decoder_;
+  int status_ = 0;
+  bool close_ = false;
+  bool chunked_ = false;
+  size_t body_remaining_ = 0;
+};
+
+void RunConnection(const Options& options,
+                   Clock::time_point measure_begin,
+                   Clock::time_point end,
+                   Clock::duration interval,
+                   Clock::time_point first_send,
+                   Results* results) {
+  // All the requests that can be in flight at once, back to back, to be sent with a single write.
+  const std::string request = BuildRequest(options);
+  std::string requests;
+  for (size_t i = 0; i < options.pipeline; ++i) {
+    requests += request;
+  }
+  const bool open_loop = interval != Clock::duration::zero();
+  Clock::time_point next_send = first_send;
+  std::deque<Clock::time_point> in_flight;  // When each request was due.
+  ResponseReader reader;
+  std::unique_ptr<GenericConnection> connection;
+
+  auto now = Clock::now();
+  while (now < end) {
+    try {
+      if (!connection) {
+        connection.reset(new GenericConnection(Connect(options)));
+        reader.Reset();
+      }
+      size_t due = options.pipeline - in_flight.size();
+      if (open_loop) {
+        size_t ready = 0;
+        while (ready < due && next_send + ready * interval <= now) {
+          ++ready;
+        }
+        due = ready;
+      }
+      if (due) {
+        connection->BlockingWrite(requests.data(), request.size() * due);
+        for (size_t i = 0; i < due; ++i) {
+          in_flight.push_back(open_loop ? next_send : now);
+          if (open_loop) {
+            next_send += interval;
+          }
+        }
+      } else {
+        // Wait for responses, but no longer than until the next request is due.
+        Clock::duration timeout = std::chrono::milliseconds(kReceiveTimeoutMS);
+        const bool waiting_to_send = in_flight.size() < options.pipeline;
+        if (waiting_to_send) {
+          timeout = std::max(std::min(next_send - now, timeout), Clock::duration::zero());
+        }
+        const auto timeout_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count();
+        timespec ts;
+        ts.tv_sec = static_cast<time_t>(timeout_ns / 1000000000);
+        ts.tv_nsec = static_cast<long>(timeout_ns % 1000000000);
+        pollfd p;
+        p.fd = connection->Descriptor();
+        p.events = POLLIN;
+        if (ppoll(&p, 1, &ts, nullptr) > 0) {
+          bool closed = !reader.Read(*connection);
+          const auto received = Clock::now();
+          int status;
+          bool close;
+          while (!in_flight.empty() && reader.NextResponse(&status, &close)) {
+            if (in_flight.front() >= measure_begin && received < end) {
+              results->latency_ns.Record(
+                  std::chrono::duration_cast<std::chrono::nanoseconds>(received - in_flight.front()).count());
+              if (status < 200 || status >= 300) {
+                ++results->non_2xx;
+              }
+            }
+            in_flight.pop_front();
+            closed = closed || close;
+          }
+          if (closed || !options.keep_alive) {
+            results->errors += in_flight.size();
+            in_flight.clear();
+            connection.reset();
+          }
+        } else if (!waiting_to_send) {
+          throw SocketReadException();
+        }
+      }
+    } catch (const NetworkException&) {
+      // Failed to connect, timed out, or got a malformed response: start over on a new connection.
+      results->errors += std::max(in_flight.size(), static_cast<size_t>(1));
+      in_flight.clear();
+      connection.reset();
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    now = Clock::now();
+  }
+}
+
+int main(int argc, char** argv) {
+  const Options options = ParseOptions(argc, argv);
+  const auto begin = Clock::now();
+  const auto measure_begin = begin + std::chrono::duration_cast<Clock::duration>(
+                                         std::chrono::duration<double>(options.warmup));
+  const auto end = measure_begin + std::chrono::duration_cast<Clock::duration>(
+                                       std::chrono::duration<double>(options.duration));
+  Clock::duration interval = Clock::duration::zero();
+  if (options.rate > 0) {
+    interval = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(options.connections / options.rate));
+  }
+
+  std::vector<Results> results(options.connections);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < options.connections; ++i) {
+    // In the open loop, the connections take turns, so that the requests are evenly spread in time.
+    const auto first_send = begin + interval * i / options.connections;
+    threads.emplace_back(RunConnection, std::cref(options), measure_begin, end, interval, first_send, &results[i]);
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  Results total;
+  for (const auto& r : results) {
+    total.latency_ns.Merge(r.latency_ns);
+    total.non_2xx += r.non_2xx;
+    total.errors += r.errors;
+  }
+  const LatencyHistogram& h = total.latency_ns;
+  auto us = [](double ns) { return ns / 1e3; };
+  printf(
+      "{\"host\":\"%s\",\"port\":%d,\"address\":\"%s\",\"path\":\"%s\",\"mode\":\"%s\",\"connections\":%zu,"
+      "\"pipeline\":%zu,\"keepalive\":%s,\"body\":%zu,\"rate\":%.0f,\"duration_s\":%.3f,"
+      "\"requests\":%llu,\"non_2xx\":%llu,\"errors\":%llu,\"requests_per_second\":%.1f,"
+      "\"latency_us\":{\"min\":%.1f,\"mean\":%.1f,\"p50\":%.1f,\"p90\":%.1f,\"p99\":%.1f,\"p999\":%.1f,"
+      "\"max\":%.1f}}\n",
+      options.host.c_str(),
+      options.port,
+      options.address.ToString().c_str(),
+      options.path.c_str(),
+      options.rate > 0 ? "open" : "closed",
+      options.connections,
+      options.pipeline,
+      options.keep_alive ? "true" : "false",
+      options.body,
+      options.rate,
+      options.duration,
+      static_cast<unsigned long long>(h.Count()),
+      static_cast<unsigned long long>(total.non_2xx),
+      static_cast<unsigned long long>(total.errors),
+      h.Count() / options.duration,
+      us(h.Min()),
+      us(h.Mean()),
+      us(h.ValueAtPercentile(50)),
+      us(h.ValueAtPercentile(90)),
+      us(h.ValueAtPercentile(99)),
+      us(h.ValueAtPercentile(99.9)),
+      us(h.Max()));
+}
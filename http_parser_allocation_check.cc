@@ -0,0 +1,131 @@
+// Checks that parsing requests does not touch the heap once warm. Replaces the global `operator new` and
+// `operator delete` with counting ones, parses each corpus file once to warm the buffer pools and arenas up,
+// then parses it again on a new connection, and exits non-zero if any of the requests has allocated.
+
+/*
+make alloc-check
+./build/http_parser_allocation_check --corpus=corpus
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "http_parser_harness.h"
+#include "http_request_parser.h"
+#include "posix_http_server.h"
+
+static size_t allocations = 0;
+
+void* operator new(size_t size) {
+  ++allocations;
+  if (void* p = malloc(size ? size : 1)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) {
+  return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  ++allocations;
+  return malloc(size ? size : 1);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+  return operator new(size, std::nothrow);
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+void operator delete[](void* p) noexcept {
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+  free(p);
+}
+
+struct Fragmentation {
+  std::string name;
+  size_t max_fragment;
+  uint32_t seed;
+};
+
+// Parses all of `requests` on a new connection. Returns how many of them have allocated, counting what setting
+// the connection up allocates against the first one.
+template <typename HEADER_PARSER>
+size_t CountAllocatingRequests(const std::string& requests, const Fragmentation& fragmentation, size_t* parsed) {
+  size_t allocating = 0;
+  *parsed = 0;
+  size_t before = allocations;
+  HTTPParserHarness<HEADER_PARSER> parser;
+  FakeConnection c(requests, fragmentation.max_fragment, fragmentation.seed);
+  try {
+    while (true) {
+      parser.Parse(c);
+      ++*parsed;
+      if (allocations != before) {
+        ++allocating;
+      }
+      before = allocations;
+    }
+  } catch (const HTTPConnectionClosedException&) {
+  }
+  return allocating;
+}
+
+template <typename HEADER_PARSER>
+bool Check(const char* parser_name,
+           const std::string& corpus_name,
+           const std::string& requests,
+           const Fragmentation& fragmentation) {
+  size_t parsed;
+  const size_t warming_up = CountAllocatingRequests<HEADER_PARSER>(requests, fragmentation, &parsed);
+  const size_t allocating = CountAllocatingRequests<HEADER_PARSER>(requests, fragmentation, &parsed);
+  printf("%s %s %s: %zu of %zu requests allocated, %zu while warming up\n",
+         parser_name,
+         corpus_name.c_str(),
+         fragmentation.name.c_str(),
+         allocating,
+         parsed,
+         warming_up);
+  return !allocating && parsed;
+}
+
+int main(int argc, char** argv) {
+  std::string corpus_directory = "corpus";
+  for (int i = 1; i < argc; ++i) {
+    if (!strncmp(argv[i], "--corpus=", 9)) {
+      corpus_directory = argv[i] + 9;
+    } else {
+      fprintf(stderr, "Usage: %s [--corpus=corpus]\n", argv[0]);
+      return 1;
+    }
+  }
+  const auto corpus = LoadHTTPCorpus(corpus_directory);
+  if (corpus.empty()) {
+    fprintf(stderr, "No `*.http` files in `%s`.\n", corpus_directory.c_str());
+    return 1;
+  }
+  const std::vector<Fragmentation> fragmentations = {{"none", 0, 0}, {"64", 64, 0}, {"random", 64, 42}};
+  bool ok = true;
+  for (const auto& entry : corpus) {
+    for (const auto& fragmentation : fragmentations) {
+      ok &= Check<HTTPHeaderParser>("HTTPHeaderParser", entry.first, entry.second, fragmentation);
+      ok &= Check<ZeroCopyHTTPHeaderParser>("ZeroCopyHTTPHeaderParser", entry.first, entry.second, fragmentation);
+    }
+  }
+  return ok ? 0 : 1;
+}
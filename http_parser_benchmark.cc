@@ -0,0 +1,115 @@
+// Micro-benchmark of the request parsers on recorded requests, with no sockets involved.
+// Each corpus file is repeated back to back into one long pipelined stream, which is fed to the parser
+// through `FakeConnection` in whole buffers, in fixed-size fragments, and in random-size fragments.
+// Prints one JSON object per parser, corpus file and fragmentation, with ns/request and bytes/cycle.
+
+/*
+# To run, with optimizations on:
+make build/bench/http_parser_benchmark
+./build/bench/http_parser_benchmark
+./build/bench/http_parser_benchmark --corpus=corpus --fragment=1
+*/
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "http_parser_harness.h"
+#include "http_request_parser.h"
+#include "posix_http_server.h"
+
+const size_t kRepetitions = 1000;
+const double kSecondsPerMeasurement = 0.2;
+const uint32_t kRandomFragmentationSeed = 42;
+
+// The TSC on x86, which ticks at a constant rate close to the nominal CPU frequency; zero elsewhere.
+inline uint64_t ReadCycleCounter() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+struct Fragmentation {
+  std::string name;
+  size_t max_fragment;
+  uint32_t seed;
+};
+
+template <typename HEADER_PARSER>
+void Run(const char* parser_name,
+         const std::string& corpus_name,
+         const std::string& requests,
+         const Fragmentation& fragmentation) {
+  std::string stream;
+  for (size_t i = 0; i < kRepetitions; ++i) {
+    stream += requests;
+  }
+  size_t expected;
+  {
+    HTTPParserHarness<HEADER_PARSER> parser;
+    expected = parser.ParseAll(FakeConnection(requests)) * kRepetitions;
+  }
+
+  size_t parsed = 0;
+  size_t passes = 0;
+  const auto begin = std::chrono::steady_clock::now();
+  const uint64_t begin_cycles = ReadCycleCounter();
+  auto end = begin;
+  do {
+    // A new parser per pass, as for a new connection, but one pass is `kRepetitions` requests.
+    HTTPParserHarness<HEADER_PARSER> parser;
+    parsed += parser.ParseAll(FakeConnection(stream, fragmentation.max_fragment, fragmentation.seed));
+    ++passes;
+    end = std::chrono::steady_clock::now();
+  } while (std::chrono::duration<double>(end - begin).count() < kSecondsPerMeasurement);
+  const uint64_t cycles = ReadCycleCounter() - begin_cycles;
+
+  const double ns = std::chrono::duration<double, std::nano>(end - begin).count();
+  const double bytes = static_cast<double>(stream.size()) * passes;
+  printf("{\"parser\":\"%s\",\"corpus\":\"%s\",\"fragment\":\"%s\",\"bytes_per_request\":%.1f,\"requests\":%zu,",
+         parser_name,
+         corpus_name.c_str(),
+         fragmentation.name.c_str(),
+         bytes / parsed,
+         parsed);
+  printf("\"ns_per_request\":%.1f,\"bytes_per_cycle\":%.3f,\"ok\":%s}\n",
+         ns / parsed,
+         cycles ? bytes / cycles : 0.0,
+         parsed == expected * passes ? "true" : "false");
+}
+
+int main(int argc, char** argv) {
+  std::string corpus_directory = "corpus";
+  std::vector<Fragmentation> fragmentations = {{"none", 0, 0}, {"64", 64, 0}, {"random", 64, kRandomFragmentationSeed}};
+  for (int i = 1; i < argc; ++i) {
+    if (!strncmp(argv[i], "--corpus=", 9)) {
+      corpus_directory = argv[i] + 9;
+    } else if (!strncmp(argv[i], "--fragment=", 11)) {
+      const size_t max_fragment = static_cast<size_t>(atol(argv[i] + 11));
+      fragmentations = {{std::to_string(max_fragment), max_fragment, 0}};
+    } else {
+      fprintf(stderr, "Usage: %s [--corpus=corpus] [--fragment=N]\n", argv[0]);
+      return 1;
+    }
+  }
+  const auto corpus = LoadHTTPCorpus(corpus_directory);
+  if (corpus.empty()) {
+    fprintf(stderr, "No `*.http` files in `%s`.\n", corpus_directory.c_str());
+    return 1;
+  }
+  for (const auto& entry : corpus) {
+    for (const auto& fragmentation : fragmentations) {
+      Run<HTTPHeaderParser>("HTTPHeaderParser", entry.first, entry.second, fragmentation);
+      Run<ZeroCopyHTTPHeaderParser>("ZeroCopyHTTPHeaderParser", entry.first, entry.second, fragmentation);
+    }
+  }
+}
@@ -0,0 +1,224 @@
+// Fuzz target for the request parsers, over the same in-memory harness as `http_parser_benchmark`.
+// The first byte of the input sets the read fragmentation, the rest is the byte stream from the client.
+// Any exception other than `HTTPException`, any crash, and any body claimed to extend past the received bytes
+// is a bug.
+//
+// Builds either as a libFuzzer target, or standalone, with a simple mutator seeded from `corpus/`.
+
+/*
+# Standalone, with the sanitizers on:
+make fuzz
+./build/fuzz/http_parser_fuzzer fuzz-crash.http  # Replays the input that has crashed the previous run.
+
+# With libFuzzer:
+clang++ -std=c++11 -g -O1 -fsanitize=fuzzer,address -DTOY_LIBFUZZER -o build/http_parser_fuzzer http_parser_fuzzer.cc
+./build/http_parser_fuzzer corpus/
+*/
+
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+
+#include "http_parser_harness.h"
+#include "http_request_parser.h"
+#include "http_streaming_parser.h"
+#include "posix_http_server.h"
+
+template <typename HEADER_PARSER>
+void FuzzHeaderParser(const std::string& input, size_t max_fragment) {
+  HTTPParserHarness<HEADER_PARSER> parser;
+  FakeConnection c(input, max_fragment);
+  try {
+    while (true) {
+      parser.Parse(c);
+      if (parser.HasBody() && parser.BodyLength() > input.size()) {
+        abort();
+      }
+      if (parser.HasBody()) {
+        parser.Body();
+      }
+      parser.Method();
+      parser.URL();
+      parser.KeepAlive();
+    }
+  } catch (const HTTPException&) {
+  }
+}
+
+void FuzzChunkedBodyDecoder(const std::string& input) {
+  HTTPChunkedBodyDecoder decoder;
+  size_t offset = 0;
+  try {
+    while (offset < input.size() && !decoder.Done()) {
+      StringView piece;
+      const size_t consumed = decoder.Decode(input.data() + offset, input.size() - offset, &piece);
+      if (consumed > input.size() - offset || piece.size() > consumed) {
+        abort();
+      }
+      offset += consumed;
+    }
+  } catch (const HTTPException&) {
+  }
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+  if (!size) {
+    return 0;
+  }
+  const size_t max_fragment = data[0];
+  const std::string input(reinterpret_cast<const char*>(data) + 1, size - 1);
+  FuzzHeaderParser<HTTPHeaderParser>(input, max_fragment);
+  FuzzHeaderParser<ZeroCopyHTTPHeaderParser>(input, max_fragment);
+  FuzzChunkedBodyDecoder(input);
+  return 0;
+}
+
+#ifndef TOY_LIBFUZZER
+
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+const char* const kCrashFileName = "fuzz-crash.http";
+
+// Fragments that make the mutated inputs reach deeper into the parsers than random bytes would.
+const std::vector<std::string> kDictionary = {"\r\n",
+                                              "\r\n\r\n",
+                                              "\n",
+                                              ": ",
+                                              ":",
+                                              " ",
+                                              "GET / HTTP/1.1\r\n",
+                                              "POST / HTTP/1.0\r\n",
+                                              "Content-Length: ",
+                                              "content-length:",
+                                              "Transfer-Encoding: chunked\r\n",
+                                              "Connection: close\r\n",
+                                              "Connection: keep-alive\r\n",
+                                              "0",
+                                              "-1",
+                                              "18446744073709551616",
+                                              "ffffffffffffffff",
+                                              "0\r\n\r\n",
+                                              ";ext=1",
+                                              std::string(1, '\0')};
+
+// The input being run, to save if it crashes the process.
+std::string g_current_input;
+
+void SaveCurrentInputAndDie(int signal_number) {
+  // Only async-signal-safe calls here.
+  const int fd = open(kCrashFileName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd != -1) {
+    const ssize_t ignored = write(fd, g_current_input.data(), g_current_input.size());
+    static_cast<void>(ignored);
+    close(fd);
+  }
+  signal(signal_number, SIG_DFL);
+  raise(signal_number);
+}
+
+void Run(const std::string& input) {
+  g_current_input = input;
+  LLVMFuzzerTestOneInput(reinterpret_cast<const uint8_t*>(input.data()), input.size());
+}
+
+class Mutator final {
+ public:
+  explicit Mutator(uint32_t seed) : state_(seed) {
+  }
+
+  std::string Mutate(std::string input) {
+    const size_t mutations = 1 + Random(4);
+    for (size_t i = 0; i < mutations; ++i) {
+      const size_t position = Random(input.size() + 1);
+      switch (Random(5)) {
+        case 0:
+          if (position < input.size()) {
+            input[position] = static_cast<char>(Random(256));
+          }
+          break;
+        case 1:
+          input.insert(position, 1, static_cast<char>(Random(256)));
+          break;
+        case 2:
+          input.erase(position, 1 + Random(16));
+          break;
+        case 3:
+          input.insert(position, kDictionary[Random(kDictionary.size())]);
+          break;
+        default:
+          if (position < input.size()) {
+            input.insert(Random(input.size() + 1), input.substr(position, 1 + Random(32)));
+          }
+          break;
+      }
+    }
+    return input;
+  }
+
+  size_t Random(size_t n) {
+    // Xorshift32.
+    state_ ^= state_ << 13;
+    state_ ^= state_ >> 17;
+    state_ ^= state_ << 5;
+    return n ? state_ % n : 0;
+  }
+
+ private:
+  uint32_t state_;
+};
+
+int main(int argc, char** argv) {
+  size_t iterations = 100000;
+  std::vector<std::string> files;
+  for (int i = 1; i < argc; ++i) {
+    if (!strncmp(argv[i], "--iterations=", 13)) {
+      iterations = static_cast<size_t>(atol(argv[i] + 13));
+    } else {
+      files.push_back(argv[i]);
+    }
+  }
+
+  signal(SIGSEGV, SaveCurrentInputAndDie);
+  signal(SIGABRT, SaveCurrentInputAndDie);
+  signal(SIGBUS, SaveCurrentInputAndDie);
+  signal(SIGFPE, SaveCurrentInputAndDie);
+
+  if (!files.empty()) {
+    // Replay the given inputs as they are, the fragmentation byte included.
+    for (const auto& name : files) {
+      std::ifstream file(name, std::ios::binary);
+      std::ostringstream contents;
+      contents << file.rdbuf();
+      Run(contents.str());
+      printf("%s: OK\n", name.c_str());
+    }
+    return 0;
+  }
+
+  std::vector<std::string> seeds;
+  for (const auto& entry : LoadHTTPCorpus("corpus")) {
+    seeds.push_back(std::string(1, '\0') + entry.second);
+  }
+  if (seeds.empty()) {
+    seeds.push_back(std::string(1, '\0'));
+  }
+  Mutator mutator(42);
+  for (size_t i = 0; i < iterations; ++i) {
+    std::string input = mutator.Mutate(seeds[mutator.Random(seeds.size())]);
+    if (!input.empty() && mutator.Random(2)) {
+      input[0] = static_cast<char>(mutator.Random(17));
+    }
+    Run(input);
+  }
+  printf("%zu inputs: OK\n", iterations);
+}
+
+#endif  // TOY_LIBFUZZER
@@ -0,0 +1,112 @@
+#ifndef TOY_HTTP_PARSER_HARNESS_H
+#define TOY_HTTP_PARSER_HARNESS_H
+
+// Runs the `HEADER_PARSER`-s of `GenericHTTPConnection` without sockets, for benchmarks and fuzzing.
+// `FakeConnection` hands out bytes from memory in pieces of configurable size, the way `read()` would
+// return them as the TCP segments arrive, and `HTTPParserHarness` drives a parser over it.
+
+#include <dirent.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "exceptions.h"
+
+// A stand-in for `GenericConnection` in `ParseHTTPHeader()`: returns at most `max_fragment` bytes per read,
+// or a pseudo-random number of bytes between 1 and `max_fragment` if `seed` is non-zero. Zero `max_fragment`
+// means no limit. Reads return zero once all the data has been consumed.
+class FakeConnection final {
+ public:
+  FakeConnection(const std::string& data, size_t max_fragment = 0, uint32_t seed = 0)
+      : data_(data), max_fragment_(max_fragment), seed_(seed) {
+    Rewind();
+  }
+
+  void Rewind() {
+    offset_ = 0;
+    state_ = seed_;
+  }
+
+  bool Exhausted() const {
+    return offset_ == data_.size();
+  }
+
+  template <typename T>
+  size_t BlockingRead(T* buffer, size_t max_length) const {
+    size_t length = std::min(max_length * sizeof(T), data_.size() - offset_);
+    if (max_fragment_) {
+      length = std::min(length, NextFragmentSize());
+    }
+    memcpy(buffer, data_.data() + offset_, length);
+    offset_ += length;
+    return length;
+  }
+
+ private:
+  size_t NextFragmentSize() const {
+    if (!state_) {
+      return max_fragment_;
+    }
+    // Xorshift32.
+    state_ ^= state_ << 13;
+    state_ ^= state_ >> 17;
+    state_ ^= state_ << 5;
+    return 1 + state_ % max_fragment_;
+  }
+
+  const std::string& data_;
+  const size_t max_fragment_;
+  const uint32_t seed_;
+  mutable size_t offset_;
+  mutable uint32_t state_;
+};
+
+// Exposes the protected `ParseHTTPHeader()` of a `HEADER_PARSER`, as `GenericHTTPConnection` does.
+template <typename HEADER_PARSER>
+class HTTPParserHarness final : public HEADER_PARSER {
+ public:
+  void Parse(const FakeConnection& c) {
+    HEADER_PARSER::ParseHTTPHeader(c);
+  }
+
+  // Parses requests until the data is over. Returns how many requests were parsed.
+  size_t ParseAll(const FakeConnection& c) {
+    size_t count = 0;
+    try {
+      while (true) {
+        Parse(c);
+        ++count;
+      }
+    } catch (const HTTPConnectionClosedException&) {
+    }
+    return count;
+  }
+};
+
+// Loads all the `*.http` files of `directory`, each holding one or more recorded requests, sorted by name.
+inline std::vector<std::pair<std::string, std::string>> LoadHTTPCorpus(const std::string& directory) {
+  std::vector<std::pair<std::string, std::string>> result;
+  DIR* dir = opendir(directory.c_str());
+  if (dir) {
+    while (const dirent* entry = readdir(dir)) {
+      const std::string name = entry->d_name;
+      if (name.size() > 5 && name.substr(name.size() - 5) == ".http") {
+        std::ifstream file(directory + '/' + name, std::ios::binary);
+        std::ostringstream contents;
+        contents << file.rdbuf();
+        result.emplace_back(name.substr(0, name.size() - 5), contents.str());
+      }
+    }
+    closedir(dir);
+  }
+  std::sort(result.begin(), result.end());
+  return result;
+}
+
+#endif  // TOY_HTTP_PARSER_HARNESS_H
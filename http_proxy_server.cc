@@ -0,0 +1,95 @@
+// A reverse proxy on port 8080, forwarding to the upstreams given as `host:port` arguments over pooled keep-alive
+// connections, with bodies streamed through in both directions.
+// Without arguments, forwards to a backend of its own on port 8081: `/bytes/N` returns N bytes, `/chunked/N`
+// returns them chunked, and requests with a body get its length and checksum back.
+
+/*
+# To test:
+curl localhost:8080/bytes/10
+curl -s localhost:8080/bytes/100000000 | wc -c  # Spliced from socket to socket.
+curl -s localhost:8080/chunked/100000000 | wc -c
+curl -I localhost:8080/bytes/10
+curl -s --data-binary @/some/large/file localhost:8080
+head -c 100000000 /dev/zero | curl -s -T - localhost:8080  # Chunked.
+./build/http_proxy_server localhost:8081 localhost:9999  # Round-robin, skipping the one that is down.
+curl -s localhost:8080/stats | grep connects  # About one upstream connection per worker, not one per request.
+*/
+
+#include <algorithm>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "http_client.h"
+#include "http_streaming_parser.h"
+#include "signal_waiter.h"
+
+const int kPort = 8080;
+const int kBackendPort = 8081;
+
+void Backend(StreamingHTTPConnection& c) {
+  const StringView url(c.URL());
+  if (c.HasBody()) {
+    // FNV-1a, computed piece by piece as the body arrives.
+    uint64_t checksum = 14695981039346656037ull;
+    const size_t length = c.ReadBody([&checksum](const char* data, size_t length) {
+      for (size_t i = 0; i < length; ++i) {
+        checksum = (checksum ^ static_cast<uint8_t>(data[i])) * 1099511628211ull;
+      }
+    });
+    std::ostringstream os;
+    os << length << " bytes, checksum " << std::hex << checksum << '\n';
+    c.SendHTTPResponse(os.str());
+  } else if (url.substr(0, 7) == "/bytes/") {
+    c.SendHTTPResponse(std::string(strtoul(url.substr(7).ToString().c_str(), nullptr, 10), '.'));
+  } else if (url.substr(0, 9) == "/chunked/") {
+    size_t remaining = strtoul(url.substr(9).ToString().c_str(), nullptr, 10);
+    const std::string piece(64 * 1024, '.');
+    HTTPChunkedResponse response = c.SendChunkedHTTPResponse();
+    while (remaining) {
+      const size_t n = std::min(remaining, piece.size());
+      response.Send(piece.data(), n);
+      remaining -= n;
+    }
+  } else {
+    c.SendHTTPResponse(std::string("BAZINGA\n"));
+  }
+}
+
+void Proxy(const std::vector<HTTPUpstream>& upstreams, SignalWaiter& signals) {
+  Socket s(kPort);
+  const HTTPReverseProxy proxy(upstreams);
+  GenericHTTPThreadPoolServer<StreamingHTTPConnection> server(s, [&proxy](StreamingHTTPConnection& c) {
+    if (!ServeHTTPMetricsIfRequested(c)) {
+      proxy(c);
+    }
+  });
+  std::thread accepting([&server]() { server.Run(); });
+  signals.Wait();
+  server.Shutdown();
+  accepting.join();
+}
+
+int main(int argc, char** argv) {
+  SignalWaiter signals({SIGTERM, SIGINT});
+  std::vector<HTTPUpstream> upstreams;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const size_t colon = arg.rfind(':');
+    upstreams.emplace_back(arg.substr(0, colon), colon == std::string::npos ? 80 : atoi(arg.c_str() + colon + 1));
+  }
+  if (!upstreams.empty()) {
+    Proxy(upstreams, signals);
+    return 0;
+  }
+  Socket backend_socket(kBackendPort);
+  GenericHTTPThreadPoolServer<StreamingHTTPConnection> backend(backend_socket, Backend);
+  std::thread backend_accepting([&backend]() { backend.Run(); });
+  Proxy({HTTPUpstream("127.0.0.1", kBackendPort)}, signals);
+  backend.Shutdown();
+  backend_accepting.join();
+}
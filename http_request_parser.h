@@ -0,0 +1,422 @@
+#ifndef TOY_HTTP_REQUEST_PARSER_H
+#define TOY_HTTP_REQUEST_PARSER_H
+
+// A resumable HTTP request parser that neither copies nor rescans the bytes it has already seen.
+// Method, URL, headers and body are kept as offsets into the receive buffer and exposed as `StringView`-s,
+// so parsing a request with up to `kHTTPInlineHeaders` headers does no heap allocations.
+
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include "exceptions.h"
+#include "http_scanner.h"
+#include "object_pool.h"
+#include "posix_http_server.h"
+#include "posix_tcp_server.h"
+#include "small_vector.h"
+#include "string_view.h"
+
+const size_t kHTTPInlineHeaders = 32;
+
+enum class HTTPRequestParserStatus : int { NeedMoreData, Complete };
+
+// The parsing state machine, decoupled from the socket: feed it the bytes of one request as they arrive.
+class HTTPRequestParser final {
+ public:
+  HTTPRequestParser() {
+    Reset();
+  }
+
+  // Requests with more than `max_header_bytes` in the request line and the headers, or with more than
+  // `max_headers` headers, make `Parse()` throw `HTTPHeadersTooLargeException`.
+  void SetLimits(size_t max_header_bytes, size_t max_headers) {
+    max_header_bytes_ = max_header_bytes;
+    max_headers_ = max_headers;
+  }
+
+  // Prepares the parser for the next request.
+  void Reset() {
+    phase_ = Phase::RequestLine;
+    data_ = nullptr;
+    line_offset_ = 0;
+    scan_offset_ = 0;
+    colon_offset_ = kNone;
+    method_ = url_ = version_ = Span();
+    headers_.Clear();
+    content_length_ = kNone;
+    body_offset_ = kNone;
+    request_length_ = kNone;
+    keep_alive_ = false;
+    chunked_ = false;
+  }
+
+  // `data` holds the first `length` bytes received for this request. Each call must pass a prefix-extension
+  // of the bytes passed in the previous call, although the buffer itself may have moved in memory.
+  // Throws `HTTPMalformedRequestException` if the request can not be parsed.
+  HTTPRequestParserStatus Parse(const char* data, size_t length) {
+    data_ = data;
+    while (phase_ != Phase::Body) {
+      // Find the end of the line and the header key-value separator in one vectorized pass.
+      size_t colon;
+      const size_t lf = scan_offset_ + HTTPScanLine(data + scan_offset_, length - scan_offset_, &colon);
+      if (colon != kHTTPScanNone && colon_offset_ == kNone) {
+        colon_offset_ = scan_offset_ + colon;
+      }
+      if (lf == length) {
+        if (length > max_header_bytes_) {
+          throw HTTPHeadersTooLargeException();
+        }
+        scan_offset_ = length;
+        return HTTPRequestParserStatus::NeedMoreData;
+      }
+      const size_t next_line_offset = lf + 1;
+      size_t line_end = lf;
+      if (line_end > line_offset_ && data[line_end - 1] == '\r') {
+        --line_end;
+      }
+      OnLine(line_offset_, line_end, next_line_offset);
+      line_offset_ = scan_offset_ = next_line_offset;
+      colon_offset_ = kNone;
+    }
+    return length < request_length_ ? HTTPRequestParserStatus::NeedMoreData : HTTPRequestParserStatus::Complete;
+  }
+
+  bool HeadersComplete() const {
+    return phase_ == Phase::Body;
+  }
+
+  StringView Method() const {
+    return View(method_);
+  }
+
+  StringView URL() const {
+    return View(url_);
+  }
+
+  StringView Version() const {
+    return View(version_);
+  }
+
+  size_t HeadersCount() const {
+    return headers_.Size();
+  }
+
+  StringView HeaderKey(size_t i) const {
+    return View(headers_[i].key);
+  }
+
+  StringView HeaderValue(size_t i) const {
+    return View(headers_[i].value);
+  }
+
+  // Calls `f(StringView key, StringView value)` for each header, in the order received.
+  template <typename F>
+  void ForEachHeader(F&& f) const {
+    for (size_t i = 0; i < headers_.Size(); ++i) {
+      f(View(headers_[i].key), View(headers_[i].value));
+    }
+  }
+
+  // Returns the value of the first header named `key`, compared case-insensitively, or an empty view.
+  StringView Header(const StringView& key) const {
+    for (size_t i = 0; i < headers_.Size(); ++i) {
+      if (EqualsIgnoreCase(View(headers_[i].key), key)) {
+        return View(headers_[i].value);
+      }
+    }
+    return StringView();
+  }
+
+  bool HasBody() const {
+    return content_length_ != kNone;
+  }
+
+  size_t BodyOffset() const {
+    return body_offset_;
+  }
+
+  size_t ContentLength() const {
+    return content_length_;
+  }
+
+  StringView Body() const {
+    return StringView(data_ + body_offset_, content_length_);
+  }
+
+  // The total number of bytes in this request, headers and body; the next pipelined request starts right after.
+  // Only valid once the headers are complete.
+  size_t RequestLength() const {
+    return request_length_;
+  }
+
+  bool KeepAlive() const {
+    return keep_alive_;
+  }
+
+  bool IsHTTP11() const {
+    return View(version_) == "HTTP/1.1";
+  }
+
+  // Whether the body follows in `Transfer-Encoding: chunked`.
+  bool IsChunked() const {
+    return chunked_;
+  }
+
+ private:
+  static const size_t kNone = static_cast<size_t>(-1);
+
+  enum class Phase : int { RequestLine, Headers, Body };
+
+  struct Span {
+    size_t offset = 0;
+    size_t length = 0;
+    Span() = default;
+    Span(size_t begin, size_t end) : offset(begin), length(end - begin) {
+    }
+  };
+
+  struct HeaderSpans {
+    Span key;
+    Span value;
+  };
+
+  StringView View(const Span& span) const {
+    return StringView(data_ + span.offset, span.length);
+  }
+
+  size_t Find(char c, size_t begin, size_t end) const {
+    const void* p = memchr(data_ + begin, c, end - begin);
+    return p ? static_cast<const char*>(p) - data_ : end;
+  }
+
+  void OnLine(size_t begin, size_t end, size_t next_line_offset) {
+    if (phase_ == Phase::RequestLine) {
+      // It's recommended by W3 to wait for the first line ignoring prior CRLF-s.
+      if (begin != end) {
+        const size_t method_end = Find(' ', begin, end);
+        if (method_end == end || method_end == begin) {
+          throw HTTPMalformedRequestException();
+        }
+        const size_t url_end = Find(' ', method_end + 1, end);
+        method_ = Span(begin, method_end);
+        url_ = Span(method_end + 1, url_end);
+        version_ = url_end < end ? Span(url_end + 1, end) : Span(end, end);
+        keep_alive_ = (View(version_) == "HTTP/1.1");
+        phase_ = Phase::Headers;
+      }
+    } else if (begin != end) {
+      const size_t colon = colon_offset_;
+      if (colon == kNone) {
+        // Ignore malformed header lines, as the original parser does.
+        return;
+      }
+      size_t value_begin = colon + 1;
+      while (value_begin < end && (data_[value_begin] == ' ' || data_[value_begin] == '\t')) {
+        ++value_begin;
+      }
+      size_t value_end = end;
+      while (value_end > value_begin && (data_[value_end - 1] == ' ' || data_[value_end - 1] == '\t')) {
+        --value_end;
+      }
+      if (headers_.Size() == max_headers_) {
+        throw HTTPHeadersTooLargeException();
+      }
+      HeaderSpans header;
+      header.key = Span(begin, colon);
+      header.value = Span(value_begin, value_end);
+      headers_.PushBack(header);
+      OnKnownHeader(View(header.key), View(header.value));
+    } else {
+      // HTTP body starts right after this empty line.
+      // A chunked body has no length known upfront: the request is considered to end with its headers,
+      // and the body is left for `HTTPChunkedBodyDecoder`. Per RFC 7230, chunking overrides `Content-Length`.
+      if (next_line_offset > max_header_bytes_) {
+        throw HTTPHeadersTooLargeException();
+      }
+      body_offset_ = next_line_offset;
+      if (chunked_) {
+        content_length_ = kNone;
+      }
+      request_length_ = body_offset_ + (content_length_ != kNone ? content_length_ : 0);
+      phase_ = Phase::Body;
+    }
+  }
+
+  template <size_t N>
+  static bool IsHeader(const StringView& key, const char (&lowercase_name)[N]) {
+    return HTTPHeaderNameEquals(key.data(), key.size(), lowercase_name, N - 1);
+  }
+
+  void OnKnownHeader(const StringView& key, const StringView& value) {
+    if (IsHeader(key, "content-length")) {
+      content_length_ = ParseHTTPContentLength(value.data(), value.size());
+    } else if (IsHeader(key, "transfer-encoding")) {
+      // The final encoding is what matters, as in "Transfer-Encoding: gzip, chunked".
+      chunked_ = value.size() >= 7 && EqualsIgnoreCase(value.substr(value.size() - 7), "chunked");
+    } else if (IsHeader(key, "connection")) {
+      if (EqualsIgnoreCase(value, "close")) {
+        keep_alive_ = false;
+      } else if (EqualsIgnoreCase(value, "keep-alive")) {
+        keep_alive_ = true;
+      }
+    }
+  }
+
+  Phase phase_;
+  const char* data_;
+  size_t line_offset_;   // Where the line being scanned begins.
+  size_t scan_offset_;   // Where to resume looking for the end of that line; bytes before it are never rescanned.
+  size_t colon_offset_;  // The first ':' of that line, if seen already.
+  Span method_;
+  Span url_;
+  Span version_;
+  SmallVector<HeaderSpans, kHTTPInlineHeaders> headers_;
+  size_t content_length_;
+  size_t body_offset_;
+  size_t request_length_;
+  bool keep_alive_;
+  bool chunked_;
+  size_t max_header_bytes_ = kDefaultHTTPMaxHeaderBytes;
+  size_t max_headers_ = kDefaultHTTPMaxHeaders;
+};
+
+// Drop-in replacement for `HTTPHeaderParser` as the `HEADER_PARSER` of `GenericHTTPConnection`.
+// The receive buffer is allocated once per connection and reused for all the requests on it.
+class ZeroCopyHTTPHeaderParser {
+ public:
+  explicit ZeroCopyHTTPHeaderParser(size_t initial_buffer_size = 1600) : buffer_(*pooled_buffer_) {
+    if (buffer_.size() < initial_buffer_size) {
+      buffer_.resize(initial_buffer_size);
+    }
+  }
+
+  ~ZeroCopyHTTPHeaderParser() {
+    if (buffer_.size() > kMaxPooledHTTPBufferSize) {
+      std::vector<char>().swap(buffer_);
+    }
+  }
+
+  StringView Method() const {
+    return parser_.Method();
+  }
+
+  StringView URL() const {
+    return parser_.URL();
+  }
+
+  size_t HeadersCount() const {
+    return parser_.HeadersCount();
+  }
+
+  StringView HeaderKey(size_t i) const {
+    return parser_.HeaderKey(i);
+  }
+
+  StringView HeaderValue(size_t i) const {
+    return parser_.HeaderValue(i);
+  }
+
+  template <typename F>
+  void ForEachHeader(F&& f) const {
+    parser_.ForEachHeader(std::forward<F>(f));
+  }
+
+  StringView Header(const StringView& key) const {
+    return parser_.Header(key);
+  }
+
+  bool HasBody() const {
+    return parser_.HasBody();
+  }
+
+  StringView Body() const {
+    if (HasBody()) {
+      return parser_.Body();
+    } else {
+      throw HTTPNoBodyProvidedException();
+    }
+  }
+
+  const char* BodyAsNonCopiedBuffer() const {
+    return Body().data();
+  }
+
+  size_t BodyLength() const {
+    return Body().size();
+  }
+
+  bool KeepAlive() const {
+    return parser_.KeepAlive();
+  }
+
+  bool IsHTTP11() const {
+    return parser_.IsHTTP11();
+  }
+
+ protected:
+  void SetHTTPLimits(const HTTPServerLimits& limits) {
+    parser_.SetLimits(limits.max_header_bytes, limits.max_headers);
+    max_body_bytes_ = limits.max_body_bytes;
+  }
+
+  bool HTTPHeadersComplete() const {
+    return parser_.HeadersComplete();
+  }
+
+  bool HTTPBodyPending() const {
+    return false;
+  }
+
+  // `CONNECTION` only needs `BlockingRead()`, as with `HTTPHeaderParser`.
+  template <typename CONNECTION>
+  void ParseHTTPHeader(const CONNECTION& c) {
+    // Whatever follows the previous request in `buffer_` is the beginning of the next, pipelined, one.
+    begin_ += request_length_;
+    request_length_ = 0;
+    if (begin_ == end_) {
+      begin_ = end_ = 0;
+    }
+    parser_.Reset();
+    while (parser_.Parse(&buffer_[begin_], end_ - begin_) == HTTPRequestParserStatus::NeedMoreData) {
+      if (parser_.HeadersComplete() && parser_.ContentLength() > max_body_bytes_) {
+        begin_ = end_ = 0;
+        throw HTTPBodyTooLargeException();
+      }
+      if (end_ == buffer_.size()) {
+        if (begin_) {
+          // The parser only keeps offsets relative to the beginning of the request, so the bytes can be moved.
+          memmove(&buffer_[0], &buffer_[begin_], end_ - begin_);
+          end_ -= begin_;
+          begin_ = 0;
+        } else {
+          buffer_.resize(buffer_.size() * 2);
+        }
+      }
+      const size_t read_count = c.BlockingRead(&buffer_[end_], buffer_.size() - end_);
+      if (!read_count) {
+        begin_ = end_ = 0;
+        throw HTTPConnectionClosedException();
+      }
+      end_ += read_count;
+    }
+    request_length_ = parser_.RequestLength();
+    if (parser_.IsChunked()) {
+      // Chunked bodies are only supported by `StreamingHTTPHeaderParser`, which does not buffer them whole.
+      throw HTTPUnsupportedTransferEncodingException();
+    }
+  }
+
+ private:
+  PooledObject<std::vector<char>> pooled_buffer_;  // Recycled between connections.
+  std::vector<char>& buffer_;
+  size_t begin_ = 0;           // Where the current request starts in `buffer_`.
+  size_t end_ = 0;             // How many bytes of `buffer_` hold received data.
+  size_t request_length_ = 0;  // The length of the current request, once parsed.
+  size_t max_body_bytes_ = kDefaultHTTPMaxBodyBytes;
+  HTTPRequestParser parser_;
+};
+
+typedef GenericHTTPConnection<ZeroCopyHTTPHeaderParser> ZeroCopyHTTPConnection;
+
+#endif  // TOY_HTTP_REQUEST_PARSER_H
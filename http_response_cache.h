@@ -0,0 +1,308 @@
+#ifndef TOY_HTTP_RESPONSE_CACHE_H
+#define TOY_HTTP_RESPONSE_CACHE_H
+
+// An in-memory cache of `GET` responses, in front of handlers whose output only depends on the URL
+// and, optionally, on a few request headers.
+//
+// Responses are stored fully formatted, status line, headers and body, so a hit is a lookup and a single
+// gathered write, with no handler call and no formatting. Each stored response gets an `ETag`, the hash
+// of its body unless the handler has set one, and a request with a matching `If-None-Match` is answered
+// with `304 Not Modified` and no body. Entries expire after a fixed time to live, and the least recently used
+// ones are evicted to keep the total size within the capacity. The entries are spread across shards,
+// each with its own lock, for multi-threaded servers.
+//
+// Only `200 OK` responses sent with `SendHTTPResponse()` are stored; chunked and file responses pass through.
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "http_response_codes.h"
+#include "metrics.h"
+#include "posix_http_server.h"
+#include "string_view.h"
+
+const std::chrono::milliseconds kDefaultHTTPResponseCacheTTL = std::chrono::milliseconds(1000);
+const size_t kDefaultHTTPResponseCacheCapacity = 64 * 1024 * 1024;
+const size_t kDefaultHTTPResponseCacheShards = 16;
+
+// The quoted hex FNV-1a hash of `body`, as a strong entity tag.
+inline std::string HTTPBodyETag(const std::string& body) {
+  uint64_t hash = 14695981039346656037ull;
+  for (const char c : body) {
+    hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+  }
+  char result[19];
+  result[0] = result[17] = '"';
+  for (int i = 16; i >= 1; --i, hash >>= 4) {
+    result[i] = "0123456789abcdef"[hash & 15];
+  }
+  return std::string(result, 18);
+}
+
+// Whether the `If-None-Match` header value `condition` matches `etag`: either '*', or a comma-separated list
+// of entity tags, one of which is `etag` when compared weakly, ignoring a "W/" prefix.
+inline bool HTTPETagMatches(const StringView& condition, const StringView& etag) {
+  size_t i = 0;
+  while (i < condition.size()) {
+    while (i < condition.size() && (condition[i] == ' ' || condition[i] == '\t' || condition[i] == ',')) {
+      ++i;
+    }
+    size_t end = i;
+    while (end < condition.size() && condition[end] != ',') {
+      ++end;
+    }
+    size_t last = end;
+    while (last > i && (condition[last - 1] == ' ' || condition[last - 1] == '\t')) {
+      --last;
+    }
+    StringView candidate = condition.substr(i, last - i);
+    if (candidate == "*") {
+      return true;
+    }
+    if (candidate.size() > 2 && candidate[0] == 'W' && candidate[1] == '/') {
+      candidate = candidate.substr(2);
+    }
+    if (!candidate.empty() && candidate == etag) {
+      return true;
+    }
+    i = end;
+  }
+  return false;
+}
+
+// A formatted response. `bytes` is the status line and the headers, except for `Connection`, followed by
+// the empty line and the body, which begin at `head_size`.
+struct HTTPCachedResponse {
+  std::string bytes;
+  size_t head_size;
+  std::string etag;
+  std::chrono::steady_clock::time_point expires;
+};
+
+template <typename CONNECTION = HTTPConnection>
+class GenericHTTPResponseCache final {
+ public:
+  typedef std::function<void(CONNECTION&)> T_HANDLER;
+
+  // `vary_headers` are the request headers the responses depend on, which become part of the cache key.
+  explicit GenericHTTPResponseCache(std::chrono::milliseconds ttl = kDefaultHTTPResponseCacheTTL,
+                                    size_t capacity = kDefaultHTTPResponseCacheCapacity,
+                                    const std::vector<std::string>& vary_headers = std::vector<std::string>(),
+                                    size_t shards = kDefaultHTTPResponseCacheShards)
+      : ttl_(ttl), vary_headers_(vary_headers) {
+    if (!shards) {
+      shards = 1;
+    }
+    for (size_t i = 0; i < shards; ++i) {
+      shards_.emplace_back(new Shard());
+    }
+    shard_capacity_ = capacity / shards;
+    for (size_t i = 0; i < vary_headers_.size(); ++i) {
+      vary_header_value_ += (i ? ", " : "") + vary_headers_[i];
+    }
+  }
+
+  // Responds to the request in `c` from the cache if possible, and calls `handler` otherwise, storing
+  // its response for the next requests. Requests other than `GET`, and requests with a body, always go
+  // to `handler`.
+  void Serve(CONNECTION& c, const T_HANDLER& handler) {
+    if (c.Method() != "GET" || c.HasBody()) {
+      handler(c);
+      return;
+    }
+    std::string& key = ThreadKeyBuffer();
+    BuildKey(c, key);
+    Shard& shard = *shards_[std::hash<std::string>()(key) % shards_.size()];
+    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    std::shared_ptr<const HTTPCachedResponse> cached = shard.Find(key, now);
+    if (cached) {
+      MetricsAdd(MetricsCounter::HTTPCacheHits);
+      Send(c, *cached);
+      return;
+    }
+    MetricsAdd(MetricsCounter::HTTPCacheMisses);
+    // `key` is per-thread, and the handler may use the cache too: keep a copy.
+    const std::string miss_key = key;
+    HTTPResponseCapture capture;
+    c.CaptureNextHTTPResponse(&capture);
+    try {
+      handler(c);
+    } catch (...) {
+      c.CaptureNextHTTPResponse(nullptr);
+      throw;
+    }
+    c.CaptureNextHTTPResponse(nullptr);
+    if (!capture.captured) {
+      // Responded with a chunked or a file response, or not at all.
+      return;
+    }
+    if (capture.code != HTTPResponseCode::OK) {
+      c.SendHTTPResponse(capture.body, capture.code, capture.content_type, capture.extra_headers);
+      return;
+    }
+    // The first response is formatted the same way as the cached ones, `ETag` included.
+    cached = Format(capture, now + ttl_);
+    Send(c, *cached);
+    shard.Insert(miss_key, std::move(cached), shard_capacity_);
+  }
+
+  // Drops all the entries, for when the underlying data has changed.
+  void Clear() {
+    for (auto& shard : shards_) {
+      shard->Clear();
+    }
+  }
+
+ private:
+  typedef std::pair<std::string, std::shared_ptr<const HTTPCachedResponse>> Entry;
+
+  // The entries of one shard, most recently used first.
+  struct Shard {
+    std::shared_ptr<const HTTPCachedResponse> Find(const std::string& key,
+                                                   std::chrono::steady_clock::time_point now) {
+      std::lock_guard<std::mutex> lock(mutex);
+      const auto it = index.find(key);
+      if (it == index.end()) {
+        return nullptr;
+      }
+      if (it->second->second->expires <= now) {
+        Erase(it->second);
+        return nullptr;
+      }
+      lru.splice(lru.begin(), lru, it->second);
+      return it->second->second;
+    }
+
+    void Insert(const std::string& key, std::shared_ptr<const HTTPCachedResponse> response, size_t capacity) {
+      const size_t size = EntrySize(key, *response);
+      if (size > capacity) {
+        return;
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      const auto it = index.find(key);
+      if (it != index.end()) {
+        Erase(it->second);
+      }
+      while (bytes + size > capacity) {
+        Erase(std::prev(lru.end()));
+      }
+      lru.emplace_front(key, std::move(response));
+      index.emplace(key, lru.begin());
+      bytes += size;
+    }
+
+    void Clear() {
+      std::lock_guard<std::mutex> lock(mutex);
+      index.clear();
+      lru.clear();
+      bytes = 0;
+    }
+
+    void Erase(typename std::list<Entry>::iterator entry) {
+      bytes -= EntrySize(entry->first, *entry->second);
+      index.erase(entry->first);
+      lru.erase(entry);
+    }
+
+    static size_t EntrySize(const std::string& key, const HTTPCachedResponse& response) {
+      return key.size() * 2 + response.bytes.size() + response.etag.size() + sizeof(HTTPCachedResponse);
+    }
+
+    std::mutex mutex;
+    std::list<Entry> lru;
+    std::unordered_map<std::string, typename std::list<Entry>::iterator> index;
+    size_t bytes = 0;
+    char padding[kCacheLineSize];  // Keeps the locks of neighbouring shards off the same cache line.
+  };
+
+  void BuildKey(const CONNECTION& c, std::string& key) const {
+    key.assign(c.URL().data(), c.URL().size());
+    for (const auto& name : vary_headers_) {
+      const StringView value = c.Header(name);
+      key += '\n';
+      key.append(value.data(), value.size());
+    }
+  }
+
+  std::shared_ptr<const HTTPCachedResponse> Format(const HTTPResponseCapture& capture,
+                                                   std::chrono::steady_clock::time_point expires) const {
+    std::shared_ptr<HTTPCachedResponse> response = std::make_shared<HTTPCachedResponse>();
+    std::string& bytes = response->bytes;
+    bytes.reserve(256 + capture.body.size());
+    const HTTPBytes status_line = HTTPStatusLine(HTTPResponseCode::OK);
+    bytes.append(status_line.data, status_line.size);
+    bytes += "Content-Type: " + capture.content_type + "\r\n";
+    for (const auto& header : capture.extra_headers) {
+      if (EqualsIgnoreCase(header.first, "ETag")) {
+        response->etag = header.second;
+      }
+      bytes += header.first + ": " + header.second + "\r\n";
+    }
+    if (response->etag.empty()) {
+      response->etag = HTTPBodyETag(capture.body);
+      bytes += "ETag: " + response->etag + "\r\n";
+    }
+    if (!vary_header_value_.empty()) {
+      bytes += "Vary: " + vary_header_value_ + "\r\n";
+    }
+    bytes += "Content-Length: " + std::to_string(capture.body.size()) + "\r\n";
+    response->head_size = bytes.size();
+    bytes += "\r\n";
+    bytes += capture.body;
+    response->expires = expires;
+    return response;
+  }
+
+  void Send(CONNECTION& c, const HTTPCachedResponse& cached) const {
+    const StringView condition = c.Header("If-None-Match");
+    if (!condition.empty() && HTTPETagMatches(condition, cached.etag)) {
+      MetricsAdd(MetricsCounter::HTTPCacheNotModified);
+      SendNotModified(c, cached);
+    } else {
+      c.SendPreformattedHTTPResponse(HTTPResponseCode::OK,
+                                     cached.bytes.data(),
+                                     cached.head_size,
+                                     cached.bytes.data() + cached.head_size,
+                                     cached.bytes.size() - cached.head_size);
+    }
+  }
+
+  void SendNotModified(CONNECTION& c, const HTTPCachedResponse& cached) const {
+    HTTPResponseHeaderBuilder head;
+    head.Append(HTTPStatusLine(HTTPResponseCode::NotModified));
+    head.Append("ETag: ");
+    head.Append(cached.etag);
+    head.Append("\r\n");
+    if (!vary_header_value_.empty()) {
+      head.Append("Vary: ");
+      head.Append(vary_header_value_);
+      head.Append("\r\n");
+    }
+    c.SendPreformattedHTTPResponse(HTTPResponseCode::NotModified, head.Data(), head.Size(), "\r\n", 2);
+  }
+
+  static std::string& ThreadKeyBuffer() {
+    static thread_local std::string buffer;
+    return buffer;
+  }
+
+  const std::chrono::milliseconds ttl_;
+  const std::vector<std::string> vary_headers_;
+  std::string vary_header_value_;
+  std::vector<std::unique_ptr<Shard>> shards_;
+  size_t shard_capacity_;
+
+  GenericHTTPResponseCache(const GenericHTTPResponseCache&) = delete;
+  void operator=(const GenericHTTPResponseCache&) = delete;
+};
+
+typedef GenericHTTPResponseCache<HTTPConnection> HTTPResponseCache;
+
+#endif  // TOY_HTTP_RESPONSE_CACHE_H
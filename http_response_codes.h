@@ -3,103 +3,122 @@
 
 // HTTP codes: http://www.w3.org/Protocols/rfc2616/rfc2616-sec6.html
 
-#include <map>
+#include <cstddef>
 #include <string>
 
+// The single list of supported codes: `X(enum name, numeric code, reason phrase)`.
+#define TOY_HTTP_RESPONSE_CODES(X)                                        \
+  X(Continue, 100, "Continue")                                            \
+  X(SwitchingProtocols, 101, "Switching Protocols")                       \
+  X(OK, 200, "OK")                                                        \
+  X(Created, 201, "Created")                                              \
+  X(Accepted, 202, "Accepted")                                            \
+  X(NonAuthoritativeInformation, 203, "Non-Authoritative Information")    \
+  X(NoContent, 204, "No Content")                                         \
+  X(ResetContent, 205, "Reset Content")                                   \
+  X(PartialContent, 206, "Partial Content")                               \
+  X(MultipleChoices, 300, "Multiple Choices")                             \
+  X(MovedPermanently, 301, "Moved Permanently")                           \
+  X(Found, 302, "Found")                                                  \
+  X(SeeOther, 303, "See Other")                                           \
+  X(NotModified, 304, "Not Modified")                                     \
+  X(UseProxy, 305, "Use Proxy")                                           \
+  X(TemporaryRedirect, 307, "Temporary Redirect")                         \
+  X(BadRequest, 400, "Bad Request")                                       \
+  X(Unauthorized, 401, "Unauthorized")                                    \
+  X(PaymentRequired, 402, "Payment Required")                             \
+  X(Forbidden, 403, "Forbidden")                                          \
+  X(NotFound, 404, "Not Found")                                           \
+  X(MethodNotAllowed, 405, "Method Not Allowed")                          \
+  X(NotAcceptable, 406, "Not Acceptable")                                 \
+  X(ProxyAuthenticationRequired, 407, "Proxy Authentication Required")    \
+  X(RequestTimeout, 408, "Request Time-out")                              \
+  X(Conflict, 409, "Conflict")                                            \
+  X(Gone, 410, "Gone")                                                    \
+  X(LengthRequired, 411, "Length Required")                               \
+  X(PreconditionFailed, 412, "Precondition Failed")                       \
+  X(RequestEntityTooLarge, 413, "Request Entity Too Large")               \
+  X(RequestURITooLarge, 414, "Request-URI Too Large")                     \
+  X(UnsupportedMediaType, 415, "Unsupported Media Type")                  \
+  X(RequestedRangeNotSatisfiable, 416, "Requested range not satisfiable") \
+  X(ExpectationFailed, 417, "Expectation Failed")                         \
+  X(InternalServerError, 500, "Internal Server Error")                    \
+  X(NotImplemented, 501, "Not Implemented")                               \
+  X(BadGateway, 502, "Bad Gateway")                                       \
+  X(ServiceUnavailable, 503, "Service Unavailable")                       \
+  X(GatewayTimeout, 504, "Gateway Time-out")                              \
+  X(HTTPVersionNotSupported, 505, "HTTP Version not supported")
+
 enum class HTTPResponseCode : int {
-  Continue = 100,
-  SwitchingProtocols = 101,
-  OK = 200,
-  Created = 201,
-  Accepted = 202,
-  NonAuthoritativeInformation = 203,
-  NoContent = 204,
-  ResetContent = 205,
-  PartialContent = 206,
-  MultipleChoices = 300,
-  MovedPermanently = 301,
-  Found = 302,
-  SeeOther = 303,
-  NotModified = 304,
-  UseProxy = 305,
-  TemporaryRedirect = 307,
-  BadRequest = 400,
-  Unauthorized = 401,
-  PaymentRequired = 402,
-  Forbidden = 403,
-  NotFound = 404,
-  MethodNotAllowed = 405,
-  NotAcceptable = 406,
-  ProxyAuthenticationRequired = 407,
-  RequestTimeout = 408,
-  Conflict = 409,
-  Gone = 410,
-  LengthRequired = 411,
-  PreconditionFailed = 412,
-  RequestEntityTooLarge = 413,
-  RequestURITooLarge = 414,
-  UnsupportedMediaType = 415,
-  RequestedRangeNotSatisfiable = 416,
-  ExpectationFailed = 417,
-  InternalServerError = 500,
-  NotImplemented = 501,
-  BadGateway = 502,
-  ServiceUnavailable = 503,
-  GatewayTimeout = 504,
-  HTTPVersionNotSupported = 505,
+#define TOY_HTTP_RESPONSE_CODE_ENUM(name, code, text) name = code,
+  TOY_HTTP_RESPONSE_CODES(TOY_HTTP_RESPONSE_CODE_ENUM)
+#undef TOY_HTTP_RESPONSE_CODE_ENUM
+};
+
+// A span of ready-made bytes to be sent as is.
+struct HTTPBytes {
+  const char* data;
+  size_t size;
 };
 
+#define TOY_HTTP_BYTES(literal) (HTTPBytes{literal, sizeof(literal) - 1})
+
+// Pre-baked header fragments for the response writer.
+const HTTPBytes kHTTPContentLengthHeaderPrefix = TOY_HTTP_BYTES("Content-Length: ");
+const HTTPBytes kHTTPContentTypeHeaderPrefix = TOY_HTTP_BYTES("Content-Type: ");
+const HTTPBytes kHTTPContentTypeTextPlainHeader = TOY_HTTP_BYTES("Content-Type: text/plain\r\n");
+const HTTPBytes kHTTPContentTypeApplicationJSONHeader = TOY_HTTP_BYTES("Content-Type: application/json\r\n");
+const HTTPBytes kHTTPContentTypeTextHTMLHeader = TOY_HTTP_BYTES("Content-Type: text/html\r\n");
+const HTTPBytes kHTTPTransferEncodingChunkedHeader = TOY_HTTP_BYTES("Transfer-Encoding: chunked\r\n");
+const HTTPBytes kHTTPConnectionKeepAliveHeader = TOY_HTTP_BYTES("Connection: keep-alive\r\n");
+const HTTPBytes kHTTPConnectionCloseHeader = TOY_HTTP_BYTES("Connection: close\r\n");
+
+// Returns the complete status line for `code`, such as "HTTP/1.1 200 OK\r\n", or an empty span for unknown codes.
+// The lines are string literals, looked up in a dense table indexed by the class and the number of the code,
+// which is constant-initialized at compile time.
+inline HTTPBytes HTTPStatusLine(HTTPResponseCode code) {
+  struct Table {
+    static constexpr HTTPBytes At(int c) {
+#define TOY_HTTP_STATUS_LINE_CASE(name, code, text) \
+  (c == code) ? TOY_HTTP_BYTES("HTTP/1.1 " #code " " text "\r\n") :
+      return TOY_HTTP_RESPONSE_CODES(TOY_HTTP_STATUS_LINE_CASE) HTTPBytes{nullptr, 0};
+#undef TOY_HTTP_STATUS_LINE_CASE
+    }
+  };
+  // The largest code number within a class is 417.
+  static const int kCodesPerClass = 18;
+#define TOY_HTTP_STATUS_LINE_ROW(base)                                                                               \
+  Table::At(base + 0), Table::At(base + 1), Table::At(base + 2), Table::At(base + 3), Table::At(base + 4),           \
+      Table::At(base + 5), Table::At(base + 6), Table::At(base + 7), Table::At(base + 8), Table::At(base + 9),       \
+      Table::At(base + 10), Table::At(base + 11), Table::At(base + 12), Table::At(base + 13), Table::At(base + 14), \
+      Table::At(base + 15), Table::At(base + 16), Table::At(base + 17)
+  static constexpr HTTPBytes kTable[] = {TOY_HTTP_STATUS_LINE_ROW(100),
+                                         TOY_HTTP_STATUS_LINE_ROW(200),
+                                         TOY_HTTP_STATUS_LINE_ROW(300),
+                                         TOY_HTTP_STATUS_LINE_ROW(400),
+                                         TOY_HTTP_STATUS_LINE_ROW(500)};
+#undef TOY_HTTP_STATUS_LINE_ROW
+  const int c = static_cast<int>(code);
+  const int code_class = c / 100;
+  const int index = c % 100;
+  if (code_class >= 1 && code_class <= 5 && index < kCodesPerClass) {
+    return kTable[(code_class - 1) * kCodesPerClass + index];
+  } else {
+    return HTTPBytes{nullptr, 0};
+  }
+}
+
 class HTTPResponseCodeAsStringGenerator {
  public:
   static std::string CodeAsString(HTTPResponseCode code) {
-    static const std::map<int, std::string> codes = {
-        {100, "Continue"},
-        {101, "Switching Protocols"},
-        {200, "OK"},
-        {201, "Created"},
-        {202, "Accepted"},
-        {203, "Non-Authoritative Information"},
-        {204, "No Content"},
-        {205, "Reset Content"},
-        {206, "Partial Content"},
-        {300, "Multiple Choices"},
-        {301, "Moved Permanently"},
-        {302, "Found"},
-        {303, "See Other"},
-        {304, "Not Modified"},
-        {305, "Use Proxy"},
-        {307, "Temporary Redirect"},
-        {400, "Bad Request"},
-        {401, "Unauthorized"},
-        {402, "Payment Required"},
-        {403, "Forbidden"},
-        {404, "Not Found"},
-        {405, "Method Not Allowed"},
-        {406, "Not Acceptable"},
-        {407, "Proxy Authentication Required"},
-        {408, "Request Time-out"},
-        {409, "Conflict"},
-        {410, "Gone"},
-        {411, "Length Required"},
-        {412, "Precondition Failed"},
-        {413, "Request Entity Too Large"},
-        {414, "Request-URI Too Large"},
-        {415, "Unsupported Media Type"},
-        {416, "Requested range not satisfiable"},
-        {417, "Expectation Failed"},
-        {500, "Internal Server Error"},
-        {501, "Not Implemented"},
-        {502, "Bad Gateway"},
-        {503, "Service Unavailable"},
-        {504, "Gateway Time-out"},
-        {505, "HTTP Version not supported"},
-    };
-    const auto cit = codes.find(static_cast<int>(code));
-    if (cit != codes.end()) {
-      return cit->second;
-    } else {
-      return "Unknown Code";
+    switch (code) {
+#define TOY_HTTP_RESPONSE_CODE_TEXT(name, code, text) \
+  case HTTPResponseCode::name:                        \
+    return text;
+      TOY_HTTP_RESPONSE_CODES(TOY_HTTP_RESPONSE_CODE_TEXT)
+#undef TOY_HTTP_RESPONSE_CODE_TEXT
     }
+    return "Unknown Code";
   }
 };
 
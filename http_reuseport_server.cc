@@ -0,0 +1,65 @@
+// An HTTP server with one `SO_REUSEPORT` listening socket per core, each served by its own pinned thread.
+// Uses the zero-copy request parser.
+//
+// Restarts with no connection refused or dropped: a new instance takes the listening sockets over from the running
+// one, which then stops accepting, finishes the requests in flight, and exits. `SIGTERM` or `SIGINT` makes
+// the server drain and exit too.
+
+/*
+# To test:
+curl localhost:8080
+curl -d DATA localhost:8080
+curl localhost:8080/stats  # Metrics, in the Prometheus text format.
+# To restart under load, start a second instance while the first one runs:
+./build/http_load_generator --duration=10 & sleep 2 ; ./build/http_reuseport_server &
+*/
+
+#include <csignal>
+#include <sstream>
+#include <thread>
+
+#include "http_request_parser.h"
+#include "signal_waiter.h"
+#include "socket_handoff.h"
+
+const int kPort = 8080;
+const char* const kHandoffPath = "/tmp/toy_http_reuseport_server.sock";
+
+typedef GenericHTTPReusePortServer<ZeroCopyHTTPConnection> Server;
+
+int main() {
+  // Before any thread is started, for all of them to leave the signals to `signals.Wait()`.
+  SignalWaiter signals({SIGTERM, SIGINT});
+
+  const Server::T_HANDLER handler = [](ZeroCopyHTTPConnection& c) {
+    if (ServeHTTPMetricsIfRequested(c)) {
+      return;
+    }
+    std::ostringstream os;
+    os << "BAZINGA\n" << c.Method() << "(" << c.URL() << ")\n";
+    if (c.HasBody()) {
+      os << c.Body() << '\n';
+    }
+    c.SendHTTPResponse(os.str(), HTTPResponseCode::OK);
+  };
+
+  const std::vector<int> inherited = TakeOverListeningSockets(kHandoffPath);
+  std::unique_ptr<Server> server(inherited.empty()
+                                     ? new Server(kPort, handler, std::thread::hardware_concurrency(), true)
+                                     : new Server(inherited, handler, true));
+
+  ListeningSocketHandoff handoff(kHandoffPath, server->ListeningDescriptors());
+  std::thread handing_off([&handoff]() {
+    if (handoff.Wait()) {
+      // The next instance accepts on the sockets now: drain and exit, as on `SIGTERM`.
+      kill(getpid(), SIGTERM);
+    }
+  });
+  std::thread serving([&server]() { server->Run(); });
+
+  signals.Wait();
+  handoff.Cancel();
+  handing_off.join();
+  server->Shutdown();
+  serving.join();
+}
@@ -0,0 +1,382 @@
+#ifndef TOY_HTTP_ROUTER_H
+#define TOY_HTTP_ROUTER_H
+
+// Dispatching requests to handlers by method and path.
+//
+// `HTTPRouter` is built at startup from route patterns:
+//   "/health"            exact path,
+//   "/users/{id}/posts"  `{name}` matches one whole non-empty path segment, returned as a parameter,
+//   "/static/*"          trailing `*` matches any remainder of the path, including an empty one.
+// The patterns are merged into a character trie, so matching costs O(path length) regardless of the number
+// of routes, and allocates nothing: parameters are views into the URL. Where several routes match,
+// the one sharing the longest literal prefix with the path wins, then `{name}` over `*`.
+//
+// `TOY_HTTP_STATIC_DISPATCH` is the compile-time variant, for exact routes listed in an X-macro: it compiles
+// into a `switch` on a hash of method and path computed by `constexpr` functions, so hash collisions between
+// the routes are caught by the compiler as duplicate `case` labels.
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "exceptions.h"
+#include "http_response_codes.h"
+#include "http_url.h"
+#include "posix_http_server.h"
+#include "small_vector.h"
+#include "string_view.h"
+
+#define TOY_HTTP_METHODS(X) X(GET) X(HEAD) X(POST) X(PUT) X(DELETE) X(PATCH) X(OPTIONS)
+
+enum class HTTPMethod : int {
+#define TOY_HTTP_METHOD_ENUM(name) name,
+  TOY_HTTP_METHODS(TOY_HTTP_METHOD_ENUM)
+#undef TOY_HTTP_METHOD_ENUM
+      Count
+};
+
+const size_t kHTTPMethods = static_cast<size_t>(HTTPMethod::Count);
+const size_t kHTTPRouteInlineParams = 8;
+
+// Returns the index of `method` in `HTTPMethod`, or `kHTTPMethods` if it is not one of them.
+inline size_t HTTPMethodIndex(const StringView& method) {
+#define TOY_HTTP_METHOD_INDEX(name)                \
+  if (method == #name) {                           \
+    return static_cast<size_t>(HTTPMethod::name); \
+  }
+  TOY_HTTP_METHODS(TOY_HTTP_METHOD_INDEX)
+#undef TOY_HTTP_METHOD_INDEX
+  return kHTTPMethods;
+}
+
+// The path part of a URL, without the query string and the fragment.
+inline StringView HTTPRoutePath(const StringView& url) {
+  return HTTPURL(url).Path();
+}
+
+enum class HTTPRouteStatus : int { Found, NotFound, MethodNotAllowed };
+
+// The `{name}` segments of the matched route, and what its trailing `*` has matched.
+// The values point into the URL, and are valid as long as it is.
+class HTTPRouteParams final {
+ public:
+  size_t Size() const {
+    return values_.Size();
+  }
+
+  StringView Name(size_t i) const {
+    return (*names_)[i];
+  }
+
+  StringView operator[](size_t i) const {
+    return values_[i];
+  }
+
+  // Returns the value of the parameter `name`, or an empty view if the route has no such parameter.
+  StringView Get(const StringView& name) const {
+    for (size_t i = 0; i < values_.Size(); ++i) {
+      if (StringView((*names_)[i]) == name) {
+        return values_[i];
+      }
+    }
+    return StringView();
+  }
+
+  StringView Rest() const {
+    return rest_;
+  }
+
+ private:
+  template <typename HANDLER>
+  friend class GenericHTTPRouter;
+
+  const std::vector<std::string>* names_ = nullptr;
+  SmallVector<StringView, kHTTPRouteInlineParams> values_;
+  StringView rest_;
+};
+
+template <typename HANDLER>
+class GenericHTTPRouter {
+ public:
+  GenericHTTPRouter() : nodes_(1) {
+  }
+
+  // Registers `handler` for `method`, one of `HTTPMethod`, or "*" for all of them, and the path `pattern`.
+  // Throws `HTTPInvalidRouteException` on a malformed pattern, and `HTTPDuplicateRouteException`
+  // if the same method and pattern are already registered.
+  void Add(const StringView& method, const StringView& pattern, HANDLER handler) {
+    const size_t method_slot = (method == "*") ? kHTTPMethods : HTTPMethodIndex(method);
+    if ((method_slot == kHTTPMethods && method != "*") || pattern.empty() || pattern[0] != '/') {
+      throw HTTPInvalidRouteException();
+    }
+    Route route;
+    route.handler = std::move(handler);
+    uint32_t n = 0;
+    bool prefix = false;
+    for (size_t i = 0; i < pattern.size(); ++i) {
+      const char c = pattern[i];
+      if (c == '{') {
+        const size_t close = pattern.find('}', i);
+        if (pattern[i - 1] != '/' || close == StringView::npos || close == i + 1 ||
+            (close + 1 < pattern.size() && pattern[close + 1] != '/')) {
+          throw HTTPInvalidRouteException();
+        }
+        route.param_names.push_back(pattern.substr(i + 1, close - i - 1).ToString());
+        if (nodes_[n].param_child == kNoNode) {
+          const uint32_t child = NewNode();
+          nodes_[n].param_child = child;
+        }
+        n = nodes_[n].param_child;
+        i = close;
+      } else if (c == '*') {
+        if (i + 1 != pattern.size()) {
+          throw HTTPInvalidRouteException();
+        }
+        prefix = true;
+      } else if (c == '}') {
+        throw HTTPInvalidRouteException();
+      } else {
+        n = LiteralChild(n, c);
+      }
+    }
+    int32_t& slot = prefix ? nodes_[n].prefix_routes[method_slot] : nodes_[n].exact_routes[method_slot];
+    if (slot != kNoRoute) {
+      throw HTTPDuplicateRouteException();
+    }
+    slot = static_cast<int32_t>(routes_.size());
+    routes_.push_back(std::move(route));
+    nodes_[n].has_prefix_routes = nodes_[n].has_prefix_routes || prefix;
+  }
+
+  // Finds the route for `method` and the path of `url`. On success, sets `*handler` and fills in `*params`.
+  // Otherwise tells whether the path matches no route at all, or only routes for other methods.
+  HTTPRouteStatus Match(const StringView& method,
+                        const StringView& url,
+                        const HANDLER** handler,
+                        HTTPRouteParams* params) const {
+    const StringView path = HTTPRoutePath(url);
+    params->values_.Clear();
+    params->rest_ = StringView();
+    const int32_t route = Walk(0, 0, path, HTTPMethodIndex(method), params);
+    if (route != kNoRoute) {
+      *handler = &routes_[route].handler;
+      params->names_ = &routes_[route].param_names;
+      return HTTPRouteStatus::Found;
+    }
+    params->values_.Clear();
+    params->rest_ = StringView();
+    return Walk(0, 0, path, kAnyMethod, params) != kNoRoute ? HTTPRouteStatus::MethodNotAllowed
+                                                           : HTTPRouteStatus::NotFound;
+  }
+
+ private:
+  static const uint32_t kNoNode = static_cast<uint32_t>(-1);
+  static const int32_t kNoRoute = -1;
+  static const size_t kAnyMethod = kHTTPMethods + 1;  // For `Walk()`: a route for any method would do.
+
+  struct Node {
+    std::vector<std::pair<char, uint32_t>> children;  // Sorted by the character.
+    uint32_t param_child = kNoNode;
+    int32_t exact_routes[kHTTPMethods + 1];  // Per method, and for all the methods in the last slot.
+    int32_t prefix_routes[kHTTPMethods + 1];
+    bool has_prefix_routes = false;
+
+    Node() {
+      for (size_t i = 0; i <= kHTTPMethods; ++i) {
+        exact_routes[i] = prefix_routes[i] = kNoRoute;
+      }
+    }
+  };
+
+  struct Route {
+    HANDLER handler;
+    std::vector<std::string> param_names;
+  };
+
+  // A node where a `{name}` or a `*` could match, if the literal path beyond it leads nowhere.
+  struct Fallback {
+    uint32_t node;
+    size_t position;
+  };
+
+  uint32_t NewNode() {
+    nodes_.emplace_back();
+    return static_cast<uint32_t>(nodes_.size() - 1);
+  }
+
+  uint32_t LiteralChild(uint32_t n, char c) {
+    size_t i = 0;
+    while (i < nodes_[n].children.size() && nodes_[n].children[i].first < c) {
+      ++i;
+    }
+    if (i < nodes_[n].children.size() && nodes_[n].children[i].first == c) {
+      return nodes_[n].children[i].second;
+    }
+    // `NewNode()` may move the nodes, so no references into them are held across it.
+    const uint32_t child = NewNode();
+    nodes_[n].children.insert(nodes_[n].children.begin() + i, std::make_pair(c, child));
+    return child;
+  }
+
+  uint32_t FindLiteralChild(const Node& node, char c) const {
+    // Binary search: the root and the nodes right after a '/' may have dozens of children.
+    size_t lo = 0;
+    size_t hi = node.children.size();
+    while (lo < hi) {
+      const size_t mid = (lo + hi) / 2;
+      if (node.children[mid].first < c) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    return (lo < node.children.size() && node.children[lo].first == c) ? node.children[lo].second : kNoNode;
+  }
+
+  static int32_t RouteFor(const int32_t* routes, size_t method) {
+    if (method == kAnyMethod) {
+      for (size_t i = 0; i <= kHTTPMethods; ++i) {
+        if (routes[i] != kNoRoute) {
+          return routes[i];
+        }
+      }
+      return kNoRoute;
+    }
+    if (method < kHTTPMethods && routes[method] != kNoRoute) {
+      return routes[method];
+    }
+    return routes[kHTTPMethods];
+  }
+
+  // Follows the literal characters of `path` as far as they go, then backtracks through the places
+  // where a parameter or a wildcard could match instead, deepest first. Recurses once per `{name}` segment.
+  int32_t Walk(uint32_t n, size_t position, const StringView& path, size_t method, HTTPRouteParams* params) const {
+    SmallVector<Fallback, 16> fallbacks;
+    while (true) {
+      const Node& node = nodes_[n];
+      if (node.param_child != kNoNode || node.has_prefix_routes) {
+        fallbacks.PushBack(Fallback{n, position});
+      }
+      if (position == path.size()) {
+        const int32_t route = RouteFor(node.exact_routes, method);
+        if (route != kNoRoute) {
+          return route;
+        }
+        break;
+      }
+      const uint32_t child = FindLiteralChild(node, path[position]);
+      if (child == kNoNode) {
+        break;
+      }
+      n = child;
+      ++position;
+    }
+    for (size_t i = fallbacks.Size(); i-- > 0;) {
+      const Fallback fallback = fallbacks[i];
+      const Node& node = nodes_[fallback.node];
+      if (node.param_child != kNoNode) {
+        size_t end = path.find('/', fallback.position);
+        if (end == StringView::npos) {
+          end = path.size();
+        }
+        if (end > fallback.position) {
+          params->values_.PushBack(path.substr(fallback.position, end - fallback.position));
+          const int32_t route = Walk(node.param_child, end, path, method, params);
+          if (route != kNoRoute) {
+            return route;
+          }
+          params->values_.PopBack();
+        }
+      }
+      const int32_t route = RouteFor(node.prefix_routes, method);
+      if (route != kNoRoute) {
+        params->rest_ = path.substr(fallback.position);
+        return route;
+      }
+    }
+    return kNoRoute;
+  }
+
+  std::vector<Node> nodes_;  // The root is `nodes_[0]`.
+  std::vector<Route> routes_;
+};
+
+// The router for handlers of `GenericHTTPConnection`-s, with the default responses for unmatched requests.
+template <typename CONNECTION = HTTPConnection>
+class HTTPRouter final : public GenericHTTPRouter<std::function<void(CONNECTION&, const HTTPRouteParams&)>> {
+ public:
+  typedef std::function<void(CONNECTION&, const HTTPRouteParams&)> T_HANDLER;
+
+  // Calls the handler of the matching route, or responds with `404 Not Found` or `405 Method Not Allowed`.
+  HTTPRouteStatus Dispatch(CONNECTION& c) const {
+    const T_HANDLER* handler;
+    HTTPRouteParams params;
+    const HTTPRouteStatus status = this->Match(StringView(c.Method()), StringView(c.URL()), &handler, &params);
+    if (status == HTTPRouteStatus::Found) {
+      (*handler)(c, params);
+    } else {
+      const HTTPResponseCode code = (status == HTTPRouteStatus::NotFound) ? HTTPResponseCode::NotFound
+                                                                          : HTTPResponseCode::MethodNotAllowed;
+      c.SendHTTPResponse(HTTPResponseCodeAsStringGenerator::CodeAsString(code) + '\n', code);
+    }
+    return status;
+  }
+};
+
+// FNV-1a over the method, a space and the path; `constexpr`, so that it can be a `case` label.
+const uint64_t kHTTPStaticRouteHashBasis = 14695981039346656037ull;
+const uint64_t kHTTPStaticRouteHashPrime = 1099511628211ull;
+
+constexpr uint64_t HTTPStaticRouteHashOf(const char* s, uint64_t hash) {
+  return *s ? HTTPStaticRouteHashOf(s + 1, (hash ^ static_cast<unsigned char>(*s)) * kHTTPStaticRouteHashPrime)
+            : hash;
+}
+
+constexpr uint64_t HTTPStaticRouteKey(const char* method, const char* path) {
+  return HTTPStaticRouteHashOf(path, (HTTPStaticRouteHashOf(method, kHTTPStaticRouteHashBasis) ^ ' ') *
+                                         kHTTPStaticRouteHashPrime);
+}
+
+inline uint64_t HTTPStaticRouteKey(const StringView& method, const StringView& path) {
+  uint64_t hash = kHTTPStaticRouteHashBasis;
+  for (char c : method) {
+    hash = (hash ^ static_cast<unsigned char>(c)) * kHTTPStaticRouteHashPrime;
+  }
+  hash = (hash ^ ' ') * kHTTPStaticRouteHashPrime;
+  for (char c : path) {
+    hash = (hash ^ static_cast<unsigned char>(c)) * kHTTPStaticRouteHashPrime;
+  }
+  return hash;
+}
+
+// Compile-time routes: `ROUTES` is an X-macro of `X(method, "/exact/path", handler)`, where `handler(connection)`
+// handles the request. Expands to a statement that calls the matching handler and makes the enclosing function
+// `return true`; falls through if no route matches, for the caller to try an `HTTPRouter` or respond 404.
+//
+//   #define API_ROUTES(X) X(GET, "/health", Health) X(POST, "/events", PostEvent)
+//   bool Dispatch(HTTPConnection& c) {
+//     TOY_HTTP_STATIC_DISPATCH(c, API_ROUTES);
+//     return false;
+//   }
+#define TOY_HTTP_STATIC_ROUTE_CASE(method, path, handler)                                                 \
+  case HTTPStaticRouteKey(#method, path):                                                                  \
+    if (toy_http_static_route_method == StringView(#method) && toy_http_static_route_path == StringView(path)) { \
+      handler(toy_http_static_route_connection);                                                           \
+      return true;                                                                                         \
+    }                                                                                                      \
+    break;
+
+#define TOY_HTTP_STATIC_DISPATCH(connection, ROUTES)                                                          \
+  do {                                                                                                        \
+    auto& toy_http_static_route_connection = (connection);                                                    \
+    const StringView toy_http_static_route_method(toy_http_static_route_connection.Method());                  \
+    const StringView toy_http_static_route_path = HTTPRoutePath(toy_http_static_route_connection.URL());     \
+    switch (HTTPStaticRouteKey(toy_http_static_route_method, toy_http_static_route_path)) {                  \
+      ROUTES(TOY_HTTP_STATIC_ROUTE_CASE)                                                                      \
+      default:                                                                                                \
+        break;                                                                                                \
+    }                                                                                                         \
+  } while (false)
+
+#endif  // TOY_HTTP_ROUTER_H
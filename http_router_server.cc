@@ -0,0 +1,75 @@
+// An HTTP server that dispatches requests with the router: a few exact routes known at compile time,
+// and routes with parameters and wildcards registered at startup, whose responses are cached for a second.
+
+/*
+# To test:
+curl localhost:8080/health
+curl localhost:8080/users/42
+curl 'localhost:8080/users/42?fields=name%2Cemail'
+curl localhost:8080/users/42/posts/7
+curl -X DELETE localhost:8080/users/42  # 405.
+curl localhost:8080/static/css/site.css
+curl localhost:8080/nowhere             # 404.
+curl -i localhost:8080/users/42         # Note the `ETag`, and pass it back to get a 304:
+curl -i -H 'If-None-Match: "..."' localhost:8080/users/42
+*/
+
+#include <thread>
+
+#include "http_request_parser.h"
+#include "http_response_cache.h"
+#include "http_router.h"
+
+const int kPort = 8080;
+
+typedef ZeroCopyHTTPConnection RoutedConnection;
+
+void Health(RoutedConnection& c) {
+  c.SendHTTPResponse(std::string("OK\n"));
+}
+
+void Version(RoutedConnection& c) {
+  c.SendHTTPResponse(std::string("{\"version\":1}\n"), HTTPResponseCode::OK, "application/json");
+}
+
+#define STATIC_ROUTES(X) \
+  X(GET, "/health", Health) \
+  X(GET, "/version", Version)
+
+bool DispatchStaticRoutes(RoutedConnection& c) {
+  TOY_HTTP_STATIC_DISPATCH(c, STATIC_ROUTES);
+  return false;
+}
+
+int main() {
+  HTTPRouter<RoutedConnection> router;
+  router.Add("GET", "/users/{id}", [](RoutedConnection& c, const HTTPRouteParams& params) {
+    std::string response = "User " + params.Get("id").ToString();
+    HTTPQueryIterator it = c.ParsedURL().QueryParameters();
+    while (it.Next()) {
+      response += ", " + it.Key().ToString() + ": " + it.Value().ToString();
+    }
+    c.SendHTTPResponse(response + '\n');
+  });
+  router.Add("GET", "/users/{id}/posts/{post}", [](RoutedConnection& c, const HTTPRouteParams& params) {
+    c.SendHTTPResponse("Post " + params[1].ToString() + " of user " + params[0].ToString() + '\n');
+  });
+  router.Add("*", "/static/*", [](RoutedConnection& c, const HTTPRouteParams& params) {
+    c.SendHTTPResponse("Static file " + params.Rest().ToString() + '\n');
+  });
+
+  GenericHTTPResponseCache<RoutedConnection> cache;
+  const GenericHTTPResponseCache<RoutedConnection>::T_HANDLER dispatch = [&router](RoutedConnection& c) {
+    router.Dispatch(c);
+  };
+
+  GenericHTTPReusePortServer<RoutedConnection> server(kPort,
+                                                      [&cache, &dispatch](RoutedConnection& c) {
+                                                        if (!DispatchStaticRoutes(c)) {
+                                                          cache.Serve(c, dispatch);
+                                                        }
+                                                      },
+                                                      std::thread::hardware_concurrency(),
+                                                      false);
+  server.Run();
+}
@@ -0,0 +1,281 @@
+#ifndef TOY_HTTP_SCANNER_H
+#define TOY_HTTP_SCANNER_H
+
+// Vectorized scanning kernels for the HTTP header parser and the query string decoder.
+// `HTTPScanLine` finds the end of a header line and the key-value separator in the same pass, 16 or 32 bytes
+// at a time, with the kernel picked at runtime: AVX2 if the CPU supports it, SSE2 otherwise on x86-64,
+// and a portable scalar loop elsewhere. `HTTPScanQueryParameter` does the same for one `key=value` pair
+// of a query string, and also tells whether it has escapes to decode.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define TOY_HTTP_SCANNER_X86
+#include <immintrin.h>
+#endif
+
+const size_t kHTTPScanNone = static_cast<size_t>(-1);
+
+// Signature of all the `HTTPScanLine*` kernels: returns the index of the first '\n' in `[data, data + length)`,
+// or `length` if there is none. `*colon` is set to the index of the first ':' before that position,
+// or to `kHTTPScanNone` if there is none.
+typedef size_t (*HTTPScanLineFunction)(const char* data, size_t length, size_t* colon);
+
+// Signature of all the `HTTPScanQueryParameter*` kernels: returns the index of the first '&'
+// in `[data, data + length)`, or `length` if there is none. `*equals` is set to the index of the first '='
+// before that position, or to `kHTTPScanNone` if there is none, and `*escaped` to whether a '%' or a '+'
+// is there.
+typedef size_t (*HTTPScanQueryParameterFunction)(const char* data, size_t length, size_t* equals, bool* escaped);
+
+// Finishes the scan from `begin` one byte at a time. Also serves as the tail of the vectorized kernels.
+inline size_t HTTPScanLineScalarFrom(const char* data, size_t begin, size_t length, size_t* colon) {
+  for (size_t i = begin; i < length; ++i) {
+    const char c = data[i];
+    if (c == '\n') {
+      return i;
+    } else if (c == ':' && *colon == kHTTPScanNone) {
+      *colon = i;
+    }
+  }
+  return length;
+}
+
+inline size_t HTTPScanLineScalar(const char* data, size_t length, size_t* colon) {
+  *colon = kHTTPScanNone;
+  return HTTPScanLineScalarFrom(data, 0, length, colon);
+}
+
+inline size_t HTTPScanQueryParameterScalarFrom(
+    const char* data, size_t begin, size_t length, size_t* equals, bool* escaped) {
+  for (size_t i = begin; i < length; ++i) {
+    const char c = data[i];
+    if (c == '&') {
+      return i;
+    } else if (c == '=' && *equals == kHTTPScanNone) {
+      *equals = i;
+    } else if (c == '%' || c == '+') {
+      *escaped = true;
+    }
+  }
+  return length;
+}
+
+inline size_t HTTPScanQueryParameterScalar(const char* data, size_t length, size_t* equals, bool* escaped) {
+  *equals = kHTTPScanNone;
+  *escaped = false;
+  return HTTPScanQueryParameterScalarFrom(data, 0, length, equals, escaped);
+}
+
+#ifdef TOY_HTTP_SCANNER_X86
+
+// Records the first colon of a block, ignoring the ones past the first line feed of that block.
+inline void HTTPScanRecordColon(size_t block_offset, uint32_t lf_mask, uint32_t colon_mask, size_t* colon) {
+  if (lf_mask) {
+    colon_mask &= (lf_mask & (0u - lf_mask)) - 1;
+  }
+  if (colon_mask) {
+    *colon = block_offset + __builtin_ctz(colon_mask);
+  }
+}
+
+__attribute__((target("sse2"))) inline size_t HTTPScanLineSSE2(const char* data, size_t length, size_t* colon) {
+  *colon = kHTTPScanNone;
+  const __m128i lf = _mm_set1_epi8('\n');
+  const __m128i separator = _mm_set1_epi8(':');
+  size_t i = 0;
+  for (; i + 16 <= length; i += 16) {
+    const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+    const uint32_t lf_mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, lf)));
+    if (*colon == kHTTPScanNone) {
+      HTTPScanRecordColon(
+          i, lf_mask, static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, separator))), colon);
+    }
+    if (lf_mask) {
+      return i + __builtin_ctz(lf_mask);
+    }
+  }
+  return HTTPScanLineScalarFrom(data, i, length, colon);
+}
+
+__attribute__((target("avx2"))) inline size_t HTTPScanLineAVX2(const char* data, size_t length, size_t* colon) {
+  *colon = kHTTPScanNone;
+  const __m256i lf = _mm256_set1_epi8('\n');
+  const __m256i separator = _mm256_set1_epi8(':');
+  size_t i = 0;
+  for (; i + 32 <= length; i += 32) {
+    const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+    const uint32_t lf_mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, lf)));
+    if (*colon == kHTTPScanNone) {
+      HTTPScanRecordColon(
+          i, lf_mask, static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, separator))), colon);
+    }
+    if (lf_mask) {
+      return i + __builtin_ctz(lf_mask);
+    }
+  }
+  return HTTPScanLineScalarFrom(data, i, length, colon);
+}
+
+// Same as `HTTPScanRecordColon`, for the escapes: only the ones before the first '&' of the block count.
+inline void HTTPScanRecordEscape(uint32_t amp_mask, uint32_t escape_mask, bool* escaped) {
+  if (amp_mask) {
+    escape_mask &= (amp_mask & (0u - amp_mask)) - 1;
+  }
+  if (escape_mask) {
+    *escaped = true;
+  }
+}
+
+__attribute__((target("sse2"))) inline size_t HTTPScanQueryParameterSSE2(const char* data,
+                                                                         size_t length,
+                                                                         size_t* equals,
+                                                                         bool* escaped) {
+  *equals = kHTTPScanNone;
+  *escaped = false;
+  const __m128i amp = _mm_set1_epi8('&');
+  const __m128i eq = _mm_set1_epi8('=');
+  const __m128i percent = _mm_set1_epi8('%');
+  const __m128i plus = _mm_set1_epi8('+');
+  size_t i = 0;
+  for (; i + 16 <= length; i += 16) {
+    const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+    const uint32_t amp_mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, amp)));
+    if (*equals == kHTTPScanNone) {
+      HTTPScanRecordColon(i, amp_mask, static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, eq))), equals);
+    }
+    if (!*escaped) {
+      const __m128i escape = _mm_or_si128(_mm_cmpeq_epi8(block, percent), _mm_cmpeq_epi8(block, plus));
+      HTTPScanRecordEscape(amp_mask, static_cast<uint32_t>(_mm_movemask_epi8(escape)), escaped);
+    }
+    if (amp_mask) {
+      return i + __builtin_ctz(amp_mask);
+    }
+  }
+  return HTTPScanQueryParameterScalarFrom(data, i, length, equals, escaped);
+}
+
+__attribute__((target("avx2"))) inline size_t HTTPScanQueryParameterAVX2(const char* data,
+                                                                         size_t length,
+                                                                         size_t* equals,
+                                                                         bool* escaped) {
+  *equals = kHTTPScanNone;
+  *escaped = false;
+  const __m256i amp = _mm256_set1_epi8('&');
+  const __m256i eq = _mm256_set1_epi8('=');
+  const __m256i percent = _mm256_set1_epi8('%');
+  const __m256i plus = _mm256_set1_epi8('+');
+  size_t i = 0;
+  for (; i + 32 <= length; i += 32) {
+    const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+    const uint32_t amp_mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, amp)));
+    if (*equals == kHTTPScanNone) {
+      HTTPScanRecordColon(
+          i, amp_mask, static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, eq))), equals);
+    }
+    if (!*escaped) {
+      const __m256i escape = _mm256_or_si256(_mm256_cmpeq_epi8(block, percent), _mm256_cmpeq_epi8(block, plus));
+      HTTPScanRecordEscape(amp_mask, static_cast<uint32_t>(_mm256_movemask_epi8(escape)), escaped);
+    }
+    if (amp_mask) {
+      return i + __builtin_ctz(amp_mask);
+    }
+  }
+  return HTTPScanQueryParameterScalarFrom(data, i, length, equals, escaped);
+}
+
+inline HTTPScanLineFunction SelectHTTPScanLineFunction() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") ? HTTPScanLineAVX2 : HTTPScanLineSSE2;
+}
+
+// Query parameters are mostly shorter than 32 bytes, which the AVX2 kernel would scan entirely in its scalar tail:
+// SSE2 is faster on them. The AVX2 kernel stays for `http_scanner_benchmark` to compare.
+inline HTTPScanQueryParameterFunction SelectHTTPScanQueryParameterFunction() {
+  return HTTPScanQueryParameterSSE2;
+}
+
+#else
+
+inline HTTPScanLineFunction SelectHTTPScanLineFunction() {
+  return HTTPScanLineScalar;
+}
+
+inline HTTPScanQueryParameterFunction SelectHTTPScanQueryParameterFunction() {
+  return HTTPScanQueryParameterScalar;
+}
+
+#endif  // TOY_HTTP_SCANNER_X86
+
+// The fastest kernel supported by the CPU, selected once.
+inline size_t HTTPScanLine(const char* data, size_t length, size_t* colon) {
+  static const HTTPScanLineFunction f = SelectHTTPScanLineFunction();
+  return f(data, length, colon);
+}
+
+inline size_t HTTPScanQueryParameter(const char* data, size_t length, size_t* equals, bool* escaped) {
+  static const HTTPScanQueryParameterFunction f = SelectHTTPScanQueryParameterFunction();
+  return f(data, length, equals, escaped);
+}
+
+// Lowercases the bytes 'A' to 'Z' of `x`, eight at a time, leaving all the others as they are: adding to the low
+// seven bits of each byte sets its top bit if it is at least 'A', or above 'Z', with no carry into the next byte.
+inline uint64_t HTTPLowercaseASCII8(uint64_t x) {
+  const uint64_t high = 0x8080808080808080ull;
+  const uint64_t low = x & ~high;
+  const uint64_t at_least_a = low + 0x3f3f3f3f3f3f3f3full;   // 0x80 - 'A'.
+  const uint64_t above_z = low + 0x2525252525252525ull;      // 0x7f - 'Z'.
+  const uint64_t upper = (at_least_a ^ above_z) & ~x & high;  // Not for the bytes with the top bit set.
+  return x | (upper >> 2);
+}
+
+// Case-insensitive comparison of a header name against a well-known one, given in lowercase.
+// Only 'A' to 'Z' are folded, so that no other byte, such as '\r', can pass for a character of the name.
+// The comparison runs a machine word or a vector register at a time.
+inline bool HTTPHeaderNameEquals(const char* key, size_t key_length, const char* lowercase_name, size_t length) {
+  if (key_length != length) {
+    return false;
+  }
+#ifdef TOY_HTTP_SCANNER_X86
+  if (length >= 16) {
+    // Signed comparisons, so that the bytes with the top bit set are below 'A'.
+    const __m128i before_a = _mm_set1_epi8('A' - 1);
+    const __m128i after_z = _mm_set1_epi8('Z' + 1);
+    const __m128i fold = _mm_set1_epi8(0x20);
+    size_t i = 0;
+    while (true) {
+      const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(key + i));
+      const __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(a, before_a), _mm_cmplt_epi8(a, after_z));
+      const __m128i lower = _mm_or_si128(a, _mm_and_si128(upper, fold));
+      const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lowercase_name + i));
+      if (_mm_movemask_epi8(_mm_cmpeq_epi8(lower, b)) != 0xffff) {
+        return false;
+      }
+      if (i + 16 == length) {
+        return true;
+      }
+      // The last block overlaps with the previous one instead of reading past the end.
+      i = (i + 32 <= length) ? i + 16 : length - 16;
+    }
+  }
+#endif
+  if (length >= 8) {
+    uint64_t a1, a2, b1, b2;
+    memcpy(&a1, key, 8);
+    memcpy(&a2, key + length - 8, 8);
+    memcpy(&b1, lowercase_name, 8);
+    memcpy(&b2, lowercase_name + length - 8, 8);
+    return HTTPLowercaseASCII8(a1) == b1 && HTTPLowercaseASCII8(a2) == b2;
+  } else {
+    for (size_t i = 0; i < length; ++i) {
+      const char c = key[i];
+      if ((static_cast<unsigned char>(c - 'A') < 26u ? c | 0x20 : c) != lowercase_name[i]) {
+        return false;
+      }
+    }
+    return true;
+  }
+}
+
+#endif  // TOY_HTTP_SCANNER_H
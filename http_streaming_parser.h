@@ -0,0 +1,325 @@
+#ifndef TOY_HTTP_STREAMING_PARSER_H
+#define TOY_HTTP_STREAMING_PARSER_H
+
+// Streaming request bodies: the headers are parsed as usual, while the body is handed out in pieces
+// as it arrives from the socket, so the memory per connection stays constant regardless of the body size.
+// Supports both `Content-Length` and `Transfer-Encoding: chunked` bodies.
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include "exceptions.h"
+#include "http_request_parser.h"
+#include "object_pool.h"
+#include "posix_http_server.h"
+#include "posix_tcp_server.h"
+#include "string_view.h"
+
+const size_t kDefaultHTTPStreamingBufferSize = 64 * 1024;
+
+// Incremental decoder of `Transfer-Encoding: chunked`: http://tools.ietf.org/html/rfc7230#section-4.1
+// Chunk extensions and trailers are skipped.
+class HTTPChunkedBodyDecoder final {
+ public:
+  HTTPChunkedBodyDecoder() {
+    Reset();
+  }
+
+  void Reset() {
+    state_ = State::Size;
+    chunk_remaining_ = 0;
+    size_digits_ = 0;
+    in_extension_ = false;
+    trailer_line_length_ = 0;
+  }
+
+  bool Done() const {
+    return state_ == State::Done;
+  }
+
+  // Consumes bytes from `[data, data + length)` up to and including the next piece of body data, if any.
+  // Returns the number of bytes consumed; `*piece` is set to the body data among them, or to an empty view.
+  // Throws `HTTPMalformedRequestException` on invalid framing.
+  size_t Decode(const char* data, size_t length, StringView* piece) {
+    *piece = StringView();
+    size_t i = 0;
+    while (i < length && state_ != State::Done) {
+      const char c = data[i];
+      if (state_ == State::Data) {
+        const size_t n = std::min(length - i, chunk_remaining_);
+        *piece = StringView(data + i, n);
+        chunk_remaining_ -= n;
+        if (!chunk_remaining_) {
+          state_ = State::DataEnd;
+        }
+        return i + n;
+      }
+      ++i;
+      if (state_ == State::Size) {
+        if (c == '\n') {
+          if (!size_digits_) {
+            throw HTTPMalformedRequestException();
+          }
+          state_ = chunk_remaining_ ? State::Data : State::Trailers;
+          size_digits_ = 0;
+          in_extension_ = false;
+        } else if (c == ';' || c == ' ' || c == '\t') {
+          in_extension_ = true;
+        } else if (c != '\r' && !in_extension_) {
+          const int digit = HexDigit(c);
+          if (digit < 0 || (chunk_remaining_ >> (sizeof(size_t) * 8 - 4))) {
+            throw HTTPMalformedRequestException();
+          }
+          chunk_remaining_ = chunk_remaining_ * 16 + digit;
+          ++size_digits_;
+        }
+      } else if (state_ == State::DataEnd) {
+        if (c == '\n') {
+          state_ = State::Size;
+        } else if (c != '\r') {
+          throw HTTPMalformedRequestException();
+        }
+      } else if (state_ == State::Trailers) {
+        if (c == '\n') {
+          if (!trailer_line_length_) {
+            state_ = State::Done;
+          }
+          trailer_line_length_ = 0;
+        } else if (c != '\r') {
+          ++trailer_line_length_;
+        }
+      }
+    }
+    return i;
+  }
+
+ private:
+  enum class State : int { Size, Data, DataEnd, Trailers, Done };
+
+  static int HexDigit(char c) {
+    if (c >= '0' && c <= '9') {
+      return c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      return c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+      return c - 'A' + 10;
+    } else {
+      return -1;
+    }
+  }
+
+  State state_;
+  size_t chunk_remaining_;
+  size_t size_digits_;
+  bool in_extension_;
+  size_t trailer_line_length_;
+};
+
+// `HEADER_PARSER` for `GenericHTTPConnection` that parses the headers only, and leaves the body to the handler,
+// which pulls it via `ReadBody()`. Uses a single fixed-size buffer per connection; the headers may take up
+// at most half of it, and the other half cycles through the body.
+class StreamingHTTPHeaderParser {
+ public:
+  explicit StreamingHTTPHeaderParser(size_t buffer_size = kDefaultHTTPStreamingBufferSize)
+      : buffer_(*pooled_buffer_) {
+    buffer_.resize(buffer_size);
+  }
+
+  StringView Method() const {
+    return parser_.Method();
+  }
+
+  StringView URL() const {
+    return parser_.URL();
+  }
+
+  size_t HeadersCount() const {
+    return parser_.HeadersCount();
+  }
+
+  StringView HeaderKey(size_t i) const {
+    return parser_.HeaderKey(i);
+  }
+
+  StringView HeaderValue(size_t i) const {
+    return parser_.HeaderValue(i);
+  }
+
+  template <typename F>
+  void ForEachHeader(F&& f) const {
+    parser_.ForEachHeader(std::forward<F>(f));
+  }
+
+  StringView Header(const StringView& key) const {
+    return parser_.Header(key);
+  }
+
+  bool KeepAlive() const {
+    return parser_.KeepAlive();
+  }
+
+  bool IsHTTP11() const {
+    return parser_.IsHTTP11();
+  }
+
+  bool HasBody() const {
+    return parser_.HasBody() || parser_.IsChunked();
+  }
+
+  bool IsChunked() const {
+    return parser_.IsChunked();
+  }
+
+  // Pull-style: copies up to `max_length` next bytes of the body into `buffer`.
+  // Returns the number of bytes copied, or zero once the body is over.
+  size_t ReadBody(void* buffer, size_t max_length) {
+    StringView piece;
+    if (!NextBodyPiece(&piece, max_length)) {
+      return 0;
+    }
+    memcpy(buffer, piece.data(), piece.size());
+    return piece.size();
+  }
+
+  // For a `Content-Length` body that the caller reads straight from the socket, as with `splice()`: calls
+  // `f(const char* data, size_t length)` once with the part of the body already received, possibly empty,
+  // and returns how many bytes of it are still to be read from the socket. The body then counts as read.
+  template <typename F>
+  size_t TakeOverBody(F&& f) {
+    if (chunked_) {
+      throw HTTPUnsupportedTransferEncodingException();
+    }
+    const size_t n = std::min(end_ - begin_, body_remaining_);
+    f(static_cast<const char*>(&buffer_[begin_]), n);
+    begin_ += n;
+    const size_t remaining = body_remaining_ - n;
+    body_remaining_ = 0;
+    body_finished_ = true;
+    return remaining;
+  }
+
+  // Push-style: calls `f(const char* data, size_t length)` for each piece of the body as it arrives,
+  // straight from the receive buffer. Returns the total length of the body.
+  template <typename F>
+  size_t ReadBody(F&& f) {
+    size_t total = 0;
+    StringView piece;
+    while (NextBodyPiece(&piece, buffer_.size())) {
+      f(piece.data(), piece.size());
+      total += piece.size();
+    }
+    return total;
+  }
+
+ protected:
+  // The body is streamed, so its size is not limited.
+  void SetHTTPLimits(const HTTPServerLimits& limits) {
+    parser_.SetLimits(limits.max_header_bytes, limits.max_headers);
+  }
+
+  bool HTTPHeadersComplete() const {
+    return parser_.HeadersComplete();
+  }
+
+  // Whether the handler has yet to read the body, or its end.
+  bool HTTPBodyPending() const {
+    return !body_finished_;
+  }
+
+  // The body is read later, by `ReadBody()`, through the base `GenericConnection`.
+  template <typename CONNECTION>
+  void ParseHTTPHeader(const CONNECTION& c) {
+    connection_ = &c;
+    // Skip whatever the handler has not read of the previous body, to get to the next request.
+    StringView unused;
+    while (NextBodyPiece(&unused, buffer_.size())) {
+    }
+    parser_.Reset();
+    if (begin_ == end_) {
+      begin_ = end_ = 0;
+    }
+    while (parser_.Parse(&buffer_[begin_], end_ - begin_), !parser_.HeadersComplete()) {
+      if (end_ == buffer_.size()) {
+        if (!begin_) {
+          throw HTTPHeadersTooLargeException();
+        }
+        // The parser only keeps offsets relative to the beginning of the request, so the bytes can be moved.
+        memmove(&buffer_[0], &buffer_[begin_], end_ - begin_);
+        end_ -= begin_;
+        begin_ = 0;
+      }
+      Fill(c);
+    }
+    // The headers themselves are limited, wherever in the buffer the request starts.
+    if (parser_.BodyOffset() > buffer_.size() / 2) {
+      throw HTTPHeadersTooLargeException();
+    }
+    // Past the middle, the request is moved to the front, for the body to cycle through half the buffer at least.
+    // As it takes half a buffer of requests to get there, the bytes moved stay proportional to those received.
+    if (begin_ + parser_.BodyOffset() > buffer_.size() / 2) {
+      memmove(&buffer_[0], &buffer_[begin_], end_ - begin_);
+      end_ -= begin_;
+      begin_ = 0;
+    }
+    begin_ += parser_.BodyOffset();
+    // The headers stay in `[0, body_area_begin_)` for `Method()`, `URL()` and `Header()` to point to.
+    body_area_begin_ = begin_;
+    chunked_ = parser_.IsChunked();
+    body_remaining_ = parser_.HasBody() ? parser_.ContentLength() : 0;
+    body_finished_ = !chunked_ && !body_remaining_;
+    decoder_.Reset();
+  }
+
+ private:
+  // Returns the next piece of the body, of at most `max_length` bytes, or false if the body is over.
+  bool NextBodyPiece(StringView* piece, size_t max_length) {
+    while (!body_finished_) {
+      if (begin_ == end_) {
+        begin_ = end_ = body_area_begin_;
+        Fill(*connection_);
+      }
+      const size_t available = std::min(end_ - begin_, max_length);
+      if (!chunked_) {
+        const size_t n = std::min(available, body_remaining_);
+        *piece = StringView(&buffer_[begin_], n);
+        begin_ += n;
+        body_remaining_ -= n;
+        body_finished_ = !body_remaining_;
+        return true;
+      }
+      begin_ += decoder_.Decode(&buffer_[begin_], available, piece);
+      body_finished_ = decoder_.Done();
+      if (!piece->empty()) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  template <typename CONNECTION>
+  void Fill(const CONNECTION& c) {
+    const size_t read_count = c.BlockingRead(&buffer_[end_], buffer_.size() - end_);
+    if (!read_count) {
+      throw HTTPConnectionClosedException();
+    }
+    end_ += read_count;
+  }
+
+  PooledObject<std::vector<char>> pooled_buffer_;  // Recycled between connections.
+  std::vector<char>& buffer_;
+  size_t begin_ = 0;            // The first byte of `buffer_` not consumed yet.
+  size_t end_ = 0;              // How many bytes of `buffer_` hold received data.
+  size_t body_area_begin_ = 0;  // Where the body bytes are read into, right past the headers.
+  const GenericConnection* connection_ = nullptr;
+  HTTPRequestParser parser_;
+  HTTPChunkedBodyDecoder decoder_;
+  bool chunked_ = false;
+  size_t body_remaining_ = 0;
+  bool body_finished_ = true;
+};
+
+typedef GenericHTTPConnection<StreamingHTTPHeaderParser> StreamingHTTPConnection;
+
+#endif  // TOY_HTTP_STREAMING_PARSER_H
@@ -0,0 +1,62 @@
+// An HTTP server with a fixed pool of worker threads.
+// When all workers are busy and the queue is full, new clients get `503 Service Unavailable` right away.
+// When the queue stands, with connections waiting in it for over half a second, the requests that have waited
+// that long get `503` and `Retry-After` instead of being served, except for `/health`, which is held to two
+// seconds instead, while `/batch/...` gets `503` as long as the queue stands.
+// On `SIGTERM` or `SIGINT`, stops accepting and exits once the requests accepted already have been answered.
+
+/*
+# To test:
+curl localhost:8080
+curl -d DATA localhost:8080
+for i in $(seq 50) ; do ./curl.sh & done  # Most of them get 503-s.
+./build/http_load_generator --connections=32 --keepalive=0 --duration=10  # Admitted requests wait under 2 s.
+curl -s localhost:8080/stats | grep -e shed -e queue_seconds_sum
+curl localhost:8080 & sleep 0.1 ; pkill -INT http_thread_pool  # The request still gets its response.
+*/
+
+#include <csignal>
+#include <sstream>
+#include <thread>
+
+#include "posix_http_server.h"
+#include "signal_waiter.h"
+
+const int kPort = 8080;
+const size_t kThreads = 4;
+const size_t kQueueCapacity = 16;
+
+int main() {
+  SignalWaiter signals({SIGTERM, SIGINT});
+  Socket s(kPort);
+  HTTPThreadPoolServer server(s,
+                              [](HTTPConnection& c) {
+                                if (ServeHTTPMetricsIfRequested(c)) {
+                                  return;
+                                }
+                                std::ostringstream os;
+                                os << "BAZINGA\n" << c.Method() << "(" << c.URL() << ")\n";
+                                if (c.HasBody()) {
+                                  os << c.Body() << '\n';
+                                }
+                                std::this_thread::sleep_for(std::chrono::seconds(1));
+                                c.SendHTTPResponse(os.str(), HTTPResponseCode::OK);
+                              },
+                              kThreads,
+                              kQueueCapacity,
+                              HTTPServerOverloadPolicy::RespondServiceUnavailable);
+  AdmissionControlOptions admission;
+  admission.target = std::chrono::milliseconds(500);
+  admission.interval = std::chrono::milliseconds(2000);
+  server.SetAdmissionControl(admission, [](const HTTPConnection& c) {
+    const StringView path = c.ParsedURL().Path();
+    if (path == "/health") {
+      return AdmissionPriority::High;
+    }
+    return path.substr(0, 7) == "/batch/" ? AdmissionPriority::Low : AdmissionPriority::Normal;
+  });
+  std::thread accepting([&server]() { server.Run(); });
+  signals.Wait();
+  server.Shutdown();
+  accepting.join();
+}
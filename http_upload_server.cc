@@ -0,0 +1,38 @@
+// An HTTP server that accepts uploads of any size in constant memory, by streaming request bodies.
+// Replies with the number of bytes received and their checksum.
+
+/*
+# To test:
+curl -d DATA localhost:8080
+head -c 500000000 /dev/zero | curl -s -T - localhost:8080  # Chunked, half a gigabyte.
+curl -s --data-binary @/some/large/file localhost:8080
+*/
+
+#include <cstdint>
+#include <sstream>
+
+#include "http_streaming_parser.h"
+
+const int kPort = 8080;
+
+int main() {
+  Socket s(kPort);
+  while (true) {
+    try {
+      StreamingHTTPConnection c(s.Accept());
+      do {
+        // FNV-1a, computed piece by piece as the body arrives.
+        uint64_t checksum = 14695981039346656037ull;
+        const size_t length = c.ReadBody([&checksum](const char* data, size_t length) {
+          for (size_t i = 0; i < length; ++i) {
+            checksum = (checksum ^ static_cast<uint8_t>(data[i])) * 1099511628211ull;
+          }
+        });
+        std::ostringstream os;
+        os << c.Method() << "(" << c.URL() << "): " << length << " bytes, checksum " << std::hex << checksum << '\n';
+        c.SendHTTPResponse(os.str());
+      } while (c.NextRequest());
+    } catch (NetworkException&) {
+    }
+  }
+}
@@ -0,0 +1,196 @@
+#ifndef TOY_HTTP_URL_H
+#define TOY_HTTP_URL_H
+
+// The parts of a request target: "/path?query#fragment".
+//
+// `HTTPURL` is a view into the URL as the parser has received it, and is split into path, query and fragment
+// on first access. `HTTPQueryIterator` walks the `key=value` pairs of the query string, scanning for the
+// delimiters and escapes a vector register at a time. Keys and values without escapes are returned as views
+// into the URL; only the ones with '%' or '+' in them are decoded, into a buffer owned by the iterator
+// and reused for every parameter, so a long query string is walked without a heap allocation per parameter.
+
+#include <cstddef>
+#include <string>
+
+#include "http_scanner.h"
+#include "string_view.h"
+
+// Returns the value of the hex digit `c`, or -1 if it is not one.
+inline int HTTPHexDigitValue(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  } else if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  } else if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  } else {
+    return -1;
+  }
+}
+
+// Decodes `%XX` escapes, and '+' into ' ' if `plus_as_space` is set, as in query strings.
+// Malformed escapes are kept as they are. Writes at most `length` bytes to `output`, and returns their number.
+inline size_t HTTPPercentDecode(const char* data, size_t length, char* output, bool plus_as_space) {
+  size_t n = 0;
+  for (size_t i = 0; i < length; ++i) {
+    const char c = data[i];
+    if (c == '%' && i + 2 < length) {
+      const int hi = HTTPHexDigitValue(data[i + 1]);
+      const int lo = HTTPHexDigitValue(data[i + 2]);
+      if (hi >= 0 && lo >= 0) {
+        output[n++] = static_cast<char>(hi * 16 + lo);
+        i += 2;
+        continue;
+      }
+    }
+    output[n++] = (c == '+' && plus_as_space) ? ' ' : c;
+  }
+  return n;
+}
+
+// Appends the decoded `input` to `*output`.
+inline void HTTPPercentDecode(const StringView& input, std::string* output, bool plus_as_space = false) {
+  const size_t offset = output->size();
+  output->resize(offset + input.size());
+  output->resize(offset + HTTPPercentDecode(input.data(), input.size(), &(*output)[offset], plus_as_space));
+}
+
+class HTTPQueryIterator final {
+ public:
+  explicit HTTPQueryIterator(const StringView& query) : rest_(query) {
+  }
+
+  // Moves to the next parameter, skipping the empty ones, as in "a=1&&b=2". Returns false past the last one.
+  // The views returned by `Key()` and `Value()` are valid until the next call.
+  bool Next() {
+    while (!rest_.empty()) {
+      size_t equals;
+      bool escaped;
+      const size_t end = HTTPScanQueryParameter(rest_.data(), rest_.size(), &equals, &escaped);
+      const StringView parameter = rest_.substr(0, end);
+      rest_ = rest_.substr(end + 1);
+      if (parameter.empty()) {
+        continue;
+      }
+      StringView key = parameter;
+      StringView value;
+      if (equals != kHTTPScanNone) {
+        key = parameter.substr(0, equals);
+        value = parameter.substr(equals + 1);
+      }
+      escaped_ = escaped;
+      if (escaped) {
+        decoded_.resize(parameter.size());
+        char* output = &decoded_[0];
+        const size_t key_size = HTTPPercentDecode(key.data(), key.size(), output, true);
+        const size_t value_size = HTTPPercentDecode(value.data(), value.size(), output + key_size, true);
+        key_ = StringView(output, key_size);
+        value_ = StringView(output + key_size, value_size);
+      } else {
+        key_ = key;
+        value_ = value;
+      }
+      return true;
+    }
+    return false;
+  }
+
+  StringView Key() const {
+    return key_;
+  }
+
+  StringView Value() const {
+    return value_;
+  }
+
+  // Whether `Key()` and `Value()` have been decoded into the buffer of the iterator, rather than point into
+  // the URL.
+  bool Decoded() const {
+    return escaped_;
+  }
+
+ private:
+  StringView rest_;
+  StringView key_;
+  StringView value_;
+  bool escaped_ = false;
+  std::string decoded_;
+};
+
+class HTTPURL final {
+ public:
+  HTTPURL() = default;
+
+  explicit HTTPURL(const StringView& url) : url_(url) {
+  }
+
+  StringView Full() const {
+    return url_;
+  }
+
+  // The path, still percent-encoded, as "/a%20b" may not be the same resource as "/a/b" after decoding.
+  StringView Path() const {
+    Split();
+    return path_;
+  }
+
+  // The query string, without the leading '?'. Empty if there is none.
+  StringView Query() const {
+    Split();
+    return query_;
+  }
+
+  // The fragment, without the leading '#'. Clients do not normally send it.
+  StringView Fragment() const {
+    Split();
+    return fragment_;
+  }
+
+  HTTPQueryIterator QueryParameters() const {
+    return HTTPQueryIterator(Query());
+  }
+
+  // Looks up the first query parameter named `key`, comparing decoded keys. Returns false if there is none.
+  // `*value` is a view into the URL, or into `*scratch` if the parameter had to be decoded.
+  bool GetQueryParameter(const StringView& key, StringView* value, std::string* scratch) const {
+    HTTPQueryIterator it(Query());
+    while (it.Next()) {
+      if (it.Key() == key) {
+        if (it.Decoded()) {
+          scratch->assign(it.Value().data(), it.Value().size());
+          *value = StringView(*scratch);
+        } else {
+          *value = it.Value();
+        }
+        return true;
+      }
+    }
+    return false;
+  }
+
+ private:
+  void Split() const {
+    if (split_) {
+      return;
+    }
+    split_ = true;
+    const size_t hash = url_.find('#');
+    const StringView before_fragment = url_.substr(0, hash);
+    if (hash != StringView::npos) {
+      fragment_ = url_.substr(hash + 1);
+    }
+    const size_t question = before_fragment.find('?');
+    path_ = before_fragment.substr(0, question);
+    if (question != StringView::npos) {
+      query_ = before_fragment.substr(question + 1);
+    }
+  }
+
+  StringView url_;
+  mutable bool split_ = false;
+  mutable StringView path_;
+  mutable StringView query_;
+  mutable StringView fragment_;
+};
+
+#endif  // TOY_HTTP_URL_H
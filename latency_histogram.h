@@ -0,0 +1,127 @@
+#ifndef TOY_LATENCY_HISTOGRAM_H
+#define TOY_LATENCY_HISTOGRAM_H
+
+// A fixed-size log-linear histogram in the spirit of HdrHistogram: values below 2^kLatencyHistogramPrecisionBits
+// are recorded exactly, larger ones with a relative error under 2^-(kLatencyHistogramPrecisionBits - 1),
+// i.e. 1.6%. Recording is a couple of bit operations and one increment, with no allocations.
+// Histograms recorded in different threads are combined with `Merge()`.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+const int kLatencyHistogramPrecisionBits = 7;
+
+class LatencyHistogram final {
+ public:
+  LatencyHistogram() {
+    Reset();
+  }
+
+  void Reset() {
+    std::fill(buckets_, buckets_ + kBuckets, 0);
+    count_ = 0;
+    sum_ = 0;
+    min_ = std::numeric_limits<uint64_t>::max();
+    max_ = 0;
+  }
+
+  void Record(uint64_t value) {
+    ++buckets_[BucketIndex(value)];
+    ++count_;
+    sum_ += value;
+    min_ = std::min(min_, value);
+    max_ = std::max(max_, value);
+  }
+
+  void Merge(const LatencyHistogram& rhs) {
+    for (size_t i = 0; i < kBuckets; ++i) {
+      buckets_[i] += rhs.buckets_[i];
+    }
+    count_ += rhs.count_;
+    sum_ += rhs.sum_;
+    min_ = std::min(min_, rhs.min_);
+    max_ = std::max(max_, rhs.max_);
+  }
+
+  uint64_t Count() const {
+    return count_;
+  }
+
+  uint64_t Sum() const {
+    return sum_;
+  }
+
+  uint64_t Min() const {
+    return count_ ? min_ : 0;
+  }
+
+  uint64_t Max() const {
+    return max_;
+  }
+
+  double Mean() const {
+    return count_ ? static_cast<double>(sum_) / count_ : 0.0;
+  }
+
+  // The smallest recorded value such that `percentile` percent of all the values are less than or equal to it,
+  // up to the precision of the bucket; reported as the highest value of that bucket, but never above `Max()`.
+  uint64_t ValueAtPercentile(double percentile) const {
+    if (!count_) {
+      return 0;
+    }
+    const double fraction = std::min(std::max(percentile, 0.0), 100.0) / 100.0;
+    const uint64_t rank = std::max(static_cast<uint64_t>(fraction * count_ + 0.5), static_cast<uint64_t>(1));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kBuckets; ++i) {
+      seen += buckets_[i];
+      if (seen >= rank) {
+        return std::min(std::max(BucketHighestValue(i), min_), max_);
+      }
+    }
+    return max_;
+  }
+
+  // Bucket-level access, to export the whole distribution. Buckets cover increasing, contiguous ranges of values.
+  static size_t BucketsCount() {
+    return kBuckets;
+  }
+
+  static uint64_t BucketHighestValue(size_t index) {
+    if (index < kSubBuckets) {
+      return index;
+    }
+    const size_t magnitude = index / kHalfSubBuckets - 1;
+    const uint64_t lowest = static_cast<uint64_t>(index % kHalfSubBuckets + kHalfSubBuckets) << magnitude;
+    return lowest + ((static_cast<uint64_t>(1) << magnitude) - 1);
+  }
+
+  uint64_t BucketCount(size_t index) const {
+    return buckets_[index];
+  }
+
+ private:
+  static const size_t kSubBuckets = static_cast<size_t>(1) << kLatencyHistogramPrecisionBits;
+  static const size_t kHalfSubBuckets = kSubBuckets / 2;
+  // Values of up to 64 bits: exact ones, then one half-range of sub-buckets per power of two above them.
+  static const size_t kBuckets = kSubBuckets + (64 - kLatencyHistogramPrecisionBits) * kHalfSubBuckets;
+
+  static size_t BucketIndex(uint64_t value) {
+    if (value < kSubBuckets) {
+      return static_cast<size_t>(value);
+    }
+    const int msb = 63 - __builtin_clzll(value);
+    const int magnitude = msb - kLatencyHistogramPrecisionBits + 1;
+    return static_cast<size_t>(magnitude + 1) * kHalfSubBuckets + static_cast<size_t>(value >> magnitude) -
+           kHalfSubBuckets;
+  }
+
+  uint64_t buckets_[kBuckets];
+  uint64_t count_;
+  uint64_t sum_;
+  uint64_t min_;
+  uint64_t max_;
+};
+
+#endif  // TOY_LATENCY_HISTOGRAM_H
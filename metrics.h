@@ -0,0 +1,346 @@
+#ifndef TOY_METRICS_H
+#define TOY_METRICS_H
+
+// Always-on server metrics: counters and latency histograms, updated on the hot path at the cost of a few
+// nanoseconds, and aggregated only when read.
+// Every thread updates its own slot, padded to not share cache lines with other threads' slots, with relaxed
+// atomic loads and stores and no read-modify-write instructions, as no other thread ever writes to it.
+// When a thread exits, its values are folded into the totals and its slot is recycled for the next thread.
+// Compile with `-DTOY_NO_METRICS` to turn all of it into no-ops.
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define TOY_METRICS_TSC
+#include <x86intrin.h>
+#endif
+
+// The counters: `X(enum name, Prometheus name, Prometheus labels, help)`.
+// Consecutive counters with the same name are exported as one metric with different labels.
+#define TOY_METRICS_COUNTERS(X)                                                                                   \
+  X(Accepts, "toy_accepts_total", "", "Connections accepted.")                                                    \
+  X(AcceptErrors, "toy_accept_errors_total", "", "Failed accept() calls.")                                        \
+  X(Connects, "toy_connects_total", "", "Outbound connections established.")                                      \
+  X(ConnectErrors, "toy_connect_errors_total", "", "Failed outbound connection attempts.")                        \
+  X(Reads, "toy_reads_total", "", "Socket reads that returned data or the end of the stream.")                    \
+  X(ReadBytes, "toy_read_bytes_total", "", "Bytes read from sockets.")                                            \
+  X(ReadErrors, "toy_read_errors_total", "", "Failed socket reads, timeouts included.")                           \
+  X(Writes, "toy_writes_total", "", "Socket write, sendfile() and splice() calls.")                               \
+  X(WrittenBytes, "toy_written_bytes_total", "", "Bytes written to sockets.")                                     \
+  X(WriteErrors, "toy_write_errors_total", "", "Failed socket writes.")                                           \
+  X(HTTPRequests, "toy_http_requests_total", "", "HTTP requests parsed.")                                         \
+  X(HTTPParseErrors, "toy_http_parse_errors_total", "", "HTTP requests rejected as malformed.")                   \
+  X(HTTPTimeouts, "toy_http_timeouts_total", "", "HTTP connections closed on a read or write deadline.")          \
+  X(HTTPShedRequests, "toy_http_shed_requests_total", "", "HTTP requests answered 503 to shed load.")             \
+  X(HTTPResponses1xx, "toy_http_responses_total", "{class=\"1xx\"}", "HTTP responses, by status class.")          \
+  X(HTTPResponses2xx, "toy_http_responses_total", "{class=\"2xx\"}", "HTTP responses, by status class.")          \
+  X(HTTPResponses3xx, "toy_http_responses_total", "{class=\"3xx\"}", "HTTP responses, by status class.")          \
+  X(HTTPResponses4xx, "toy_http_responses_total", "{class=\"4xx\"}", "HTTP responses, by status class.")          \
+  X(HTTPResponses5xx, "toy_http_responses_total", "{class=\"5xx\"}", "HTTP responses, by status class.")          \
+  X(HTTPCacheHits, "toy_http_cache_lookups_total", "{result=\"hit\"}", "Response cache lookups.")                 \
+  X(HTTPCacheNotModified, "toy_http_cache_lookups_total", "{result=\"not_modified\"}", "Response cache lookups.") \
+  X(HTTPCacheMisses, "toy_http_cache_lookups_total", "{result=\"miss\"}", "Response cache lookups.")
+
+// The histograms: `X(enum name, Prometheus name, help)`.
+#define TOY_METRICS_HISTOGRAMS(X)                                                                            \
+  X(HTTPParseTime, "toy_http_parse_seconds", "From the first bytes of a request to its headers being parsed.") \
+  X(HTTPHandlerTime, "toy_http_handler_seconds", "From a request being parsed to its response being started.") \
+  X(HTTPResponseWriteTime, "toy_http_response_write_seconds", "Writing a response with a known length.")       \
+  X(HTTPQueueTime, "toy_http_queue_seconds", "From a connection being accepted to a worker taking it up.")
+
+enum class MetricsCounter : int {
+#define TOY_METRICS_COUNTER_ENUM(name, metric, labels, help) name,
+  TOY_METRICS_COUNTERS(TOY_METRICS_COUNTER_ENUM)
+#undef TOY_METRICS_COUNTER_ENUM
+      Count
+};
+
+enum class MetricsHistogram : int {
+#define TOY_METRICS_HISTOGRAM_ENUM(name, metric, help) name,
+  TOY_METRICS_HISTOGRAMS(TOY_METRICS_HISTOGRAM_ENUM)
+#undef TOY_METRICS_HISTOGRAM_ENUM
+      Count
+};
+
+const size_t kMetricsCounters = static_cast<size_t>(MetricsCounter::Count);
+const size_t kMetricsHistograms = static_cast<size_t>(MetricsHistogram::Count);
+
+// Bucket `i` of every histogram holds durations below 2^(i + 10) ns, that is from about 1us to about 4s,
+// and the last one holds everything above.
+const size_t kMetricsHistogramBuckets = 24;
+const int kMetricsHistogramFirstBucketBits = 10;
+
+const size_t kCacheLineSize = 64;
+
+// Timestamps for the histograms: the TSC on x86, which is much cheaper to read than the system clock,
+// and the steady clock elsewhere. Only differences of two timestamps are meaningful.
+class MetricsClock final {
+ public:
+  static uint64_t Now() {
+#if defined(TOY_NO_METRICS)
+    return 0;
+#elif defined(TOY_METRICS_TSC)
+    return __rdtsc();
+#else
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+            .count());
+#endif
+  }
+
+  static uint64_t ToNanoseconds(uint64_t ticks) {
+#ifdef TOY_METRICS_TSC
+    return static_cast<uint64_t>(ticks * NanosecondsPerTick());
+#else
+    return ticks;
+#endif
+  }
+
+  // Measures the TSC frequency against the steady clock, once per process, taking a few milliseconds.
+  static double NanosecondsPerTick() {
+#ifdef TOY_METRICS_TSC
+    static const double value = []() {
+      const auto begin = std::chrono::steady_clock::now();
+      const uint64_t begin_ticks = __rdtsc();
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+      const auto end = std::chrono::steady_clock::now();
+      const uint64_t end_ticks = __rdtsc();
+      return std::chrono::duration<double, std::nano>(end - begin).count() / (end_ticks - begin_ticks);
+    }();
+    return value;
+#else
+    return 1.0;
+#endif
+  }
+};
+
+// A consistent-enough copy of all the metrics, summed over all the threads.
+struct MetricsSnapshot {
+  uint64_t counters[kMetricsCounters] = {};
+  uint64_t buckets[kMetricsHistograms][kMetricsHistogramBuckets] = {};
+  uint64_t sums_ns[kMetricsHistograms] = {};
+
+  uint64_t Counter(MetricsCounter counter) const {
+    return counters[static_cast<size_t>(counter)];
+  }
+
+  // Prometheus text exposition format: https://prometheus.io/docs/instrumenting/exposition_formats/
+  std::string AsPrometheusText() const {
+    static const char* const kCounterNames[] = {
+#define TOY_METRICS_COUNTER_NAME(name, metric, labels, help) metric,
+        TOY_METRICS_COUNTERS(TOY_METRICS_COUNTER_NAME)
+#undef TOY_METRICS_COUNTER_NAME
+    };
+    static const char* const kCounterLabels[] = {
+#define TOY_METRICS_COUNTER_LABELS(name, metric, labels, help) labels,
+        TOY_METRICS_COUNTERS(TOY_METRICS_COUNTER_LABELS)
+#undef TOY_METRICS_COUNTER_LABELS
+    };
+    static const char* const kCounterHelp[] = {
+#define TOY_METRICS_COUNTER_HELP(name, metric, labels, help) help,
+        TOY_METRICS_COUNTERS(TOY_METRICS_COUNTER_HELP)
+#undef TOY_METRICS_COUNTER_HELP
+    };
+    static const char* const kHistogramNames[] = {
+#define TOY_METRICS_HISTOGRAM_NAME(name, metric, help) metric,
+        TOY_METRICS_HISTOGRAMS(TOY_METRICS_HISTOGRAM_NAME)
+#undef TOY_METRICS_HISTOGRAM_NAME
+    };
+    static const char* const kHistogramHelp[] = {
+#define TOY_METRICS_HISTOGRAM_HELP(name, metric, help) help,
+        TOY_METRICS_HISTOGRAMS(TOY_METRICS_HISTOGRAM_HELP)
+#undef TOY_METRICS_HISTOGRAM_HELP
+    };
+
+    std::string result;
+    char line[256];
+    for (size_t i = 0; i < kMetricsCounters; ++i) {
+      if (!i || std::string(kCounterNames[i]) != kCounterNames[i - 1]) {
+        snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s counter\n", kCounterNames[i], kCounterHelp[i],
+                 kCounterNames[i]);
+        result += line;
+      }
+      snprintf(line, sizeof(line), "%s%s %llu\n", kCounterNames[i], kCounterLabels[i],
+               static_cast<unsigned long long>(counters[i]));
+      result += line;
+    }
+    for (size_t h = 0; h < kMetricsHistograms; ++h) {
+      const char* const name = kHistogramNames[h];
+      snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s histogram\n", name, kHistogramHelp[h], name);
+      result += line;
+      uint64_t cumulative = 0;
+      for (size_t b = 0; b < kMetricsHistogramBuckets; ++b) {
+        cumulative += buckets[h][b];
+        if (b + 1 < kMetricsHistogramBuckets) {
+          const double le = static_cast<double>(1ull << (b + kMetricsHistogramFirstBucketBits)) * 1e-9;
+          snprintf(line, sizeof(line), "%s_bucket{le=\"%g\"} %llu\n", name, le,
+                   static_cast<unsigned long long>(cumulative));
+        } else {
+          snprintf(line, sizeof(line), "%s_bucket{le=\"+Inf\"} %llu\n", name,
+                   static_cast<unsigned long long>(cumulative));
+        }
+        result += line;
+      }
+      snprintf(line, sizeof(line), "%s_sum %.9f\n%s_count %llu\n", name, sums_ns[h] * 1e-9, name,
+               static_cast<unsigned long long>(cumulative));
+      result += line;
+    }
+    return result;
+  }
+};
+
+// The metrics of one thread. Only the owning thread writes to it.
+struct MetricsSlot {
+  char padding_before[kCacheLineSize];
+  std::atomic<uint64_t> counters[kMetricsCounters];
+  std::atomic<uint64_t> buckets[kMetricsHistograms][kMetricsHistogramBuckets];
+  std::atomic<uint64_t> sums_ns[kMetricsHistograms];
+  char padding_after[kCacheLineSize];
+
+  MetricsSlot() {
+    Clear();
+  }
+
+  void Clear() {
+    for (auto& c : counters) {
+      c.store(0, std::memory_order_relaxed);
+    }
+    for (auto& histogram : buckets) {
+      for (auto& b : histogram) {
+        b.store(0, std::memory_order_relaxed);
+      }
+    }
+    for (auto& s : sums_ns) {
+      s.store(0, std::memory_order_relaxed);
+    }
+  }
+
+  void AddTo(MetricsSnapshot& snapshot) const {
+    for (size_t i = 0; i < kMetricsCounters; ++i) {
+      snapshot.counters[i] += counters[i].load(std::memory_order_relaxed);
+    }
+    for (size_t h = 0; h < kMetricsHistograms; ++h) {
+      for (size_t b = 0; b < kMetricsHistogramBuckets; ++b) {
+        snapshot.buckets[h][b] += buckets[h][b].load(std::memory_order_relaxed);
+      }
+      snapshot.sums_ns[h] += sums_ns[h].load(std::memory_order_relaxed);
+    }
+  }
+
+  // Single writer, so a plain load and store do, without the cost of a locked `fetch_add()`.
+  static void Increment(std::atomic<uint64_t>& value, uint64_t delta) {
+    value.store(value.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+  }
+};
+
+// All the slots in use, and the totals of the threads that have exited.
+class MetricsRegistry final {
+ public:
+  static MetricsRegistry& Instance() {
+    static MetricsRegistry* instance = new MetricsRegistry();  // Never destroyed, to outlive all the threads.
+    return *instance;
+  }
+
+  MetricsSlot* AcquireSlot() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    MetricsSlot* slot;
+    if (free_.empty()) {
+      slot = new MetricsSlot();
+    } else {
+      slot = free_.back();
+      free_.pop_back();
+    }
+    active_.push_back(slot);
+    return slot;
+  }
+
+  void ReleaseSlot(MetricsSlot* slot) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    slot->AddTo(retired_);
+    slot->Clear();
+    for (auto& s : active_) {
+      if (s == slot) {
+        s = active_.back();
+        active_.pop_back();
+        break;
+      }
+    }
+    free_.push_back(slot);
+  }
+
+  MetricsSnapshot Snapshot() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    MetricsSnapshot result = retired_;
+    for (const MetricsSlot* slot : active_) {
+      slot->AddTo(result);
+    }
+    return result;
+  }
+
+ private:
+  MetricsRegistry() = default;
+
+  std::mutex mutex_;
+  std::vector<MetricsSlot*> active_;
+  std::vector<MetricsSlot*> free_;
+  MetricsSnapshot retired_;
+};
+
+// Owns the slot of the current thread, from its first metric update until the thread exits.
+class MetricsThreadSlot final {
+ public:
+  MetricsThreadSlot() : slot_(MetricsRegistry::Instance().AcquireSlot()) {
+  }
+
+  ~MetricsThreadSlot() {
+    MetricsRegistry::Instance().ReleaseSlot(slot_);
+  }
+
+  static MetricsSlot& Get() {
+    static thread_local MetricsThreadSlot instance;
+    return *instance.slot_;
+  }
+
+ private:
+  MetricsSlot* const slot_;
+};
+
+inline void MetricsAdd(MetricsCounter counter, uint64_t delta = 1) {
+#ifndef TOY_NO_METRICS
+  MetricsSlot::Increment(MetricsThreadSlot::Get().counters[static_cast<size_t>(counter)], delta);
+#endif
+}
+
+inline void MetricsRecordNanoseconds(MetricsHistogram histogram, uint64_t ns) {
+#ifndef TOY_NO_METRICS
+  const uint64_t scaled = ns >> kMetricsHistogramFirstBucketBits;
+  size_t bucket = scaled ? static_cast<size_t>(64 - __builtin_clzll(scaled)) : 0;
+  if (bucket >= kMetricsHistogramBuckets) {
+    bucket = kMetricsHistogramBuckets - 1;
+  }
+  MetricsSlot& slot = MetricsThreadSlot::Get();
+  const size_t h = static_cast<size_t>(histogram);
+  MetricsSlot::Increment(slot.buckets[h][bucket], 1);
+  MetricsSlot::Increment(slot.sums_ns[h], ns);
+#endif
+}
+
+// Records the duration between two `MetricsClock::Now()` timestamps.
+inline void MetricsRecord(MetricsHistogram histogram, uint64_t begin_ticks, uint64_t end_ticks) {
+  MetricsRecordNanoseconds(histogram,
+                           MetricsClock::ToNanoseconds(end_ticks > begin_ticks ? end_ticks - begin_ticks : 0));
+}
+
+inline MetricsSnapshot MetricsSnapshotOfAllThreads() {
+  return MetricsRegistry::Instance().Snapshot();
+}
+
+#endif  // TOY_METRICS_H
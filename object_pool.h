@@ -0,0 +1,71 @@
+#ifndef TOY_OBJECT_POOL_H
+#define TOY_OBJECT_POOL_H
+
+// Per-thread recycling of heavyweight objects, such as receive buffers, between connections.
+// `PooledObject<T>` takes a `T` from the free list of the current thread, or creates one if the list is empty,
+// and returns it there when destroyed. The objects keep their capacity, so in steady state a worker thread
+// serves new connections without heap allocations.
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+const size_t kDefaultMaxPooledObjectsPerThread = 64;
+
+template <typename T, size_t MAX_POOLED = kDefaultMaxPooledObjectsPerThread>
+class PooledObject final {
+ public:
+  PooledObject() : object_(Acquire()) {
+  }
+
+  PooledObject(PooledObject&& rhs) : object_(std::move(rhs.object_)) {
+  }
+
+  ~PooledObject() {
+    if (object_) {
+      FreeList& free_list = ThreadFreeList();
+      if (free_list.objects.size() < MAX_POOLED) {
+        free_list.objects.push_back(std::move(object_));
+      }
+    }
+  }
+
+  T& operator*() const {
+    return *object_;
+  }
+
+  T* operator->() const {
+    return object_.get();
+  }
+
+ private:
+  struct FreeList {
+    std::vector<std::unique_ptr<T>> objects;
+    FreeList() {
+      objects.reserve(MAX_POOLED);
+    }
+  };
+
+  static FreeList& ThreadFreeList() {
+    static thread_local FreeList free_list;
+    return free_list;
+  }
+
+  static std::unique_ptr<T> Acquire() {
+    FreeList& free_list = ThreadFreeList();
+    if (free_list.objects.empty()) {
+      return std::unique_ptr<T>(new T());
+    }
+    std::unique_ptr<T> result = std::move(free_list.objects.back());
+    free_list.objects.pop_back();
+    return result;
+  }
+
+  std::unique_ptr<T> object_;
+
+  PooledObject(const PooledObject&) = delete;
+  void operator=(const PooledObject&) = delete;
+  void operator=(PooledObject&&) = delete;
+};
+
+#endif  // TOY_OBJECT_POOL_H
@@ -0,0 +1,243 @@
+#ifndef TOY_POSIX_EPOLL_SERVER_H
+#define TOY_POSIX_EPOLL_SERVER_H
+
+// An edge-triggered epoll reactor: one thread multiplexes the listening `Socket` and all accepted connections,
+// so idle keep-alive connections cost a few hundred bytes each instead of a kernel thread each.
+// Connection deadlines are kept in a `TimerWheel` driven by the same thread, with no locking.
+
+#include <chrono>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <sys/epoll.h>
+
+#include "exceptions.h"
+#include "posix_tcp_server.h"
+#include "timer_wheel.h"
+
+const size_t kDefaultMaxEpollEvents = 256;
+const std::chrono::milliseconds kDefaultEpollTimerResolution = std::chrono::milliseconds(100);
+
+enum class EpollAction : int { KeepOpen, Close };
+
+// `HANDLER` is the per-connection state machine. It is constructed once per accepted connection and must provide:
+//   explicit HANDLER(GenericConnection&& c);
+//   EpollAction OnReadable();  // Must read until `kWouldBlock`, since the events are edge-triggered.
+//   EpollAction OnWritable();  // Called when the socket send buffer has room again.
+//   std::chrono::steady_clock::time_point Deadline() const;  // Asked after each call; `time_point::max()` for none.
+//   EpollAction OnTimeout();   // Called once the deadline has passed, up to one timer resolution late.
+// Returning `EpollAction::Close` destroys the handler, which closes the connection.
+template <typename HANDLER>
+class EpollServer final {
+ public:
+  explicit EpollServer(Socket& socket,
+                       const size_t max_events = kDefaultMaxEpollEvents,
+                       std::chrono::milliseconds timer_resolution = kDefaultEpollTimerResolution)
+      : socket_(socket),
+        epoll_fd_(epoll_create1(0)),
+        events_(max_events),
+        timer_resolution_(timer_resolution.count() > 0 ? timer_resolution : std::chrono::milliseconds(1)),
+        epoch_(std::chrono::steady_clock::now()) {
+    if (epoll_fd_ < 0) {
+      throw EpollCreateException();
+    }
+    socket_.MakeNonBlocking();
+    epoll_event e;
+    e.events = EPOLLIN | EPOLLET;
+    e.data.ptr = nullptr;  // `nullptr` stands for the listening socket.
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, socket_.Descriptor(), &e)) {
+      close(epoll_fd_);
+      throw EpollControlException();
+    }
+  }
+
+  ~EpollServer() {
+    for (auto& connection : connections_) {
+      timers_.Cancel(connection.second.get());
+    }
+    close(epoll_fd_);
+  }
+
+  void Run() {
+    while (true) {
+      RunOnce(-1);
+    }
+  }
+
+  // Waits up to `timeout_ms` milliseconds, -1 meaning forever, and dispatches all ready events and expired
+  // deadlines. While any deadline is pending, waits for at most one timer resolution.
+  // Returns the number of events processed.
+  size_t RunOnce(int timeout_ms) {
+    if ((!timers_.Empty() || accept_paused_) && (timeout_ms < 0 || timeout_ms > timer_resolution_.count())) {
+      timeout_ms = static_cast<int>(timer_resolution_.count());
+    }
+    const int n = epoll_wait(epoll_fd_, &events_[0], static_cast<int>(events_.size()), timeout_ms);
+    if (n < 0) {
+      if (errno == EINTR) {
+        return 0;
+      }
+      throw EpollWaitException();
+    }
+    for (int i = 0; i < n; ++i) {
+      const epoll_event& e = events_[i];
+      if (!e.data.ptr) {
+        AcceptAll();
+      } else {
+        Dispatch(reinterpret_cast<Entry*>(e.data.ptr), e.events);
+      }
+    }
+    // The connections left queued raise no new edge, so they are retried for.
+    if (accept_paused_ && std::chrono::steady_clock::now() >= accept_resume_) {
+      AcceptAll();
+    }
+    if (!timers_.Empty()) {
+      timers_.Advance(ElapsedTicks(std::chrono::steady_clock::now()),
+                      [this](TimerWheelEntry* timer) { Expire(static_cast<Entry*>(timer)); });
+    }
+    return static_cast<size_t>(n);
+  }
+
+  // Stops accepting, and serves the open connections until their handlers close them all, for at most `timeout`.
+  // Returns false if some are still open by then. The listening socket stays open, to be handed off or closed.
+  bool Drain(std::chrono::milliseconds timeout) {
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, socket_.Descriptor(), nullptr);
+    draining_ = true;
+    accept_paused_ = false;
+    const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + timeout;
+    while (!connections_.empty()) {
+      const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+      if (now >= deadline) {
+        return false;
+      }
+      RunOnce(static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count()) + 1);
+    }
+    return true;
+  }
+
+  size_t ConnectionsCount() const {
+    return connections_.size();
+  }
+
+ private:
+  struct Entry : TimerWheelEntry {
+    const int fd;
+    HANDLER handler;
+    Entry(int fd, GenericConnection&& c) : fd(fd), handler(std::move(c)) {
+    }
+  };
+
+  // Rounded up, for deadlines to never fire early.
+  uint64_t Ticks(std::chrono::steady_clock::time_point t) const {
+    return static_cast<uint64_t>((t - epoch_ + timer_resolution_ - std::chrono::nanoseconds(1)) / timer_resolution_);
+  }
+
+  // Rounded down, for the timers to never be advanced ahead of the clock.
+  uint64_t ElapsedTicks(std::chrono::steady_clock::time_point t) const {
+    return static_cast<uint64_t>((t - epoch_) / timer_resolution_);
+  }
+
+  // Out of descriptors, stops accepting for one timer resolution, serving the open connections meanwhile.
+  void AcceptAll() {
+    if (draining_) {
+      return;
+    }
+    accept_paused_ = false;
+    int fd;
+    while (true) {
+      try {
+        fd = socket_.NonBlockingAccept();
+      } catch (const SocketAcceptNoResourcesException&) {
+        PauseAccepting();
+        return;
+      }
+      if (fd == -1) {
+        return;
+      }
+      std::unique_ptr<Entry> entry(new Entry(fd, GenericConnection(fd)));
+      epoll_event e;
+      e.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+      e.data.ptr = entry.get();
+      if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &e)) {
+        // Over `max_user_watches`, or out of kernel memory: the connection is dropped, as it can not be watched.
+        if (errno == ENOSPC || errno == ENOMEM) {
+          PauseAccepting();
+          return;
+        }
+        throw EpollControlException();
+      }
+      Entry* const raw = entry.get();
+      connections_[fd] = std::move(entry);
+      // Data may have arrived before the descriptor was registered; give the handler a chance to consume it.
+      Dispatch(raw, EPOLLIN);
+    }
+  }
+
+  void PauseAccepting() {
+    accept_paused_ = true;
+    accept_resume_ = std::chrono::steady_clock::now() + timer_resolution_;
+  }
+
+  void Dispatch(Entry* entry, const uint32_t events) {
+    EpollAction action = EpollAction::KeepOpen;
+    try {
+      if (events & (EPOLLERR | EPOLLHUP)) {
+        action = EpollAction::Close;
+      }
+      if (action == EpollAction::KeepOpen && (events & (EPOLLIN | EPOLLRDHUP))) {
+        action = entry->handler.OnReadable();
+      }
+      if (action == EpollAction::KeepOpen && (events & EPOLLOUT)) {
+        action = entry->handler.OnWritable();
+      }
+    } catch (NetworkException&) {
+      action = EpollAction::Close;
+    }
+    Complete(entry, action);
+  }
+
+  void Expire(Entry* entry) {
+    EpollAction action;
+    try {
+      action = entry->handler.OnTimeout();
+    } catch (NetworkException&) {
+      action = EpollAction::Close;
+    }
+    Complete(entry, action);
+  }
+
+  // Closes the connection, or schedules its next deadline.
+  void Complete(Entry* entry, EpollAction action) {
+    if (action == EpollAction::Close) {
+      timers_.Cancel(entry);
+      epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, entry->fd, nullptr);
+      connections_.erase(entry->fd);
+      return;
+    }
+    const std::chrono::steady_clock::time_point deadline = entry->handler.Deadline();
+    if (deadline == std::chrono::steady_clock::time_point::max()) {
+      timers_.Cancel(entry);
+    } else {
+      timers_.Schedule(entry, Ticks(deadline));
+    }
+  }
+
+  Socket& socket_;
+  const int epoll_fd_;
+  std::vector<epoll_event> events_;
+  const std::chrono::milliseconds timer_resolution_;
+  const std::chrono::steady_clock::time_point epoch_;
+  TimerWheel timers_;
+  std::unordered_map<int, std::unique_ptr<Entry>> connections_;
+  bool accept_paused_ = false;
+  bool draining_ = false;
+  std::chrono::steady_clock::time_point accept_resume_;
+
+  EpollServer(const EpollServer&) = delete;
+  EpollServer(EpollServer&&) = delete;
+  void operator=(const EpollServer&) = delete;
+  void operator=(EpollServer&&) = delete;
+};
+
+#endif  // TOY_POSIX_EPOLL_SERVER_H
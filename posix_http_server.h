@@ -3,21 +3,113 @@
 
 // HTTP message: http://www.w3.org/Protocols/rfc2616/rfc2616.html
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
 #include <map>
-#include <sstream>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
+#include <strings.h>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+
+#include "admission_control.h"
+#include "arena.h"
+#include "bounded_mpmc_queue.h"
+#include "connection_watchdog.h"
 #include "exceptions.h"
 #include "posix_tcp_server.h"
 #include "http_response_codes.h"
+#include "http_url.h"
+#include "metrics.h"
+#include "object_pool.h"
+#include "string_view.h"
 
 typedef std::vector<std::pair<std::string, std::string>> HTTPHeadersType;
 
+// How long a persistent connection may stay idle between requests before the server closes it.
+const std::chrono::milliseconds kDefaultHTTPKeepAliveTimeout = std::chrono::milliseconds(5000);
+
+const std::chrono::milliseconds kDefaultHTTPHeaderTimeout = std::chrono::milliseconds(10000);
+const std::chrono::milliseconds kDefaultHTTPBodyTimeout = std::chrono::milliseconds(30000);
+const std::chrono::milliseconds kDefaultHTTPWriteTimeout = std::chrono::milliseconds(30000);
+const size_t kDefaultHTTPMaxHeaderBytes = 64 * 1024;
+const size_t kDefaultHTTPMaxHeaders = 100;
+const size_t kDefaultHTTPMaxBodyBytes = 64 * 1024 * 1024;
+
+// Deadlines and size limits for each request, so that slow or oversized clients can not hold a worker
+// or its memory. Requests over the deadlines are answered with `408 Request Timeout`, requests over the limits
+// with `413 Request Entity Too Large`, and the connection is closed. A zero timeout disables the deadline.
+struct HTTPServerLimits {
+  // From accepting the connection, or from the first byte of a subsequent request on it, to the end of the headers.
+  std::chrono::milliseconds header_timeout = kDefaultHTTPHeaderTimeout;
+  // From the end of the headers to the end of the body.
+  std::chrono::milliseconds body_timeout = kDefaultHTTPBodyTimeout;
+  // For each response to be written out, except for the body of a chunked one.
+  std::chrono::milliseconds write_timeout = kDefaultHTTPWriteTimeout;
+  size_t max_header_bytes = kDefaultHTTPMaxHeaderBytes;  // The request line and the headers.
+  size_t max_headers = kDefaultHTTPMaxHeaders;
+  size_t max_body_bytes = kDefaultHTTPMaxBodyBytes;  // For the parsers that buffer the body whole.
+};
+
+// Receive buffers above this size are shrunk back before returning to the pool, to not hoard memory.
+const size_t kMaxPooledHTTPBufferSize = 64 * 1024;
+
+// Parses the value of the `Content-Length` header: decimal digits only, with no sign, and small enough
+// for the end of the body to be computed as an offset without overflowing. Throws `HTTPMalformedRequestException`
+// otherwise, as a body of unknown length can not be skipped safely.
+inline size_t ParseHTTPContentLength(const char* value, size_t length) {
+  const size_t kMaxContentLength = static_cast<size_t>(-1) / 2;
+  if (!length) {
+    throw HTTPMalformedRequestException();
+  }
+  size_t result = 0;
+  for (size_t i = 0; i < length; ++i) {
+    const char c = value[i];
+    if (c < '0' || c > '9' || result > (kMaxContentLength - 9) / 10) {
+      throw HTTPMalformedRequestException();
+    }
+    result = result * 10 + (c - '0');
+  }
+  return result;
+}
+
+// The allocation-heavy state of `HTTPHeaderParser`, recycled between connections by `PooledObject`.
+struct HTTPHeaderParserStorage {
+  std::vector<char> buffer;
+  std::string method;
+  std::string url;
+  Arena arena;  // For the headers of the current request.
+};
+
 class HTTPHeaderParser {
  public:
-  HTTPHeaderParser(const int intial_buffer_size = 1600, const int buffer_growth_k = 1.95)
-      : buffer_(intial_buffer_size), buffer_growth_k_(buffer_growth_k) {
+  HTTPHeaderParser(const int intial_buffer_size = 1600, const double buffer_growth_k = 1.95)
+      : method_(storage_->method),
+        url_(storage_->url),
+        buffer_(storage_->buffer),
+        buffer_growth_k_(buffer_growth_k),
+        headers_(std::less<ArenaString>(), ArenaAllocator<ArenaHeader>(storage_->arena)) {
+    if (buffer_.size() < static_cast<size_t>(intial_buffer_size)) {
+      buffer_.resize(intial_buffer_size);
+    }
+  }
+
+  ~HTTPHeaderParser() {
+    headers_.clear();
+    storage_->arena.Reset();
+    if (buffer_.size() > kMaxPooledHTTPBufferSize) {
+      std::vector<char>().swap(buffer_);
+    }
   }
 
   const std::string& Method() const {
@@ -28,6 +120,25 @@ class HTTPHeaderParser {
     return url_;
   }
 
+  // The value of the header `key`, compared case-insensitively, or an empty view if there is no such header.
+  StringView Header(const StringView& key) const {
+    for (const auto& header : headers_) {
+      if (EqualsIgnoreCase(StringView(header.first.data(), header.first.size()), key)) {
+        return StringView(header.second.data(), header.second.size());
+      }
+    }
+    return StringView();
+  }
+
+  // Calls `f(StringView key, StringView value)` for each header, in no particular order.
+  template <typename F>
+  void ForEachHeader(F&& f) const {
+    for (const auto& header : headers_) {
+      f(StringView(header.first.data(), header.first.size()),
+        StringView(header.second.data(), header.second.size()));
+    }
+  }
+
   bool HasBody() const {
     return content_offset_ != static_cast<size_t>(-1) && content_length_ != static_cast<size_t>(-1);
   }
@@ -56,16 +167,53 @@ class HTTPHeaderParser {
     }
   }
 
+  // Whether the client allows another request on this connection: the default for HTTP/1.1,
+  // opt-in via `Connection: keep-alive` for HTTP/1.0, and opt-out via `Connection: close` for both.
+  bool KeepAlive() const {
+    return keep_alive_;
+  }
+
+  // Whether the client speaks HTTP/1.1, and thus understands a chunked response.
+  bool IsHTTP11() const {
+    return http11_;
+  }
+
  protected:
-  // Parses HTTP headers. Extracts method, URL, and body, if provided.
+  void SetHTTPLimits(const HTTPServerLimits& limits) {
+    max_header_bytes_ = limits.max_header_bytes;
+    max_headers_ = limits.max_headers;
+    max_body_bytes_ = limits.max_body_bytes;
+  }
+
+  // Whether the headers of the request being parsed are in, and the rest, if anything, is the body.
+  bool HTTPHeadersComplete() const {
+    return headers_complete_;
+  }
+
+  // Whether the body is left for the handler to read from the socket. Never, as it is buffered whole.
+  bool HTTPBodyPending() const {
+    return false;
+  }
+
+  // Parses HTTP headers. Extracts method, URL, and body, if provided. Only bodies framed by `Content-Length` are
+  // supported: requests with any other `Transfer-Encoding` than `identity` are rejected.
+  // Can be called repeatedly on a persistent connection: the bytes of the next pipelined request,
+  // if they were read along with the previous one, are kept in `buffer_` and parsed first.
   // Can be statically overridden by providing a different templated class as a parameter for GenericHTTPConnection.
-  void ParseHTTPHeader(const GenericConnection& c) {
+  // `CONNECTION` only needs `BlockingRead()`, so that the parser can be fed from memory in benchmarks and fuzzing.
+  template <typename CONNECTION>
+  void ParseHTTPHeader(const CONNECTION& c) {
     // HTTP constants to parse the header and extract method, URL, headers and body.
     const char* const kCRLF = "\r\n";
     const size_t kCRLFLength = strlen(kCRLF);
     const char* const kHeaderKeyValueSeparator = ": ";
     const size_t kHeaderKeyValueSeparatorLength = strlen(kHeaderKeyValueSeparator);
     const char* const kContentLengthHeaderKey = "Content-Length";
+    const char* const kConnectionHeaderKey = "Connection";
+    const char* const kTransferEncodingHeaderKey = "Transfer-Encoding";
+    const char* const kHTTP11 = "HTTP/1.1";
+
+    ResetRequest();
 
     // `buffer_` stores all the stream of data read from the socket, headers followed by optional body.
     size_t current_line_offset = 0;
@@ -73,26 +221,19 @@ class HTTPHeaderParser {
     // `first_line_parsed` denotes whether the line being parsed is the first one, with method and URL.
     bool first_line_parsed = false;
 
-    // `offset` is the number of bytes read so far.
+    // `offset` is the number of bytes read so far, including the ones left over from the previous request.
     // `length_cap` is infinity first (size_t is unsigned), and it changes/ to the absolute offset
     // of the end of HTTP body in the buffer_, once `Content-Length` and two consecutive CRLS have been seen.
-    size_t offset = 0;
+    size_t offset = buffered_length_;
     size_t length_cap = static_cast<size_t>(-1);
+    size_t headers_count = 0;
 
-    while (offset < length_cap) {
-      size_t chunk;
-      size_t read_count;
-      // Use `- offset - 1` instead of just `- offset` to leave room for the '\0'.
-      while (chunk = buffer_.size() - offset - 1,
-             read_count = c.BlockingRead(&buffer_[offset], chunk),
-             offset += read_count,
-             read_count == chunk) {
-        buffer_.resize(buffer_.size() * buffer_growth_k_);
-      }
+    while (true) {
       buffer_[offset] = '\0';
       char* p = &buffer_[current_line_offset];
       char* current_line = p;
-      while ((p = strstr(current_line, kCRLF))) {
+      // Stop scanning lines once the headers are over: the body, and maybe the next request, follow.
+      while (length_cap == static_cast<size_t>(-1) && (p = strstr(current_line, kCRLF))) {
         *p = '\0';
         if (!first_line_parsed) {
           if (*current_line) {
@@ -106,6 +247,8 @@ class HTTPHeaderParser {
               char* p3 = strstr(p2, " ");
               if (p3) {
                 *p3 = '\0';
+                http11_ = !strcmp(p3 + 1, kHTTP11);
+                keep_alive_ = http11_;
               }
               url_ = p2;
             }
@@ -118,41 +261,316 @@ class HTTPHeaderParser {
               *p = '\0';
               const char* const key = current_line;
               const char* const value = p + kHeaderKeyValueSeparatorLength;
+              if (++headers_count > max_headers_) {
+                buffered_length_ = 0;
+                throw HTTPHeadersTooLargeException();
+              }
               OnHeader(key, value);
-              if (!strcmp(key, kContentLengthHeaderKey)) {
-                content_length_ = static_cast<size_t>(atoi(value));
+              if (!strcasecmp(key, kContentLengthHeaderKey)) {
+                content_length_ = ParseHTTPContentLength(value, strlen(value));
+              } else if (!strcasecmp(key, kTransferEncodingHeaderKey) && strcasecmp(value, "identity")) {
+                // A body that is not framed by `Content-Length` would be taken for the next request.
+                buffered_length_ = 0;
+                throw HTTPUnsupportedTransferEncodingException();
+              } else if (!strcasecmp(key, kConnectionHeaderKey)) {
+                if (!strcasecmp(value, "close")) {
+                  keep_alive_ = false;
+                } else if (!strcasecmp(value, "keep-alive")) {
+                  keep_alive_ = true;
+                }
               }
             }
           } else {
             // HTTP body starts right after this last CRLF.
             content_offset_ = current_line + kCRLFLength - &buffer_[0];
+            if (content_offset_ > max_header_bytes_) {
+              buffered_length_ = 0;
+              throw HTTPHeadersTooLargeException();
+            }
+            headers_complete_ = true;
             // Only accept HTTP body if Content-Length has been set; ignore it otherwise.
             if (content_length_ != static_cast<size_t>(-1)) {
+              if (content_length_ > max_body_bytes_) {
+                buffered_length_ = 0;
+                throw HTTPBodyTooLargeException();
+              }
               length_cap = content_offset_ + content_length_;
             } else {
               length_cap = content_offset_;
             }
           }
         }
-        current_line = p + 2;
+        current_line = p + kCRLFLength;
       }
       current_line_offset = current_line - &buffer_[0];
+      if (offset >= length_cap) {
+        break;
+      }
+      if (!headers_complete_ && offset > max_header_bytes_) {
+        buffered_length_ = 0;
+        throw HTTPHeadersTooLargeException();
+      }
+      // Use `- offset - 1` instead of just `- offset` to leave room for the '\0'.
+      if (offset + 1 >= buffer_.size()) {
+        buffer_.resize(static_cast<size_t>(buffer_.size() * buffer_growth_k_) + 1);
+      }
+      const size_t read_count = c.BlockingRead(&buffer_[offset], buffer_.size() - offset - 1);
+      if (!read_count) {
+        buffered_length_ = 0;
+        throw HTTPConnectionClosedException();
+      }
+      offset += read_count;
     }
+
+    // Keep the bytes past the end of this request, if any, for the next call.
+    buffered_length_ = offset;
+    next_request_offset_ = length_cap;
   }
 
   // Can be statically overridden by proviging a different templated class to GenericHTTPConnection.
   void OnHeader(const char* key, const char* value) {
-    headers_[key] = value;
+    const ArenaAllocator<char> allocator(storage_->arena);
+    ArenaString k(key, allocator);
+    const auto it = headers_.find(k);
+    if (it == headers_.end()) {
+      headers_.emplace(std::move(k), ArenaString(value, allocator));
+    } else {
+      it->second.assign(value);
+    }
   }
 
  private:
-  std::string method_;
-  std::string url_;
-  std::map<std::string, std::string> headers_;
-  std::vector<char> buffer_;
+  // Clears the state of the previous request and moves the pipelined bytes past it to the front of `buffer_`.
+  void ResetRequest() {
+    if (next_request_offset_) {
+      buffered_length_ -= next_request_offset_;
+      memmove(&buffer_[0], &buffer_[next_request_offset_], buffered_length_);
+      next_request_offset_ = 0;
+    }
+    method_.clear();
+    url_.clear();
+    headers_.clear();
+    storage_->arena.Reset();
+    content_offset_ = static_cast<size_t>(-1);
+    content_length_ = static_cast<size_t>(-1);
+    keep_alive_ = false;
+    http11_ = false;
+    headers_complete_ = false;
+  }
+
+  typedef std::basic_string<char, std::char_traits<char>, ArenaAllocator<char>> ArenaString;
+  typedef std::pair<const ArenaString, ArenaString> ArenaHeader;
+
+  PooledObject<HTTPHeaderParserStorage> storage_;
+  std::string& method_;
+  std::string& url_;
+  std::vector<char>& buffer_;
   const double buffer_growth_k_;
+  std::map<ArenaString, ArenaString, std::less<ArenaString>, ArenaAllocator<ArenaHeader>> headers_;
   size_t content_offset_ = static_cast<size_t>(-1);
   size_t content_length_ = static_cast<size_t>(-1);
+  size_t buffered_length_ = 0;
+  size_t next_request_offset_ = 0;
+  bool keep_alive_ = false;
+  bool http11_ = false;
+  bool headers_complete_ = false;
+  size_t max_header_bytes_ = kDefaultHTTPMaxHeaderBytes;
+  size_t max_headers_ = kDefaultHTTPMaxHeaders;
+  size_t max_body_bytes_ = kDefaultHTTPMaxBodyBytes;
+};
+
+const size_t kHTTPResponseHeaderInlineSize = 512;
+
+// Accumulates the status line and headers of a response. Typical headers fit into the inline storage,
+// which lives on the stack of `SendHTTPResponse`, so formatting them does not allocate.
+class HTTPResponseHeaderBuilder final {
+ public:
+  HTTPResponseHeaderBuilder() : data_(inline_), capacity_(kHTTPResponseHeaderInlineSize) {
+  }
+
+  void Append(const char* s, size_t length) {
+    if (size_ + length > capacity_) {
+      Grow(size_ + length);
+    }
+    memcpy(data_ + size_, s, length);
+    size_ += length;
+  }
+
+  void Append(const char* s) {
+    Append(s, strlen(s));
+  }
+
+  void Append(const std::string& s) {
+    Append(s.data(), s.length());
+  }
+
+  void Append(const HTTPBytes& bytes) {
+    Append(bytes.data, bytes.size);
+  }
+
+  void AppendNumber(size_t x) {
+    char digits[20];
+    char* p = digits + sizeof(digits);
+    do {
+      *--p = static_cast<char>('0' + x % 10);
+      x /= 10;
+    } while (x);
+    Append(p, digits + sizeof(digits) - p);
+  }
+
+  const char* Data() const {
+    return data_;
+  }
+
+  size_t Size() const {
+    return size_;
+  }
+
+ private:
+  // Spills into a per-thread buffer, which keeps its capacity for the next oversized header block.
+  // There is at most one builder per thread at a time, as responses are written one after another.
+  void Grow(size_t required) {
+    std::vector<char>& heap = ThreadSpillBuffer();
+    if (heap.size() < required) {
+      heap.resize(std::max(required, capacity_ * 2));
+    }
+    if (data_ == inline_) {
+      memcpy(&heap[0], inline_, size_);
+    }
+    data_ = &heap[0];
+    capacity_ = heap.size();
+  }
+
+  static std::vector<char>& ThreadSpillBuffer() {
+    static thread_local std::vector<char> buffer;
+    return buffer;
+  }
+
+  char inline_[kHTTPResponseHeaderInlineSize];
+  char* data_;
+  size_t capacity_;
+  size_t size_ = 0;
+
+  HTTPResponseHeaderBuilder(const HTTPResponseHeaderBuilder&) = delete;
+  void operator=(const HTTPResponseHeaderBuilder&) = delete;
+};
+
+// The body of a `Transfer-Encoding: chunked` response, sent piece by piece as the handler produces it.
+// Each piece goes out in a single gathered write, together with its chunk framing.
+// Unless `chunked` is false, for HTTP/1.0 clients: the pieces then go out as they are, and closing the connection
+// ends the body.
+class HTTPChunkedResponse final {
+ public:
+  explicit HTTPChunkedResponse(GenericConnection& c, bool chunked = true) : c_(&c), chunked_(chunked) {
+  }
+
+  HTTPChunkedResponse(HTTPChunkedResponse&& rhs) : c_(rhs.c_), chunked_(rhs.chunked_) {
+    rhs.c_ = nullptr;
+  }
+
+  // Terminates the body, unless `Finish()` has already done it. Errors are ignored here; call `Finish()` to see them.
+  ~HTTPChunkedResponse() {
+    if (c_) {
+      try {
+        Finish();
+      } catch (NetworkException&) {
+      }
+    }
+  }
+
+  void Send(const char* data, size_t length) {
+    if (!c_) {
+      throw HTTPAttemptedToRespondTwiceException();
+    }
+    if (!length) {
+      // An empty chunk would terminate the body.
+      return;
+    }
+    if (!chunked_) {
+      c_->BlockingWrite(data, length);
+      return;
+    }
+    // The chunk size in hex, followed by CRLF, formatted right to left.
+    char size_line[20];
+    char* p = size_line + sizeof(size_line) - 2;
+    p[0] = '\r';
+    p[1] = '\n';
+    for (size_t x = length; x; x >>= 4) {
+      *--p = "0123456789abcdef"[x & 15];
+    }
+    iovec iov[3];
+    iov[0].iov_base = p;
+    iov[0].iov_len = size_line + sizeof(size_line) - p;
+    iov[1].iov_base = const_cast<char*>(data);
+    iov[1].iov_len = length;
+    iov[2].iov_base = const_cast<char*>("\r\n");
+    iov[2].iov_len = 2;
+    c_->BlockingWrite(iov, 3);
+  }
+
+  template <typename T>
+  typename std::enable_if<sizeof(typename T::value_type) == 1>::type Send(const T& container) {
+    Send(container.empty() ? nullptr : reinterpret_cast<const char*>(&(*container.begin())), container.size());
+  }
+
+  void Send(const char* s) {
+    Send(s, strlen(s));
+  }
+
+  // Leaves the body unterminated, for the peer to tell it is incomplete once the connection is closed, as it then
+  // must be. For when the source of the body has failed midway.
+  void Abort() {
+    if (c_ && !chunked_) {
+      // Closed as usual, the connection would end the body as if complete: have it reset instead.
+      const linger reset = {1, 0};
+      setsockopt(c_->Descriptor(), SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+    }
+    c_ = nullptr;
+  }
+
+  // Sends the terminating empty chunk. No more data can be sent afterwards.
+  void Finish() {
+    if (c_) {
+      GenericConnection* c = c_;
+      c_ = nullptr;
+      if (chunked_) {
+        c->BlockingWrite("0\r\n\r\n");
+      }
+    }
+  }
+
+ private:
+  GenericConnection* c_;
+  const bool chunked_;
+
+  HTTPChunkedResponse(const HTTPChunkedResponse&) = delete;
+  void operator=(const HTTPChunkedResponse&) = delete;
+  void operator=(HTTPChunkedResponse&&) = delete;
+};
+
+inline MetricsCounter HTTPResponseClassCounter(HTTPResponseCode code) {
+  switch (static_cast<int>(code) / 100) {
+    case 1:
+      return MetricsCounter::HTTPResponses1xx;
+    case 2:
+      return MetricsCounter::HTTPResponses2xx;
+    case 3:
+      return MetricsCounter::HTTPResponses3xx;
+    case 4:
+      return MetricsCounter::HTTPResponses4xx;
+    default:
+      return MetricsCounter::HTTPResponses5xx;
+  }
+}
+
+// A response passed to `SendHTTPResponse()` and held back instead of sent, for `HTTPResponseCache` to store
+// and then send.
+struct HTTPResponseCapture {
+  bool captured = false;
+  HTTPResponseCode code = HTTPResponseCode::OK;
+  std::string content_type;
+  HTTPHeadersType extra_headers;
+  std::string body;
 };
 
 template <typename HEADER_PARSER = HTTPHeaderParser>
@@ -160,18 +578,79 @@ class GenericHTTPConnection final : public GenericConnection, public HEADER_PARS
  public:
   typedef HEADER_PARSER T_HEADER_PARSER;
 
-  GenericHTTPConnection(GenericConnection&& c) : GenericConnection(std::move(c)), T_HEADER_PARSER() {
-    T_HEADER_PARSER::ParseHTTPHeader(*this);
+  GenericHTTPConnection(GenericConnection&& c, const HTTPServerLimits& limits = HTTPServerLimits())
+      : GenericConnection(std::move(c)), T_HEADER_PARSER(), limits_(limits) {
+    T_HEADER_PARSER::SetHTTPLimits(limits_);
+    // The first request is timed from the accept, so that a client can not hold the connection by sending nothing.
+    ArmReadDeadline(ReadPhase::Headers);
+    ParseRequest();
   }
 
-  GenericHTTPConnection(GenericHTTPConnection&& c) : GenericConnection(std::move(c)), T_HEADER_PARSER() {
-    T_HEADER_PARSER::ParseHTTPHeader(*this);
+  // Parses the request from `buffers`, which must hold it whole, and responds into them, never blocking.
+  // For the servers that do their socket I/O themselves, asynchronously: they enforce the limits on time,
+  // and `limits` only those on size.
+  GenericHTTPConnection(GenericConnection&& c, ConnectionBuffers& buffers, const HTTPServerLimits& limits)
+      : GenericConnection(std::move(c)), T_HEADER_PARSER(), limits_(limits) {
+    UseBuffers(&buffers);
+    T_HEADER_PARSER::SetHTTPLimits(limits_);
+    ParseRequest();
+  }
+
+  GenericHTTPConnection(GenericHTTPConnection&& c)
+      : GenericConnection(std::move(c)), T_HEADER_PARSER(), limits_(c.limits_) {
+    c.DisarmDeadline();
+    T_HEADER_PARSER::SetHTTPLimits(limits_);
+    ArmReadDeadline(ReadPhase::Headers);
+    ParseRequest();
+  }
+
+  ~GenericHTTPConnection() {
+    // Before the socket is closed, for the watchdog to never shut down a descriptor that has been reused.
+    DisarmDeadline();
   }
 
   static const std::string DefaultContentType() {
     return "text/plain";
   }
 
+  // The path, query string and fragment of the URL of the current request, split on first access.
+  const HTTPURL& ParsedURL() const {
+    return parsed_url_;
+  }
+
+  // Makes the responses sent once `*flag` is set say `Connection: close`, and be the last ones on the connection.
+  // For the server to drain its connections when shutting down.
+  void CloseWhen(const std::atomic<bool>* flag) {
+    close_when_ = flag;
+  }
+
+  // Reads the next request from the same persistent connection, once the current one has been responded to.
+  // Returns false if the connection should be closed instead: the client has not asked to keep it alive,
+  // the current request was not responded to, the client has disconnected,
+  // or the next request has not begun to arrive within `idle_timeout`, zero meaning forever.
+  bool NextRequest(std::chrono::milliseconds idle_timeout = kDefaultHTTPKeepAliveTimeout) {
+    if (!responded_ || !keep_alive_) {
+      return false;
+    }
+    responded_ = false;
+    try {
+      // The header deadline takes over once the request begins to arrive, in `BlockingRead()`.
+      read_phase_ = ReadPhase::Idle;
+      if (idle_timeout.count() > 0) {
+        ArmDeadline(idle_timeout, SHUT_RD);
+      }
+      ParseRequest();
+      return true;
+    } catch (NetworkException&) {
+      return false;
+    }
+  }
+
+  // Whether the current request has been responded to, with the connection kept alive for the next one.
+  bool Persistent() const {
+    return responded_ && keep_alive_;
+  }
+
   template <typename T>
   typename std::enable_if<sizeof(typename T::value_type) == 1>::type SendHTTPResponse(
       const T& begin,
@@ -179,22 +658,34 @@ class GenericHTTPConnection final : public GenericConnection, public HEADER_PARS
       HTTPResponseCode code = HTTPResponseCode::OK,
       const std::string& content_type = DefaultContentType(),
       const HTTPHeadersType& extra_headers = HTTPHeadersType()) {
-    if (responded_) {
-      throw HTTPAttemptedToRespondTwiceException();
+    const size_t length = end - begin;
+    if (capture_) {
+      // Whoever has asked for the capture sends the response instead.
+      capture_->captured = true;
+      capture_->code = code;
+      capture_->content_type = content_type;
+      capture_->extra_headers = extra_headers;
+      capture_->body.assign(length ? reinterpret_cast<const char*>(&(*begin)) : "", length);
+      capture_ = nullptr;
+      return;
     }
-    responded_ = true;
-    std::ostringstream os;
-    os << "HTTP/1.1 " << static_cast<int>(code) << " " << HTTPResponseCodeAsStringGenerator::CodeAsString(code)
-       << "\r\n"
-       << "Content-Type: " << content_type << "\r\n"
-       << "Content-Length: " << (end - begin) << "\r\n";
-    for (const auto cit : extra_headers) {
-      os << cit.first << ": " << cit.second << "\r\n";
+    HTTPResponseHeaderBuilder header;
+    StartHTTPResponse(header, code, content_type, extra_headers);
+    header.Append(kHTTPContentLengthHeaderPrefix);
+    header.AppendNumber(length);
+    header.Append("\r\n\r\n");
+    // Headers and body leave in a single syscall, and thus usually in a single TCP segment.
+    iovec iov[2];
+    iov[0].iov_base = const_cast<char*>(header.Data());
+    iov[0].iov_len = header.Size();
+    iov[1].iov_base = length ? const_cast<char*>(reinterpret_cast<const char*>(&(*begin))) : nullptr;
+    iov[1].iov_len = length;
+    const uint64_t write_begin = MetricsClock::Now();
+    {
+      ScopedWriteDeadline deadline(*this);
+      BlockingWrite(iov, 2);
     }
-    os << "\r\n";
-    BlockingWrite(os.str());
-    BlockingWrite(begin, end);
-    BlockingWrite("\r\n");
+    MetricsRecord(MetricsHistogram::HTTPResponseWriteTime, write_begin, MetricsClock::Now());
   }
 
   template <typename T>
@@ -206,8 +697,413 @@ class GenericHTTPConnection final : public GenericConnection, public HEADER_PARS
     SendHTTPResponse(container.begin(), container.end(), code, content_type, extra_headers);
   }
 
+  // Sends a response formatted ahead of time: `head` is the status line and the headers, `tail` is the empty line
+  // ending the headers and the body. The `Connection` header for this request goes in between.
+  void SendPreformattedHTTPResponse(HTTPResponseCode code,
+                                    const char* head,
+                                    size_t head_size,
+                                    const char* tail,
+                                    size_t tail_size) {
+    MarkResponded(code);
+    const HTTPBytes connection_header = keep_alive_ ? kHTTPConnectionKeepAliveHeader : kHTTPConnectionCloseHeader;
+    iovec iov[3];
+    iov[0].iov_base = const_cast<char*>(head);
+    iov[0].iov_len = head_size;
+    iov[1].iov_base = const_cast<char*>(connection_header.data);
+    iov[1].iov_len = connection_header.size;
+    iov[2].iov_base = const_cast<char*>(tail);
+    iov[2].iov_len = tail_size;
+    const uint64_t write_begin = MetricsClock::Now();
+    {
+      ScopedWriteDeadline deadline(*this);
+      BlockingWrite(iov, 3);
+    }
+    MetricsRecord(MetricsHistogram::HTTPResponseWriteTime, write_begin, MetricsClock::Now());
+  }
+
+  // Answers `503 Service Unavailable`, with `Retry-After` and `Connection: close`, instead of serving the request,
+  // for the server to shed load. The connection is closed after it.
+  void ShedRequest(std::chrono::seconds retry_after) {
+    if (responded_) {
+      throw HTTPAttemptedToRespondTwiceException();
+    }
+    responded_ = true;
+    keep_alive_ = false;
+    if (read_phase_ != ReadPhase::None) {
+      read_phase_ = ReadPhase::None;
+      DisarmDeadline();
+    }
+    MetricsAdd(MetricsCounter::HTTPShedRequests);
+    RejectRequest(HTTPResponseCode::ServiceUnavailable, retry_after);
+  }
+
+  // Makes the next `SendHTTPResponse()` copy the response into `*capture` instead of sending it,
+  // leaving the request not responded to yet. Pass `nullptr` to cancel.
+  void CaptureNextHTTPResponse(HTTPResponseCapture* capture) {
+    capture_ = capture;
+  }
+
+  // Starts a `Transfer-Encoding: chunked` response, for bodies produced incrementally and of unknown length.
+  // The returned object sends the body piece by piece, and terminates it when finished or destroyed.
+  // HTTP/1.0 clients know nothing of chunks: they get the body as it is, with `Connection: close`, and the
+  // connection closed after it to end it.
+  HTTPChunkedResponse SendChunkedHTTPResponse(HTTPResponseCode code = HTTPResponseCode::OK,
+                                              const std::string& content_type = DefaultContentType(),
+                                              const HTTPHeadersType& extra_headers = HTTPHeadersType()) {
+    const bool chunked = T_HEADER_PARSER::IsHTTP11();
+    HTTPResponseHeaderBuilder header;
+    StartHTTPResponse(header, code, content_type, extra_headers, !chunked);
+    if (chunked) {
+      header.Append(kHTTPTransferEncodingChunkedHeader);
+    }
+    header.Append("\r\n");
+    {
+      ScopedWriteDeadline deadline(*this);
+      BlockingWrite(header.Data(), header.Size());
+    }
+    return HTTPChunkedResponse(*this, chunked);
+  }
+
+  // Sends `length` bytes of the file or pipe `fd`, starting at `offset` for files, as the response body.
+  // The bytes go from `fd` to the socket within the kernel, via `sendfile()` or `splice()`, never copied
+  // through user space. Does not close `fd`.
+  void SendHTTPFileResponse(int fd,
+                            off_t offset,
+                            size_t length,
+                            HTTPResponseCode code = HTTPResponseCode::OK,
+                            const std::string& content_type = DefaultContentType(),
+                            const HTTPHeadersType& extra_headers = HTTPHeadersType()) {
+    HTTPResponseHeaderBuilder header;
+    StartHTTPResponse(header, code, content_type, extra_headers);
+    header.Append(kHTTPContentLengthHeaderPrefix);
+    header.AppendNumber(length);
+    header.Append("\r\n\r\n");
+    iovec iov;
+    iov.iov_base = const_cast<char*>(header.Data());
+    iov.iov_len = header.Size();
+    // `MSG_MORE` holds the headers back, so that they share a TCP segment with the beginning of the file.
+    const uint64_t write_begin = MetricsClock::Now();
+    {
+      ScopedWriteDeadline deadline(*this);
+      BlockingWrite(&iov, 1, length > 0);
+      BlockingSendFile(fd, offset, length);
+    }
+    MetricsRecord(MetricsHistogram::HTTPResponseWriteTime, write_begin, MetricsClock::Now());
+  }
+
+  // Sends the whole regular file `fd` as the response body.
+  void SendHTTPFileResponse(int fd,
+                            HTTPResponseCode code = HTTPResponseCode::OK,
+                            const std::string& content_type = DefaultContentType(),
+                            const HTTPHeadersType& extra_headers = HTTPHeadersType()) {
+    struct stat file_stat;
+    if (fstat(fd, &file_stat)) {
+      throw SocketSendFileException();
+    }
+    SendHTTPFileResponse(fd, 0, static_cast<size_t>(file_stat.st_size), code, content_type, extra_headers);
+  }
+
+  // Sends a response relayed from the socket `fd`: `received` is the part of the body already read from it,
+  // and the `remaining` bytes that follow go from socket to socket within the kernel, via `splice()`.
+  void SendHTTPSplicedResponse(const StringView& received,
+                               int fd,
+                               size_t remaining,
+                               HTTPResponseCode code = HTTPResponseCode::OK,
+                               const std::string& content_type = DefaultContentType(),
+                               const HTTPHeadersType& extra_headers = HTTPHeadersType()) {
+    HTTPResponseHeaderBuilder header;
+    StartHTTPResponse(header, code, content_type, extra_headers);
+    header.Append(kHTTPContentLengthHeaderPrefix);
+    header.AppendNumber(received.size() + remaining);
+    header.Append("\r\n\r\n");
+    iovec iov[2];
+    iov[0].iov_base = const_cast<char*>(header.Data());
+    iov[0].iov_len = header.Size();
+    iov[1].iov_base = const_cast<char*>(received.data());
+    iov[1].iov_len = received.size();
+    const uint64_t write_begin = MetricsClock::Now();
+    {
+      ScopedWriteDeadline deadline(*this);
+      BlockingWrite(iov, 2, remaining > 0);
+      BlockingSpliceFrom(fd, remaining, ThreadSplicePipe());
+    }
+    MetricsRecord(MetricsHistogram::HTTPResponseWriteTime, write_begin, MetricsClock::Now());
+  }
+
+  // Shadows `GenericConnection::BlockingRead()` for the header parser, to time parsing from when the request arrives
+  // rather than from when the server started waiting for it, and to move from the header deadline to the body one.
+  // The parsers that buffer the body whole read it here too, once the headers are complete.
+  template <typename T>
+  size_t BlockingRead(T* buffer, size_t max_length = kDefaultMaxLengthToReceive) const {
+    if (T_HEADER_PARSER::HTTPHeadersComplete()) {
+      SendHTTPContinueIfExpected();
+      // Also when the headers have been pipelined behind the previous request, with the body still to come.
+      if (read_phase_ == ReadPhase::Idle || read_phase_ == ReadPhase::Headers) {
+        ArmReadDeadline(ReadPhase::Body);
+      }
+    }
+    const size_t result = GenericConnection::BlockingRead(buffer, max_length);
+    if (!request_arrived_ticks_ && result) {
+      request_arrived_ticks_ = MetricsClock::Now();
+      if (read_phase_ == ReadPhase::Idle) {
+        ArmReadDeadline(ReadPhase::Headers);
+      }
+    }
+    return result;
+  }
+
+  // Shadow those of `StreamingHTTPHeaderParser`, for the handler to get the body once the client has been told
+  // to send it.
+  template <typename... ARGS>
+  size_t ReadBody(ARGS&&... args) {
+    SendHTTPContinueIfExpected();
+    return T_HEADER_PARSER::ReadBody(std::forward<ARGS>(args)...);
+  }
+
+  template <typename F>
+  size_t TakeOverBody(F&& f) {
+    SendHTTPContinueIfExpected();
+    return T_HEADER_PARSER::TakeOverBody(std::forward<F>(f));
+  }
+
  private:
+  // Which read deadline is armed.
+  enum class ReadPhase : int { None, Idle, Headers, Body };
+
+  bool ExpectsHTTPContinue() const {
+    return EqualsIgnoreCase(T_HEADER_PARSER::Header("Expect"), "100-continue");
+  }
+
+  // A client that has sent `Expect: 100-continue` waits for the interim `100 Continue` before sending the body,
+  // or for a while: sent once per request, as the body is first read.
+  void SendHTTPContinueIfExpected() const {
+    if (continue_checked_ || Buffers()) {
+      return;
+    }
+    continue_checked_ = true;
+    if (!ExpectsHTTPContinue()) {
+      return;
+    }
+    HTTPResponseHeaderBuilder header;
+    header.Append(HTTPStatusLine(HTTPResponseCode::Continue));
+    header.Append("\r\n");
+    {
+      ScopedWriteDeadline deadline(*this);
+      // The parsers read through a const connection.
+      const_cast<GenericHTTPConnection*>(this)->BlockingWrite(header.Data(), header.Size());
+    }
+    ArmReadDeadline(ReadPhase::Body);
+  }
+
+  // Arms the write deadline for its lifetime. Past it, the socket is shut down and the write fails.
+  class ScopedWriteDeadline final {
+   public:
+    explicit ScopedWriteDeadline(const GenericHTTPConnection& c)
+        : c_(c), armed_(c.limits_.write_timeout.count() > 0) {
+      if (armed_) {
+        c_.read_phase_ = ReadPhase::None;
+        c_.ArmDeadline(c_.limits_.write_timeout, SHUT_RDWR);
+      }
+    }
+
+    ~ScopedWriteDeadline() {
+      if (armed_) {
+        c_.DisarmDeadline();
+        if (c_.deadline_.expired) {
+          MetricsAdd(MetricsCounter::HTTPTimeouts);
+        }
+      }
+    }
+
+   private:
+    const GenericHTTPConnection& c_;
+    const bool armed_;
+  };
+
+  void ArmDeadline(std::chrono::milliseconds timeout, int how) const {
+    if (Buffers()) {
+      return;
+    }
+    ConnectionWatchdog::Default().Arm(deadline_, Descriptor(), timeout, how);
+    deadline_armed_ = true;
+  }
+
+  void DisarmDeadline() const {
+    if (deadline_armed_) {
+      ConnectionWatchdog::Default().Disarm(deadline_);
+      deadline_armed_ = false;
+    }
+  }
+
+  // Shutting down the receiving side only leaves the socket writable for the `408`.
+  void ArmReadDeadline(ReadPhase phase) const {
+    read_phase_ = phase;
+    const std::chrono::milliseconds timeout =
+        phase == ReadPhase::Headers ? limits_.header_timeout : limits_.body_timeout;
+    if (timeout.count() > 0) {
+      ArmDeadline(timeout, SHUT_RD);
+    } else {
+      DisarmDeadline();
+    }
+  }
+
+  void ParseRequest() {
+    const uint64_t begin = MetricsClock::Now();
+    request_arrived_ticks_ = 0;
+    continue_checked_ = false;
+    try {
+      T_HEADER_PARSER::ParseHTTPHeader(*this);
+    } catch (...) {
+      // Whatever the error, as the connection may be freed while it propagates.
+      const bool idle = read_phase_ == ReadPhase::Idle;
+      read_phase_ = ReadPhase::None;
+      DisarmDeadline();
+      RethrowParseError(idle);
+    }
+    if (T_HEADER_PARSER::HTTPBodyPending()) {
+      ArmReadDeadline(ReadPhase::Body);
+    } else {
+      continue_checked_ = true;
+      read_phase_ = ReadPhase::None;
+      DisarmDeadline();
+    }
+    // A request that was already buffered, pipelined behind the previous one, has arrived before parsing began.
+    request_parsed_ticks_ = MetricsClock::Now();
+    parsed_url_ = HTTPURL(StringView(T_HEADER_PARSER::URL()));
+    MetricsRecord(MetricsHistogram::HTTPParseTime,
+                  request_arrived_ticks_ ? request_arrived_ticks_ : begin,
+                  request_parsed_ticks_);
+    MetricsAdd(MetricsCounter::HTTPRequests);
+  }
+
+  // Answers the request that `ParseRequest()` has failed on, if it can be answered, and rethrows the error.
+  // A persistent connection left `idle` gets no answer, as no request has begun to arrive on it.
+  [[noreturn]] void RethrowParseError(bool idle) {
+    try {
+      throw;
+    } catch (const HTTPConnectionClosedException&) {
+      // The deadline has shut the socket down, or the client has gone.
+      if (deadline_.expired && !idle) {
+        MetricsAdd(MetricsCounter::HTTPTimeouts);
+        RejectRequest(HTTPResponseCode::RequestTimeout);
+        throw HTTPRequestTimeoutException();
+      }
+      throw;
+    } catch (const HTTPHeadersTooLargeException&) {
+      MetricsAdd(MetricsCounter::HTTPParseErrors);
+      RejectRequest(HTTPResponseCode::RequestEntityTooLarge);
+      throw;
+    } catch (const HTTPBodyTooLargeException&) {
+      MetricsAdd(MetricsCounter::HTTPParseErrors);
+      RejectRequest(HTTPResponseCode::RequestEntityTooLarge);
+      throw;
+    } catch (const HTTPUnsupportedTransferEncodingException&) {
+      MetricsAdd(MetricsCounter::HTTPParseErrors);
+      RejectRequest(HTTPResponseCode::NotImplemented);
+      throw;
+    } catch (const HTTPException&) {
+      MetricsAdd(MetricsCounter::HTTPParseErrors);
+      throw;
+    }
+  }
+
+  // Marks the request as responded to, and formats the status line and the common headers.
+  // The caller appends the headers describing the body length, and the empty line ending the headers.
+  // With `close`, this is the last response on the connection, for a body ended by closing it.
+  void StartHTTPResponse(HTTPResponseHeaderBuilder& header,
+                         HTTPResponseCode code,
+                         const std::string& content_type,
+                         const HTTPHeadersType& extra_headers,
+                         bool close = false) {
+    MarkResponded(code);
+    if (close) {
+      keep_alive_ = false;
+    }
+    const HTTPBytes status_line = HTTPStatusLine(code);
+    if (status_line.size) {
+      header.Append(status_line);
+    } else {
+      header.Append("HTTP/1.1 ");
+      header.AppendNumber(static_cast<size_t>(code));
+      header.Append(" ");
+      header.Append(HTTPResponseCodeAsStringGenerator::CodeAsString(code));
+      header.Append("\r\n");
+    }
+    if (content_type == "text/plain") {
+      header.Append(kHTTPContentTypeTextPlainHeader);
+    } else if (content_type == "application/json") {
+      header.Append(kHTTPContentTypeApplicationJSONHeader);
+    } else if (content_type == "text/html") {
+      header.Append(kHTTPContentTypeTextHTMLHeader);
+    } else {
+      header.Append(kHTTPContentTypeHeaderPrefix);
+      header.Append(content_type);
+      header.Append("\r\n");
+    }
+    header.Append(keep_alive_ ? kHTTPConnectionKeepAliveHeader : kHTTPConnectionCloseHeader);
+    for (const auto& cit : extra_headers) {
+      header.Append(cit.first);
+      header.Append(": ");
+      header.Append(cit.second);
+      header.Append("\r\n");
+    }
+  }
+
+  void MarkResponded(HTTPResponseCode code) {
+    if (responded_) {
+      throw HTTPAttemptedToRespondTwiceException();
+    }
+    responded_ = true;
+    keep_alive_ = T_HEADER_PARSER::KeepAlive() && !(close_when_ && *close_when_);
+    if (!continue_checked_) {
+      // The client may still be waiting to send the body, which would then be taken for the next request.
+      continue_checked_ = true;
+      if (ExpectsHTTPContinue()) {
+        keep_alive_ = false;
+      }
+    }
+    if (read_phase_ != ReadPhase::None) {
+      read_phase_ = ReadPhase::None;
+      DisarmDeadline();
+    }
+    MetricsRecord(MetricsHistogram::HTTPHandlerTime, request_parsed_ticks_, MetricsClock::Now());
+    MetricsAdd(HTTPResponseClassCounter(code));
+  }
+
+  // Answers a request that can not be served with an empty response, and `Connection: close`.
+  // Best effort: the client may have gone already.
+  void RejectRequest(HTTPResponseCode code, std::chrono::seconds retry_after = std::chrono::seconds(0)) {
+    MetricsAdd(HTTPResponseClassCounter(code));
+    HTTPResponseHeaderBuilder header;
+    header.Append(HTTPStatusLine(code));
+    header.Append(kHTTPContentLengthHeaderPrefix);
+    header.Append("0\r\n");
+    if (retry_after.count() > 0) {
+      header.Append("Retry-After: ");
+      header.AppendNumber(static_cast<size_t>(retry_after.count()));
+      header.Append("\r\n");
+    }
+    header.Append(kHTTPConnectionCloseHeader);
+    header.Append("\r\n");
+    try {
+      ScopedWriteDeadline deadline(*this);
+      BlockingWrite(header.Data(), header.Size());
+    } catch (NetworkException&) {
+    }
+  }
+
+  const HTTPServerLimits limits_;
+  mutable ConnectionDeadline deadline_;
+  mutable bool deadline_armed_ = false;
+  mutable ReadPhase read_phase_ = ReadPhase::None;
+  mutable bool continue_checked_ = true;  // Whether `Expect: 100-continue` is dealt with for the current request.
   bool responded_ = false;
+  bool keep_alive_ = false;  // Whether the response sent says so.
+  const std::atomic<bool>* close_when_ = nullptr;
+  mutable uint64_t request_arrived_ticks_ = 0;
+  uint64_t request_parsed_ticks_ = 0;
+  HTTPURL parsed_url_;
+  HTTPResponseCapture* capture_ = nullptr;
 
   GenericHTTPConnection(const GenericHTTPConnection&) = delete;
   void operator=(const GenericHTTPConnection&) = delete;
@@ -217,4 +1113,429 @@ class GenericHTTPConnection final : public GenericConnection, public HEADER_PARS
 // Default HTTPConnection parses URL, method, and body for requests with Content-Length.
 typedef GenericHTTPConnection<HTTPHeaderParser> HTTPConnection;
 
+const char* const kDefaultHTTPMetricsPath = "/stats";
+
+// The optional built-in metrics endpoint: call first thing in the handler. If the request is a `GET` of `path`,
+// responds with the metrics of the whole process in the Prometheus text format, and returns true.
+template <typename CONNECTION>
+bool ServeHTTPMetricsIfRequested(CONNECTION& c, const char* path = kDefaultHTTPMetricsPath) {
+  if (c.URL() != path || c.Method() != "GET") {
+    return false;
+  }
+  c.SendHTTPResponse(
+      MetricsSnapshotOfAllThreads().AsPrometheusText(), HTTPResponseCode::OK, "text/plain; version=0.0.4");
+  return true;
+}
+
+const std::chrono::milliseconds kDefaultHTTPDrainTimeout = std::chrono::milliseconds(10000);
+
+// The graceful shutdown of a server. Wakes up the accepting threads, for them to stop accepting, and lets
+// the connections accepted already finish: the requests being served get their responses, with
+// `Connection: close`, and the keep-alive connections waiting for their next request are closed right away.
+class HTTPServerDrain final {
+ public:
+  explicit HTTPServerDrain(size_t workers)
+      : wake_fd_(eventfd(0, EFD_CLOEXEC)), workers_(workers), idle_(new IdleSlot[workers]) {
+    if (wake_fd_ < 0) {
+      throw SocketCreateException();
+    }
+  }
+
+  ~HTTPServerDrain() {
+    close(wake_fd_);
+  }
+
+  // Becomes readable, for good, once draining has begun.
+  int WakeDescriptor() const {
+    return wake_fd_;
+  }
+
+  const std::atomic<bool>* Draining() const {
+    return &draining_;
+  }
+
+  void ConnectionStarted() {
+    ++active_;
+  }
+
+  void ConnectionFinished() {
+    if (--active_ == 0 && draining_) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      drained_.notify_all();
+    }
+  }
+
+  // `c.NextRequest()`, for the connection served by `worker`, that a drain can interrupt while idle.
+  template <typename CONNECTION>
+  bool NextRequest(size_t worker, CONNECTION& c) {
+    IdleSlot& slot = idle_[worker];
+    {
+      std::lock_guard<std::mutex> lock(slot.mutex);
+      if (draining_) {
+        return false;
+      }
+      slot.fd = c.Descriptor();
+    }
+    const bool result = c.NextRequest();
+    std::lock_guard<std::mutex> lock(slot.mutex);
+    slot.fd = -1;
+    return result;
+  }
+
+  void Begin() {
+    draining_ = true;
+    const uint64_t one = 1;
+    if (write(wake_fd_, &one, sizeof(one)) != sizeof(one)) {
+      throw SocketWriteException();
+    }
+    // Like any keep-alive connection, these may be closed as a request arrives; clients retry on another.
+    for (size_t i = 0; i < workers_; ++i) {
+      std::lock_guard<std::mutex> lock(idle_[i].mutex);
+      if (idle_[i].fd != -1) {
+        shutdown(idle_[i].fd, SHUT_RD);
+      }
+    }
+  }
+
+  // Returns false if some connections are still being served after `timeout`.
+  bool Wait(std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return drained_.wait_for(lock, timeout, [this]() { return !active_; });
+  }
+
+ private:
+  // The connection of a worker while it waits for the next request on it, if any.
+  struct IdleSlot {
+    std::mutex mutex;
+    int fd = -1;
+    char padding[kCacheLineSize];  // Keeps the slots of different workers off the same cache line.
+  };
+
+  const int wake_fd_;
+  const size_t workers_;
+  std::atomic<bool> draining_{false};
+  std::atomic<size_t> active_{0};
+  std::unique_ptr<IdleSlot[]> idle_;
+  std::mutex mutex_;
+  std::condition_variable drained_;
+};
+
+// What the accepting thread does when all workers are busy and the queue of accepted connections is full.
+enum class HTTPServerOverloadPolicy : int {
+  BlockAccept,                // Stop accepting until a worker frees up; excess clients wait in the kernel backlog.
+  RespondServiceUnavailable,  // Reply `503 Service Unavailable` right away and close the connection.
+};
+
+const size_t kDefaultHTTPServerQueueCapacity = 1024;
+
+// Serves HTTP requests with a fixed number of pre-spawned worker threads.
+// The accepting thread hands connections to workers through a bounded lock-free queue,
+// so both the number of threads and the number of connections held in memory are capped.
+// With `SetAdmissionControl()`, the first request of each connection that has waited in the queue for too long
+// is answered `503` instead of being served, see `admission_control.h`.
+template <typename CONNECTION = HTTPConnection>
+class GenericHTTPThreadPoolServer final {
+ public:
+  typedef std::function<void(CONNECTION&)> T_HANDLER;
+  // Classifies a parsed request for admission control, such as by its path.
+  typedef std::function<AdmissionPriority(const CONNECTION&)> T_PRIORITY;
+
+  GenericHTTPThreadPoolServer(Socket& socket,
+                              T_HANDLER handler,
+                              size_t threads = std::thread::hardware_concurrency(),
+                              size_t queue_capacity = kDefaultHTTPServerQueueCapacity,
+                              HTTPServerOverloadPolicy policy = HTTPServerOverloadPolicy::BlockAccept,
+                              const HTTPServerLimits& limits = HTTPServerLimits())
+      : socket_(socket),
+        handler_(handler),
+        queue_(queue_capacity),
+        policy_(policy),
+        limits_(limits),
+        drain_(threads ? threads : 1) {
+    if (!threads) {
+      threads = 1;
+    }
+    for (size_t i = 0; i < threads; ++i) {
+      workers_.emplace_back(&GenericHTTPThreadPoolServer::WorkerThread, this, i);
+    }
+  }
+
+  ~GenericHTTPThreadPoolServer() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    not_empty_.notify_all();
+    not_full_.notify_all();
+    for (auto& thread : workers_) {
+      thread.join();
+    }
+    QueuedConnection queued;
+    while (queue_.TryPop(queued)) {
+      close(queued.fd);
+      drain_.ConnectionFinished();
+    }
+  }
+
+  // Sheds load when connections wait in the queue for too long, with the requests classified by `priority`,
+  // or all of `AdmissionPriority::Normal` if it is empty. Call before `Run()`.
+  void SetAdmissionControl(const AdmissionControlOptions& options, T_PRIORITY priority = T_PRIORITY()) {
+    admission_.reset(new AdmissionController(options));
+    priority_ = priority;
+  }
+
+  // Accepts connections on the calling thread until `Shutdown()`.
+  void Run() {
+    socket_.MakeNonBlocking();
+    // With connections pending in the backlog, accepting does not wait, so it does not notice the drain either.
+    while (!*drain_.Draining()) {
+      int fd;
+      try {
+        fd = socket_.AcceptOrWake(drain_.WakeDescriptor());
+      } catch (SocketAcceptNoResourcesException&) {
+        // Transient: the workers free descriptors as their connections close.
+        std::this_thread::sleep_for(kAcceptNoResourcesDelay);
+        continue;
+      }
+      if (fd == -1) {
+        return;
+      }
+      GenericConnection c(fd);
+      drain_.ConnectionStarted();
+      QueuedConnection queued;
+      queued.fd = fd;
+      queued.accepted = std::chrono::steady_clock::now();
+      if (queue_.TryPush(queued)) {
+        c.Release();
+        WakeWorker();
+      } else if (policy_ == HTTPServerOverloadPolicy::BlockAccept) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_full_.wait(lock, [this, &queued]() { return stop_ || *drain_.Draining() || queue_.TryPush(queued); });
+        if (stop_ || *drain_.Draining()) {
+          // Not served yet, so closed right away like those still in the backlog.
+          lock.unlock();
+          drain_.ConnectionFinished();
+          return;
+        }
+        c.Release();
+        lock.unlock();
+        not_empty_.notify_one();
+      } else {
+        RespondServiceUnavailable(c);
+        drain_.ConnectionFinished();
+      }
+    }
+  }
+
+  // Makes `Run()` return, and waits up to `timeout` for the connections accepted already, queued ones included,
+  // to be served. Returns false if some are still being served by then. Thread-safe.
+  bool Shutdown(std::chrono::milliseconds timeout = kDefaultHTTPDrainTimeout) {
+    drain_.Begin();
+    // `Run()` may be waiting for room in the queue rather than for a connection.
+    { std::lock_guard<std::mutex> lock(mutex_); }
+    not_full_.notify_all();
+    return drain_.Wait(timeout);
+  }
+
+ private:
+  // Trivially copyable, for the lock-free queue.
+  struct QueuedConnection {
+    int fd;
+    std::chrono::steady_clock::time_point accepted;
+  };
+
+  void WakeWorker() {
+    // Taking the mutex orders this push against a worker that has just found the queue empty and is about to sleep.
+    { std::lock_guard<std::mutex> lock(mutex_); }
+    not_empty_.notify_one();
+  }
+
+  static void RespondServiceUnavailable(GenericConnection& c) {
+    static const std::string response = std::string(HTTPStatusLine(HTTPResponseCode::ServiceUnavailable).data) +
+                                        "Content-Length: 0\r\nConnection: close\r\n\r\n";
+    try {
+      c.BlockingWrite(response);
+    } catch (NetworkException&) {
+    }
+  }
+
+  void WorkerThread(size_t index) {
+    while (true) {
+      QueuedConnection queued;
+      if (!queue_.TryPop(queued)) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_empty_.wait(lock, [this, &queued]() { return stop_ || queue_.TryPop(queued); });
+        if (stop_) {
+          return;
+        }
+      }
+      if (policy_ == HTTPServerOverloadPolicy::BlockAccept) {
+        { std::lock_guard<std::mutex> lock(mutex_); }
+        not_full_.notify_one();
+      }
+      const std::chrono::steady_clock::time_point dequeued = std::chrono::steady_clock::now();
+      const std::chrono::steady_clock::duration sojourn = dequeued - queued.accepted;
+      MetricsRecordNanoseconds(MetricsHistogram::HTTPQueueTime,
+                               std::chrono::duration_cast<std::chrono::nanoseconds>(sojourn).count());
+      try {
+        GenericConnection accepted(queued.fd);
+        CONNECTION c(std::move(accepted), limits_);
+        c.CloseWhen(drain_.Draining());
+        // Only the first request has waited in the queue; those after it are served as they come.
+        if (admission_ &&
+            !admission_->Admit(sojourn, priority_ ? priority_(c) : AdmissionPriority::Normal, dequeued)) {
+          c.ShedRequest(admission_->Options().retry_after);
+        } else {
+          do {
+            handler_(c);
+          } while (drain_.NextRequest(index, c));
+        }
+      } catch (NetworkException&) {
+      }
+      drain_.ConnectionFinished();
+    }
+  }
+
+  Socket& socket_;
+  const T_HANDLER handler_;
+  BoundedMPMCQueue<QueuedConnection> queue_;
+  const HTTPServerOverloadPolicy policy_;
+  std::unique_ptr<AdmissionController> admission_;
+  T_PRIORITY priority_;
+  const HTTPServerLimits limits_;
+  HTTPServerDrain drain_;
+  std::vector<std::thread> workers_;
+  std::mutex mutex_;
+  std::condition_variable not_empty_;
+  std::condition_variable not_full_;
+  bool stop_ = false;
+
+  GenericHTTPThreadPoolServer(const GenericHTTPThreadPoolServer&) = delete;
+  GenericHTTPThreadPoolServer(GenericHTTPThreadPoolServer&&) = delete;
+  void operator=(const GenericHTTPThreadPoolServer&) = delete;
+  void operator=(GenericHTTPThreadPoolServer&&) = delete;
+};
+
+typedef GenericHTTPThreadPoolServer<HTTPConnection> HTTPThreadPoolServer;
+
+// Serves HTTP requests with one `SO_REUSEPORT` listening socket per worker thread.
+// The kernel spreads new connections across the sockets, so there is no shared accept queue or lock.
+// With `pin_to_cpus` set, worker `i` is bound to CPU `i % hardware_concurrency()`.
+// The listening sockets can be handed over to the next server process, for it to accept where this one stops,
+// see `socket_handoff.h`.
+template <typename CONNECTION = HTTPConnection>
+class GenericHTTPReusePortServer final {
+ public:
+  typedef std::function<void(CONNECTION&)> T_HANDLER;
+
+  GenericHTTPReusePortServer(const SocketAddress& address,
+                             T_HANDLER handler,
+                             size_t threads = std::thread::hardware_concurrency(),
+                             bool pin_to_cpus = false,
+                             const HTTPServerLimits& limits = HTTPServerLimits())
+      : handler_(handler), pin_to_cpus_(pin_to_cpus), limits_(limits), drain_(threads ? threads : 1) {
+    if (!threads) {
+      threads = 1;
+    }
+    // Create all the sockets upfront, so that binding errors are reported to the caller.
+    for (size_t i = 0; i < threads; ++i) {
+      sockets_.emplace_back(new Socket(address, kMaxQueuedConnections, true));
+      sockets_.back()->MakeNonBlocking();
+    }
+  }
+
+  // Takes over the listening sockets `listening_fds`, such as those of `ListeningDescriptors()` of the previous
+  // server process, with one worker thread each.
+  GenericHTTPReusePortServer(const std::vector<int>& listening_fds,
+                             T_HANDLER handler,
+                             bool pin_to_cpus = false,
+                             const HTTPServerLimits& limits = HTTPServerLimits())
+      : handler_(handler), pin_to_cpus_(pin_to_cpus), limits_(limits), drain_(listening_fds.size()) {
+    for (const int fd : listening_fds) {
+      sockets_.emplace_back(new Socket(AdoptListeningSocket(), fd));
+      sockets_.back()->MakeNonBlocking();
+    }
+  }
+
+  std::vector<int> ListeningDescriptors() const {
+    std::vector<int> result;
+    for (const auto& socket : sockets_) {
+      result.push_back(socket->Descriptor());
+    }
+    return result;
+  }
+
+  // Runs the accepting workers until `Shutdown()`.
+  void Run() {
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < sockets_.size(); ++i) {
+      workers.emplace_back(&GenericHTTPReusePortServer::WorkerThread, this, i);
+    }
+    for (auto& thread : workers) {
+      thread.join();
+    }
+  }
+
+  // Makes `Run()` return once the connections being served are done, and waits up to `timeout` for them.
+  // Returns false if some are still being served by then. Thread-safe.
+  bool Shutdown(std::chrono::milliseconds timeout = kDefaultHTTPDrainTimeout) {
+    drain_.Begin();
+    return drain_.Wait(timeout);
+  }
+
+ private:
+  void WorkerThread(size_t index) {
+    if (pin_to_cpus_) {
+      const unsigned cpus = std::thread::hardware_concurrency();
+      if (cpus) {
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        CPU_SET(index % cpus, &cpu_set);
+        // Best effort: the server still works, unpinned, if the affinity can not be set.
+        pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+      }
+    }
+    const Socket& socket = *sockets_[index];
+    // As in `GenericHTTPThreadPoolServer::Run()`, a full backlog would keep the drain from being noticed.
+    while (!*drain_.Draining()) {
+      int fd;
+      try {
+        fd = socket.AcceptOrWake(drain_.WakeDescriptor());
+      } catch (SocketAcceptNoResourcesException&) {
+        // Transient: this and the other workers free descriptors as their connections close.
+        std::this_thread::sleep_for(kAcceptNoResourcesDelay);
+        continue;
+      } catch (NetworkException&) {
+        continue;
+      }
+      if (fd == -1) {
+        return;
+      }
+      drain_.ConnectionStarted();
+      try {
+        CONNECTION c(GenericConnection(fd), limits_);
+        c.CloseWhen(drain_.Draining());
+        do {
+          handler_(c);
+        } while (drain_.NextRequest(index, c));
+      } catch (NetworkException&) {
+      }
+      drain_.ConnectionFinished();
+    }
+  }
+
+  const T_HANDLER handler_;
+  const bool pin_to_cpus_;
+  const HTTPServerLimits limits_;
+  HTTPServerDrain drain_;
+  std::vector<std::unique_ptr<Socket>> sockets_;
+
+  GenericHTTPReusePortServer(const GenericHTTPReusePortServer&) = delete;
+  GenericHTTPReusePortServer(GenericHTTPReusePortServer&&) = delete;
+  void operator=(const GenericHTTPReusePortServer&) = delete;
+  void operator=(GenericHTTPReusePortServer&&) = delete;
+};
+
+typedef GenericHTTPReusePortServer<HTTPConnection> HTTPReusePortServer;
+
 #endif  // TOY_POSIX_HTTP_SERVER_H
@@ -2,26 +2,165 @@
 #define TOY_POSIX_TCP_SERVER_H
 
 #include "exceptions.h"
+#include "metrics.h"
+#include "socket_address.h"
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <cerrno>
 #include <cstring>
 #include <string>
 #include <utility>
 #include <vector>
 
 #include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 const size_t kDefaultMaxLengthToReceive = 1024 * 1024;
 const size_t kMaxQueuedConnections = 1024;
 
+// The most bytes to `splice()` into a pipe at once: the default capacity of a pipe.
+const size_t kMaxSpliceLength = 64 * 1024;
+
+// How long to wait before accepting again when out of descriptors or memory, for some connections to close
+// meanwhile, rather than to spin on the pending ones.
+const std::chrono::milliseconds kAcceptNoResourcesDelay = std::chrono::milliseconds(10);
+
+// Returned by non-blocking reads and writes when the operation would block.
+const size_t kWouldBlock = static_cast<size_t>(-1);
+
+inline void MakeNonBlocking(const int fd) {
+  const int flags = fcntl(fd, F_GETFL, 0);
+  if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+    throw SocketFcntlException();
+  }
+}
+
+// For non-blocking descriptors: returns the number of bytes read, `0` if the peer has closed the connection,
+// or `kWouldBlock` if no data is available right now.
+inline size_t NonBlockingRead(int fd, void* buffer, size_t max_length) {
+  const ssize_t result = read(fd, buffer, max_length);
+  if (result < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+      return kWouldBlock;
+    }
+    MetricsAdd(MetricsCounter::ReadErrors);
+    throw SocketReadException();
+  }
+  MetricsAdd(MetricsCounter::Reads);
+  MetricsAdd(MetricsCounter::ReadBytes, static_cast<size_t>(result));
+  return static_cast<size_t>(result);
+}
+
+// For non-blocking descriptors: returns the number of bytes written, possibly fewer than requested,
+// or `kWouldBlock` if the socket send buffer is full. A peer that has gone makes it throw rather than raise `SIGPIPE`,
+// so the descriptor must be a socket.
+inline size_t NonBlockingWrite(int fd, const void* buffer, size_t write_length) {
+  assert(buffer);
+  const ssize_t result = send(fd, buffer, write_length, MSG_NOSIGNAL);
+  if (result < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+      return kWouldBlock;
+    }
+    MetricsAdd(MetricsCounter::WriteErrors);
+    throw SocketWriteException();
+  }
+  MetricsAdd(MetricsCounter::Writes);
+  MetricsAdd(MetricsCounter::WrittenBytes, static_cast<size_t>(result));
+  return static_cast<size_t>(result);
+}
+
+// In-memory I/O for a connection served by a reactor, such as the coroutine server, rather than by a thread
+// blocking on its socket. The blocking reads of the connection take the bytes the reactor has received,
+// up to `input_end`, and its blocking writes append to `output`, for the reactor to send.
+struct ConnectionBuffers {
+  std::vector<char> input;  // Received bytes in `[0, received)`, followed by room for more.
+  size_t received = 0;
+  size_t input_begin = 0;  // The next byte for a blocking read.
+  size_t input_end = 0;    // Blocking reads stop here, even if more has been received.
+  std::vector<char> output;
+
+  size_t Read(void* buffer, size_t max_length) {
+    const size_t n = std::min(max_length, input_end - input_begin);
+    if (n) {
+      memcpy(buffer, &input[input_begin], n);
+      input_begin += n;
+    }
+    return n;
+  }
+
+  void Write(const void* buffer, size_t length) {
+    output.insert(output.end(), static_cast<const char*>(buffer), static_cast<const char*>(buffer) + length);
+  }
+};
+
+// A pipe to move data between sockets with `splice()`, which needs a pipe on one side. Empty between transfers.
+class SplicePipe final {
+ public:
+  SplicePipe() {
+    Open();
+  }
+
+  ~SplicePipe() {
+    Close();
+  }
+
+  int ReadEnd() const {
+    return fds_[0];
+  }
+
+  int WriteEnd() const {
+    return fds_[1];
+  }
+
+  // Drops whatever a failed transfer has left in the pipe.
+  void Reset() {
+    Close();
+    Open();
+  }
+
+ private:
+  void Open() {
+    if (pipe2(fds_, O_CLOEXEC)) {
+      throw SocketCreateException();
+    }
+  }
+
+  void Close() {
+    close(fds_[0]);
+    close(fds_[1]);
+  }
+
+  int fds_[2];
+
+  SplicePipe(const SplicePipe&) = delete;
+  void operator=(const SplicePipe&) = delete;
+};
+
+// The pipe of the calling thread, created on first use.
+inline SplicePipe& ThreadSplicePipe() {
+  static thread_local SplicePipe pipe;
+  return pipe;
+}
+
 class GenericConnection {
  public:
   explicit GenericConnection(const int fd) : fd_(fd) {
   }
 
-  GenericConnection(GenericConnection&& rhs) : fd_(-1) {
+  GenericConnection(GenericConnection&& rhs) : fd_(-1), buffers_(nullptr) {
     std::swap(fd_, rhs.fd_);
+    std::swap(buffers_, rhs.buffers_);
   }
 
   ~GenericConnection() {
@@ -30,22 +169,110 @@ class GenericConnection {
     }
   }
 
+  int Descriptor() const {
+    return fd_;
+  }
+
+  void MakeNonBlocking() {
+    ::MakeNonBlocking(fd_);
+  }
+
+  // Makes blocking reads fail with `SocketReadException` after `timeout` without data; zero means wait forever.
+  void SetReceiveTimeout(std::chrono::milliseconds timeout) {
+    timeval tv;
+    tv.tv_sec = static_cast<time_t>(timeout.count() / 1000);
+    tv.tv_usec = static_cast<suseconds_t>((timeout.count() % 1000) * 1000);
+    if (setsockopt(fd_, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv))) {
+      throw SocketSetOptionException();
+    }
+  }
+
+  // Makes the blocking reads and writes work on `*buffers` instead of the socket, or on the socket again
+  // with `nullptr`.
+  void UseBuffers(ConnectionBuffers* buffers) {
+    buffers_ = buffers;
+  }
+
+  ConnectionBuffers* Buffers() const {
+    return buffers_;
+  }
+
+  // Gives up the ownership of the descriptor, which will no longer be closed by this object.
+  int Release() {
+    const int fd = fd_;
+    fd_ = -1;
+    return fd;
+  }
+
   template <typename T>
   size_t BlockingRead(T* buffer, size_t max_length = kDefaultMaxLengthToReceive) const {
+    if (buffers_) {
+      return buffers_->Read(buffer, max_length * sizeof(T));
+    }
     const int read_length_or_error = read(fd_, reinterpret_cast<void*>(buffer), max_length * sizeof(T));
     if (read_length_or_error < 0) {
+      MetricsAdd(MetricsCounter::ReadErrors);
       throw SocketReadException();
     }
+    MetricsAdd(MetricsCounter::Reads);
+    MetricsAdd(MetricsCounter::ReadBytes, static_cast<size_t>(read_length_or_error));
     return static_cast<size_t>(read_length_or_error);
   }
 
   void BlockingWrite(const void* buffer, size_t write_length) {
     assert(buffer);
-    const int result = write(fd_, buffer, write_length);
-    if (result < 0) {
-      throw SocketWriteException();
-    } else if (result != static_cast<int>(write_length)) {
-      throw SocketCouldNotWriteEverythingException();
+    iovec iov;
+    iov.iov_base = const_cast<void*>(buffer);
+    iov.iov_len = write_length;
+    BlockingWrite(&iov, 1);
+  }
+
+  // Writes all the buffers, gathering them into as few syscalls as possible and resuming after partial writes.
+  // Modifies `iov` in the process. With `more` set, the kernel may hold the data back until the next write,
+  // to send both in the same TCP segment.
+  void BlockingWrite(iovec* iov, size_t count, bool more = false) {
+    if (buffers_) {
+      for (size_t i = 0; i < count; ++i) {
+        buffers_->Write(iov[i].iov_base, iov[i].iov_len);
+      }
+      return;
+    }
+    while (count && !iov->iov_len) {
+      ++iov;
+      --count;
+    }
+    while (count) {
+      msghdr message;
+      memset(&message, 0, sizeof(message));
+      message.msg_iov = iov;
+      message.msg_iovlen = count;
+      // `MSG_NOSIGNAL` turns a write to a connection closed by the peer into an error instead of a `SIGPIPE`.
+      ssize_t result = sendmsg(fd_, &message, MSG_NOSIGNAL | (more ? MSG_MORE : 0));
+      if (result < 0 && errno == ENOTSOCK) {
+        result = writev(fd_, iov, static_cast<int>(count));
+      }
+      if (result < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        MetricsAdd(MetricsCounter::WriteErrors);
+        throw SocketWriteException();
+      } else if (!result) {
+        MetricsAdd(MetricsCounter::WriteErrors);
+        throw SocketCouldNotWriteEverythingException();
+      }
+      MetricsAdd(MetricsCounter::Writes);
+      MetricsAdd(MetricsCounter::WrittenBytes, static_cast<size_t>(result));
+      size_t written = static_cast<size_t>(result);
+      while (count && written >= iov->iov_len) {
+        written -= iov->iov_len;
+        ++iov;
+        --count;
+      }
+      if (count) {
+        iov->iov_base = static_cast<char*>(iov->iov_base) + written;
+        iov->iov_len -= written;
+      }
     }
   }
 
@@ -64,8 +291,116 @@ class GenericConnection {
     BlockingWrite(container.begin(), container.end());
   }
 
+  // Sends `length` bytes from the descriptor `in_fd` without copying them through user space:
+  // with `sendfile()` from a regular file, starting at `offset`, or with `splice()` from a pipe.
+  void BlockingSendFile(int in_fd, off_t offset, size_t length) {
+    if (buffers_) {
+      BufferFrom(in_fd, offset, length);
+      return;
+    }
+    struct stat in_stat;
+    if (fstat(in_fd, &in_stat)) {
+      throw SocketSendFileException();
+    }
+    const bool is_pipe = S_ISFIFO(in_stat.st_mode);
+    while (length) {
+      const ssize_t result = is_pipe ? splice(in_fd, nullptr, fd_, nullptr, length, SPLICE_F_MORE)
+                                     : sendfile(fd_, in_fd, &offset, length);
+      if (result < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        MetricsAdd(MetricsCounter::WriteErrors);
+        throw SocketSendFileException();
+      } else if (!result) {
+        // The file is shorter than promised.
+        MetricsAdd(MetricsCounter::WriteErrors);
+        throw SocketCouldNotWriteEverythingException();
+      }
+      MetricsAdd(MetricsCounter::Writes);
+      MetricsAdd(MetricsCounter::WrittenBytes, static_cast<size_t>(result));
+      length -= static_cast<size_t>(result);
+    }
+  }
+
+  // Moves `length` bytes from the socket `in_fd` to this one through `pipe`, without copying them through
+  // user space. Throws `SocketReadException` if `in_fd` fails or ends first, and `SocketWriteException`
+  // if this socket fails; either way, the bytes already moved are gone from `in_fd`.
+  void BlockingSpliceFrom(int in_fd, size_t length, SplicePipe& pipe) {
+    if (buffers_) {
+      BufferFrom(in_fd, -1, length);
+      return;
+    }
+    try {
+      while (length) {
+        const ssize_t in =
+            splice(in_fd, nullptr, pipe.WriteEnd(), nullptr, std::min(length, kMaxSpliceLength), SPLICE_F_MOVE);
+        if (in < 0 && errno == EINTR) {
+          continue;
+        } else if (in <= 0) {
+          MetricsAdd(MetricsCounter::ReadErrors);
+          throw SocketReadException();
+        }
+        MetricsAdd(MetricsCounter::Reads);
+        MetricsAdd(MetricsCounter::ReadBytes, static_cast<size_t>(in));
+        length -= static_cast<size_t>(in);
+        size_t piped = static_cast<size_t>(in);
+        while (piped) {
+          const ssize_t out =
+              splice(pipe.ReadEnd(), nullptr, fd_, nullptr, piped, SPLICE_F_MOVE | (length ? SPLICE_F_MORE : 0));
+          if (out < 0 && errno == EINTR) {
+            continue;
+          } else if (out <= 0) {
+            MetricsAdd(MetricsCounter::WriteErrors);
+            throw SocketWriteException();
+          }
+          MetricsAdd(MetricsCounter::Writes);
+          MetricsAdd(MetricsCounter::WrittenBytes, static_cast<size_t>(out));
+          piped -= static_cast<size_t>(out);
+        }
+      }
+    } catch (SocketException&) {
+      pipe.Reset();
+      throw;
+    }
+  }
+
+  // For non-blocking descriptors: see `::NonBlockingRead()`.
+  size_t NonBlockingRead(void* buffer, size_t max_length) const {
+    return ::NonBlockingRead(fd_, buffer, max_length);
+  }
+
+  // For non-blocking descriptors: see `::NonBlockingWrite()`.
+  size_t NonBlockingWrite(const void* buffer, size_t write_length) {
+    return ::NonBlockingWrite(fd_, buffer, write_length);
+  }
+
  private:
+  // Appends `length` bytes of `in_fd` to the buffered output, from `offset`, or from the current position
+  // if negative.
+  void BufferFrom(int in_fd, off_t offset, size_t length) {
+    std::vector<char>& output = buffers_->output;
+    size_t size = output.size();
+    output.resize(size + length);
+    while (length) {
+      const ssize_t result =
+          offset < 0 ? read(in_fd, &output[size], length) : pread(in_fd, &output[size], length, offset);
+      if (result < 0 && errno == EINTR) {
+        continue;
+      } else if (result <= 0) {
+        output.resize(size);
+        throw SocketSendFileException();
+      }
+      size += static_cast<size_t>(result);
+      length -= static_cast<size_t>(result);
+      if (offset >= 0) {
+        offset += result;
+      }
+    }
+  }
+
   int fd_;  // Non-const for move constructor.
+  ConnectionBuffers* buffers_ = nullptr;
 
   GenericConnection(const GenericConnection&) = delete;
   void operator=(const GenericConnection&) = delete;
@@ -81,22 +416,94 @@ class Connection final : public GenericConnection {
   }
 };
 
+// Takes over the connected `fd`, with Nagle's algorithm off over TCP, as requests are written whole.
+inline GenericConnection ConnectedSocket(int fd, int family) {
+  if (family == AF_INET || family == AF_INET6) {
+    int just_one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &just_one, sizeof(int));
+  }
+  MetricsAdd(MetricsCounter::Connects);
+  return GenericConnection(fd);
+}
+
+// Connects to `port` on `host`, a name or an IPv4 or IPv6 address, as a blocking connection.
+inline GenericConnection Connect(const std::string& host, int port) {
+  addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* addresses = nullptr;
+  if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addresses)) {
+    MetricsAdd(MetricsCounter::ConnectErrors);
+    throw SocketConnectException();
+  }
+  int fd = -1;
+  int family = AF_UNSPEC;
+  for (const addrinfo* address = addresses; address && fd == -1; address = address->ai_next) {
+    family = address->ai_family;
+    fd = socket(family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd != -1 && connect(fd, address->ai_addr, address->ai_addrlen)) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  freeaddrinfo(addresses);
+  if (fd == -1) {
+    MetricsAdd(MetricsCounter::ConnectErrors);
+    throw SocketConnectException();
+  }
+  return ConnectedSocket(fd, family);
+}
+
+// Connects to `address`, of any family, as a blocking connection.
+inline GenericConnection Connect(const SocketAddress& address) {
+  const int fd = socket(address.Family(), SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1 || connect(fd, address.Address(), address.Length())) {
+    if (fd != -1) {
+      close(fd);
+    }
+    MetricsAdd(MetricsCounter::ConnectErrors);
+    throw SocketConnectException();
+  }
+  return ConnectedSocket(fd, address.Family());
+}
+
+// Tags the constructor of `Socket` that takes over a descriptor already bound and listening, such as one
+// inherited from, or handed over by, the previous server process.
+struct AdoptListeningSocket {};
+
 class Socket final {
  public:
-  explicit Socket(int port, int max_connections = kMaxQueuedConnections) : socket_(socket(AF_INET, SOCK_STREAM, 0)) {
+  // With `reuse_port` set, several sockets can listen on the same port, and the kernel load-balances
+  // incoming connections across them. Use one such socket per accepting thread to avoid a shared accept queue.
+  // Only IP addresses can be shared this way.
+  // The path of a Unix socket is left in place as the socket closes, for it to keep working once handed over
+  // to the next server process; binding to it again removes it first, unless some process still listens on it.
+  explicit Socket(const SocketAddress& address, int max_connections = kMaxQueuedConnections, bool reuse_port = false)
+      : socket_(socket(address.Family(), SOCK_STREAM, 0)) {
     if (socket_ < 0) {
       throw SocketCreateException();
     }
 
     int just_one = 1;
-    setsockopt(socket_, SOL_SOCKET, SO_REUSEADDR, &just_one, sizeof(int));
-
-    sockaddr_in addr_server;
-    addr_server.sin_family = AF_INET;
-    addr_server.sin_addr.s_addr = INADDR_ANY;
-    addr_server.sin_port = htons(port);
+    if (address.IsIP()) {
+      setsockopt(socket_, SOL_SOCKET, SO_REUSEADDR, &just_one, sizeof(int));
+    }
+    if (reuse_port && (!address.IsIP() || setsockopt(socket_, SOL_SOCKET, SO_REUSEPORT, &just_one, sizeof(int)))) {
+      close(socket_);
+      throw SocketSetOptionException();
+    }
+    // Set either way, as the system-wide default can be either.
+    int v6_only = address.V6Only();
+    if (address.Family() == AF_INET6 && setsockopt(socket_, IPPROTO_IPV6, IPV6_V6ONLY, &v6_only, sizeof(int))) {
+      close(socket_);
+      throw SocketSetOptionException();
+    }
 
-    if (bind(socket_, (sockaddr*)&addr_server, sizeof(addr_server)) == -1) {
+    if (address.IsUnix() && !address.IsAbstract()) {
+      RemoveStaleUnixSocket(address);
+    }
+    if (bind(socket_, address.Address(), address.Length()) == -1) {
       close(socket_);
       throw SocketBindException();
     }
@@ -107,21 +514,116 @@ class Socket final {
     }
   }
 
+  Socket(AdoptListeningSocket, int fd) : socket_(fd) {
+    int listening = 0;
+    socklen_t length = sizeof(listening);
+    if (getsockopt(socket_, SOL_SOCKET, SO_ACCEPTCONN, &listening, &length) || !listening) {
+      close(socket_);
+      throw SocketListenException();
+    }
+  }
+
   ~Socket() {
     close(socket_);
   }
 
   GenericConnection Accept() const {
-    sockaddr_in addr_client;
-    socklen_t addr_client_length = sizeof(sockaddr_in);
-    const int fd = accept(socket_, (struct sockaddr*)&addr_client, &addr_client_length);
+    const int fd = accept(socket_, nullptr, nullptr);
     if (fd == -1) {
+      MetricsAdd(MetricsCounter::AcceptErrors);
       throw SocketAcceptException();
     }
+    MetricsAdd(MetricsCounter::Accepts);
     return GenericConnection(fd);
   }
 
+  int Descriptor() const {
+    return socket_;
+  }
+
+  // The address bound, with the port the kernel has picked for port zero.
+  SocketAddress LocalAddress() const {
+    sockaddr_storage address;
+    socklen_t length = sizeof(address);
+    if (getsockname(socket_, reinterpret_cast<sockaddr*>(&address), &length)) {
+      throw SocketAddressException();
+    }
+    return SocketAddress(reinterpret_cast<const sockaddr*>(&address), length);
+  }
+
+  void MakeNonBlocking() {
+    ::MakeNonBlocking(socket_);
+  }
+
+  // For non-blocking sockets: returns the descriptor of the accepted connection, itself non-blocking,
+  // or -1 if there are no pending connections. Throws `SocketAcceptNoResourcesException` when out of descriptors
+  // or memory, with the pending connections left queued.
+  int NonBlockingAccept() const {
+    const int fd = accept4(socket_, nullptr, nullptr, SOCK_NONBLOCK);
+    if (fd == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR || errno == ECONNABORTED) {
+        return -1;
+      }
+      MetricsAdd(MetricsCounter::AcceptErrors);
+      if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+        throw SocketAcceptNoResourcesException();
+      }
+      throw SocketAcceptException();
+    }
+    MetricsAdd(MetricsCounter::Accepts);
+    return fd;
+  }
+
+  // Waits for a connection, and accepts it as a blocking one, unless `wake_fd` becomes readable first.
+  // Returns the accepted descriptor, or -1 once `wake_fd` is readable. The socket must be non-blocking,
+  // as another thread or process accepting from it may take the connection between the wait and the accept.
+  // Throws `SocketAcceptNoResourcesException` when out of descriptors or memory, as `NonBlockingAccept()` does.
+  int AcceptOrWake(int wake_fd) const {
+    while (true) {
+      const int fd = accept4(socket_, nullptr, nullptr, 0);
+      if (fd != -1) {
+        MetricsAdd(MetricsCounter::Accepts);
+        return fd;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED) {
+        MetricsAdd(MetricsCounter::AcceptErrors);
+        if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+          throw SocketAcceptNoResourcesException();
+        }
+        throw SocketAcceptException();
+      }
+      pollfd fds[2];
+      fds[0].fd = socket_;
+      fds[0].events = POLLIN;
+      fds[1].fd = wake_fd;
+      fds[1].events = POLLIN;
+      fds[0].revents = fds[1].revents = 0;
+      if (poll(fds, 2, -1) < 0 && errno != EINTR) {
+        throw SocketAcceptException();
+      }
+      if (fds[1].revents) {
+        return -1;
+      }
+    }
+  }
+
  private:
+  // Unlinks the socket file at the path of `address` if no process accepts on it any more.
+  static void RemoveStaleUnixSocket(const SocketAddress& address) {
+    struct stat status;
+    if (stat(address.UnixPath().c_str(), &status) || !S_ISSOCK(status.st_mode)) {
+      return;
+    }
+    const int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (probe == -1) {
+      return;
+    }
+    if (connect(probe, address.Address(), address.Length()) && errno == ECONNREFUSED) {
+      unlink(address.UnixPath().c_str());
+    }
+    close(probe);
+  }
+
   const int socket_;
 
   Socket(const Socket&) = delete;
@@ -0,0 +1,524 @@
+#ifndef TOY_POSIX_URING_SERVER_H
+#define TOY_POSIX_URING_SERVER_H
+
+// A completion-based reactor on io_uring, with the handler interface of the epoll one, see `posix_epoll_server.h`.
+//
+// The listening socket is armed once with a multishot accept, and each connection once with a multishot receive
+// into the provided buffers of an `IOUringBufferRing`, so neither costs a syscall per operation. What a handler
+// writes is collected and sent by one `IORING_OP_SEND` at a time, and the last send of a connection being closed
+// is linked to its `IORING_OP_CLOSE`. All that is queued while dispatching a batch of completions is submitted
+// in the same `io_uring_enter()` that waits for the next batch.
+//
+// Handlers get a `UringConnection` instead of a `GenericConnection`, with the same non-blocking reads and writes,
+// so a handler templated on its connection runs on either reactor; `IOUringSupported()` tells which one to pick,
+// see `epoll_http_server.cc`. Single-threaded: run it on the thread that has constructed it.
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <sys/socket.h>
+
+#include "exceptions.h"
+#include "metrics.h"
+#include "posix_epoll_server.h"
+#include "posix_tcp_server.h"
+#include "timer_wheel.h"
+#include "uring.h"
+
+const std::chrono::milliseconds kDefaultUringTimerResolution = std::chrono::milliseconds(100);
+// Written and not yet submitted, per connection, beyond which `NonBlockingWrite()` returns `kWouldBlock`.
+const size_t kDefaultUringMaxPendingOutput = 256 * 1024;
+// How long a closed connection may take to send out what it has written, before it is dropped.
+const std::chrono::milliseconds kDefaultUringLingerTimeout = std::chrono::seconds(10);
+const uint16_t kUringBufferGroup = 0;
+
+// The I/O state of a connection of `UringServer`, shared by the reactor and the `UringConnection` of its handler.
+struct UringConnectionIO {
+  struct Received {
+    uint16_t buffer;
+    uint32_t offset;
+    uint32_t length;
+  };
+
+  const int fd;
+  IOUringBufferRing& buffers;
+  std::vector<Received> received;  // Not yet read, from `received_head` on.
+  size_t received_head = 0;
+  std::string output;  // Written, not yet submitted.
+  bool end_of_stream = false;
+  bool failed = false;
+  bool write_blocked = false;  // Until the handler is called back with `OnWritable()`.
+
+  UringConnectionIO(int fd, IOUringBufferRing& buffers) : fd(fd), buffers(buffers) {
+  }
+
+  void RecycleReceived() {
+    for (size_t i = received_head; i < received.size(); ++i) {
+      buffers.Recycle(received[i].buffer);
+    }
+    received.clear();
+    received_head = 0;
+  }
+};
+
+// Does not own the descriptor: the reactor closes it once the handler is done with it.
+class UringConnection final {
+ public:
+  explicit UringConnection(UringConnectionIO* io) : io_(io) {
+  }
+
+  UringConnection(UringConnection&& rhs) : io_(rhs.io_) {
+    rhs.io_ = nullptr;
+  }
+
+  int Descriptor() const {
+    return io_->fd;
+  }
+
+  // Returns the number of bytes copied out of the buffers received, `0` if the peer has closed the connection,
+  // or `kWouldBlock` if nothing is left to read.
+  size_t NonBlockingRead(void* buffer, size_t max_length) const {
+    if (io_->failed) {
+      throw SocketReadException();
+    }
+    size_t length = 0;
+    while (length < max_length && io_->received_head < io_->received.size()) {
+      UringConnectionIO::Received& received = io_->received[io_->received_head];
+      const size_t n = std::min(max_length - length, static_cast<size_t>(received.length - received.offset));
+      memcpy(static_cast<char*>(buffer) + length, io_->buffers.Buffer(received.buffer) + received.offset, n);
+      length += n;
+      received.offset += static_cast<uint32_t>(n);
+      if (received.offset == received.length) {
+        io_->buffers.Recycle(received.buffer);
+        if (++io_->received_head == io_->received.size()) {
+          io_->received.clear();
+          io_->received_head = 0;
+        }
+      }
+    }
+    if (length) {
+      return length;
+    }
+    return io_->end_of_stream ? 0 : kWouldBlock;
+  }
+
+  // Returns the number of bytes taken, to be sent once the handler returns, possibly fewer than requested,
+  // or `kWouldBlock` if `kDefaultUringMaxPendingOutput` bytes are waiting already.
+  size_t NonBlockingWrite(const void* buffer, size_t write_length) {
+    assert(buffer);
+    if (io_->failed) {
+      throw SocketWriteException();
+    }
+    if (io_->output.size() >= kDefaultUringMaxPendingOutput) {
+      io_->write_blocked = true;
+      return kWouldBlock;
+    }
+    const size_t n = std::min(write_length, kDefaultUringMaxPendingOutput - io_->output.size());
+    io_->output.append(static_cast<const char*>(buffer), n);
+    return n;
+  }
+
+ private:
+  UringConnectionIO* io_;
+
+  UringConnection(const UringConnection&) = delete;
+  void operator=(const UringConnection&) = delete;
+  void operator=(UringConnection&&) = delete;
+};
+
+// `HANDLER` is as for `EpollServer`, constructed from a `UringConnection&&`. `OnReadable()` is called once data
+// has been received, and `OnWritable()` once what it has written is sent, if a write has returned `kWouldBlock`.
+template <typename HANDLER>
+class UringServer final {
+ public:
+  explicit UringServer(Socket& socket,
+                       unsigned entries = kDefaultIOUringEntries,
+                       std::chrono::milliseconds timer_resolution = kDefaultUringTimerResolution)
+      : socket_(socket),
+        ring_(entries),
+        buffers_(ring_, kUringBufferGroup),
+        timer_resolution_(timer_resolution.count() > 0 ? timer_resolution : std::chrono::milliseconds(1)),
+        epoch_(std::chrono::steady_clock::now()) {
+    Accept();
+  }
+
+  ~UringServer() {
+    for (auto& connection : connections_) {
+      timers_.Cancel(connection.first);
+    }
+  }
+
+  void Run() {
+    while (true) {
+      RunOnce(-1);
+    }
+  }
+
+  // Submits what is queued, waits up to `timeout_ms` milliseconds, -1 meaning forever, and dispatches all
+  // completions and expired deadlines. While any deadline is pending, waits for at most one timer resolution.
+  // Returns the number of completions processed.
+  size_t RunOnce(int timeout_ms) {
+    if ((!timers_.Empty() || accept_paused_) && (timeout_ms < 0 || timeout_ms > timer_resolution_.count())) {
+      timeout_ms = static_cast<int>(timer_resolution_.count());
+    }
+    ring_.SubmitAndWait(timeout_ms);
+    const size_t n = ring_.ForEachCompletion([this](const io_uring_cqe& cqe) { Complete(cqe); });
+    if (accept_paused_ && std::chrono::steady_clock::now() >= accept_resume_) {
+      ResumeAccepting();
+    }
+    if (!timers_.Empty()) {
+      timers_.Advance(ElapsedTicks(std::chrono::steady_clock::now()),
+                      [this](TimerWheelEntry* timer) { Expire(static_cast<Entry*>(timer)); });
+    }
+    return n;
+  }
+
+  // As `EpollServer::Drain()`.
+  bool Drain(std::chrono::milliseconds timeout) {
+    draining_ = true;
+    accept_paused_ = false;
+    if (accepting_) {
+      Cancel(UserData(nullptr, Operation::Accept));
+    }
+    const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + timeout;
+    while (!connections_.empty()) {
+      const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+      if (now >= deadline) {
+        return false;
+      }
+      RunOnce(static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count()) + 1);
+    }
+    return true;
+  }
+
+  // Closed connections included, until their last operations complete.
+  size_t ConnectionsCount() const {
+    return connections_.size();
+  }
+
+ private:
+  // Tagged into the low bits of the `user_data` of each submission, along with its `Entry`.
+  enum class Operation : uintptr_t { Ignored, Accept, Receive, Send, Close };
+  static const uintptr_t kOperationMask = 7;
+
+  struct Entry : TimerWheelEntry {
+    UringConnectionIO io;
+    HANDLER handler;
+    std::string sending;  // Submitted, from `sent` on.
+    size_t sent = 0;
+    size_t in_flight = 0;  // Operations submitted and not yet through with their completions.
+    bool receiving = false;
+    bool send_in_flight = false;
+    bool closing = false;  // The handler is done: send out what it has written, and close.
+    bool close_submitted = false;
+    bool closed = false;
+
+    Entry(int fd, IOUringBufferRing& buffers) : io(fd, buffers), handler(UringConnection(&io)) {
+    }
+
+    ~Entry() {
+      io.RecycleReceived();
+      if (!closed) {
+        close(io.fd);
+      }
+    }
+  };
+
+  static uint64_t UserData(Entry* entry, Operation operation) {
+    return reinterpret_cast<uintptr_t>(entry) | static_cast<uintptr_t>(operation);
+  }
+
+  // Rounded up, for deadlines to never fire early.
+  uint64_t Ticks(std::chrono::steady_clock::time_point t) const {
+    return static_cast<uint64_t>((t - epoch_ + timer_resolution_ - std::chrono::nanoseconds(1)) / timer_resolution_);
+  }
+
+  // Rounded down, for the timers to never be advanced ahead of the clock.
+  uint64_t ElapsedTicks(std::chrono::steady_clock::time_point t) const {
+    return static_cast<uint64_t>((t - epoch_) / timer_resolution_);
+  }
+
+  void Accept() {
+    io_uring_sqe* sqe = ring_.NextSubmission();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = socket_.Descriptor();
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = UserData(nullptr, Operation::Accept);
+    accepting_ = true;
+  }
+
+  // Out of descriptors, the accept is not rearmed until a connection closes or one timer resolution has passed,
+  // as it would fail again straight away.
+  void PauseAccepting() {
+    accept_paused_ = true;
+    accept_resume_ = std::chrono::steady_clock::now() + timer_resolution_;
+  }
+
+  void ResumeAccepting() {
+    accept_paused_ = false;
+    if (!draining_) {
+      Accept();
+    }
+  }
+
+  void Receive(Entry* entry) {
+    io_uring_sqe* sqe = ring_.NextSubmission();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = entry->io.fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = buffers_.Group();
+    sqe->user_data = UserData(entry, Operation::Receive);
+    entry->receiving = true;
+    ++entry->in_flight;
+  }
+
+  void Cancel(uint64_t user_data) {
+    io_uring_sqe* sqe = ring_.NextSubmission();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = user_data;
+    sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+    sqe->user_data = UserData(nullptr, Operation::Ignored);
+  }
+
+  // Sends what the handler has written, unless a send is in flight already. For a connection being closed,
+  // once all of it is submitted, closes it too, right after the last send.
+  void Flush(Entry* entry) {
+    if (entry->send_in_flight || entry->close_submitted) {
+      return;
+    }
+    if (entry->sent == entry->sending.size()) {
+      entry->sending.clear();
+      entry->sent = 0;
+      entry->sending.swap(entry->io.output);
+    }
+    const bool last = entry->closing && entry->io.output.empty();
+    if (last) {
+      ring_.Reserve(2);
+    }
+    if (entry->sent < entry->sending.size()) {
+      io_uring_sqe* sqe = ring_.NextSubmission();
+      sqe->opcode = IORING_OP_SEND;
+      sqe->fd = entry->io.fd;
+      sqe->addr = reinterpret_cast<uint64_t>(&entry->sending[entry->sent]);
+      sqe->len = static_cast<uint32_t>(entry->sending.size() - entry->sent);
+      // `MSG_WAITALL` has the kernel carry on after partial sends, for the chain to break on errors only.
+      sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+      sqe->flags = last ? IOSQE_IO_LINK : 0;
+      sqe->user_data = UserData(entry, Operation::Send);
+      entry->send_in_flight = true;
+      ++entry->in_flight;
+    }
+    if (last) {
+      io_uring_sqe* sqe = ring_.NextSubmission();
+      sqe->opcode = IORING_OP_CLOSE;
+      sqe->fd = entry->io.fd;
+      sqe->user_data = UserData(entry, Operation::Close);
+      entry->close_submitted = true;
+      ++entry->in_flight;
+    }
+  }
+
+  void Complete(const io_uring_cqe& cqe) {
+    Entry* const entry = reinterpret_cast<Entry*>(cqe.user_data & ~kOperationMask);
+    switch (static_cast<Operation>(cqe.user_data & kOperationMask)) {
+      case Operation::Accept:
+        Accepted(cqe);
+        break;
+      case Operation::Receive:
+        Received(entry, cqe);
+        break;
+      case Operation::Send:
+        Sent(entry, cqe);
+        break;
+      case Operation::Close:
+        Closed(entry, cqe);
+        break;
+      case Operation::Ignored:
+        break;
+    }
+  }
+
+  void Accepted(const io_uring_cqe& cqe) {
+    if (!(cqe.flags & IORING_CQE_F_MORE)) {
+      accepting_ = false;
+      if (cqe.res == -EMFILE || cqe.res == -ENFILE || cqe.res == -ENOBUFS || cqe.res == -ENOMEM) {
+        PauseAccepting();
+      } else if (!draining_) {
+        Accept();
+      }
+    }
+    if (cqe.res < 0) {
+      if (cqe.res != -ECANCELED) {
+        MetricsAdd(MetricsCounter::AcceptErrors);
+      }
+      return;
+    }
+    MetricsAdd(MetricsCounter::Accepts);
+    std::unique_ptr<Entry> entry(new Entry(cqe.res, buffers_));
+    Entry* const raw = entry.get();
+    connections_[raw] = std::move(entry);
+    Receive(raw);
+    Done(raw, EpollAction::KeepOpen);
+  }
+
+  void Received(Entry* entry, const io_uring_cqe& cqe) {
+    if (!(cqe.flags & IORING_CQE_F_MORE)) {
+      entry->receiving = false;
+      --entry->in_flight;
+    }
+    if (cqe.res > 0 && IOUringBufferRing::HasBuffer(cqe.flags)) {
+      MetricsAdd(MetricsCounter::Reads);
+      MetricsAdd(MetricsCounter::ReadBytes, static_cast<size_t>(cqe.res));
+      UringConnectionIO::Received received;
+      received.buffer = IOUringBufferRing::BufferId(cqe.flags);
+      received.offset = 0;
+      received.length = static_cast<uint32_t>(cqe.res);
+      entry->io.received.push_back(received);
+    } else if (!cqe.res) {
+      MetricsAdd(MetricsCounter::Reads);
+      entry->io.end_of_stream = true;
+    } else if (cqe.res != -ENOBUFS && cqe.res != -ECANCELED) {
+      MetricsAdd(MetricsCounter::ReadErrors);
+      entry->io.failed = true;
+    }
+    if (entry->closing) {
+      entry->io.RecycleReceived();
+      Release(entry);
+      return;
+    }
+    // Out of buffers, or stopped by the kernel: rearm, to be submitted after the handler has returned the buffers.
+    if (!entry->receiving && !entry->io.end_of_stream && !entry->io.failed) {
+      Receive(entry);
+    }
+    EpollAction action;
+    try {
+      action = entry->handler.OnReadable();
+    } catch (NetworkException&) {
+      action = EpollAction::Close;
+    }
+    Done(entry, action);
+  }
+
+  void Sent(Entry* entry, const io_uring_cqe& cqe) {
+    entry->send_in_flight = false;
+    --entry->in_flight;
+    if (cqe.res >= 0) {
+      MetricsAdd(MetricsCounter::Writes);
+      MetricsAdd(MetricsCounter::WrittenBytes, static_cast<size_t>(cqe.res));
+      entry->sent += static_cast<size_t>(cqe.res);
+    } else {
+      if (cqe.res != -ECANCELED) {
+        MetricsAdd(MetricsCounter::WriteErrors);
+      }
+      entry->io.failed = true;
+    }
+    if (entry->io.failed) {
+      entry->sending.clear();
+      entry->sent = 0;
+      entry->io.output.clear();
+    }
+    if (entry->closing) {
+      Flush(entry);
+      Release(entry);
+      return;
+    }
+    EpollAction action = entry->io.failed ? EpollAction::Close : EpollAction::KeepOpen;
+    if (action == EpollAction::KeepOpen && entry->io.write_blocked) {
+      Flush(entry);
+      entry->io.write_blocked = false;
+      try {
+        action = entry->handler.OnWritable();
+      } catch (NetworkException&) {
+        action = EpollAction::Close;
+      }
+    }
+    Done(entry, action);
+  }
+
+  void Closed(Entry* entry, const io_uring_cqe& cqe) {
+    --entry->in_flight;
+    if (cqe.res == -ECANCELED) {
+      // The send linked before it has failed.
+      close(entry->io.fd);
+    }
+    entry->closed = true;
+    Release(entry);
+  }
+
+  void Expire(Entry* entry) {
+    if (entry->closing) {
+      // The peer is not reading the last response.
+      if (entry->send_in_flight) {
+        Cancel(UserData(entry, Operation::Send));
+      }
+      return;
+    }
+    EpollAction action;
+    try {
+      action = entry->handler.OnTimeout();
+    } catch (NetworkException&) {
+      action = EpollAction::Close;
+    }
+    Done(entry, action);
+  }
+
+  // Sends what the handler has written, and schedules its next deadline, or starts closing the connection.
+  void Done(Entry* entry, EpollAction action) {
+    if (action == EpollAction::Close) {
+      entry->closing = true;
+      if (entry->receiving) {
+        Cancel(UserData(entry, Operation::Receive));
+      }
+      timers_.Schedule(entry, Ticks(std::chrono::steady_clock::now() + kDefaultUringLingerTimeout));
+      Flush(entry);
+      return;
+    }
+    Flush(entry);
+    const std::chrono::steady_clock::time_point deadline = entry->handler.Deadline();
+    if (deadline == std::chrono::steady_clock::time_point::max()) {
+      timers_.Cancel(entry);
+    } else {
+      timers_.Schedule(entry, Ticks(deadline));
+    }
+  }
+
+  // Destroys a closed connection once the last completion for it is in.
+  void Release(Entry* entry) {
+    if (entry->closed && !entry->in_flight) {
+      timers_.Cancel(entry);
+      connections_.erase(entry);
+      if (accept_paused_) {
+        ResumeAccepting();
+      }
+    }
+  }
+
+  Socket& socket_;
+  IOUring ring_;
+  IOUringBufferRing buffers_;
+  const std::chrono::milliseconds timer_resolution_;
+  const std::chrono::steady_clock::time_point epoch_;
+  TimerWheel timers_;
+  bool accepting_ = false;
+  bool accept_paused_ = false;
+  bool draining_ = false;
+  std::chrono::steady_clock::time_point accept_resume_;
+  // Keyed by address rather than by descriptor, which may be reused while the completions for a closed one
+  // are still to come.
+  std::unordered_map<Entry*, std::unique_ptr<Entry>> connections_;
+
+  UringServer(const UringServer&) = delete;
+  UringServer(UringServer&&) = delete;
+  void operator=(const UringServer&) = delete;
+  void operator=(UringServer&&) = delete;
+};
+
+#endif  // TOY_POSIX_URING_SERVER_H
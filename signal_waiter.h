@@ -0,0 +1,39 @@
+#ifndef TOY_SIGNAL_WAITER_H
+#define TOY_SIGNAL_WAITER_H
+
+// Receives signals, such as `SIGTERM`, on a thread that waits for them, rather than in a handler interrupting
+// whatever thread happens to run, so that the response to a signal may take locks and join threads.
+
+#include <initializer_list>
+
+#include <pthread.h>
+#include <signal.h>
+
+class SignalWaiter final {
+ public:
+  // Blocks `signals` for the calling thread and for the threads it starts afterwards, which inherit its mask.
+  // Construct before starting any thread, for no thread to be left with the default action of the signals.
+  explicit SignalWaiter(std::initializer_list<int> signals) {
+    sigemptyset(&set_);
+    for (const int signal : signals) {
+      sigaddset(&set_, signal);
+    }
+    pthread_sigmask(SIG_BLOCK, &set_, nullptr);
+  }
+
+  // Blocks until one of the signals is delivered to the process, and returns it.
+  int Wait() const {
+    int signal;
+    while (sigwait(&set_, &signal)) {
+    }
+    return signal;
+  }
+
+ private:
+  sigset_t set_;
+
+  SignalWaiter(const SignalWaiter&) = delete;
+  void operator=(const SignalWaiter&) = delete;
+};
+
+#endif  // TOY_SIGNAL_WAITER_H
@@ -0,0 +1,61 @@
+#ifndef TOY_SMALL_VECTOR_H
+#define TOY_SMALL_VECTOR_H
+
+// A vector of trivially copyable elements that keeps the first `N` of them inline,
+// and only touches the heap if more than `N` are added. `Clear()` keeps the heap storage for reuse.
+
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+
+template <typename T, size_t N>
+class SmallVector final {
+ public:
+  SmallVector() {
+    static_assert(std::is_trivially_copyable<T>::value, "SmallVector only holds trivially copyable types.");
+  }
+
+  void PushBack(const T& value) {
+    if (size_ < N) {
+      inline_[size_] = value;
+    } else {
+      overflow_.push_back(value);
+    }
+    ++size_;
+  }
+
+  size_t Size() const {
+    return size_;
+  }
+
+  bool Empty() const {
+    return !size_;
+  }
+
+  const T& operator[](size_t i) const {
+    return i < N ? inline_[i] : overflow_[i - N];
+  }
+
+  T& operator[](size_t i) {
+    return i < N ? inline_[i] : overflow_[i - N];
+  }
+
+  void PopBack() {
+    --size_;
+    if (size_ >= N) {
+      overflow_.pop_back();
+    }
+  }
+
+  void Clear() {
+    size_ = 0;
+    overflow_.clear();
+  }
+
+ private:
+  T inline_[N];
+  std::vector<T> overflow_;
+  size_t size_ = 0;
+};
+
+#endif  // TOY_SMALL_VECTOR_H
@@ -0,0 +1,221 @@
+#ifndef TOY_SOCKET_ADDRESS_H
+#define TOY_SOCKET_ADDRESS_H
+
+// The addresses to listen on and to connect to: IPv4, IPv6, and Unix sockets, by path or in the Linux abstract
+// namespace. HTTP runs over any of them the same way; a Unix socket skips the TCP/IP stack, for the lower latency
+// of the clients on the same host, such as a reverse proxy or a sidecar in front of the server.
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "exceptions.h"
+
+class SocketAddress final {
+ public:
+  // Any IPv4 interface: what a bare port has always meant to `Socket`.
+  SocketAddress(int port) : SocketAddress(IPv4(port)) {
+  }
+
+  // `length` bytes of a `sockaddr`, as returned by `getsockname()` or `accept()`.
+  SocketAddress(const sockaddr* address, socklen_t length) : length_(length) {
+    if (length > sizeof(address_)) {
+      throw SocketAddressException();
+    }
+    memset(&address_, 0, sizeof(address_));
+    memcpy(&address_, address, length);
+  }
+
+  // `host` is a numeric address, or empty for all the interfaces.
+  static SocketAddress IPv4(int port, const std::string& host = std::string()) {
+    SocketAddress result;
+    sockaddr_in& address = reinterpret_cast<sockaddr_in&>(result.address_);
+    address.sin_family = AF_INET;
+    address.sin_port = htons(CheckPort(port));
+    if (host.empty()) {
+      address.sin_addr.s_addr = htonl(INADDR_ANY);
+    } else if (inet_pton(AF_INET, host.c_str(), &address.sin_addr) != 1) {
+      throw SocketAddressException();
+    }
+    result.length_ = sizeof(sockaddr_in);
+    return result;
+  }
+
+  // `host` is a numeric address, or empty for all the interfaces. Unless `v6_only` is set, listening on all
+  // the IPv6 interfaces takes the IPv4 connections as well, as IPv4-mapped addresses.
+  static SocketAddress IPv6(int port, const std::string& host = std::string(), bool v6_only = false) {
+    SocketAddress result;
+    sockaddr_in6& address = reinterpret_cast<sockaddr_in6&>(result.address_);
+    address.sin6_family = AF_INET6;
+    address.sin6_port = htons(CheckPort(port));
+    if (host.empty()) {
+      address.sin6_addr = in6addr_any;
+    } else if (inet_pton(AF_INET6, host.c_str(), &address.sin6_addr) != 1) {
+      throw SocketAddressException();
+    }
+    result.length_ = sizeof(sockaddr_in6);
+    result.v6_only_ = v6_only;
+    return result;
+  }
+
+  // A Unix socket at the filesystem `path`, which access to is subject to its permissions.
+  static SocketAddress Unix(const std::string& path) {
+    SocketAddress result;
+    sockaddr_un& address = reinterpret_cast<sockaddr_un&>(result.address_);
+    if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+      throw SocketAddressException();
+    }
+    address.sun_family = AF_UNIX;
+    memcpy(address.sun_path, path.data(), path.size());
+    result.length_ = static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + path.size() + 1);
+    return result;
+  }
+
+  // A Unix socket in the Linux abstract namespace: no file to create or remove, and the name is released
+  // as the last socket bound to it is closed.
+  static SocketAddress AbstractUnix(const std::string& name) {
+    SocketAddress result;
+    sockaddr_un& address = reinterpret_cast<sockaddr_un&>(result.address_);
+    if (name.size() + 1 > sizeof(address.sun_path)) {
+      throw SocketAddressException();
+    }
+    address.sun_family = AF_UNIX;
+    memcpy(address.sun_path + 1, name.data(), name.size());
+    result.length_ = static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + 1 + name.size());
+    return result;
+  }
+
+  // Parses what `ToString()` returns, as well as the shorthands: `8080` and `*:8080` for any IPv4 interface,
+  // `[::]:8080` for any interface, IPv4 included, `/run/server.sock` and `@server` for the Unix sockets.
+  static SocketAddress Parse(const std::string& text) {
+    if (text.compare(0, 5, "unix:") == 0) {
+      return ParseUnix(text.substr(5));
+    }
+    if (!text.empty() && (text[0] == '/' || text[0] == '@')) {
+      return ParseUnix(text);
+    }
+    const size_t colon = text.rfind(':');
+    if (colon == std::string::npos) {
+      return IPv4(ParsePort(text));
+    }
+    const int port = ParsePort(text.substr(colon + 1));
+    const std::string host = text.substr(0, colon);
+    if (host.size() >= 2 && host.front() == '[' && host.back() == ']') {
+      const std::string ipv6 = host.substr(1, host.size() - 2);
+      return IPv6(port, ipv6 == "::" ? std::string() : ipv6);
+    }
+    return IPv4(port, host == "*" ? std::string() : host);
+  }
+
+  int Family() const {
+    return address_.ss_family;
+  }
+
+  bool IsIP() const {
+    return Family() == AF_INET || Family() == AF_INET6;
+  }
+
+  bool IsUnix() const {
+    return Family() == AF_UNIX;
+  }
+
+  bool IsAbstract() const {
+    return IsUnix() && length_ > offsetof(sockaddr_un, sun_path) && !UnixAddress().sun_path[0];
+  }
+
+  bool V6Only() const {
+    return v6_only_;
+  }
+
+  // Zero for the Unix sockets.
+  int Port() const {
+    if (Family() == AF_INET) {
+      return ntohs(reinterpret_cast<const sockaddr_in&>(address_).sin_port);
+    }
+    if (Family() == AF_INET6) {
+      return ntohs(reinterpret_cast<const sockaddr_in6&>(address_).sin6_port);
+    }
+    return 0;
+  }
+
+  // The filesystem path of a Unix socket, or the name of an abstract one.
+  std::string UnixPath() const {
+    if (!IsUnix() || length_ <= offsetof(sockaddr_un, sun_path)) {
+      return std::string();
+    }
+    const char* path = UnixAddress().sun_path;
+    const size_t length = length_ - offsetof(sockaddr_un, sun_path);
+    if (!path[0]) {
+      return std::string(path + 1, length - 1);
+    }
+    return std::string(path, strnlen(path, length));
+  }
+
+  const sockaddr* Address() const {
+    return reinterpret_cast<const sockaddr*>(&address_);
+  }
+
+  socklen_t Length() const {
+    return length_;
+  }
+
+  std::string ToString() const {
+    char host[INET6_ADDRSTRLEN] = "";
+    if (Family() == AF_INET) {
+      inet_ntop(AF_INET, &reinterpret_cast<const sockaddr_in&>(address_).sin_addr, host, sizeof(host));
+      return std::string(host) + ':' + std::to_string(Port());
+    }
+    if (Family() == AF_INET6) {
+      inet_ntop(AF_INET6, &reinterpret_cast<const sockaddr_in6&>(address_).sin6_addr, host, sizeof(host));
+      return '[' + std::string(host) + "]:" + std::to_string(Port());
+    }
+    if (IsUnix()) {
+      return std::string(IsAbstract() ? "unix:@" : "unix:") + UnixPath();
+    }
+    return std::string();
+  }
+
+ private:
+  SocketAddress() : length_(0) {
+    memset(&address_, 0, sizeof(address_));
+  }
+
+  static int CheckPort(int port) {
+    if (port < 0 || port > 65535) {
+      throw SocketAddressException();
+    }
+    return port;
+  }
+
+  static int ParsePort(const std::string& text) {
+    char* end = nullptr;
+    const long port = strtol(text.c_str(), &end, 10);
+    if (text.empty() || *end || port < 0 || port > 65535) {
+      throw SocketAddressException();
+    }
+    return static_cast<int>(port);
+  }
+
+  static SocketAddress ParseUnix(const std::string& path) {
+    if (!path.empty() && path[0] == '@') {
+      return AbstractUnix(path.substr(1));
+    }
+    return Unix(path);
+  }
+
+  const sockaddr_un& UnixAddress() const {
+    return reinterpret_cast<const sockaddr_un&>(address_);
+  }
+
+  sockaddr_storage address_;
+  socklen_t length_;
+  bool v6_only_ = false;
+};
+
+#endif  // TOY_SOCKET_ADDRESS_H
@@ -0,0 +1,245 @@
+#ifndef TOY_SOCKET_HANDOFF_H
+#define TOY_SOCKET_HANDOFF_H
+
+// Restarts without refused or dropped connections: the listening sockets pass from the running server process
+// to the one replacing it, so the connections queued in the kernel are accepted by one or the other.
+//
+// The running process offers its listening sockets on a Unix socket with `ListeningSocketHandoff`. The new process
+// calls `TakeOverListeningSockets()` on the same path, receives duplicates of the descriptors via `SCM_RIGHTS`,
+// and starts accepting on them, while the old one stops accepting and drains its connections. A process started
+// by a supervisor that passes the sockets down as inherited descriptors, as systemd socket activation does,
+// gets them with `InheritedListeningSockets()` instead.
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "exceptions.h"
+#include "socket_address.h"
+
+// `SCM_MAX_FD`: the most descriptors the kernel passes in one message.
+const size_t kMaxHandedOffSockets = 253;
+
+// The first descriptor passed down by systemd, see `sd_listen_fds(3)`.
+const int kFirstInheritedSocket = 3;
+
+// Sends `fds` over the connected Unix socket `unix_fd`, in a single message. The receiver gets duplicates,
+// which refer to the same sockets; the sender keeps its own.
+inline void SendDescriptors(int unix_fd, const std::vector<int>& fds) {
+  if (fds.size() > kMaxHandedOffSockets) {
+    throw SocketWriteException();
+  }
+  // The count goes as the payload, as a message must carry at least one byte.
+  uint32_t count = static_cast<uint32_t>(fds.size());
+  iovec iov;
+  iov.iov_base = &count;
+  iov.iov_len = sizeof(count);
+  msghdr message;
+  memset(&message, 0, sizeof(message));
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+  std::vector<char> control(CMSG_SPACE(sizeof(int) * fds.size()));
+  if (!fds.empty()) {
+    message.msg_control = &control[0];
+    message.msg_controllen = control.size();
+    cmsghdr* header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+    memcpy(CMSG_DATA(header), &fds[0], sizeof(int) * fds.size());
+  }
+  if (sendmsg(unix_fd, &message, MSG_NOSIGNAL) != static_cast<ssize_t>(sizeof(count))) {
+    throw SocketWriteException();
+  }
+}
+
+// Receives the descriptors sent by `SendDescriptors()`, close-on-exec.
+inline std::vector<int> ReceiveDescriptors(int unix_fd) {
+  uint32_t count = 0;
+  iovec iov;
+  iov.iov_base = &count;
+  iov.iov_len = sizeof(count);
+  msghdr message;
+  memset(&message, 0, sizeof(message));
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+  std::vector<char> control(CMSG_SPACE(sizeof(int) * kMaxHandedOffSockets));
+  message.msg_control = &control[0];
+  message.msg_controllen = control.size();
+  ssize_t result;
+  do {
+    result = recvmsg(unix_fd, &message, MSG_CMSG_CLOEXEC);
+  } while (result < 0 && errno == EINTR);
+  std::vector<int> fds;
+  for (cmsghdr* header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header)) {
+    if (header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS) {
+      const size_t n = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      const size_t offset = fds.size();
+      fds.resize(offset + n);
+      memcpy(&fds[offset], CMSG_DATA(header), sizeof(int) * n);
+    }
+  }
+  if (result != static_cast<ssize_t>(sizeof(count)) || (message.msg_flags & MSG_CTRUNC) || fds.size() != count) {
+    for (const int fd : fds) {
+      close(fd);
+    }
+    throw SocketReadException();
+  }
+  return fds;
+}
+
+// Offers listening sockets to the next server process, on the Unix socket `path`.
+class ListeningSocketHandoff final {
+ public:
+  // `fds` stay owned by the caller, and must stay open until `Wait()` returns.
+  ListeningSocketHandoff(const std::string& path, const std::vector<int>& fds)
+      : path_(path), fds_(fds), wake_fd_(eventfd(0, EFD_CLOEXEC)) {
+    if (wake_fd_ < 0) {
+      throw SocketCreateException();
+    }
+    try {
+      Listen();
+    } catch (...) {
+      close(wake_fd_);
+      throw;
+    }
+  }
+
+  ~ListeningSocketHandoff() {
+    StopListening();
+    close(wake_fd_);
+  }
+
+  // Blocks until the next process has taken the sockets, and returns true, or until `Cancel()`, and returns false.
+  // Once the sockets are handed off, this process should stop accepting on them, and drain.
+  bool Wait() {
+    while (listen_fd_ != -1) {
+      pollfd fds[2];
+      fds[0].fd = listen_fd_;
+      fds[0].events = POLLIN;
+      fds[1].fd = wake_fd_;
+      fds[1].events = POLLIN;
+      fds[0].revents = fds[1].revents = 0;
+      if (poll(fds, 2, -1) < 0 && errno != EINTR) {
+        throw SocketAcceptException();
+      }
+      if (fds[1].revents) {
+        return false;
+      }
+      const int peer = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+      if (peer == -1) {
+        continue;
+      }
+      // Free the path first, for the next process to offer the sockets there in turn once it has them.
+      StopListening();
+      try {
+        SendDescriptors(peer, fds_);
+        close(peer);
+        return true;
+      } catch (NetworkException&) {
+        // The next process is gone: keep offering.
+        close(peer);
+        Listen();
+      }
+    }
+    return false;
+  }
+
+  // Makes `Wait()` return false. Thread-safe.
+  void Cancel() {
+    const uint64_t one = 1;
+    if (write(wake_fd_, &one, sizeof(one)) != sizeof(one)) {
+      throw SocketWriteException();
+    }
+  }
+
+ private:
+  void Listen() {
+    const SocketAddress address = SocketAddress::Unix(path_);
+    listen_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd_ < 0) {
+      throw SocketCreateException();
+    }
+    // A path left behind by a process that has crashed.
+    unlink(path_.c_str());
+    if (bind(listen_fd_, address.Address(), address.Length())) {
+      close(listen_fd_);
+      listen_fd_ = -1;
+      throw SocketBindException();
+    }
+    if (listen(listen_fd_, 1)) {
+      StopListening();
+      throw SocketListenException();
+    }
+  }
+
+  void StopListening() {
+    if (listen_fd_ != -1) {
+      unlink(path_.c_str());
+      close(listen_fd_);
+      listen_fd_ = -1;
+    }
+  }
+
+  const std::string path_;
+  const std::vector<int> fds_;
+  const int wake_fd_;
+  int listen_fd_ = -1;
+
+  ListeningSocketHandoff(const ListeningSocketHandoff&) = delete;
+  void operator=(const ListeningSocketHandoff&) = delete;
+};
+
+// Takes over the listening sockets offered on `path` by the running server process, if there is one.
+// Returns no descriptors if there is not, for the caller to create its sockets anew.
+inline std::vector<int> TakeOverListeningSockets(const std::string& path) {
+  const SocketAddress address = SocketAddress::Unix(path);
+  const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    throw SocketCreateException();
+  }
+  if (connect(fd, address.Address(), address.Length())) {
+    const int error = errno;
+    close(fd);
+    if (error == ENOENT || error == ECONNREFUSED) {
+      return std::vector<int>();
+    }
+    throw SocketConnectException();
+  }
+  try {
+    std::vector<int> fds = ReceiveDescriptors(fd);
+    close(fd);
+    return fds;
+  } catch (...) {
+    close(fd);
+    throw;
+  }
+}
+
+// The listening sockets passed down by the parent process with the systemd protocol: `LISTEN_FDS` descriptors
+// starting from 3, meant for the process `LISTEN_PID`. Unsets the variables, for the children to not take them.
+inline std::vector<int> InheritedListeningSockets() {
+  std::vector<int> fds;
+  const char* pid = getenv("LISTEN_PID");
+  const char* count = getenv("LISTEN_FDS");
+  if (pid && count && atol(pid) == static_cast<long>(getpid())) {
+    const int n = atoi(count);
+    for (int fd = kFirstInheritedSocket; fd < kFirstInheritedSocket + n; ++fd) {
+      fcntl(fd, F_SETFD, FD_CLOEXEC);
+      fds.push_back(fd);
+    }
+  }
+  unsetenv("LISTEN_PID");
+  unsetenv("LISTEN_FDS");
+  return fds;
+}
+
+#endif  // TOY_SOCKET_HANDOFF_H
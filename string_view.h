@@ -0,0 +1,115 @@
+#ifndef TOY_STRING_VIEW_H
+#define TOY_STRING_VIEW_H
+
+// A non-owning view into a contiguous range of characters, a C++11 stand-in for `std::string_view`.
+// Member names follow the standard library, so that views work where string containers are expected.
+
+#include <cstring>
+#include <ostream>
+#include <string>
+
+class StringView final {
+ public:
+  typedef char value_type;
+  typedef const char* const_iterator;
+  typedef const char* iterator;
+
+  static const size_t npos = static_cast<size_t>(-1);
+
+  StringView() : data_(nullptr), size_(0) {
+  }
+
+  StringView(const char* data, size_t size) : data_(data), size_(size) {
+  }
+
+  StringView(const char* s) : data_(s), size_(strlen(s)) {
+  }
+
+  StringView(const std::string& s) : data_(s.data()), size_(s.size()) {
+  }
+
+  const char* data() const {
+    return data_;
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+  size_t length() const {
+    return size_;
+  }
+
+  bool empty() const {
+    return !size_;
+  }
+
+  const char* begin() const {
+    return data_;
+  }
+
+  const char* end() const {
+    return data_ + size_;
+  }
+
+  char operator[](size_t i) const {
+    return data_[i];
+  }
+
+  StringView substr(size_t pos, size_t n = npos) const {
+    if (pos > size_) {
+      pos = size_;
+    }
+    if (n > size_ - pos) {
+      n = size_ - pos;
+    }
+    return StringView(data_ + pos, n);
+  }
+
+  size_t find(char c, size_t from = 0) const {
+    if (from >= size_) {
+      return npos;
+    }
+    const void* p = memchr(data_ + from, c, size_ - from);
+    return p ? static_cast<const char*>(p) - data_ : npos;
+  }
+
+  std::string ToString() const {
+    return std::string(data_, size_);
+  }
+
+  bool operator==(const StringView& rhs) const {
+    return size_ == rhs.size_ && (!size_ || !memcmp(data_, rhs.data_, size_));
+  }
+
+  bool operator!=(const StringView& rhs) const {
+    return !operator==(rhs);
+  }
+
+ private:
+  const char* data_;
+  size_t size_;
+};
+
+// ASCII-only case folding, which is all HTTP header names need.
+inline char ToLowerASCII(char c) {
+  return (c >= 'A' && c <= 'Z') ? static_cast<char>(c + ('a' - 'A')) : c;
+}
+
+inline bool EqualsIgnoreCase(const StringView& a, const StringView& b) {
+  if (a.size() != b.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < a.size(); ++i) {
+    if (ToLowerASCII(a[i]) != ToLowerASCII(b[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+inline std::ostream& operator<<(std::ostream& os, const StringView& s) {
+  return os.write(s.data(), s.size());
+}
+
+#endif  // TOY_STRING_VIEW_H
@@ -0,0 +1,151 @@
+#ifndef TOY_TIMER_WHEEL_H
+#define TOY_TIMER_WHEEL_H
+
+// A hierarchical timing wheel: http://www.cs.columbia.edu/~nahum/w6998/papers/sosp87-timing-wheels.pdf
+//
+// Timers are intrusive `TimerWheelEntry`-s, embedded in whatever they time, such as a connection, so scheduling,
+// rescheduling and cancelling a timer is a few pointer writes, with no allocation and no search. Time is counted
+// in ticks of a resolution chosen by the user. Each of the `kTimerWheelLevels` levels has `kTimerWheelSlots`
+// slots, each slot of a level spanning all the slots of the level below; timers far in the future wait
+// in the upper levels and cascade down as their time approaches. Timers further away than the span
+// of all the levels wait at the top, and are cascaded again until due.
+//
+// Not thread-safe: the owner either runs it on a single thread, as the epoll reactor does, or guards it.
+
+#include <cstddef>
+#include <cstdint>
+
+const size_t kTimerWheelLevelBits = 6;
+const size_t kTimerWheelSlots = 1 << kTimerWheelLevelBits;
+const size_t kTimerWheelLevels = 4;
+
+// A timer, linked into at most one slot of at most one wheel.
+struct TimerWheelEntry {
+  TimerWheelEntry* prev = nullptr;
+  TimerWheelEntry* next = nullptr;
+  uint64_t expiry = 0;  // The tick to fire at.
+
+  TimerWheelEntry() = default;
+
+  bool Scheduled() const {
+    return next != nullptr;
+  }
+
+  void Unlink() {
+    prev->next = next;
+    next->prev = prev;
+    prev = next = nullptr;
+  }
+
+  // Entries must be cancelled before they are destroyed or moved.
+  TimerWheelEntry(const TimerWheelEntry&) = delete;
+  void operator=(const TimerWheelEntry&) = delete;
+};
+
+class TimerWheel final {
+ public:
+  explicit TimerWheel(uint64_t now = 0) : now_(now) {
+    for (size_t level = 0; level < kTimerWheelLevels; ++level) {
+      for (size_t slot = 0; slot < kTimerWheelSlots; ++slot) {
+        slots_[level][slot].prev = slots_[level][slot].next = &slots_[level][slot];
+      }
+    }
+  }
+
+  uint64_t Now() const {
+    return now_;
+  }
+
+  size_t Size() const {
+    return size_;
+  }
+
+  bool Empty() const {
+    return !size_;
+  }
+
+  // Makes `entry` fire at tick `expiry`, or on the next tick if `expiry` is not in the future.
+  // Reschedules it if it is scheduled already.
+  void Schedule(TimerWheelEntry* entry, uint64_t expiry) {
+    if (entry->Scheduled()) {
+      entry->Unlink();
+    } else {
+      ++size_;
+    }
+    entry->expiry = expiry > now_ ? expiry : now_ + 1;
+    Place(entry);
+  }
+
+  // Does nothing if `entry` is not scheduled.
+  void Cancel(TimerWheelEntry* entry) {
+    if (entry->Scheduled()) {
+      entry->Unlink();
+      --size_;
+    }
+  }
+
+  // Moves the time forward to tick `now`, and calls `fire(TimerWheelEntry*)` for each timer that has come due,
+  // tick by tick, with `Now()` at the tick of its expiry. The entry is no longer scheduled when `fire` is called,
+  // and `fire` may schedule or cancel any entry, that one included, or destroy it.
+  template <typename F>
+  void Advance(uint64_t now, F&& fire) {
+    while (now_ < now) {
+      if (!size_) {
+        now_ = now;
+        return;
+      }
+      const uint64_t tick = ++now_;
+      // Cascade the top level first: its entries may land in the lower level slot being emptied right after.
+      size_t levels = 1;
+      while (levels < kTimerWheelLevels && !(tick & ((uint64_t(1) << (kTimerWheelLevelBits * levels)) - 1))) {
+        ++levels;
+      }
+      for (size_t level = levels - 1; level > 0; --level) {
+        TimerWheelEntry& head = slots_[level][(tick >> (kTimerWheelLevelBits * level)) & (kTimerWheelSlots - 1)];
+        while (head.next != &head) {
+          TimerWheelEntry* entry = head.next;
+          entry->Unlink();
+          Place(entry);
+        }
+      }
+      TimerWheelEntry& head = slots_[0][tick & (kTimerWheelSlots - 1)];
+      while (head.next != &head) {
+        TimerWheelEntry* entry = head.next;
+        entry->Unlink();
+        --size_;
+        fire(entry);
+      }
+    }
+  }
+
+ private:
+  // Links `entry` into the slot of the lowest level whose span covers the time left until its expiry.
+  void Place(TimerWheelEntry* entry) {
+    uint64_t delta = entry->expiry - now_;
+    uint64_t expiry = entry->expiry;
+    const uint64_t kSpan = uint64_t(1) << (kTimerWheelLevelBits * kTimerWheelLevels);
+    if (delta >= kSpan) {
+      // Parked at the top, to be placed again once the wheel has turned enough.
+      delta = kSpan - 1;
+      expiry = now_ + delta;
+    }
+    size_t level = 0;
+    while (delta >= (uint64_t(1) << (kTimerWheelLevelBits * (level + 1)))) {
+      ++level;
+    }
+    TimerWheelEntry& head = slots_[level][(expiry >> (kTimerWheelLevelBits * level)) & (kTimerWheelSlots - 1)];
+    entry->prev = head.prev;
+    entry->next = &head;
+    head.prev->next = entry;
+    head.prev = entry;
+  }
+
+  TimerWheelEntry slots_[kTimerWheelLevels][kTimerWheelSlots];  // List heads.
+  uint64_t now_;
+  size_t size_ = 0;
+
+  TimerWheel(const TimerWheel&) = delete;
+  void operator=(const TimerWheel&) = delete;
+};
+
+#endif  // TOY_TIMER_WHEEL_H
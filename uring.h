@@ -0,0 +1,330 @@
+#ifndef TOY_URING_H
+#define TOY_URING_H
+
+// A minimal io_uring, on the raw syscalls and `<linux/io_uring.h>`, with no dependency on liburing.
+//
+// `IOUring` owns the submission and completion rings, shared with the kernel. Queueing a submission is a few
+// memory writes, and `SubmitAndWait()` hands all the queued ones to the kernel and waits for completions
+// in a single `io_uring_enter()`. `IOUringBufferRing` is a group of provided buffers, registered with the kernel,
+// for receives to pick a buffer when their data arrives, rather than each idle connection holding one.
+//
+// `IOUringSupported()` tells whether the kernel, and its seccomp policy, allow what `UringServer` needs.
+
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "exceptions.h"
+
+const unsigned kDefaultIOUringEntries = 1024;
+// Multishot requests complete many times per submission.
+const unsigned kIOUringCompletionsPerEntry = 4;
+const unsigned kDefaultIOUringBufferCount = 1024;  // A power of two, up to 32768.
+const unsigned kDefaultIOUringBufferSize = 4096;
+
+inline int IOUringSetup(unsigned entries, io_uring_params* params) {
+  return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+inline int IOUringEnter(
+    int fd, unsigned to_submit, unsigned min_complete, unsigned flags, const void* arg, size_t arg_size) {
+  return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, arg_size));
+}
+
+inline int IOUringRegister(int fd, unsigned opcode, const void* arg, unsigned count) {
+  return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, count));
+}
+
+// Not thread-safe. On kernels that support it, the ring only accepts submissions from the thread that created it.
+class IOUring final {
+ public:
+  explicit IOUring(unsigned entries = kDefaultIOUringEntries) {
+    // The cheapest way of running completions first: on the next wait only, and by this thread only.
+    const unsigned kFlags[] = {IORING_SETUP_SUBMIT_ALL | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN,
+                               IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN,
+                               0};
+    for (const unsigned flags : kFlags) {
+      memset(&params_, 0, sizeof(params_));
+      params_.flags = flags | IORING_SETUP_CQSIZE;
+      params_.cq_entries = entries * kIOUringCompletionsPerEntry;
+      fd_ = IOUringSetup(entries, &params_);
+      if (fd_ >= 0 || errno != EINVAL) {
+        break;
+      }
+    }
+    if (fd_ < 0) {
+      throw IOUringSetupException();
+    }
+    const unsigned kFeatures = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+    if ((params_.features & kFeatures) != kFeatures) {
+      close(fd_);
+      throw IOUringSetupException();
+    }
+    rings_size_ = params_.sq_off.array + params_.sq_entries * sizeof(unsigned);
+    const size_t cq_size = params_.cq_off.cqes + params_.cq_entries * sizeof(io_uring_cqe);
+    if (cq_size > rings_size_) {
+      rings_size_ = cq_size;
+    }
+    rings_ = mmap(nullptr, rings_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+    sqes_ = static_cast<io_uring_sqe*>(mmap(nullptr,
+                                            params_.sq_entries * sizeof(io_uring_sqe),
+                                            PROT_READ | PROT_WRITE,
+                                            MAP_SHARED | MAP_POPULATE,
+                                            fd_,
+                                            IORING_OFF_SQES));
+    if (rings_ == MAP_FAILED || sqes_ == MAP_FAILED) {
+      Release();
+      throw IOUringSetupException();
+    }
+    char* const rings = static_cast<char*>(rings_);
+    sq_head_ = reinterpret_cast<unsigned*>(rings + params_.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned*>(rings + params_.sq_off.tail);
+    sq_mask_ = *reinterpret_cast<unsigned*>(rings + params_.sq_off.ring_mask);
+    cq_head_ = reinterpret_cast<unsigned*>(rings + params_.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(rings + params_.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<unsigned*>(rings + params_.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(rings + params_.cq_off.cqes);
+    // Submission queue entries are used in order, so the indirection array stays the identity.
+    unsigned* const array = reinterpret_cast<unsigned*>(rings + params_.sq_off.array);
+    for (unsigned i = 0; i < params_.sq_entries; ++i) {
+      array[i] = i;
+    }
+    tail_ = *sq_tail_;
+  }
+
+  ~IOUring() {
+    Release();
+  }
+
+  int Descriptor() const {
+    return fd_;
+  }
+
+  // Submits the queued entries first unless `count` more of them fit, for linked ones to go in the same batch.
+  void Reserve(unsigned count) {
+    if (tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) + count > params_.sq_entries) {
+      Submit();
+    }
+  }
+
+  // A zeroed submission queue entry to fill in, submitted by the next `Submit()` or `SubmitAndWait()`.
+  io_uring_sqe* NextSubmission() {
+    Reserve(1);
+    if (tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) == params_.sq_entries) {
+      throw IOUringEnterException();
+    }
+    io_uring_sqe* sqe = &sqes_[tail_ & sq_mask_];
+    memset(sqe, 0, sizeof(*sqe));
+    ++tail_;
+    return sqe;
+  }
+
+  void Submit() {
+    Enter(0, 0, nullptr, 0);
+  }
+
+  // Submits the queued entries and waits up to `timeout_ms` milliseconds, -1 meaning forever, for a completion.
+  // Returns early on a signal.
+  void SubmitAndWait(int timeout_ms) {
+    if (timeout_ms < 0) {
+      Enter(1, IORING_ENTER_GETEVENTS, nullptr, 0);
+      return;
+    }
+    __kernel_timespec ts;
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = static_cast<long long>(timeout_ms % 1000) * 1000000;
+    io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.sigmask_sz = _NSIG / 8;
+    arg.ts = reinterpret_cast<uint64_t>(&ts);
+    Enter(timeout_ms ? 1 : 0, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+  }
+
+  // Calls `f(const io_uring_cqe&)` for each completion available, and returns their number.
+  // `f` may queue submissions.
+  template <typename F>
+  size_t ForEachCompletion(F&& f) {
+    unsigned head = *cq_head_;
+    const unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    size_t count = 0;
+    while (head != tail) {
+      const io_uring_cqe cqe = cqes_[head & cq_mask_];
+      __atomic_store_n(cq_head_, ++head, __ATOMIC_RELEASE);
+      f(cqe);
+      ++count;
+    }
+    return count;
+  }
+
+  bool Supports(uint8_t opcode) const {
+    const unsigned kOps = 256;
+    std::vector<char> buffer(sizeof(io_uring_probe) + kOps * sizeof(io_uring_probe_op));
+    io_uring_probe* probe = reinterpret_cast<io_uring_probe*>(&buffer[0]);
+    if (IOUringRegister(fd_, IORING_REGISTER_PROBE, probe, kOps)) {
+      return false;
+    }
+    return opcode <= probe->last_op && (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED);
+  }
+
+ private:
+  void Enter(unsigned min_complete, unsigned flags, const void* arg, size_t size) {
+    __atomic_store_n(sq_tail_, tail_, __ATOMIC_RELEASE);
+    const unsigned to_submit = tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    if (IOUringEnter(fd_, to_submit, min_complete, flags, arg, size) < 0) {
+      // Timed out, interrupted, or short of memory or of room for completions: what was not submitted
+      // is submitted by the next call, once the caller has reaped the completions.
+      if (errno != ETIME && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+        throw IOUringEnterException();
+      }
+    }
+  }
+
+  void Release() {
+    if (rings_ && rings_ != MAP_FAILED) {
+      munmap(rings_, rings_size_);
+    }
+    if (sqes_ && sqes_ != MAP_FAILED) {
+      munmap(sqes_, params_.sq_entries * sizeof(io_uring_sqe));
+    }
+    close(fd_);
+  }
+
+  io_uring_params params_;
+  int fd_ = -1;
+  void* rings_ = nullptr;
+  size_t rings_size_ = 0;
+  io_uring_sqe* sqes_ = nullptr;
+  unsigned* sq_head_ = nullptr;
+  unsigned* sq_tail_ = nullptr;
+  unsigned sq_mask_ = 0;
+  unsigned tail_ = 0;  // Of the submissions queued, ahead of `*sq_tail_` until they are submitted.
+  unsigned* cq_head_ = nullptr;
+  unsigned* cq_tail_ = nullptr;
+  unsigned cq_mask_ = 0;
+  io_uring_cqe* cqes_ = nullptr;
+
+  IOUring(const IOUring&) = delete;
+  void operator=(const IOUring&) = delete;
+};
+
+// `count` buffers of `size` bytes each, which receives flagged `IOSQE_BUFFER_SELECT` with `buf_group` set
+// to `Group()` take from. A completion names the buffer it has filled, which is the user's until `Recycle()`-d.
+class IOUringBufferRing final {
+ public:
+  IOUringBufferRing(IOUring& ring,
+                    uint16_t group,
+                    unsigned count = kDefaultIOUringBufferCount,
+                    unsigned size = kDefaultIOUringBufferSize)
+      : ring_fd_(ring.Descriptor()), group_(group), count_(count), size_(size), storage_(size_t(count) * size) {
+    if (!count || (count & (count - 1)) || count > 32768) {
+      throw IOUringSetupException();
+    }
+    // Page-aligned, as the kernel requires.
+    void* entries =
+        mmap(nullptr, count * sizeof(io_uring_buf), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (entries == MAP_FAILED) {
+      throw IOUringSetupException();
+    }
+    entries_ = static_cast<io_uring_buf*>(entries);
+    // The tail the kernel reads overlays the reserved field of the first entry.
+    tail_ = &reinterpret_cast<io_uring_buf_ring*>(entries_)->tail;
+    io_uring_buf_reg registration;
+    memset(&registration, 0, sizeof(registration));
+    registration.ring_addr = reinterpret_cast<uint64_t>(entries_);
+    registration.ring_entries = count;
+    registration.bgid = group;
+    if (IOUringRegister(ring_fd_, IORING_REGISTER_PBUF_RING, &registration, 1)) {
+      munmap(entries_, count_ * sizeof(io_uring_buf));
+      throw IOUringSetupException();
+    }
+    for (unsigned id = 0; id < count; ++id) {
+      Recycle(static_cast<uint16_t>(id));
+    }
+  }
+
+  ~IOUringBufferRing() {
+    io_uring_buf_reg registration;
+    memset(&registration, 0, sizeof(registration));
+    registration.bgid = group_;
+    IOUringRegister(ring_fd_, IORING_UNREGISTER_PBUF_RING, &registration, 1);
+    munmap(entries_, count_ * sizeof(io_uring_buf));
+  }
+
+  uint16_t Group() const {
+    return group_;
+  }
+
+  // The buffer named by the completion `flags`, if any.
+  static bool HasBuffer(uint32_t flags) {
+    return flags & IORING_CQE_F_BUFFER;
+  }
+
+  static uint16_t BufferId(uint32_t flags) {
+    return static_cast<uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT);
+  }
+
+  const char* Buffer(uint16_t id) const {
+    return &storage_[size_t(id) * size_];
+  }
+
+  // Gives buffer `id` back to the kernel, to be filled again.
+  void Recycle(uint16_t id) {
+    io_uring_buf& entry = entries_[next_ & (count_ - 1)];
+    entry.addr = reinterpret_cast<uint64_t>(Buffer(id));
+    entry.len = size_;
+    entry.bid = id;
+    __atomic_store_n(tail_, ++next_, __ATOMIC_RELEASE);
+  }
+
+ private:
+  const int ring_fd_;
+  const uint16_t group_;
+  const unsigned count_;
+  const unsigned size_;
+  std::vector<char> storage_;
+  io_uring_buf* entries_;
+  uint16_t* tail_;
+  uint16_t next_ = 0;
+
+  IOUringBufferRing(const IOUringBufferRing&) = delete;
+  void operator=(const IOUringBufferRing&) = delete;
+};
+
+// False on kernels older than 6.0, which lack multishot receives, where seccomp forbids io_uring, as container
+// runtimes often do, or with `TOY_NO_IO_URING` set in the environment. Checked once.
+inline bool IOUringSupported() {
+  static const bool supported = []() {
+    if (getenv("TOY_NO_IO_URING")) {
+      return false;
+    }
+    try {
+      IOUring ring(8);
+      // `IORING_OP_SEND_ZC` came along with multishot receives, whose support can not be probed for.
+      const uint8_t kOpcodes[] = {IORING_OP_ACCEPT,
+                                  IORING_OP_RECV,
+                                  IORING_OP_SEND,
+                                  IORING_OP_CLOSE,
+                                  IORING_OP_ASYNC_CANCEL,
+                                  IORING_OP_SEND_ZC};
+      for (const uint8_t opcode : kOpcodes) {
+        if (!ring.Supports(opcode)) {
+          return false;
+        }
+      }
+      return true;
+    } catch (const IOUringException&) {
+      return false;
+    }
+  }();
+  return supported;
+}
+
+#endif  // TOY_URING_H